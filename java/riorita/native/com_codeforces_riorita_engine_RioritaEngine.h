@@ -63,6 +63,54 @@ JNIEXPORT void JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_erase__L
 JNIEXPORT void JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_clear
   (JNIEnv *, jobject);
 
+/*
+ * Class:     com_codeforces_riorita_engine_RioritaEngine
+ * Method:    getAll
+ * Signature: (Ljava/lang/String;[Ljava/lang/String;J)[[B
+ */
+JNIEXPORT jobjectArray JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_getAll
+  (JNIEnv *, jobject, jstring, jobjectArray, jlong);
+
+/*
+ * Class:     com_codeforces_riorita_engine_RioritaEngine
+ * Method:    putAll
+ * Signature: (Ljava/lang/String;[Ljava/lang/String;[[BJJZ)[Z
+ */
+JNIEXPORT jbooleanArray JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_putAll
+  (JNIEnv *, jobject, jstring, jobjectArray, jobjectArray, jlong, jlong, jboolean);
+
+/*
+ * Class:     com_codeforces_riorita_engine_RioritaEngine
+ * Method:    hasDirect
+ * Signature: ([B[BJ)Z
+ */
+JNIEXPORT jboolean JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_hasDirect
+  (JNIEnv *, jobject, jbyteArray, jbyteArray, jlong);
+
+/*
+ * Class:     com_codeforces_riorita_engine_RioritaEngine
+ * Method:    getDirect
+ * Signature: ([B[BJLjava/nio/ByteBuffer;II)I
+ */
+JNIEXPORT jint JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_getDirect
+  (JNIEnv *, jobject, jbyteArray, jbyteArray, jlong, jobject, jint, jint);
+
+/*
+ * Class:     com_codeforces_riorita_engine_RioritaEngine
+ * Method:    putDirect
+ * Signature: ([B[BLjava/nio/ByteBuffer;IIJJZ)Z
+ */
+JNIEXPORT jboolean JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_putDirect
+  (JNIEnv *, jobject, jbyteArray, jbyteArray, jobject, jint, jint, jlong, jlong, jboolean);
+
+/*
+ * Class:     com_codeforces_riorita_engine_RioritaEngine
+ * Method:    eraseDirect
+ * Signature: ([B[BJ)Z
+ */
+JNIEXPORT jboolean JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_eraseDirect
+  (JNIEnv *, jobject, jbyteArray, jbyteArray, jlong);
+
 #ifdef __cplusplus
 }
 #endif
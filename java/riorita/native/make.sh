@@ -1,6 +1,15 @@
-mv -f /usr/lib/gcc/x86_64-redhat-linux/7/crtbeginT.o /usr/lib/gcc/x86_64-redhat-linux/7/crtbeginT.o.tmp
-cp -f /usr/lib/gcc/x86_64-redhat-linux/7/crtbeginS.o /usr/lib/gcc/x86_64-redhat-linux/7/crtbeginT.o
-BOOST=/root/boost_1_65_1/boost_output
-g++ -D_GLIBCXX_USE_CXX11_ABI=0 -std=c++14 -fPIC -O3 -static -static-libgcc -static-libstdc++ -shared -o riorita_engine.so -I /usr/lib/jvm/java-1.8.0/include -I /usr/lib/jvm/java-1.8.0/include/linux -I $BOOST/include compact.cpp riorita_engine.cpp $BOOST/lib/libboost_system.a $BOOST/lib/libboost_thread.a $BOOST/lib/libboost_filesystem.a -lpthread
-mv -f /usr/lib/gcc/x86_64-redhat-linux/7/crtbeginT.o.tmp /usr/lib/gcc/x86_64-redhat-linux/7/crtbeginT.o
+# Builds riorita_engine.so with Boost and the C++ runtime linked in statically: it depends only on libc
+# and libpthread, so it runs on systems with the glibc of the build machine or newer. Only the JNI entry
+# points are exported (riorita_engine.map) and bound inside the library, so static Boost libraries built
+# without -fPIC link too and never clash with other libraries of the JVM.
+JAVA_HOME=${JAVA_HOME:-/usr/lib/jvm/java-1.8.0}
+BOOST_INCLUDE=${BOOST_INCLUDE:-/usr/include}
+BOOST_LIB=${BOOST_LIB:-/usr/lib/x86_64-linux-gnu}
+set -e
+g++ -std=c++14 -fPIC -O3 -shared -fvisibility=hidden -fvisibility-inlines-hidden -fno-gnu-unique \
+    -static-libgcc -static-libstdc++ -Wl,-Bsymbolic -Wl,--exclude-libs,ALL -Wl,--version-script=riorita_engine.map \
+    -o riorita_engine.so -I $JAVA_HOME/include -I $JAVA_HOME/include/linux -I $BOOST_INCLUDE -I ../../../src \
+    ../../../src/compact.cpp riorita_engine.cpp \
+    $BOOST_LIB/libboost_filesystem.a $BOOST_LIB/libboost_thread.a $BOOST_LIB/libboost_system.a -lpthread
+strip --strip-unneeded riorita_engine.so
 cp -f riorita_engine.so ../src/main/files/riorita_engine.so
@@ -1,7 +1,8 @@
 #include "com_codeforces_riorita_engine_RioritaEngine.h"
 #include "compact.h"
 
-#include <map>
+#include <cstring>
+#include <vector>
 
 using namespace std;
 using namespace riorita;
@@ -13,61 +14,115 @@ std::string to_string(JNIEnv* env, jstring jstr) {
     return s;
 }
 
-map<long long, FileSystemCompactStorage*> storages;
+// Raw bytes of sections, keys and values, no modified UTF-8 conversion.
+std::string to_string(JNIEnv* env, jbyteArray bytes) {
+    jsize length = env->GetArrayLength(bytes);
+    string s(size_t(length), '\0');
+    if (length > 0)
+        env->GetByteArrayRegion(bytes, 0, length, (jbyte*)&s[0]);
+    return s;
+}
+
+// The storage of an engine is kept in its long field "handle", the field is resolved once on load.
+static jfieldID handle_field_id = NULL;
+
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void*) {
+    JNIEnv* env;
+    if (JNI_OK != vm->GetEnv((void**)&env, JNI_VERSION_1_6))
+        return JNI_ERR;
+
+    jclass engine_class = env->FindClass("com/codeforces/riorita/engine/RioritaEngine");
+    if (NULL == engine_class)
+        return JNI_ERR;
+
+    handle_field_id = env->GetFieldID(engine_class, "handle", "J");
+    if (NULL == handle_field_id)
+        return JNI_ERR;
 
-inline long long get_storage_id(JNIEnv* env, jobject self) {
-    jfieldID fid = env->GetFieldID(env->GetObjectClass(self), "id", "J");
-    return env->GetIntField(self, fid);
+    return JNI_VERSION_1_6;
 }
 
-inline FileSystemCompactStorage*& storage(JNIEnv* env, jobject self) {
-    return storages[get_storage_id(env, self)];
+inline FileSystemCompactStorage* storage(JNIEnv* env, jobject self) {
+    return reinterpret_cast<FileSystemCompactStorage*>(env->GetLongField(self, handle_field_id));
+}
+
+inline void set_storage(JNIEnv* env, jobject self, FileSystemCompactStorage* storage) {
+    env->SetLongField(self, handle_field_id, reinterpret_cast<jlong>(storage));
 }
 
 void throwNewRuntimeException(JNIEnv* env, const string& message) {
     env->ThrowNew(env->FindClass("java/lang/RuntimeException"), message.c_str());    
 }
 
+char* get_direct_buffer_address(JNIEnv* env, jobject buffer) {
+    char* address = (char*)env->GetDirectBufferAddress(buffer);
+    if (NULL == address)
+        env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), "Expected direct buffer.");
+    return address;
+}
+
 JNIEXPORT void JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_initialize
         (JNIEnv* env, jobject self, jstring directory, jint group_count) {
-    storages[get_storage_id(env, self)] = new FileSystemCompactStorage(to_string(env, directory), int(group_count));
+    try {
+        set_storage(env, self, new FileSystemCompactStorage(to_string(env, directory), int(group_count), COMPACT_ENGINE_FORMAT));
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
+    }
 }
 
 JNIEXPORT jboolean JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_has
         (JNIEnv* env, jobject self, jstring section, jstring key, jlong current_timestamp) {
-    return storage(env, self)->has(to_string(env, section), to_string(env, key), timestamp(current_timestamp));
+    try {
+        return storage(env, self)->has(to_string(env, section), to_string(env, key), timestamp(current_timestamp));
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
+        return false;
+    }
 }
 
 JNIEXPORT jbyteArray JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_get
         (JNIEnv* env, jobject self, jstring section, jstring key, jlong current_timestamp) {
     string data;
-    if (NULL == storage(env, self)->get(to_string(env, section), to_string(env, key), timestamp(current_timestamp), data))
+    try {
+        if (!storage(env, self)->get(to_string(env, section), to_string(env, key), timestamp(current_timestamp), data))
+            return NULL;
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
         return NULL;
-    else {
-        jbyteArray result = env->NewByteArray(jsize(data.length()));
-        env->SetByteArrayRegion(result, 0, jsize(data.length()), (jbyte*)data.c_str());
-        return result;
     }
+
+    jbyteArray result = env->NewByteArray(jsize(data.length()));
+    env->SetByteArrayRegion(result, 0, jsize(data.length()), (jbyte*)data.c_str());
+    return result;
 }
 
 JNIEXPORT jboolean JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_put
         (JNIEnv* env, jobject self, jstring section, jstring key, jbyteArray data, jlong current_timestamp, jlong lifetime, jboolean overwrite) {
-    if (NULL == data) {
-        storage(env, self)->erase(to_string(env, section), to_string(env, key), current_timestamp);
-        return true;
-    } else {
-        char* b = (char*)env->GetByteArrayElements(data, NULL);
-        string _data(b, b + env->GetArrayLength(data));
-        bool result = storage(env, self)->put(to_string(env, section), to_string(env, key), _data,
-            timestamp(current_timestamp), timestamp(lifetime), overwrite);
-        env->ReleaseByteArrayElements(data, (jbyte*)b, 0);
-        return result;
+    try {
+        if (NULL == data) {
+            storage(env, self)->erase(to_string(env, section), to_string(env, key), current_timestamp);
+            return true;
+        } else {
+            char* b = (char*)env->GetByteArrayElements(data, NULL);
+            string _data(b, b + env->GetArrayLength(data));
+            env->ReleaseByteArrayElements(data, (jbyte*)b, JNI_ABORT);
+            return storage(env, self)->put(to_string(env, section), to_string(env, key), _data,
+                timestamp(current_timestamp), timestamp(lifetime), overwrite);
+        }
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
+        return false;
     }
 }
 
 JNIEXPORT jboolean JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_erase__Ljava_lang_String_2Ljava_lang_String_2J
         (JNIEnv* env, jobject self, jstring section, jstring key, jlong current_timestamp) {
-    return storage(env, self)->erase(to_string(env, section), to_string(env, key), current_timestamp);
+    try {
+        return storage(env, self)->erase(to_string(env, section), to_string(env, key), current_timestamp);
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
+        return false;
+    }
 }
 
 JNIEXPORT void JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_erase__Ljava_lang_String_2
@@ -79,15 +134,136 @@ JNIEXPORT void JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_erase__L
     }
 }
 
+// The storage is cleared in place, so other threads never hold a pointer to a deleted one.
 JNIEXPORT void JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_clear
         (JNIEnv* env, jobject self) {
-    long long id = get_storage_id(env, self);
-    FileSystemCompactStorage* storage = storages[id];
-    if (0 != storage) {
-        string dir(storage->get_dir());
-        int groups(storage->get_groups());
-        storage->close();
-        delete storage;
-        storages[id] = new FileSystemCompactStorage(dir, groups);
+    try {
+        storage(env, self)->clear();
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
+    }
+}
+
+JNIEXPORT jobjectArray JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_getAll
+        (JNIEnv* env, jobject self, jstring section, jobjectArray keys, jlong current_timestamp) {
+    vector<string> names(size_t(env->GetArrayLength(keys)));
+    for (size_t i = 0; i < names.size(); i++) {
+        jstring key = (jstring)env->GetObjectArrayElement(keys, jsize(i));
+        names[i] = to_string(env, key);
+        env->DeleteLocalRef(key);
+    }
+
+    vector<string> data;
+    vector<bool> found;
+    try {
+        storage(env, self)->getAll(to_string(env, section), names, timestamp(current_timestamp), data, found);
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
+        return NULL;
+    }
+
+    // Values are returned compressed, like the ones of get().
+    jobjectArray result = env->NewObjectArray(jsize(names.size()), env->FindClass("[B"), NULL);
+    for (size_t i = 0; i < names.size(); i++)
+        if (found[i]) {
+            jbyteArray bytes = env->NewByteArray(jsize(data[i].length()));
+            env->SetByteArrayRegion(bytes, 0, jsize(data[i].length()), (const jbyte*)data[i].c_str());
+            env->SetObjectArrayElement(result, jsize(i), bytes);
+            env->DeleteLocalRef(bytes);
+        }
+    return result;
+}
+
+JNIEXPORT jbooleanArray JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_putAll
+        (JNIEnv* env, jobject self, jstring section, jobjectArray keys, jobjectArray values,
+        jlong current_timestamp, jlong lifetime, jboolean overwrite) {
+    vector<string> names(size_t(env->GetArrayLength(keys)));
+    vector<string> data(names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+        jstring key = (jstring)env->GetObjectArrayElement(keys, jsize(i));
+        names[i] = to_string(env, key);
+        env->DeleteLocalRef(key);
+
+        // Values are compressed by the caller, null ones are rejected before anything is put.
+        jbyteArray value = (jbyteArray)env->GetObjectArrayElement(values, jsize(i));
+        if (NULL == value) {
+            env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), "Expected non-null value.");
+            return NULL;
+        }
+        data[i] = to_string(env, value);
+        env->DeleteLocalRef(value);
+    }
+
+    vector<bool> put;
+    try {
+        storage(env, self)->putAll(to_string(env, section), names, data,
+            timestamp(current_timestamp), timestamp(lifetime), overwrite, put);
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
+        return NULL;
+    }
+
+    vector<jboolean> results(put.begin(), put.end());
+    jbooleanArray result = env->NewBooleanArray(jsize(results.size()));
+    env->SetBooleanArrayRegion(result, 0, jsize(results.size()), results.data());
+    return result;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_hasDirect
+        (JNIEnv* env, jobject self, jbyteArray section, jbyteArray key, jlong current_timestamp) {
+    try {
+        return storage(env, self)->has(to_string(env, section), to_string(env, key), timestamp(current_timestamp));
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
+        return false;
+    }
+}
+
+JNIEXPORT jint JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_getDirect
+        (JNIEnv* env, jobject self, jbyteArray section, jbyteArray key, jlong current_timestamp,
+        jobject buffer, jint position, jint limit) {
+    char* address = get_direct_buffer_address(env, buffer);
+    if (NULL == address)
+        return -1;
+
+    string data;
+    try {
+        if (!storage(env, self)->get(to_string(env, section), to_string(env, key), timestamp(current_timestamp), data))
+            return -1;
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
+        return -1;
+    }
+
+    // The value is still compressed, the caller retries with a larger buffer if it doesn't fit.
+    if (data.length() <= size_t(limit - position))
+        memcpy(address + position, data.data(), data.length());
+    return jint(data.length());
+}
+
+JNIEXPORT jboolean JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_putDirect
+        (JNIEnv* env, jobject self, jbyteArray section, jbyteArray key, jobject buffer, jint position, jint limit,
+        jlong current_timestamp, jlong lifetime, jboolean overwrite) {
+    char* address = get_direct_buffer_address(env, buffer);
+    if (NULL == address)
+        return false;
+
+    string data(address + position, address + limit);
+    try {
+        return storage(env, self)->put(to_string(env, section), to_string(env, key), data,
+            timestamp(current_timestamp), timestamp(lifetime), overwrite);
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
+        return false;
+    }
+}
+
+JNIEXPORT jboolean JNICALL Java_com_codeforces_riorita_engine_RioritaEngine_eraseDirect
+        (JNIEnv* env, jobject self, jbyteArray section, jbyteArray key, jlong current_timestamp) {
+    try {
+        return storage(env, self)->erase(to_string(env, section), to_string(env, key), current_timestamp);
+    } catch (const std::exception& e) {
+        throwNewRuntimeException(env, e.what());
+        return false;
     }
 }
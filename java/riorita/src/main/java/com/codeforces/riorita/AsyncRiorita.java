@@ -0,0 +1,520 @@
+package com.codeforces.riorita;
+
+import org.apache.log4j.Logger;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.io.UnsupportedEncodingException;
+import java.net.InetSocketAddress;
+import java.net.StandardSocketOptions;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.channels.AsynchronousSocketChannel;
+import java.nio.channels.CompletionHandler;
+import java.util.ArrayDeque;
+import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
+import java.util.Random;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ScheduledFuture;
+import java.util.concurrent.ScheduledThreadPoolExecutor;
+import java.util.concurrent.ThreadFactory;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicInteger;
+import java.util.concurrent.atomic.AtomicLong;
+
+/**
+ * Non-blocking client: operations return at once with futures completed by the response.
+ *
+ * Requests are spread over a pool of connections, each connection has many requests in flight
+ * (the server answers them in order) matched to responses by request id. Requests issued while
+ * a connection writes are queued and written by the next single gathering write, so concurrent
+ * GETs are flushed together without waiting for each other's responses.
+ *
+ * Unlike {@link Riorita}, operations are not retried: on an I/O error or a timeout the connection
+ * is closed, all its requests fail with IOException, and the next request reconnects.
+ * Futures are completed on I/O threads, so their callbacks shouldn't block.
+ */
+@SuppressWarnings("unused")
+public class AsyncRiorita implements Closeable {
+    private static final Logger logger = Logger.getLogger(AsyncRiorita.class);
+
+    private static final byte MAGIC_BYTE = 113;
+    private static final byte PROTOCOL_VERSION = 1;
+    private static final byte TTL_PROTOCOL_VERSION = 2;
+    private static final byte NAMESPACE_PROTOCOL_VERSION = 3;
+
+    private static final int DEFAULT_CONNECTION_COUNT = 4;
+    private static final long DEFAULT_TIMEOUT_MILLIS = 10000;
+    private static final int READ_BUFFER_SIZE = 64 * 1024;
+    // Length, magic byte, protocol version, request id and success: a failed response has no verdict.
+    private static final int RESPONSE_HEADER_LENGTH = 4 + 1 + 1 + 8 + 1;
+
+    private final InetSocketAddress address;
+    private final String hostAndPort;
+    private final List<Connection> connections;
+    private final AtomicInteger nextConnection = new AtomicInteger();
+    private final AtomicLong nextRequestId = new AtomicLong(Math.abs(new Random().nextLong() % 1000000000000000000L));
+    private final ScheduledThreadPoolExecutor timer;
+
+    private volatile String namespace = "";
+    private volatile long timeoutMillis = DEFAULT_TIMEOUT_MILLIS;
+
+    public AsyncRiorita(String host, int port) {
+        this(host, port, DEFAULT_CONNECTION_COUNT);
+    }
+
+    public AsyncRiorita(String host, int port, int connectionCount) {
+        if (connectionCount < 1) {
+            throw new IllegalArgumentException("Expected positive connectionCount, but " + connectionCount + " found.");
+        }
+
+        this.hostAndPort = host + ":" + port;
+        address = new InetSocketAddress(host, port);
+
+        connections = new ArrayList<Connection>(connectionCount);
+        for (int i = 0; i < connectionCount; i++) {
+            connections.add(new Connection());
+        }
+
+        timer = new ScheduledThreadPoolExecutor(1, new ThreadFactory() {
+            @Override
+            public Thread newThread(Runnable runnable) {
+                Thread thread = new Thread(runnable, "AsyncRiorita timeouts");
+                thread.setDaemon(true);
+                return thread;
+            }
+        });
+        timer.setRemoveOnCancelPolicy(true);
+    }
+
+    /**
+     * Sets namespace of all following operations, see {@link Riorita#setNamespace(String)}.
+     */
+    public void setNamespace(String namespace) {
+        this.namespace = namespace;
+    }
+
+    /**
+     * Sets the time to wait for a response, the connection is closed if it is exceeded.
+     */
+    public void setTimeoutMillis(long timeoutMillis) {
+        this.timeoutMillis = timeoutMillis;
+    }
+
+    public CompletableFuture<Boolean> ping() {
+        return send(Riorita.Type.PING, "", null, 0, VERDICT_PARSER);
+    }
+
+    public CompletableFuture<Boolean> has(String key) {
+        return send(Riorita.Type.HAS, key, null, 0, VERDICT_PARSER);
+    }
+
+    /**
+     * Completes with the value or null if there is no value by the key.
+     */
+    public CompletableFuture<byte[]> get(String key) {
+        return send(Riorita.Type.GET, key, null, 0, VALUE_PARSER);
+    }
+
+    public CompletableFuture<Boolean> put(String key, byte[] bytes) {
+        return put(key, bytes, 0);
+    }
+
+    /**
+     * Puts value which expires after ttlMillis milliseconds, zero ttlMillis means forever.
+     */
+    public CompletableFuture<Boolean> put(String key, byte[] bytes, long ttlMillis) {
+        if (ttlMillis < 0) {
+            throw new IllegalArgumentException("Expected non-negative ttlMillis, but " + ttlMillis + " found {" + this + "}.");
+        }
+        return send(Riorita.Type.PUT, key, bytes, ttlMillis, VERDICT_PARSER);
+    }
+
+    public CompletableFuture<Boolean> delete(String key) {
+        return send(Riorita.Type.DELETE, key, null, 0, VERDICT_PARSER);
+    }
+
+    /**
+     * Fails all requests in flight and closes connections.
+     */
+    @Override
+    public void close() {
+        for (Connection connection : connections) {
+            connection.close();
+        }
+        timer.shutdownNow();
+    }
+
+    private <T> CompletableFuture<T> send(Riorita.Type type, String key, byte[] value, long ttlMillis, ResponseParser<T> parser) {
+        String currentNamespace = namespace;
+        byte protocolVersion = !currentNamespace.isEmpty() ? NAMESPACE_PROTOCOL_VERSION
+                : ttlMillis > 0 ? TTL_PROTOCOL_VERSION : PROTOCOL_VERSION;
+        long requestId = nextRequestId.incrementAndGet();
+        ByteBuffer request = newRequest(type, requestId, protocolVersion,
+                protocolVersion >= NAMESPACE_PROTOCOL_VERSION ? getStringBytes(currentNamespace) : null,
+                getStringBytes(key), value, ttlMillis);
+
+        Pending<T> pending = new Pending<T>(type, protocolVersion, parser);
+        Connection connection = connections.get((nextConnection.getAndIncrement() & Integer.MAX_VALUE) % connections.size());
+        connection.send(requestId, pending, request);
+        return pending.future;
+    }
+
+    private static ByteBuffer newRequest(Riorita.Type type, long requestId, byte protocolVersion, byte[] namespaceBytes,
+                                         byte[] keyBytes, byte[] value, long ttlMillis) {
+        int requestLength = 4 // Request length.
+                + 1 // Magic byte.
+                + 1 // Protocol version.
+                + 1 // Type.
+                + 8 // Request id.
+                + (namespaceBytes != null ? 4 + namespaceBytes.length : 0) // Namespace length + namespace.
+                + 4 // Key length.
+                + keyBytes.length // Key.
+                + (value != null ? 4 + value.length : 0) // Value length + value.
+                + (value != null && protocolVersion >= TTL_PROTOCOL_VERSION ? 8 : 0) // TTL.
+                ;
+
+        ByteBuffer buffer = ByteBuffer.allocate(requestLength).order(ByteOrder.LITTLE_ENDIAN);
+        buffer.putInt(requestLength);
+        buffer.put(MAGIC_BYTE);
+        buffer.put(protocolVersion);
+        buffer.put(type.getByte());
+        buffer.putLong(requestId);
+        if (namespaceBytes != null) {
+            buffer.putInt(namespaceBytes.length);
+            buffer.put(namespaceBytes);
+        }
+        buffer.putInt(keyBytes.length);
+        buffer.put(keyBytes);
+        if (value != null) {
+            buffer.putInt(value.length);
+            buffer.put(value);
+            if (protocolVersion >= TTL_PROTOCOL_VERSION) {
+                buffer.putLong(ttlMillis);
+            }
+        }
+        buffer.flip();
+        return buffer;
+    }
+
+    private static byte[] getStringBytes(String s) {
+        try {
+            return s.getBytes("UTF-8");
+        } catch (UnsupportedEncodingException e) {
+            throw new RuntimeException("Can't find UTF-8.");
+        }
+    }
+
+    private static final ResponseParser<Boolean> VERDICT_PARSER = new ResponseParser<Boolean>() {
+        @Override
+        public Boolean parse(boolean verdict, ByteBuffer data) {
+            return verdict;
+        }
+    };
+
+    private static final ResponseParser<byte[]> VALUE_PARSER = new ResponseParser<byte[]>() {
+        @Override
+        public byte[] parse(boolean verdict, ByteBuffer data) {
+            if (!verdict) {
+                return null;
+            }
+            byte[] value = new byte[data.getInt()];
+            data.get(value);
+            return value;
+        }
+    };
+
+    private interface ResponseParser<T> {
+        // The data is the rest of the response after the verdict, it is valid only during the call.
+        T parse(boolean verdict, ByteBuffer data);
+    }
+
+    private static final class Pending<T> {
+        private final Riorita.Type type;
+        private final byte protocolVersion;
+        private final ResponseParser<T> parser;
+        private final CompletableFuture<T> future = new CompletableFuture<T>();
+        private ScheduledFuture<?> timeout;
+
+        private Pending(Riorita.Type type, byte protocolVersion, ResponseParser<T> parser) {
+            this.type = type;
+            this.protocolVersion = protocolVersion;
+            this.parser = parser;
+        }
+
+        private void complete(boolean verdict, ByteBuffer data) {
+            cancelTimeout();
+            try {
+                future.complete(parser.parse(verdict, data));
+            } catch (RuntimeException e) {
+                future.completeExceptionally(new IOException("Can't parse response of " + type + ".", e));
+            }
+        }
+
+        private void fail(Throwable e) {
+            cancelTimeout();
+            future.completeExceptionally(e instanceof IOException ? e : new IOException(e));
+        }
+
+        private synchronized void setTimeout(ScheduledFuture<?> timeout) {
+            this.timeout = timeout;
+        }
+
+        private synchronized void cancelTimeout() {
+            if (timeout != null) {
+                timeout.cancel(false);
+            }
+        }
+    }
+
+    // A connection with its requests in flight. The channel is replaced on reconnect: callbacks of
+    // a closed channel find it replaced and do nothing.
+    private final class Connection {
+        private AsynchronousSocketChannel channel;
+        private boolean connected;
+        private boolean writing;
+        private final ArrayDeque<ByteBuffer> queue = new ArrayDeque<ByteBuffer>();
+        private final Map<Long, Pending<?>> pending = new HashMap<Long, Pending<?>>();
+
+        private void send(final long requestId, final Pending<?> request, ByteBuffer buffer) {
+            AsynchronousSocketChannel connecting = null;
+            AsynchronousSocketChannel flushing = null;
+
+            synchronized (this) {
+                if (channel == null) {
+                    try {
+                        channel = AsynchronousSocketChannel.open();
+                        channel.setOption(StandardSocketOptions.TCP_NODELAY, true);
+                        channel.setOption(StandardSocketOptions.SO_KEEPALIVE, true);
+                    } catch (IOException e) {
+                        logger.warn("Can't open connection to " + hostAndPort + ".", e);
+                        channel = null;
+                        request.fail(e);
+                        return;
+                    }
+                    connecting = channel;
+                }
+
+                pending.put(requestId, request);
+                queue.add(buffer);
+                if (connected && !writing) {
+                    writing = true;
+                    flushing = channel;
+                }
+            }
+
+            request.setTimeout(timer.schedule(new Runnable() {
+                @Override
+                public void run() {
+                    AsynchronousSocketChannel timedOut;
+                    synchronized (Connection.this) {
+                        if (pending.get(requestId) != request) {
+                            return;
+                        }
+                        timedOut = channel;
+                    }
+                    fail(timedOut, new IOException("No response to " + request.type + " in " + timeoutMillis
+                            + " ms [requestId=" + requestId + ", " + hostAndPort + "]."));
+                }
+            }, timeoutMillis, TimeUnit.MILLISECONDS));
+
+            if (connecting != null) {
+                connect(connecting);
+            } else if (flushing != null) {
+                flush(flushing);
+            }
+        }
+
+        private void connect(final AsynchronousSocketChannel channel) {
+            channel.connect(address, null, new CompletionHandler<Void, Void>() {
+                @Override
+                public void completed(Void result, Void attachment) {
+                    synchronized (Connection.this) {
+                        if (channel != Connection.this.channel) {
+                            return;
+                        }
+                        connected = true;
+                        writing = true;
+                    }
+                    logger.info("Connected to " + hostAndPort + ".");
+                    read(channel, ByteBuffer.allocate(READ_BUFFER_SIZE).order(ByteOrder.LITTLE_ENDIAN));
+                    flush(channel);
+                }
+
+                @Override
+                public void failed(Throwable e, Void attachment) {
+                    fail(channel, e);
+                }
+            });
+        }
+
+        // Writes all queued requests at once, called by the only writer.
+        private void flush(AsynchronousSocketChannel channel) {
+            ByteBuffer[] buffers;
+            synchronized (this) {
+                if (channel != this.channel) {
+                    return;
+                }
+                if (queue.isEmpty()) {
+                    writing = false;
+                    return;
+                }
+                buffers = queue.toArray(new ByteBuffer[queue.size()]);
+                queue.clear();
+            }
+            write(channel, buffers, 0);
+        }
+
+        private void write(final AsynchronousSocketChannel channel, final ByteBuffer[] buffers, final int offset) {
+            channel.write(buffers, offset, buffers.length - offset, 0L, TimeUnit.MILLISECONDS, null,
+                    new CompletionHandler<Long, Void>() {
+                        @Override
+                        public void completed(Long written, Void attachment) {
+                            int next = offset;
+                            while (next < buffers.length && !buffers[next].hasRemaining()) {
+                                next++;
+                            }
+
+                            if (next < buffers.length) {
+                                write(channel, buffers, next);
+                            } else {
+                                flush(channel);
+                            }
+                        }
+
+                        @Override
+                        public void failed(Throwable e, Void attachment) {
+                            fail(channel, e);
+                        }
+                    });
+        }
+
+        private void read(final AsynchronousSocketChannel channel, final ByteBuffer buffer) {
+            channel.read(buffer, null, new CompletionHandler<Integer, Void>() {
+                @Override
+                public void completed(Integer count, Void attachment) {
+                    if (count < 0) {
+                        fail(channel, new IOException("Connection closed by " + hostAndPort + "."));
+                        return;
+                    }
+
+                    ByteBuffer nextBuffer;
+                    try {
+                        nextBuffer = processResponses(buffer);
+                    } catch (IOException e) {
+                        fail(channel, e);
+                        return;
+                    }
+                    read(channel, nextBuffer);
+                }
+
+                @Override
+                public void failed(Throwable e, Void attachment) {
+                    fail(channel, e);
+                }
+            });
+        }
+
+        // Processes complete responses in the buffer, returns the buffer to read the rest to.
+        private ByteBuffer processResponses(ByteBuffer readBuffer) throws IOException {
+            readBuffer.flip();
+
+            while (readBuffer.remaining() >= 4) {
+                int length = readBuffer.getInt(readBuffer.position());
+                if (length < RESPONSE_HEADER_LENGTH) {
+                    throw new IOException("Expected at least " + RESPONSE_HEADER_LENGTH + " bytes in response, but "
+                            + length + " found [" + hostAndPort + "].");
+                }
+                if (readBuffer.remaining() < length) {
+                    break;
+                }
+
+                ByteBuffer response = readBuffer.slice().order(ByteOrder.LITTLE_ENDIAN);
+                response.limit(length);
+                readBuffer.position(readBuffer.position() + length);
+                processResponse(response);
+            }
+
+            // A buffer is grown for a large response and shrunk back after it.
+            int length = readBuffer.remaining() >= 4 ? readBuffer.getInt(readBuffer.position()) : 0;
+            if (length > readBuffer.capacity()
+                    || (readBuffer.capacity() > READ_BUFFER_SIZE && length <= READ_BUFFER_SIZE)) {
+                ByteBuffer buffer = ByteBuffer.allocate(Math.max(length, READ_BUFFER_SIZE)).order(ByteOrder.LITTLE_ENDIAN);
+                buffer.put(readBuffer);
+                return buffer;
+            }
+
+            readBuffer.compact();
+            return readBuffer;
+        }
+
+        private void processResponse(ByteBuffer response) throws IOException {
+            response.getInt();
+            byte magicByte = response.get();
+            byte protocolVersion = response.get();
+            long requestId = response.getLong();
+            byte success = response.get();
+
+            if (magicByte != MAGIC_BYTE) {
+                throw new IOException("Invalid magic: expected " + (int) MAGIC_BYTE + ", found " + magicByte + " [" + hostAndPort + "].");
+            }
+
+            Pending<?> request;
+            synchronized (this) {
+                request = pending.remove(requestId);
+            }
+            if (request == null) {
+                throw new IOException("Unexpected response [requestId=" + requestId + ", " + hostAndPort + "].");
+            }
+
+            if (protocolVersion != request.protocolVersion) {
+                request.fail(new IOException("Invalid protocol: expected " + (int) request.protocolVersion
+                        + ", found " + protocolVersion + " [requestId=" + requestId + ", " + hostAndPort + "]."));
+            } else if (success != 1) {
+                request.fail(new IOException("Operation didn't return with success [requestId=" + requestId + ", " + hostAndPort + "]."));
+            } else if (!response.hasRemaining()) {
+                request.fail(new IOException("Expected verdict in response [requestId=" + requestId + ", " + hostAndPort + "]."));
+            } else {
+                request.complete(response.get() == 1, response);
+            }
+        }
+
+        // Closes the channel if it is still the current one and fails all its requests.
+        private void fail(AsynchronousSocketChannel failedChannel, Throwable e) {
+            List<Pending<?>> failed;
+            synchronized (this) {
+                if (failedChannel == null || failedChannel != channel) {
+                    return;
+                }
+                channel = null;
+                connected = false;
+                writing = false;
+                queue.clear();
+                failed = new ArrayList<Pending<?>>(pending.values());
+                pending.clear();
+            }
+
+            logger.warn("Closing connection to " + hostAndPort + " with " + failed.size() + " requests in flight.", e);
+            try {
+                failedChannel.close();
+            } catch (IOException ignored) {
+                // No operations.
+            }
+
+            for (Pending<?> request : failed) {
+                request.fail(e);
+            }
+        }
+
+        private void close() {
+            AsynchronousSocketChannel current;
+            synchronized (this) {
+                current = channel;
+            }
+            fail(current, new IOException("Client is closed [" + hostAndPort + "]."));
+        }
+    }
+}
@@ -0,0 +1,94 @@
+package com.codeforces.riorita;
+
+import java.io.UnsupportedEncodingException;
+import java.security.MessageDigest;
+import java.security.NoSuchAlgorithmException;
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.List;
+import java.util.Map;
+import java.util.SortedMap;
+import java.util.TreeMap;
+
+/**
+ * Consistent hash ring of cluster nodes: each node has weight * VIRTUAL_NODES_PER_WEIGHT points on the ring,
+ * a key belongs to the nodes of the first points clockwise from its hash. Adding a node moves only
+ * the keys which it takes, about weight/totalWeight of them. Immutable, so it is safe to share.
+ */
+final class ConsistentHashRing {
+    private static final int VIRTUAL_NODES_PER_WEIGHT = 160;
+
+    private final List<RioritaCluster.Node> nodes;
+    private final TreeMap<Long, RioritaCluster.Node> points = new TreeMap<Long, RioritaCluster.Node>();
+
+    ConsistentHashRing(List<RioritaCluster.Node> nodes) {
+        this.nodes = Collections.unmodifiableList(new ArrayList<RioritaCluster.Node>(nodes));
+
+        for (RioritaCluster.Node node : nodes) {
+            for (int i = 0; i < node.getWeight() * VIRTUAL_NODES_PER_WEIGHT; i++) {
+                long point = hash(node + "#" + i);
+                // On a collision the point stays with the node which is first in the order of addition.
+                if (!points.containsKey(point)) {
+                    points.put(point, node);
+                }
+            }
+        }
+    }
+
+    List<RioritaCluster.Node> getNodes() {
+        return nodes;
+    }
+
+    ConsistentHashRing withNode(RioritaCluster.Node node) {
+        if (nodes.contains(node)) {
+            throw new IllegalArgumentException("Node " + node + " is already in the ring.");
+        }
+
+        List<RioritaCluster.Node> newNodes = new ArrayList<RioritaCluster.Node>(nodes);
+        newNodes.add(node);
+        return new ConsistentHashRing(newNodes);
+    }
+
+    /**
+     * Returns at most count distinct nodes of the key, the first one is its primary node.
+     */
+    List<RioritaCluster.Node> getNodes(String key, int count) {
+        List<RioritaCluster.Node> result = new ArrayList<RioritaCluster.Node>(count);
+        if (points.isEmpty()) {
+            return result;
+        }
+
+        count = Math.min(count, nodes.size());
+        SortedMap<Long, RioritaCluster.Node> tail = points.tailMap(hash(key));
+        collect(tail, count, result);
+        collect(points, count, result);
+        return result;
+    }
+
+    private static void collect(SortedMap<Long, RioritaCluster.Node> points, int count, List<RioritaCluster.Node> result) {
+        for (Map.Entry<Long, RioritaCluster.Node> entry : points.entrySet()) {
+            if (result.size() >= count) {
+                return;
+            }
+            if (!result.contains(entry.getValue())) {
+                result.add(entry.getValue());
+            }
+        }
+    }
+
+    // The first 8 bytes of MD5: any key spreads evenly, unlike String.hashCode().
+    static long hash(String s) {
+        try {
+            byte[] digest = MessageDigest.getInstance("MD5").digest(s.getBytes("UTF-8"));
+            long result = 0;
+            for (int i = 0; i < 8; i++) {
+                result = (result << 8) | (digest[i] & 0xFF);
+            }
+            return result;
+        } catch (NoSuchAlgorithmException e) {
+            throw new RuntimeException("Can't find MD5.", e);
+        } catch (UnsupportedEncodingException e) {
+            throw new RuntimeException("Can't find UTF-8.", e);
+        }
+    }
+}
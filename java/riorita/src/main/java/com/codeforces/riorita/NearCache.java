@@ -0,0 +1,172 @@
+package com.codeforces.riorita;
+
+import org.apache.log4j.Logger;
+
+import java.io.IOException;
+import java.nio.charset.StandardCharsets;
+import java.util.ArrayList;
+import java.util.LinkedHashMap;
+import java.util.List;
+import java.util.Map;
+
+/**
+ * Bounded LRU cache of values in the client, kept coherent by the server: a background thread polls
+ * the server with INVALIDATIONS over its own connection every pollIntervalMillis, registers keys cached
+ * since the previous poll and drops entries of keys modified by anyone. A value may be stale for about
+ * the poll interval; values expired on the server may live until the server removes them.
+ *
+ * Entries are served only while polls succeed: after POLL_FAILURES_TO_STALE intervals without a poll
+ * the cache is bypassed. Keys are identified by 64-bit hashes of the namespace and the key.
+ */
+final class NearCache {
+    private static final Logger logger = Logger.getLogger(NearCache.class);
+
+    private static final int POLL_FAILURES_TO_STALE = 10;
+
+    private final long pollIntervalMillis;
+    private final Riorita poller;
+    private final LinkedHashMap<Long, Entry> entries;
+
+    // Keys cached since the last poll, they are registered at the next one.
+    private final List<Long> cachedHashes = new ArrayList<Long>();
+    private long cachedSince = Long.MAX_VALUE;
+    private long subscription;
+    private long sequence;
+    private long polledAtMillis;
+
+    private volatile boolean stopped;
+    private final Thread thread;
+
+    NearCache(String host, int port, final int maxEntries, long pollIntervalMillis) {
+        this.pollIntervalMillis = pollIntervalMillis;
+        poller = new Riorita(host, port);
+        entries = new LinkedHashMap<Long, Entry>(16, 0.75f, true) {
+            @Override
+            protected boolean removeEldestEntry(Map.Entry<Long, Entry> eldest) {
+                return size() > maxEntries;
+            }
+        };
+
+        thread = new Thread(new Runnable() {
+            @Override
+            public void run() {
+                NearCache.this.run();
+            }
+        }, "Riorita near cache " + host + ":" + port);
+        thread.setDaemon(true);
+        thread.start();
+    }
+
+    void stop() {
+        stopped = true;
+        thread.interrupt();
+    }
+
+    /**
+     * Returns the sequence to pass to {@link #put(String, String, byte[], long)} of a value read after this call.
+     */
+    synchronized long getSequence() {
+        return sequence;
+    }
+
+    synchronized byte[] get(String namespace, String key) {
+        if (System.currentTimeMillis() - polledAtMillis > POLL_FAILURES_TO_STALE * pollIntervalMillis) {
+            return null;
+        }
+
+        Entry entry = entries.get(getKeyHash(namespace, key));
+        return entry != null && entry.namespace.equals(namespace) && entry.key.equals(key) ? entry.value : null;
+    }
+
+    synchronized void put(String namespace, String key, byte[] value, long readSequence) {
+        long hash = getKeyHash(namespace, key);
+        entries.put(hash, new Entry(namespace, key, value));
+        cachedHashes.add(hash);
+        cachedSince = Math.min(cachedSince, readSequence);
+    }
+
+    synchronized void invalidate(String namespace, String key) {
+        entries.remove(getKeyHash(namespace, key));
+    }
+
+    synchronized void clear() {
+        entries.clear();
+    }
+
+    private void run() {
+        while (!stopped) {
+            try {
+                Thread.sleep(pollIntervalMillis);
+            } catch (InterruptedException e) {
+                // Stopped.
+                return;
+            }
+
+            long[] hashes;
+            long since;
+            long currentSubscription;
+            synchronized (this) {
+                hashes = new long[cachedHashes.size()];
+                for (int i = 0; i < hashes.length; i++) {
+                    hashes[i] = cachedHashes.get(i);
+                }
+                cachedHashes.clear();
+                // Keys are registered from the sequence before their values were read, so a modification
+                // between the read and the registration is not missed.
+                since = Math.min(sequence, cachedSince);
+                cachedSince = Long.MAX_VALUE;
+                currentSubscription = subscription;
+            }
+
+            try {
+                Riorita.Invalidations invalidations = poller.pollInvalidations(currentSubscription, since, hashes);
+                synchronized (this) {
+                    if (invalidations == null) {
+                        logger.warn("Server doesn't track invalidations, the near cache is disabled.");
+                        entries.clear();
+                        continue;
+                    }
+
+                    subscription = invalidations.getSubscription();
+                    sequence = invalidations.getSequence();
+                    polledAtMillis = System.currentTimeMillis();
+                    if (invalidations.isReset()) {
+                        entries.clear();
+                    } else {
+                        for (long hash : invalidations.getHashes()) {
+                            entries.remove(hash);
+                        }
+                    }
+                }
+            } catch (IOException e) {
+                logger.warn("Can't poll invalidations, the near cache is cleared.", e);
+                clear();
+            }
+        }
+    }
+
+    // FNV-1a of the namespace, '~' and the key, the same as the server's.
+    static long getKeyHash(String namespace, String key) {
+        long hash = 0xcbf29ce484222325L;
+        for (byte b : namespace.getBytes(StandardCharsets.UTF_8)) {
+            hash = (hash ^ (b & 0xFF)) * 0x100000001b3L;
+        }
+        hash = (hash ^ '~') * 0x100000001b3L;
+        for (byte b : key.getBytes(StandardCharsets.UTF_8)) {
+            hash = (hash ^ (b & 0xFF)) * 0x100000001b3L;
+        }
+        return hash;
+    }
+
+    private static final class Entry {
+        private final String namespace;
+        private final String key;
+        private final byte[] value;
+
+        private Entry(String namespace, String key, byte[] value) {
+            this.namespace = namespace;
+            this.key = key;
+            this.value = value;
+        }
+    }
+}
@@ -8,6 +8,11 @@ import java.net.Socket;
 import java.net.SocketAddress;
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.List;
+import java.util.Map;
+import java.util.TreeMap;
 import java.util.Random;
 import java.util.concurrent.atomic.AtomicInteger;
 
@@ -17,6 +22,29 @@ public class Riorita {
 
     private static final byte MAGIC_BYTE = 113;
     private static final byte PROTOCOL_VERSION = 1;
+    // Version 2 adds TTL to PUT, it is sent only when needed to support older servers.
+    private static final byte TTL_PROTOCOL_VERSION = 2;
+    // Version 3 adds namespaces, it is sent only if a namespace is set.
+    private static final byte NAMESPACE_PROTOCOL_VERSION = 3;
+    // Version 4 adds CAS tokens and conditional writes, it is sent only by them.
+    private static final byte CAS_PROTOCOL_VERSION = 4;
+    // Version 5 adds range reads and chunked writes of large values.
+    private static final byte RANGE_PROTOCOL_VERSION = 5;
+    private static final int CHUNK_SIZE = 4 * 1024 * 1024;
+    // Version 6 adds scans.
+    private static final byte SCAN_PROTOCOL_VERSION = 6;
+    private static final byte SCAN_SIZES = 1;
+    private static final byte SCAN_VALUES = 2;
+    private static final byte SCAN_TTLS = 4;
+    // Version 7 adds server stats.
+    private static final byte STATS_PROTOCOL_VERSION = 7;
+    // Version 8 adds hot keys.
+    private static final byte HOT_KEYS_PROTOCOL_VERSION = 8;
+    // Version 10 adds invalidations of near caches.
+    private static final byte INVALIDATIONS_PROTOCOL_VERSION = 10;
+    // Version 11 adds backups and TTLs in scans.
+    private static final byte BACKUP_PROTOCOL_VERSION = 11;
+    private static final byte SCAN_TTLS_PROTOCOL_VERSION = 11;
     private static final int MAX_RECONNECT_COUNT = 100;
     private static final long WARN_THRESHOLD_MILLIS = 100;
     private static final int MAX_OPERATION_COUNT_PER_CONNECTION = 1000;
@@ -31,16 +59,22 @@ public class Riorita {
     private InputStream inputStream;
     private OutputStream outputStream;
 
+    private final String host;
+    private final int port;
     private final String hostAndPort;
     private String keyPrefix = "";
+    private String namespace = "";
     private final boolean reconnect;
     private AtomicInteger connectionOperationCount = new AtomicInteger();
+    private NearCache nearCache;
 
     public Riorita(String host, int port) {
         this(host, port, true);
     }
 
     public Riorita(String host, int port, boolean reconnect) {
+        this.host = host;
+        this.port = port;
         this.hostAndPort = host + ":" + port;
         this.reconnect = reconnect;
         socketAddress = new InetSocketAddress(host, port);
@@ -50,10 +84,59 @@ public class Riorita {
         this.keyPrefix = keyPrefix;
     }
 
+    /**
+     * Sets namespace of all following operations, empty namespace is the default one.
+     * Unlike key prefix, namespace can be dropped at once by {@link #dropNamespace(String)}.
+     */
+    public void setNamespace(String namespace) {
+        this.namespace = namespace;
+    }
+
+    /**
+     * Keeps at most maxEntries values read by {@link #get(String)} in the client. They are dropped when
+     * the server reports their keys modified by anyone, the server is polled every pollIntervalMillis
+     * by a background thread, so a value may be stale for about that time. Writes of this client drop
+     * their keys at once. Requires a server started with --invalidation-log. The server tracks up to 8192
+     * distinct keys between resets of the cache, so a larger maxEntries mostly causes more frequent resets.
+     */
+    public void enableNearCache(int maxEntries, long pollIntervalMillis) {
+        if (maxEntries <= 0 || pollIntervalMillis <= 0) {
+            throw new IllegalArgumentException("Expected positive maxEntries and pollIntervalMillis, but "
+                    + maxEntries + " and " + pollIntervalMillis + " found {" + this + "}.");
+        }
+
+        disableNearCache();
+        nearCache = new NearCache(host, port, maxEntries, pollIntervalMillis);
+    }
+
+    public void disableNearCache() {
+        if (nearCache != null) {
+            nearCache.stop();
+            nearCache = null;
+        }
+    }
+
+    private void invalidateNearCache(String key) {
+        if (nearCache != null) {
+            nearCache.invalidate(namespace, key);
+        }
+    }
+
+    private byte getProtocolVersion(boolean ttl) {
+        if (!namespace.isEmpty()) {
+            return NAMESPACE_PROTOCOL_VERSION;
+        }
+        return ttl ? TTL_PROTOCOL_VERSION : PROTOCOL_VERSION;
+    }
+
     private String applyKeyPrefix(String key) {
         return keyPrefix + key;
     }
 
+    private String removeKeyPrefix(String key) {
+        return key.startsWith(keyPrefix) ? key.substring(keyPrefix.length()) : key;
+    }
+
     private void reconnectQuietly() {
         if (socket != null) {
             try {
@@ -100,6 +183,10 @@ public class Riorita {
     }
 
     private boolean writeRequestAndReadResponseVerdict(ByteBuffer request, long requestId) throws IOException {
+        return writeRequestAndReadResponseVerdict(request, requestId, PROTOCOL_VERSION);
+    }
+
+    private boolean writeRequestAndReadResponseVerdict(ByteBuffer request, long requestId, byte protocolVersion) throws IOException {
         outputStream.write(request.array());
         outputStream.flush();
 
@@ -108,7 +195,7 @@ public class Riorita {
             throw new IOException("Expected exactly 16 bytes in response [requestId=" + requestId + "] {" + this + "}.");
         }
 
-        return readResponseVerdict(requestId);
+        return readResponseVerdict(requestId, protocolVersion);
     }
 
     private <T> T runOperation(Operation<T> operation, int size) throws IOException {
@@ -191,23 +278,44 @@ public class Riorita {
     }
 
     private ByteBuffer newRequestBuffer(Type type, long requestId, int keyLength, Integer valueLength) {
+        return newRequestBuffer(type, requestId, keyLength, valueLength, PROTOCOL_VERSION);
+    }
+
+    private ByteBuffer newRequestBuffer(Type type, long requestId, int keyLength, Integer valueLength, byte protocolVersion) {
+        return newRequestBuffer(type, requestId, protocolVersion >= NAMESPACE_PROTOCOL_VERSION
+                ? getStringBytes(namespace) : null, keyLength, valueLength, protocolVersion);
+    }
+
+    private ByteBuffer newRequestBuffer(Type type, long requestId, byte[] namespaceBytes, int keyLength, Integer valueLength, byte protocolVersion) {
+        return newRequestBuffer(type, requestId, namespaceBytes, keyLength, valueLength, protocolVersion, 0);
+    }
+
+    private ByteBuffer newRequestBuffer(Type type, long requestId, byte[] namespaceBytes, int keyLength, Integer valueLength, byte protocolVersion, int parametersDataLength) {
         int requestLength = 4 // Request length.
                 + 1 // Magic byte.
                 + 1 // Protocol version.
                 + 1 // Type.
                 + 8 // Request id.
+                + (namespaceBytes != null ? 4 + namespaceBytes.length : 0) // Namespace length + namespace.
                 + 4 // Key length.
                 + keyLength // Key.
                 + (valueLength != null ? 4 + valueLength : 0) // Value length + value.
+                + (valueLength != null && protocolVersion >= TTL_PROTOCOL_VERSION ? 8 : 0) // TTL.
+                + type.getParametersLength() // CAS token, range, chunk position, scan, hot keys or invalidations parameters.
+                + parametersDataLength // Scan cursor or hashes of cached keys.
                 ;
 
         ByteBuffer byteBuffer = ByteBuffer.allocate(requestLength).order(ByteOrder.LITTLE_ENDIAN);
 
         byteBuffer.putInt(requestLength);
         byteBuffer.put(MAGIC_BYTE);
-        byteBuffer.put(PROTOCOL_VERSION);
+        byteBuffer.put(protocolVersion);
         byteBuffer.put(type.getByte());
         byteBuffer.putLong(requestId);
+        if (namespaceBytes != null) {
+            byteBuffer.putInt(namespaceBytes.length);
+            byteBuffer.put(namespaceBytes);
+        }
         byteBuffer.putInt(keyLength);
 
         return byteBuffer;
@@ -220,6 +328,10 @@ public class Riorita {
     }
 
     private boolean readResponseVerdict(long requestId) throws IOException {
+        return readResponseVerdict(requestId, PROTOCOL_VERSION);
+    }
+
+    private boolean readResponseVerdict(long requestId, byte expectedProtocolVersion) throws IOException {
         int responseHeaderLength = 1 // Magic byte.
                 + 1 // Protocol version.
                 + 8 // Request id.
@@ -236,8 +348,8 @@ public class Riorita {
         }
 
         int protocolVersion = responseBuffer.get();
-        if (protocolVersion != PROTOCOL_VERSION) {
-            throw new IOException("Invalid protocol: expected " + (int) PROTOCOL_VERSION + ", found " + protocolVersion + " [requestId=" + requestId + "] {" + this + "}.");
+        if (protocolVersion != expectedProtocolVersion) {
+            throw new IOException("Invalid protocol: expected " + (int) expectedProtocolVersion + ", found " + protocolVersion + " [requestId=" + requestId + "] {" + this + "}.");
         }
 
         long receivedRequestId = responseBuffer.getLong();
@@ -273,6 +385,14 @@ public class Riorita {
         }
     }
 
+    private String getString(byte[] bytes) {
+        try {
+            return new String(bytes, "UTF-8");
+        } catch (UnsupportedEncodingException e) {
+            throw new RuntimeException("Can't find UTF-8 {" + this + "}.");
+        }
+    }
+
     @SuppressWarnings("unused")
     public boolean ping() throws IOException {
         final long requestId = nextRequestId();
@@ -299,16 +419,20 @@ public class Riorita {
     @SuppressWarnings("WeakerAccess")
     public boolean has(String key) throws IOException {
         key = applyKeyPrefix(key);
+        if (nearCache != null && nearCache.get(namespace, key) != null) {
+            return true;
+        }
 
         byte[] keyBytes = getStringBytes(key);
         final long requestId = nextRequestId();
-        final ByteBuffer hasBuffer = newRequestBuffer(Type.HAS, requestId, keyBytes.length, null);
+        final byte protocolVersion = getProtocolVersion(false);
+        final ByteBuffer hasBuffer = newRequestBuffer(Type.HAS, requestId, keyBytes.length, null, protocolVersion);
         hasBuffer.put(keyBytes);
 
         return runOperation(new Operation<Boolean>() {
             @Override
             public Boolean run() throws IOException {
-                return writeRequestAndReadResponseVerdict(hasBuffer, requestId);
+                return writeRequestAndReadResponseVerdict(hasBuffer, requestId, protocolVersion);
             }
 
             @Override
@@ -326,16 +450,18 @@ public class Riorita {
     @SuppressWarnings("unused")
     public boolean delete(String key) throws IOException {
         key = applyKeyPrefix(key);
+        invalidateNearCache(key);
 
         byte[] keyBytes = getStringBytes(key);
         final long requestId = nextRequestId();
-        final ByteBuffer deleteBuffer = newRequestBuffer(Type.DELETE, requestId, keyBytes.length, null);
+        final byte protocolVersion = getProtocolVersion(false);
+        final ByteBuffer deleteBuffer = newRequestBuffer(Type.DELETE, requestId, keyBytes.length, null, protocolVersion);
         deleteBuffer.put(keyBytes);
 
         return runOperation(new Operation<Boolean>() {
             @Override
             public Boolean run() throws IOException {
-                return writeRequestAndReadResponseVerdict(deleteBuffer, requestId);
+                return writeRequestAndReadResponseVerdict(deleteBuffer, requestId, protocolVersion);
             }
 
             @Override
@@ -352,19 +478,37 @@ public class Riorita {
 
     @SuppressWarnings("WeakerAccess")
     public boolean put(String key, byte[] bytes) throws IOException {
+        return put(key, bytes, 0);
+    }
+
+    /**
+     * Puts value which expires after ttlMillis milliseconds, zero ttlMillis means forever.
+     * The server hides the value right after expiration and removes it shortly.
+     */
+    @SuppressWarnings("WeakerAccess")
+    public boolean put(String key, byte[] bytes, long ttlMillis) throws IOException {
+        if (ttlMillis < 0) {
+            throw new IllegalArgumentException("Expected non-negative ttlMillis, but " + ttlMillis + " found {" + this + "}.");
+        }
+
         key = applyKeyPrefix(key);
+        invalidateNearCache(key);
 
         byte[] keyBytes = getStringBytes(key);
         final long requestId = nextRequestId();
-        final ByteBuffer putBuffer = newRequestBuffer(Type.PUT, requestId, keyBytes.length, bytes.length);
+        final byte protocolVersion = getProtocolVersion(ttlMillis > 0);
+        final ByteBuffer putBuffer = newRequestBuffer(Type.PUT, requestId, keyBytes.length, bytes.length, protocolVersion);
         putBuffer.put(keyBytes);
         putBuffer.putInt(bytes.length);
         putBuffer.put(bytes);
+        if (protocolVersion >= TTL_PROTOCOL_VERSION) {
+            putBuffer.putLong(ttlMillis);
+        }
 
         return runOperation(new Operation<Boolean>() {
             @Override
             public Boolean run() throws IOException {
-                return writeRequestAndReadResponseVerdict(putBuffer, requestId);
+                return writeRequestAndReadResponseVerdict(putBuffer, requestId, protocolVersion);
             }
 
             @Override
@@ -383,9 +527,28 @@ public class Riorita {
     public byte[] get(String key) throws IOException {
         key = applyKeyPrefix(key);
 
+        if (nearCache == null) {
+            return getFromServer(key);
+        }
+
+        byte[] value = nearCache.get(namespace, key);
+        if (value == null) {
+            long sequence = nearCache.getSequence();
+            value = getFromServer(key);
+            if (value == null) {
+                return null;
+            }
+            nearCache.put(namespace, key, value, sequence);
+        }
+        // The cached array is never given out, so callers can't change it.
+        return value.clone();
+    }
+
+    private byte[] getFromServer(String key) throws IOException {
         byte[] keyBytes = getStringBytes(key);
         final long requestId = nextRequestId();
-        final ByteBuffer getBuffer = newRequestBuffer(Type.GET, requestId, keyBytes.length, null);
+        final byte protocolVersion = getProtocolVersion(false);
+        final ByteBuffer getBuffer = newRequestBuffer(Type.GET, requestId, keyBytes.length, null, protocolVersion);
         getBuffer.put(keyBytes);
 
         return runOperation(new Operation<byte[]>() {
@@ -399,7 +562,7 @@ public class Riorita {
                     throw new IOException("Expected at least 16 bytes in response, but " + responseLength + " found [requestId=" + requestId + "] {" + this + "}.");
                 }
 
-                boolean verdict = readResponseVerdict(requestId);
+                boolean verdict = readResponseVerdict(requestId, protocolVersion);
 
                 if (!verdict) {
                     if (responseLength != 16) {
@@ -408,17 +571,54 @@ public class Riorita {
 
                     return null;
                 } else {
-                    ByteBuffer valueLengthBuffer = ByteBuffer.allocate(4).order(ByteOrder.LITTLE_ENDIAN);
-                    readExactly(valueLengthBuffer.array(), 0, 4, requestId);
+                    return readResponseValue(requestId);
+                }
+            }
 
-                    int valueLength = valueLengthBuffer.getInt();
-                    if (valueLength < 0) {
-                        throw new IOException("Expected positive length of value in response [requestId=" + requestId + "] {" + this + "}.");
+            @Override
+            public Type getType() {
+                return Type.GET;
+            }
+
+            @Override
+            public long getRequestId() {
+                return requestId;
+            }
+        }, keyBytes.length);
+    }
+
+    /**
+     * Returns value with its CAS token or null if there is no value by the key.
+     */
+    @SuppressWarnings("unused")
+    public Versioned getVersioned(String key) throws IOException {
+        key = applyKeyPrefix(key);
+
+        byte[] keyBytes = getStringBytes(key);
+        final long requestId = nextRequestId();
+        final ByteBuffer getBuffer = newRequestBuffer(Type.GET, requestId, keyBytes.length, null, CAS_PROTOCOL_VERSION);
+        getBuffer.put(keyBytes);
+
+        return runOperation(new Operation<Versioned>() {
+            @Override
+            public Versioned run() throws IOException {
+                outputStream.write(getBuffer.array());
+                outputStream.flush();
+
+                int responseLength = readResponseLength(requestId);
+                if (responseLength < 16) {
+                    throw new IOException("Expected at least 16 bytes in response, but " + responseLength + " found [requestId=" + requestId + "] {" + this + "}.");
+                }
+
+                if (!readResponseVerdict(requestId, CAS_PROTOCOL_VERSION)) {
+                    if (responseLength != 16) {
+                        throw new IOException("Expected exactly 16 bytes in response [requestId=" + requestId + "] {" + this + "}.");
                     }
 
-                    ByteBuffer valueBuffer = ByteBuffer.allocate(valueLength).order(ByteOrder.LITTLE_ENDIAN);
-                    readExactly(valueBuffer.array(), 0, valueLength, requestId);
-                    return valueBuffer.array();
+                    return null;
+                } else {
+                    byte[] value = readResponseValue(requestId);
+                    return new Versioned(value, readResponseInt64(requestId));
                 }
             }
 
@@ -434,16 +634,745 @@ public class Riorita {
         }, keyBytes.length);
     }
 
+    /**
+     * Puts value only if there is no value by the key.
+     *
+     * @return CAS token of the value or 0 if the key has a value.
+     */
+    @SuppressWarnings("unused")
+    public long putIfAbsent(String key, byte[] bytes, long ttlMillis) throws IOException {
+        return writeConditionally(Type.PUT_IF_ABSENT, key, bytes, ttlMillis, 0);
+    }
+
+    /**
+     * Puts value only if the current value has the CAS token (see {@link #getVersioned(String)}).
+     *
+     * @return CAS token of the new value or 0 if the value was changed or deleted.
+     */
+    @SuppressWarnings("unused")
+    public long compareAndSet(String key, byte[] bytes, long cas, long ttlMillis) throws IOException {
+        return writeConditionally(Type.COMPARE_AND_SET, key, bytes, ttlMillis, cas);
+    }
+
+    /**
+     * Deletes value only if it has the CAS token.
+     */
+    @SuppressWarnings("unused")
+    public boolean compareAndDelete(String key, long cas) throws IOException {
+        return writeConditionally(Type.COMPARE_AND_DELETE, key, null, 0, cas) != 0;
+    }
+
+    /**
+     * Atomically appends bytes to the value (or puts them if there is no value), keeps its TTL.
+     *
+     * @return CAS token of the new value.
+     */
+    @SuppressWarnings("unused")
+    public long append(String key, byte[] bytes) throws IOException {
+        return writeConditionally(Type.APPEND, key, bytes, 0, 0);
+    }
+
+    // Returns CAS token of the new value (or 1 for deletion) if verdict is 1 and 0 otherwise.
+    private long writeConditionally(final Type type, String key, byte[] bytes, long ttlMillis, long cas) throws IOException {
+        if (ttlMillis < 0) {
+            throw new IllegalArgumentException("Expected non-negative ttlMillis, but " + ttlMillis + " found {" + this + "}.");
+        }
+
+        key = applyKeyPrefix(key);
+        invalidateNearCache(key);
+
+        byte[] keyBytes = getStringBytes(key);
+        final long requestId = nextRequestId();
+        final ByteBuffer requestBuffer = newRequestBuffer(type, requestId, keyBytes.length,
+                bytes != null ? bytes.length : null, CAS_PROTOCOL_VERSION);
+        requestBuffer.put(keyBytes);
+        if (bytes != null) {
+            requestBuffer.putInt(bytes.length);
+            requestBuffer.put(bytes);
+            requestBuffer.putLong(ttlMillis);
+        }
+        if (type.hasCas()) {
+            requestBuffer.putLong(cas);
+        }
+
+        return runOperation(new Operation<Long>() {
+            @Override
+            public Long run() throws IOException {
+                outputStream.write(requestBuffer.array());
+                outputStream.flush();
+
+                int responseLength = readResponseLength(requestId);
+                boolean verdict = readResponseVerdict(requestId, CAS_PROTOCOL_VERSION);
+                int expectedLength = verdict && type != Type.COMPARE_AND_DELETE ? 24 : 16;
+                if (responseLength != expectedLength) {
+                    throw new IOException("Expected exactly " + expectedLength + " bytes in response [requestId=" + requestId + "] {" + this + "}.");
+                }
+
+                if (!verdict) {
+                    return 0L;
+                }
+                return type == Type.COMPARE_AND_DELETE ? 1L : readResponseInt64(requestId);
+            }
+
+            @Override
+            public Type getType() {
+                return type;
+            }
+
+            @Override
+            public long getRequestId() {
+                return requestId;
+            }
+        }, keyBytes.length + (bytes != null ? bytes.length : 0));
+    }
+
+    /**
+     * Returns at most length bytes of the value from the offset or null if there is no value by the key.
+     */
+    @SuppressWarnings("unused")
+    public byte[] getRange(String key, long offset, int length) throws IOException {
+        ByteArrayOutputStream target = new ByteArrayOutputStream();
+        return getRange(applyKeyPrefix(key), offset, length, target) >= 0 ? target.toByteArray() : null;
+    }
+
+    /**
+     * Writes the value to the stream by chunks, so a large value is never kept in memory as a whole.
+     * A value changed during the call may be written partially changed.
+     *
+     * @return size of the value or -1 if there is no value by the key.
+     */
+    @SuppressWarnings("unused")
+    public long get(String key, OutputStream target) throws IOException {
+        key = applyKeyPrefix(key);
+
+        long totalSize = getRange(key, 0, CHUNK_SIZE, target);
+        for (long offset = CHUNK_SIZE; totalSize >= 0 && offset < totalSize; offset += CHUNK_SIZE) {
+            if (getRange(key, offset, CHUNK_SIZE, target) != totalSize) {
+                throw new IOException("Value of " + key + " was changed during reading {" + this + "}.");
+            }
+        }
+        return totalSize;
+    }
+
+    // Writes the range to the stream, returns the size of the whole value or -1 if there is no value.
+    // The range is written after the operation succeeds, so retries never write it twice.
+    private long getRange(String key, long offset, int length, OutputStream target) throws IOException {
+        byte[] keyBytes = getStringBytes(key);
+        final long requestId = nextRequestId();
+        final ByteBuffer rangeBuffer = newRequestBuffer(Type.RANGE_GET, requestId, keyBytes.length, null, RANGE_PROTOCOL_VERSION);
+        rangeBuffer.put(keyBytes);
+        rangeBuffer.putLong(offset);
+        rangeBuffer.putInt(length);
+
+        final byte[][] range = new byte[1][];
+        long totalSize = runOperation(new Operation<Long>() {
+            @Override
+            public Long run() throws IOException {
+                outputStream.write(rangeBuffer.array());
+                outputStream.flush();
+
+                int responseLength = readResponseLength(requestId);
+                if (!readResponseVerdict(requestId, RANGE_PROTOCOL_VERSION)) {
+                    if (responseLength != 16) {
+                        throw new IOException("Expected exactly 16 bytes in response [requestId=" + requestId + "] {" + this + "}.");
+                    }
+                    return -1L;
+                }
+
+                range[0] = readResponseValue(requestId);
+                return readResponseInt64(requestId);
+            }
+
+            @Override
+            public Type getType() {
+                return Type.RANGE_GET;
+            }
+
+            @Override
+            public long getRequestId() {
+                return requestId;
+            }
+        }, keyBytes.length);
+
+        if (totalSize >= 0) {
+            target.write(range[0]);
+        }
+        return totalSize;
+    }
+
+    /**
+     * Puts value of the given size from the stream by chunks, so a large value is never kept
+     * in memory as a whole. The value becomes visible after the last chunk.
+     */
+    @SuppressWarnings("unused")
+    public boolean put(String key, InputStream inputStream, long size, long ttlMillis) throws IOException {
+        if (ttlMillis < 0) {
+            throw new IllegalArgumentException("Expected non-negative ttlMillis, but " + ttlMillis + " found {" + this + "}.");
+        }
+
+        key = applyKeyPrefix(key);
+        invalidateNearCache(key);
+        byte[] keyBytes = getStringBytes(key);
+
+        byte[] chunk = new byte[(int) Math.min(size, CHUNK_SIZE)];
+        long offset = 0;
+        do {
+            int chunkLength = (int) Math.min(size - offset, CHUNK_SIZE);
+            int done = 0;
+            while (done < chunkLength) {
+                int read = inputStream.read(chunk, done, chunkLength - done);
+                if (read < 0) {
+                    throw new IOException("Unexpected end of inputStream after " + (offset + done) + " of " + size + " bytes {" + this + "}.");
+                }
+                done += read;
+            }
+
+            if (!putChunk(keyBytes, chunk, chunkLength, offset, size, ttlMillis)) {
+                return false;
+            }
+            offset += chunkLength;
+        } while (offset < size);
+
+        return true;
+    }
+
+    private boolean putChunk(byte[] keyBytes, byte[] chunk, int chunkLength, long offset, long size, long ttlMillis) throws IOException {
+        final long requestId = nextRequestId();
+        final ByteBuffer chunkBuffer = newRequestBuffer(Type.PUT_CHUNK, requestId, keyBytes.length, chunkLength, RANGE_PROTOCOL_VERSION);
+        chunkBuffer.put(keyBytes);
+        chunkBuffer.putInt(chunkLength);
+        chunkBuffer.put(chunk, 0, chunkLength);
+        chunkBuffer.putLong(ttlMillis);
+        chunkBuffer.putLong(offset);
+        chunkBuffer.putLong(size);
+
+        return runOperation(new Operation<Boolean>() {
+            @Override
+            public Boolean run() throws IOException {
+                return writeRequestAndReadResponseVerdict(chunkBuffer, requestId, RANGE_PROTOCOL_VERSION);
+            }
+
+            @Override
+            public Type getType() {
+                return Type.PUT_CHUNK;
+            }
+
+            @Override
+            public long getRequestId() {
+                return requestId;
+            }
+        }, keyBytes.length + chunkLength);
+    }
+
+    /**
+     * Lists at most limit keys starting with the prefix and greater than the cursor in ascending order,
+     * with their values if withValues is set (otherwise with sizes only). Start with an empty cursor and
+     * pass {@link ScanResult#getCursor()} of the previous page while {@link ScanResult#hasMore()}:
+     * a page may be shorter than the limit, even empty, while more keys follow.
+     * Zero limit means the server maximum.
+     */
+    @SuppressWarnings("unused")
+    public ScanResult scan(String prefix, String cursor, int limit, boolean withValues) throws IOException {
+        return scan(prefix, cursor, limit, withValues, false);
+    }
+
+    /**
+     * Lists keys like {@link #scan(String, String, int, boolean)}, with remaining TTLs if withTtls is set
+     * (it needs a server of protocol version 11).
+     */
+    @SuppressWarnings("unused")
+    public ScanResult scan(String prefix, String cursor, int limit, boolean withValues, boolean withTtls) throws IOException {
+        if (limit < 0) {
+            throw new IllegalArgumentException("Expected non-negative limit, but " + limit + " found {" + this + "}.");
+        }
+
+        byte[] prefixBytes = getStringBytes(applyKeyPrefix(prefix));
+        final byte[] cursorBytes = getStringBytes(cursor.isEmpty() ? "" : applyKeyPrefix(cursor));
+        final boolean values = withValues;
+        final boolean ttls = withTtls;
+        final byte version = withTtls ? SCAN_TTLS_PROTOCOL_VERSION : SCAN_PROTOCOL_VERSION;
+        final long requestId = nextRequestId();
+        final ByteBuffer scanBuffer = newRequestBuffer(Type.SCAN, requestId, getStringBytes(namespace),
+                prefixBytes.length, null, version, cursorBytes.length);
+        scanBuffer.put(prefixBytes);
+        scanBuffer.putInt(cursorBytes.length);
+        scanBuffer.put(cursorBytes);
+        scanBuffer.putInt(limit);
+        scanBuffer.put((byte) ((withValues ? SCAN_VALUES : SCAN_SIZES) | (withTtls ? SCAN_TTLS : 0)));
+
+        return runOperation(new Operation<ScanResult>() {
+            @Override
+            public ScanResult run() throws IOException {
+                outputStream.write(scanBuffer.array());
+                outputStream.flush();
+
+                readResponseLength(requestId);
+                if (!readResponseVerdict(requestId, version)) {
+                    throw new IOException("Scan returned false verdict [requestId=" + requestId + "] {" + this + "}.");
+                }
+
+                ByteBuffer data = ByteBuffer.wrap(readResponseValue(requestId)).order(ByteOrder.LITTLE_ENDIAN);
+                boolean more = data.get() == 1;
+                String nextCursor = removeKeyPrefix(getString(readBytes(data)));
+
+                int count = data.getInt();
+                List<ScanResult.Entry> entries = new ArrayList<ScanResult.Entry>(count);
+                for (int i = 0; i < count; i++) {
+                    String key = removeKeyPrefix(getString(readBytes(data)));
+                    long size;
+                    byte[] value = null;
+                    if (values) {
+                        value = readBytes(data);
+                        size = value.length;
+                    } else {
+                        size = data.getLong();
+                    }
+                    long ttlMillis = ttls ? data.getLong() : 0;
+                    entries.add(new ScanResult.Entry(key, size, value, ttlMillis));
+                }
+                return new ScanResult(entries, nextCursor, more);
+            }
+
+            @Override
+            public Type getType() {
+                return Type.SCAN;
+            }
+
+            @Override
+            public long getRequestId() {
+                return requestId;
+            }
+        }, prefixBytes.length + cursorBytes.length);
+    }
+
+    /**
+     * Returns server counters by name: requests by type, bytes in and out, connections,
+     * latencies, cache hits and misses and backend specific ones.
+     */
+    @SuppressWarnings("unused")
+    public Map<String, Long> getStats() throws IOException {
+        final long requestId = nextRequestId();
+        final ByteBuffer statsBuffer = newRequestBuffer(Type.STATS, requestId, 0, null, STATS_PROTOCOL_VERSION);
+
+        return runOperation(new Operation<Map<String, Long>>() {
+            @Override
+            public Map<String, Long> run() throws IOException {
+                outputStream.write(statsBuffer.array());
+                outputStream.flush();
+
+                readResponseLength(requestId);
+                if (!readResponseVerdict(requestId, STATS_PROTOCOL_VERSION)) {
+                    throw new IOException("Stats returned false verdict [requestId=" + requestId + "] {" + this + "}.");
+                }
+
+                ByteBuffer data = ByteBuffer.wrap(readResponseValue(requestId)).order(ByteOrder.LITTLE_ENDIAN);
+                int count = data.getInt();
+                Map<String, Long> stats = new TreeMap<String, Long>();
+                for (int i = 0; i < count; i++) {
+                    String name = getString(readBytes(data));
+                    stats.put(name, data.getLong());
+                }
+                return stats;
+            }
+
+            @Override
+            public Type getType() {
+                return Type.STATS;
+            }
+
+            @Override
+            public long getRequestId() {
+                return requestId;
+            }
+        }, 0);
+    }
+
+    /**
+     * Makes the server write a backup of its data into the new subdirectory of its --backup-dir, the server
+     * keeps serving meanwhile. Returns false if backups are disabled, the name is taken or the backend
+     * doesn't support them.
+     */
+    @SuppressWarnings("unused")
+    public boolean backup(String name) throws IOException {
+        byte[] nameBytes = getStringBytes(name);
+        final long requestId = nextRequestId();
+        final ByteBuffer backupBuffer = newRequestBuffer(Type.BACKUP, requestId, getStringBytes(""), nameBytes.length,
+                null, BACKUP_PROTOCOL_VERSION);
+        backupBuffer.put(nameBytes);
+
+        return runOperation(new Operation<Boolean>() {
+            @Override
+            public Boolean run() throws IOException {
+                return writeRequestAndReadResponseVerdict(backupBuffer, requestId, BACKUP_PROTOCOL_VERSION);
+            }
+
+            @Override
+            public Type getType() {
+                return Type.BACKUP;
+            }
+
+            @Override
+            public long getRequestId() {
+                return requestId;
+            }
+        }, nameBytes.length);
+    }
+
+    /**
+     * Returns at most limit most read keys of all namespaces by descending estimated read counts
+     * (recent reads weigh more), or an empty list if the server doesn't track them.
+     * Zero limit means the server maximum.
+     */
+    @SuppressWarnings("unused")
+    public List<HotKey> getHotKeys(int limit) throws IOException {
+        if (limit < 0) {
+            throw new IllegalArgumentException("Expected non-negative limit, but " + limit + " found {" + this + "}.");
+        }
+
+        final long requestId = nextRequestId();
+        final ByteBuffer hotKeysBuffer = newRequestBuffer(Type.HOT_KEYS, requestId, 0, null, HOT_KEYS_PROTOCOL_VERSION);
+        hotKeysBuffer.putInt(limit);
+
+        return runOperation(new Operation<List<HotKey>>() {
+            @Override
+            public List<HotKey> run() throws IOException {
+                outputStream.write(hotKeysBuffer.array());
+                outputStream.flush();
+
+                readResponseLength(requestId);
+                if (!readResponseVerdict(requestId, HOT_KEYS_PROTOCOL_VERSION)) {
+                    return Collections.emptyList();
+                }
+
+                ByteBuffer data = ByteBuffer.wrap(readResponseValue(requestId)).order(ByteOrder.LITTLE_ENDIAN);
+                int count = data.getInt();
+                List<HotKey> hotKeys = new ArrayList<HotKey>(count);
+                for (int i = 0; i < count; i++) {
+                    String hotKeyNamespace = getString(readBytes(data));
+                    String key = getString(readBytes(data));
+                    long readCount = data.getLong();
+                    hotKeys.add(new HotKey(hotKeyNamespace, key, readCount, data.getLong()));
+                }
+                return hotKeys;
+            }
+
+            @Override
+            public Type getType() {
+                return Type.HOT_KEYS;
+            }
+
+            @Override
+            public long getRequestId() {
+                return requestId;
+            }
+        }, 0);
+    }
+
+    // Registers hashes of keys cached by the near cache, returns hashes of modified keys after the sequence
+    // or null if the server doesn't track them.
+    Invalidations pollInvalidations(long subscription, long sequence, long[] cachedHashes) throws IOException {
+        final long requestId = nextRequestId();
+        final ByteBuffer invalidationsBuffer = newRequestBuffer(Type.INVALIDATIONS, requestId, getStringBytes(""), 0,
+                null, INVALIDATIONS_PROTOCOL_VERSION, 8 * cachedHashes.length);
+        invalidationsBuffer.putLong(subscription);
+        invalidationsBuffer.putLong(sequence);
+        invalidationsBuffer.putInt(8 * cachedHashes.length);
+        for (long hash : cachedHashes) {
+            invalidationsBuffer.putLong(hash);
+        }
+
+        return runOperation(new Operation<Invalidations>() {
+            @Override
+            public Invalidations run() throws IOException {
+                outputStream.write(invalidationsBuffer.array());
+                outputStream.flush();
+
+                readResponseLength(requestId);
+                if (!readResponseVerdict(requestId, INVALIDATIONS_PROTOCOL_VERSION)) {
+                    return null;
+                }
+
+                ByteBuffer data = ByteBuffer.wrap(readResponseValue(requestId)).order(ByteOrder.LITTLE_ENDIAN);
+                long newSubscription = data.getLong();
+                long newSequence = data.getLong();
+                boolean reset = data.get() == 1;
+                long[] hashes = new long[data.getInt()];
+                for (int i = 0; i < hashes.length; i++) {
+                    hashes[i] = data.getLong();
+                }
+                return new Invalidations(newSubscription, newSequence, reset, hashes);
+            }
+
+            @Override
+            public Type getType() {
+                return Type.INVALIDATIONS;
+            }
+
+            @Override
+            public long getRequestId() {
+                return requestId;
+            }
+        }, 8 * cachedHashes.length);
+    }
+
+    private static byte[] readBytes(ByteBuffer data) {
+        byte[] bytes = new byte[data.getInt()];
+        data.get(bytes);
+        return bytes;
+    }
+
+    private byte[] readResponseValue(long requestId) throws IOException {
+        ByteBuffer valueLengthBuffer = ByteBuffer.allocate(4).order(ByteOrder.LITTLE_ENDIAN);
+        readExactly(valueLengthBuffer.array(), 0, 4, requestId);
+
+        int valueLength = valueLengthBuffer.getInt();
+        if (valueLength < 0) {
+            throw new IOException("Expected positive length of value in response [requestId=" + requestId + "] {" + this + "}.");
+        }
+
+        ByteBuffer valueBuffer = ByteBuffer.allocate(valueLength).order(ByteOrder.LITTLE_ENDIAN);
+        readExactly(valueBuffer.array(), 0, valueLength, requestId);
+        return valueBuffer.array();
+    }
+
+    private long readResponseInt64(long requestId) throws IOException {
+        ByteBuffer int64Buffer = ByteBuffer.allocate(8).order(ByteOrder.LITTLE_ENDIAN);
+        readExactly(int64Buffer.array(), 0, 8, requestId);
+        return int64Buffer.getLong();
+    }
+
+    /**
+     * Drops all keys of the namespace at once, the server reclaims their space in background.
+     * The default (empty) namespace can't be dropped.
+     */
+    @SuppressWarnings("unused")
+    public boolean dropNamespace(String namespace) throws IOException {
+        if (nearCache != null) {
+            nearCache.clear();
+        }
+
+        final byte[] namespaceBytes = getStringBytes(namespace);
+        final long requestId = nextRequestId();
+        final ByteBuffer dropBuffer = newRequestBuffer(Type.DROP_NAMESPACE, requestId, namespaceBytes, 0, null, NAMESPACE_PROTOCOL_VERSION);
+
+        return runOperation(new Operation<Boolean>() {
+            @Override
+            public Boolean run() throws IOException {
+                return writeRequestAndReadResponseVerdict(dropBuffer, requestId, NAMESPACE_PROTOCOL_VERSION);
+            }
+
+            @Override
+            public Type getType() {
+                return Type.DROP_NAMESPACE;
+            }
+
+            @Override
+            public long getRequestId() {
+                return requestId;
+            }
+        }, namespaceBytes.length);
+    }
+
     public enum Type {
         PING,
         HAS,
         GET,
         PUT,
-        DELETE;
+        DELETE,
+        DROP_NAMESPACE,
+        PUT_IF_ABSENT,
+        COMPARE_AND_SET,
+        COMPARE_AND_DELETE,
+        APPEND,
+        RANGE_GET,
+        PUT_CHUNK,
+        SCAN,
+        STATS,
+        HOT_KEYS,
+        REPLICATE,
+        INVALIDATIONS,
+        BACKUP;
 
         byte getByte() {
             return (byte) (ordinal() + 1);
         }
+
+        boolean hasCas() {
+            return this == COMPARE_AND_SET || this == COMPARE_AND_DELETE;
+        }
+
+        int getParametersLength() {
+            if (hasCas()) {
+                return 8;
+            }
+            if (this == RANGE_GET) {
+                return 8 + 4;
+            }
+            if (this == SCAN) {
+                return 4 + 4 + 1;
+            }
+            if (this == HOT_KEYS) {
+                return 4;
+            }
+            if (this == REPLICATE) {
+                return 1 + 8 + 8 + 4;
+            }
+            if (this == INVALIDATIONS) {
+                return 8 + 8 + 4;
+            }
+            return this == PUT_CHUNK ? 8 + 8 : 0;
+        }
+    }
+
+    /**
+     * Value with its CAS token: the token changes with any change of the value.
+     */
+    public static final class Versioned {
+        private final byte[] value;
+        private final long cas;
+
+        Versioned(byte[] value, long cas) {
+            this.value = value;
+            this.cas = cas;
+        }
+
+        public byte[] getValue() {
+            return value;
+        }
+
+        public long getCas() {
+            return cas;
+        }
+    }
+
+    /**
+     * Page of scanned keys.
+     */
+    public static final class ScanResult {
+        private final List<Entry> entries;
+        private final String cursor;
+        private final boolean more;
+
+        ScanResult(List<Entry> entries, String cursor, boolean more) {
+            this.entries = Collections.unmodifiableList(entries);
+            this.cursor = cursor;
+            this.more = more;
+        }
+
+        public List<Entry> getEntries() {
+            return entries;
+        }
+
+        public String getCursor() {
+            return cursor;
+        }
+
+        public boolean hasMore() {
+            return more;
+        }
+
+        public static final class Entry {
+            private final String key;
+            private final long size;
+            private final byte[] value;
+            private final long ttlMillis;
+
+            Entry(String key, long size, byte[] value, long ttlMillis) {
+                this.key = key;
+                this.size = size;
+                this.value = value;
+                this.ttlMillis = ttlMillis;
+            }
+
+            public String getKey() {
+                return key;
+            }
+
+            public long getSize() {
+                return size;
+            }
+
+            /**
+             * Returns the value or null if the scan was without values.
+             */
+            public byte[] getValue() {
+                return value;
+            }
+
+            /**
+             * Returns the remaining TTL or 0 if the key doesn't expire (or the scan was without TTLs).
+             */
+            public long getTtlMillis() {
+                return ttlMillis;
+            }
+        }
+    }
+
+    /**
+     * A frequently read key: the count may exceed the real number of reads by at most the error.
+     */
+    public static final class HotKey {
+        private final String namespace;
+        private final String key;
+        private final long count;
+        private final long error;
+
+        HotKey(String namespace, String key, long count, long error) {
+            this.namespace = namespace;
+            this.key = key;
+            this.count = count;
+            this.error = error;
+        }
+
+        public String getNamespace() {
+            return namespace;
+        }
+
+        public String getKey() {
+            return key;
+        }
+
+        public long getCount() {
+            return count;
+        }
+
+        public long getError() {
+            return error;
+        }
+    }
+
+    /**
+     * Result of a poll of invalidations: the subscription and the sequence for the next poll and hashes
+     * of modified keys, or the reset if the whole near cache should be cleared.
+     */
+    static final class Invalidations {
+        private final long subscription;
+        private final long sequence;
+        private final boolean reset;
+        private final long[] hashes;
+
+        Invalidations(long subscription, long sequence, boolean reset, long[] hashes) {
+            this.subscription = subscription;
+            this.sequence = sequence;
+            this.reset = reset;
+            this.hashes = hashes;
+        }
+
+        long getSubscription() {
+            return subscription;
+        }
+
+        long getSequence() {
+            return sequence;
+        }
+
+        boolean isReset() {
+            return reset;
+        }
+
+        long[] getHashes() {
+            return hashes;
+        }
     }
 
     private interface Operation<T> {
@@ -0,0 +1,429 @@
+package com.codeforces.riorita;
+
+import org.apache.log4j.Logger;
+
+import java.io.IOException;
+import java.util.ArrayList;
+import java.util.LinkedHashSet;
+import java.util.List;
+import java.util.Set;
+import java.util.concurrent.Callable;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.ConcurrentLinkedQueue;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.ExecutorCompletionService;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.Future;
+import java.util.concurrent.ThreadFactory;
+import java.util.concurrent.TimeUnit;
+
+/**
+ * Client of several riorita servers: keys are spread over the nodes by a consistent hash ring
+ * with virtual nodes, each key is written to replicationFactor nodes.
+ *
+ * Reads go to the primary node of the key, if it doesn't answer in hedgeDelayMillis the next replica
+ * is asked too and the first answer wins; a failed replica is replaced by the next one at once.
+ * Writes go to all replicas in parallel and succeed if all of them succeed.
+ *
+ * Unlike {@link Riorita}, it is thread-safe: each node has a pool of connections.
+ */
+@SuppressWarnings("unused")
+public class RioritaCluster {
+    private static final Logger logger = Logger.getLogger(RioritaCluster.class);
+
+    private static final long DEFAULT_HEDGE_DELAY_MILLIS = 50;
+
+    private final int replicationFactor;
+    private volatile long hedgeDelayMillis = DEFAULT_HEDGE_DELAY_MILLIS;
+    private volatile String namespace = "";
+
+    private volatile ConsistentHashRing ring;
+    // The ring before the last added node while its keys are moved, null otherwise.
+    private volatile ConsistentHashRing previousRing;
+
+    private final ConcurrentHashMap<Node, ConcurrentLinkedQueue<Riorita>> connections
+            = new ConcurrentHashMap<Node, ConcurrentLinkedQueue<Riorita>>();
+    private final ExecutorService executor = Executors.newCachedThreadPool(new ThreadFactory() {
+        @Override
+        public Thread newThread(Runnable runnable) {
+            Thread thread = new Thread(runnable, "RioritaCluster");
+            thread.setDaemon(true);
+            return thread;
+        }
+    });
+
+    public RioritaCluster(List<Node> nodes, int replicationFactor) {
+        if (nodes.isEmpty()) {
+            throw new IllegalArgumentException("Expected at least one node {" + this + "}.");
+        }
+        if (replicationFactor < 1) {
+            throw new IllegalArgumentException("Expected positive replicationFactor, but " + replicationFactor + " found {" + this + "}.");
+        }
+
+        this.replicationFactor = replicationFactor;
+        ring = new ConsistentHashRing(nodes);
+    }
+
+    /**
+     * Sets the time to wait for the primary node before the next replica is asked for a read.
+     */
+    public void setHedgeDelayMillis(long hedgeDelayMillis) {
+        this.hedgeDelayMillis = hedgeDelayMillis;
+    }
+
+    /**
+     * Sets namespace of all following operations, see {@link Riorita#setNamespace(String)}.
+     */
+    public void setNamespace(String namespace) {
+        this.namespace = namespace;
+    }
+
+    public List<Node> getNodes() {
+        return ring.getNodes();
+    }
+
+    /**
+     * Returns nodes keeping the key, the first one is its primary node.
+     */
+    public List<Node> getNodes(String key) {
+        return ring.getNodes(key, replicationFactor);
+    }
+
+    public boolean has(final String key) throws IOException {
+        Boolean result = read(key, new NodeOperation<Boolean>() {
+            @Override
+            public Boolean run(Riorita riorita) throws IOException {
+                return riorita.has(key);
+            }
+        });
+        return result != null && result;
+    }
+
+    public byte[] get(final String key) throws IOException {
+        return read(key, new NodeOperation<byte[]>() {
+            @Override
+            public byte[] run(Riorita riorita) throws IOException {
+                return riorita.get(key);
+            }
+        });
+    }
+
+    public boolean put(String key, byte[] bytes) throws IOException {
+        return put(key, bytes, 0);
+    }
+
+    public boolean put(final String key, final byte[] bytes, final long ttlMillis) throws IOException {
+        return write(getNodes(key), new NodeOperation<Boolean>() {
+            @Override
+            public Boolean run(Riorita riorita) throws IOException {
+                return riorita.put(key, bytes, ttlMillis);
+            }
+        });
+    }
+
+    public boolean delete(final String key) throws IOException {
+        // While keys are moved a not yet moved copy is on the previous nodes.
+        Set<Node> nodes = new LinkedHashSet<Node>(getNodes(key));
+        ConsistentHashRing previous = previousRing;
+        if (previous != null) {
+            nodes.addAll(previous.getNodes(key, replicationFactor));
+        }
+
+        return write(new ArrayList<Node>(nodes), new NodeOperation<Boolean>() {
+            @Override
+            public Boolean run(Riorita riorita) throws IOException {
+                return riorita.delete(key);
+            }
+        });
+    }
+
+    /**
+     * Adds the node and moves to it the keys which it takes from others (of the current namespace),
+     * copies left on nodes which don't keep the key any more are deleted. Writes during the move go
+     * to the new nodes of keys, reads fall back to the previous ones, moved values never overwrite
+     * newer ones and keep their TTLs. A moved key is checked again by its CAS token, so a delete or
+     * an update during the move is not undone. Returns the number of moved keys.
+     */
+    public synchronized long addNode(Node node) throws IOException {
+        previousRing = ring;
+        ring = ring.withNode(node);
+        logger.warn("Node " + node + " is added, moving keys {" + this + "}.");
+
+        try {
+            long moved = 0;
+            for (Node source : previousRing.getNodes()) {
+                moved += moveKeys(source, node);
+            }
+            logger.warn("Moved " + moved + " keys to " + node + " {" + this + "}.");
+            return moved;
+        } finally {
+            previousRing = null;
+        }
+    }
+
+    private long moveKeys(Node source, Node target) throws IOException {
+        long moved = 0;
+        String cursor = "";
+        Riorita.ScanResult page;
+        do {
+            Riorita sourceRiorita = borrow(source);
+            try {
+                page = sourceRiorita.scan("", cursor, 0, false, true);
+            } finally {
+                release(source, sourceRiorita);
+            }
+
+            for (Riorita.ScanResult.Entry entry : page.getEntries()) {
+                if (moveKey(entry.getKey(), entry.getTtlMillis(), source, target)) {
+                    moved++;
+                }
+            }
+
+            cursor = page.getCursor();
+        } while (page.hasMore());
+        return moved;
+    }
+
+    // The value is read with its CAS token and the source is checked again after the copy: if the key was
+    // deleted or changed meanwhile, the copy is deleted (unless it was already overwritten on the target)
+    // and the current value is moved instead.
+    private boolean moveKey(String key, long ttlMillis, Node source, Node target) throws IOException {
+        List<Node> nodes = getNodes(key);
+        Riorita.Versioned versioned = getVersioned(source, key);
+        boolean moved = false;
+
+        while (versioned != null && nodes.contains(target)) {
+            long targetCas;
+            Riorita targetRiorita = borrow(target);
+            try {
+                targetCas = targetRiorita.putIfAbsent(key, versioned.getValue(), ttlMillis);
+            } finally {
+                release(target, targetRiorita);
+            }
+            if (targetCas == 0) {
+                break;
+            }
+
+            Riorita.Versioned current = getVersioned(source, key);
+            if (current != null && current.getCas() == versioned.getCas()) {
+                moved = true;
+                break;
+            }
+
+            targetRiorita = borrow(target);
+            try {
+                targetRiorita.compareAndDelete(key, targetCas);
+            } finally {
+                release(target, targetRiorita);
+            }
+            versioned = current;
+        }
+
+        if (versioned != null && !nodes.contains(source)) {
+            Riorita sourceRiorita = borrow(source);
+            try {
+                sourceRiorita.compareAndDelete(key, versioned.getCas());
+            } finally {
+                release(source, sourceRiorita);
+            }
+        }
+        return moved;
+    }
+
+    private Riorita.Versioned getVersioned(Node node, String key) throws IOException {
+        Riorita riorita = borrow(node);
+        try {
+            return riorita.getVersioned(key);
+        } finally {
+            release(node, riorita);
+        }
+    }
+
+    /**
+     * Stops background threads, the cluster can't be used after it.
+     */
+    public void close() {
+        executor.shutdownNow();
+    }
+
+    // Asks replicas one by one until the first answer, the next one is asked after the hedge delay or a failure.
+    private <T> T read(String key, NodeOperation<T> operation) throws IOException {
+        T result = read(getNodes(key), operation);
+
+        ConsistentHashRing previous = previousRing;
+        if (result == null || Boolean.FALSE.equals(result)) {
+            if (previous != null) {
+                result = read(previous.getNodes(key, replicationFactor), operation);
+            }
+        }
+        return result;
+    }
+
+    private <T> T read(List<Node> nodes, NodeOperation<T> operation) throws IOException {
+        ExecutorCompletionService<T> completionService = new ExecutorCompletionService<T>(executor);
+        List<Future<T>> futures = new ArrayList<Future<T>>(nodes.size());
+        IOException exception = null;
+
+        try {
+            futures.add(completionService.submit(newCallable(nodes.get(0), operation)));
+            int failed = 0;
+
+            while (failed < nodes.size()) {
+                Future<T> future = futures.size() < nodes.size()
+                        ? completionService.poll(hedgeDelayMillis, TimeUnit.MILLISECONDS)
+                        : completionService.take();
+
+                if (future == null) {
+                    logger.info("Hedging read to " + nodes.get(futures.size()) + " {" + this + "}.");
+                    futures.add(completionService.submit(newCallable(nodes.get(futures.size()), operation)));
+                    continue;
+                }
+
+                try {
+                    return future.get();
+                } catch (ExecutionException e) {
+                    logger.warn("Can't read from a replica.", e.getCause());
+                    exception = toIOException(e);
+                    failed++;
+                    if (futures.size() < nodes.size()) {
+                        futures.add(completionService.submit(newCallable(nodes.get(futures.size()), operation)));
+                    }
+                }
+            }
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+            throw new IOException("Interrupted {" + this + "}.", e);
+        } finally {
+            for (Future<T> future : futures) {
+                future.cancel(false);
+            }
+        }
+
+        throw exception;
+    }
+
+    private boolean write(List<Node> nodes, NodeOperation<Boolean> operation) throws IOException {
+        List<Future<Boolean>> futures = new ArrayList<Future<Boolean>>(nodes.size());
+        for (Node node : nodes) {
+            futures.add(executor.submit(newCallable(node, operation)));
+        }
+
+        boolean result = true;
+        IOException exception = null;
+        for (Future<Boolean> future : futures) {
+            try {
+                result &= future.get();
+            } catch (ExecutionException e) {
+                exception = toIOException(e);
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+                throw new IOException("Interrupted {" + this + "}.", e);
+            }
+        }
+
+        if (exception != null) {
+            throw exception;
+        }
+        return result;
+    }
+
+    private <T> Callable<T> newCallable(final Node node, final NodeOperation<T> operation) {
+        return new Callable<T>() {
+            @Override
+            public T call() throws IOException {
+                Riorita riorita = borrow(node);
+                try {
+                    return operation.run(riorita);
+                } finally {
+                    release(node, riorita);
+                }
+            }
+        };
+    }
+
+    private static IOException toIOException(ExecutionException e) {
+        return e.getCause() instanceof IOException
+                ? (IOException) e.getCause() : new IOException("Operation failed.", e.getCause());
+    }
+
+    private Riorita borrow(Node node) {
+        ConcurrentLinkedQueue<Riorita> pool = connections.get(node);
+        if (pool == null) {
+            connections.putIfAbsent(node, new ConcurrentLinkedQueue<Riorita>());
+            pool = connections.get(node);
+        }
+
+        Riorita riorita = pool.poll();
+        if (riorita == null) {
+            riorita = new Riorita(node.getHost(), node.getPort());
+        }
+        riorita.setNamespace(namespace);
+        return riorita;
+    }
+
+    private void release(Node node, Riorita riorita) {
+        connections.get(node).add(riorita);
+    }
+
+    private interface NodeOperation<T> {
+        T run(Riorita riorita) throws IOException;
+    }
+
+    /**
+     * A riorita server, a node with larger weight takes proportionally more keys.
+     */
+    public static final class Node {
+        private final String host;
+        private final int port;
+        private final int weight;
+
+        public Node(String host, int port) {
+            this(host, port, 1);
+        }
+
+        public Node(String host, int port, int weight) {
+            if (weight < 1) {
+                throw new IllegalArgumentException("Expected positive weight, but " + weight + " found.");
+            }
+
+            this.host = host;
+            this.port = port;
+            this.weight = weight;
+        }
+
+        public String getHost() {
+            return host;
+        }
+
+        public int getPort() {
+            return port;
+        }
+
+        public int getWeight() {
+            return weight;
+        }
+
+        @Override
+        public boolean equals(Object o) {
+            if (this == o) {
+                return true;
+            }
+            if (!(o instanceof Node)) {
+                return false;
+            }
+            Node node = (Node) o;
+            return port == node.port && host.equals(node.host);
+        }
+
+        @Override
+        public int hashCode() {
+            return 31 * host.hashCode() + port;
+        }
+
+        @Override
+        public String toString() {
+            return host + ":" + port;
+        }
+    }
+}
@@ -1,5 +1,8 @@
 package com.codeforces.riorita.engine;
 
+import java.util.Collection;
+import java.util.Map;
+
 /**
  * @author MikeMirzayanov (mirzayanovmr@gmail.com)
  */
@@ -8,6 +11,19 @@ public interface Engine {
     byte[] get(String section, String key);
     boolean put(String section, String key, byte[] bytes, long lifetimeMillis, boolean overwrite);
     boolean erase(String section, String key);
+
+    /**
+     * @return values of the keys which have them.
+     */
+    Map<String, byte[]> getAll(String section, Collection<String> keys);
+
+    /**
+     * Puts the values like {@link #put(String, String, byte[], long, boolean)} in turn.
+     *
+     * @return the number of values put.
+     */
+    int putAll(String section, Map<String, byte[]> values, long lifetimeMillis, boolean overwrite);
+
     void erase(String section);
     void clear();
 }
@@ -1,6 +1,7 @@
 package com.codeforces.riorita.engine;
 
 import java.util.Arrays;
+import java.util.Collection;
 import java.util.HashMap;
 import java.util.Map;
 
@@ -78,6 +79,29 @@ public class JavaEngine implements Engine {
         return sectionCache != null && sectionCache.remove(key) != null;
     }
 
+    @Override
+    public Map<String, byte[]> getAll(String section, Collection<String> keys) {
+        Map<String, byte[]> result = new HashMap<>();
+        for (String key : keys) {
+            byte[] bytes = get(section, key);
+            if (bytes != null) {
+                result.put(key, bytes);
+            }
+        }
+        return result;
+    }
+
+    @Override
+    public int putAll(String section, Map<String, byte[]> values, long lifetimeMillis, boolean overwrite) {
+        int count = 0;
+        for (Map.Entry<String, byte[]> entry : values.entrySet()) {
+            if (put(section, entry.getKey(), entry.getValue(), lifetimeMillis, overwrite)) {
+                count++;
+            }
+        }
+        return count;
+    }
+
     @Override
     public void erase(String section) {
         cache.remove(section);
@@ -3,19 +3,30 @@ package com.codeforces.riorita.engine;
 import org.xerial.snappy.Snappy;
 
 import java.io.*;
+import java.nio.ByteBuffer;
 import java.util.Arrays;
+import java.util.Collection;
+import java.util.HashMap;
+import java.util.Map;
 
 /**
  * @author MikeMirzayanov (mirzayanovmr@gmail.com)
  */
 public class RioritaEngine implements Engine {
-    private static int INSTANCE_COUNT = 0;
-    private final long id;
+    private static final int MIN_COMPRESSED_BUFFER_SIZE = 64 * 1024;
+
+    // Compressed values of the direct buffer API pass JNI in a direct buffer of the thread.
+    private static final ThreadLocal<ByteBuffer> compressedBuffers = new ThreadLocal<>();
+
+    private final File dataDir;
+
+    // Pointer to the native storage, set once by initialize(): clear() empties the storage in place.
+    // Engines share no native state, each one may be used from many threads.
+    @SuppressWarnings("unused")
+    private long handle;
 
     public RioritaEngine(File dataDir) {
-        INSTANCE_COUNT++;
-        id = 13 * (13 * RioritaEngine.class.getClassLoader().hashCode() + RioritaEngine.class.hashCode())
-                + INSTANCE_COUNT;
+        this.dataDir = dataDir;
         initialize(dataDir.getAbsolutePath(), 8);
     }
 
@@ -63,6 +74,168 @@ public class RioritaEngine implements Engine {
 
     private native boolean erase(String section, String key, long current_timestamp);
 
+    /**
+     * Crosses JNI once: the storage takes its locks once per group and reads values in file order.
+     */
+    @Override
+    public Map<String, byte[]> getAll(String section, Collection<String> keys) {
+        String[] keyArray = keys.toArray(new String[0]);
+        byte[][] values = getAll(section, keyArray, System.currentTimeMillis());
+
+        Map<String, byte[]> result = new HashMap<>();
+        for (int i = 0; i < keyArray.length; i++) {
+            if (values[i] != null) {
+                try {
+                    result.put(keyArray[i], Snappy.uncompress(values[i]));
+                } catch (IOException e) {
+                    throw new RuntimeException("Can't uncompress bytes.", e);
+                }
+            }
+        }
+        return result;
+    }
+
+    private native byte[][] getAll(String section, String[] keys, long currentTimestamp);
+
+    /**
+     * Crosses JNI once: values are written with a data file open once per group and their index records
+     * are appended in one write.
+     *
+     * @throws IllegalArgumentException if a value is null, nothing is put then.
+     */
+    @Override
+    public int putAll(String section, Map<String, byte[]> values, long lifetimeMillis, boolean overwrite) {
+        String[] keys = new String[values.size()];
+        byte[][] bytes = new byte[values.size()][];
+        int index = 0;
+        for (Map.Entry<String, byte[]> entry : values.entrySet()) {
+            if (entry.getValue() == null) {
+                throw new IllegalArgumentException("Expected non-null value of key '" + entry.getKey() + "' {" + this + "}.");
+            }
+            keys[index] = entry.getKey();
+            try {
+                bytes[index] = Snappy.compress(entry.getValue());
+            } catch (IOException e) {
+                throw new RuntimeException("Can't compress bytes.", e);
+            }
+            index++;
+        }
+
+        int count = 0;
+        for (boolean put : putAll(section, keys, bytes, System.currentTimeMillis(), lifetimeMillis, overwrite)) {
+            if (put) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    private native boolean[] putAll(String section, String[] keys, byte[][] values, long currentTimestamp,
+                                    long lifetime, boolean overwrite);
+
+    // Direct buffer API: values are compressed and uncompressed by snappy straight from and into direct buffers,
+    // so they are never copied to the heap. Sections and keys are raw bytes, UTF-8 bytes of ASCII strings
+    // address the same entries as the strings.
+
+    public boolean has(byte[] section, byte[] key) {
+        return hasDirect(section, key, System.currentTimeMillis());
+    }
+
+    private native boolean hasDirect(byte[] section, byte[] key, long currentTimestamp);
+
+    /**
+     * Uncompresses the value into the direct buffer from its position and advances the position by its length.
+     *
+     * @return the length of the value or -1 if there is no value. If the length is greater than the remaining
+     * space of the buffer, nothing is read: retry with a buffer of at least the length.
+     */
+    public int get(byte[] section, byte[] key, ByteBuffer buffer) {
+        checkDirect(buffer);
+        long currentTimestamp = System.currentTimeMillis();
+
+        // The value may grow between calls, so it is read until it fits.
+        ByteBuffer compressed = getCompressedBuffer(0);
+        int compressedLength;
+        while ((compressedLength = getDirect(section, key, currentTimestamp, compressed, 0, compressed.capacity()))
+                > compressed.capacity()) {
+            compressed = getCompressedBuffer(compressedLength);
+        }
+        if (compressedLength < 0) {
+            return -1;
+        }
+        compressed.limit(compressedLength);
+
+        try {
+            int length = Snappy.uncompressedLength(compressed);
+            if (length <= buffer.remaining()) {
+                // Snappy sets the limit of the buffer to the end of the value.
+                int limit = buffer.limit();
+                Snappy.uncompress(compressed, buffer);
+                buffer.limit(limit);
+                buffer.position(buffer.position() + length);
+            }
+            return length;
+        } catch (IOException e) {
+            throw new RuntimeException("Can't uncompress bytes.", e);
+        }
+    }
+
+    /**
+     * Copies the compressed value into the direct buffer from the position if it fits before the limit.
+     *
+     * @return the length of the compressed value or -1 if there is no value.
+     */
+    private native int getDirect(byte[] section, byte[] key, long currentTimestamp,
+                                 ByteBuffer buffer, int position, int limit);
+
+    /**
+     * Puts the remaining bytes of the direct buffer as the value and advances the position to the limit.
+     */
+    public boolean put(byte[] section, byte[] key, ByteBuffer buffer, long lifetimeMillis, boolean overwrite) {
+        checkDirect(buffer);
+        ByteBuffer compressed = getCompressedBuffer(Snappy.maxCompressedLength(buffer.remaining()));
+        int compressedLength;
+        try {
+            compressedLength = Snappy.compress(buffer, compressed);
+        } catch (IOException e) {
+            throw new RuntimeException("Can't compress bytes.", e);
+        }
+
+        boolean result = putDirect(section, key, compressed, 0, compressedLength,
+                System.currentTimeMillis(), lifetimeMillis, overwrite);
+        buffer.position(buffer.limit());
+        return result;
+    }
+
+    /**
+     * Puts the bytes of the direct buffer between the position and the limit as the compressed value.
+     */
+    private native boolean putDirect(byte[] section, byte[] key, ByteBuffer buffer, int position, int limit,
+                                     long currentTimestamp, long lifetime, boolean overwrite);
+
+    public boolean erase(byte[] section, byte[] key) {
+        return eraseDirect(section, key, System.currentTimeMillis());
+    }
+
+    private native boolean eraseDirect(byte[] section, byte[] key, long currentTimestamp);
+
+    private void checkDirect(ByteBuffer buffer) {
+        if (!buffer.isDirect()) {
+            throw new IllegalArgumentException("Expected direct buffer {" + this + "}.");
+        }
+    }
+
+    // The buffer is cleared, it is reallocated if it has less than the capacity.
+    private static ByteBuffer getCompressedBuffer(int capacity) {
+        ByteBuffer buffer = compressedBuffers.get();
+        if (buffer == null || buffer.capacity() < capacity) {
+            buffer = ByteBuffer.allocateDirect(Math.max(capacity, MIN_COMPRESSED_BUFFER_SIZE));
+            compressedBuffers.set(buffer);
+        }
+        buffer.clear();
+        return buffer;
+    }
+
     @Override
     public native void erase(String section);
 
@@ -72,6 +245,10 @@ public class RioritaEngine implements Engine {
     @SuppressWarnings("SameParameterValue")
     private static void loadLibraryFromJar(String name) throws IOException {
         InputStream in = RioritaEngine.class.getResourceAsStream("/" + name);
+        if (in == null) {
+            throw new IOException("Can't find resource /" + name + ", build it by java/riorita/native/make.sh"
+                    + " (make.bat on Windows) and put it into src/main/files.");
+        }
 
         ByteArrayOutputStream byteArrayOutputStream
                 = new ByteArrayOutputStream();
@@ -105,7 +282,7 @@ public class RioritaEngine implements Engine {
     @Override
     public String toString() {
         return "RioritaEngine{" +
-                "id=" + id +
+                "dataDir=" + dataDir +
                 '}';
     }
 
@@ -0,0 +1,76 @@
+package com.codeforces.riorita;
+
+import junit.framework.TestCase;
+
+import java.util.*;
+
+public class ConsistentHashRingTest extends TestCase {
+    private static final int KEY_COUNT = 100000;
+
+    private static List<RioritaCluster.Node> newNodes(int... weights) {
+        List<RioritaCluster.Node> nodes = new ArrayList<>();
+        for (int i = 0; i < weights.length; i++) {
+            nodes.add(new RioritaCluster.Node("10.0.0." + (i + 1), 8024, weights[i]));
+        }
+        return nodes;
+    }
+
+    private static Map<RioritaCluster.Node, Integer> countPrimaryNodes(ConsistentHashRing ring) {
+        Map<RioritaCluster.Node, Integer> counts = new HashMap<>();
+        for (int i = 0; i < KEY_COUNT; i++) {
+            RioritaCluster.Node node = ring.getNodes("key" + i, 1).get(0);
+            counts.put(node, counts.containsKey(node) ? counts.get(node) + 1 : 1);
+        }
+        return counts;
+    }
+
+    public void testReplicasAreDistinct() {
+        ConsistentHashRing ring = new ConsistentHashRing(newNodes(1, 1, 1, 1));
+        for (int i = 0; i < 1000; i++) {
+            List<RioritaCluster.Node> nodes = ring.getNodes("key" + i, 3);
+            assertEquals(3, nodes.size());
+            assertEquals(3, new HashSet<>(nodes).size());
+            assertEquals(nodes.get(0), ring.getNodes("key" + i, 1).get(0));
+        }
+
+        assertEquals(4, ring.getNodes("key", 10).size());
+    }
+
+    public void testWeights() {
+        List<RioritaCluster.Node> nodes = newNodes(1, 2, 1);
+        Map<RioritaCluster.Node, Integer> counts = countPrimaryNodes(new ConsistentHashRing(nodes));
+
+        for (int i = 0; i < nodes.size(); i++) {
+            double expected = KEY_COUNT * nodes.get(i).getWeight() / 4.0;
+            assertEquals(expected, counts.get(nodes.get(i)), expected * 0.2);
+        }
+    }
+
+    public void testAddedNodeTakesOnlyItsShare() {
+        ConsistentHashRing ring = new ConsistentHashRing(newNodes(1, 1, 1, 1));
+        RioritaCluster.Node added = new RioritaCluster.Node("10.0.0.5", 8024);
+        ConsistentHashRing newRing = ring.withNode(added);
+
+        int moved = 0;
+        for (int i = 0; i < KEY_COUNT; i++) {
+            RioritaCluster.Node before = ring.getNodes("key" + i, 1).get(0);
+            RioritaCluster.Node after = newRing.getNodes("key" + i, 1).get(0);
+            if (!before.equals(after)) {
+                assertEquals(added, after);
+                moved++;
+            }
+        }
+
+        assertEquals(KEY_COUNT / 5.0, moved, KEY_COUNT / 25.0);
+    }
+
+    public void testAddExistingNode() {
+        ConsistentHashRing ring = new ConsistentHashRing(newNodes(1, 1));
+        try {
+            ring.withNode(new RioritaCluster.Node("10.0.0.1", 8024, 3));
+            fail();
+        } catch (IllegalArgumentException ignored) {
+            // No operations.
+        }
+    }
+}
@@ -5,6 +5,8 @@ import junit.framework.TestCase;
 import java.io.File;
 import java.io.FileNotFoundException;
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.charset.StandardCharsets;
 import java.util.*;
 
 /**
@@ -158,6 +160,102 @@ public class RioritaEngineTest extends TestCase {
 //        internalTestRioritaEngine(10000, 7, 7, 200, 700, new int[] {20, 20, 20, 20, 20});
     }
 
+    public void testBatches() throws IOException {
+        File tmp = File.createTempFile("riorita", "" + System.currentTimeMillis());
+        tmp.delete();
+        tmp.mkdirs();
+
+        try {
+            Engine rio = new RioritaEngine(tmp);
+            Engine exp = new JavaEngine();
+            List<String> keys = generateRandomStrings(1000);
+
+            for (int iteration = 0; iteration < 10; iteration++) {
+                Map<String, byte[]> values = new HashMap<>();
+                for (int i = 0; i < 100; i++) {
+                    byte[] value = new byte[random.nextInt(1000)];
+                    for (int j = 0; j < value.length; j++) {
+                        value[j] = (byte) random.nextInt(10);
+                    }
+                    values.put(any(keys), value);
+                }
+                boolean overwrite = random.nextBoolean();
+                assertEquals(exp.putAll("section", values, 100000, overwrite),
+                        rio.putAll("section", values, 100000, overwrite));
+
+                List<String> requested = new ArrayList<>();
+                for (int i = 0; i < 200; i++) {
+                    requested.add(any(keys));
+                }
+                Map<String, byte[]> r1 = rio.getAll("section", requested);
+                Map<String, byte[]> r2 = exp.getAll("section", requested);
+                assertEquals(r2.keySet(), r1.keySet());
+                for (String key : r2.keySet()) {
+                    assertTrue(Arrays.equals(r2.get(key), r1.get(key)));
+                    assertTrue(Arrays.equals(r2.get(key), rio.get("section", key)));
+                }
+            }
+        } finally {
+            delete(tmp);
+        }
+    }
+
+    public void testDirectBuffers() throws IOException {
+        File tmp = File.createTempFile("riorita", "" + System.currentTimeMillis());
+        tmp.delete();
+        tmp.mkdirs();
+
+        try {
+            RioritaEngine rio = new RioritaEngine(tmp);
+            byte[] section = "section".getBytes(StandardCharsets.UTF_8);
+            byte[] key = "key".getBytes(StandardCharsets.UTF_8);
+
+            byte[] value = new byte[10000];
+            for (int i = 0; i < value.length; i++) {
+                value[i] = (byte) random.nextInt(10);
+            }
+            ByteBuffer putBuffer = ByteBuffer.allocateDirect(value.length);
+            putBuffer.put(value);
+            putBuffer.flip();
+            assertTrue(rio.put(section, key, putBuffer, 100000, true));
+            assertEquals(value.length, putBuffer.position());
+
+            assertTrue(rio.has(section, key));
+            assertTrue(rio.has("section", "key"));
+            assertTrue(Arrays.equals(value, rio.get("section", "key")));
+
+            ByteBuffer smallBuffer = ByteBuffer.allocateDirect(value.length - 1);
+            assertEquals(value.length, rio.get(section, key, smallBuffer));
+            assertEquals(0, smallBuffer.position());
+
+            ByteBuffer getBuffer = ByteBuffer.allocateDirect(value.length + 1);
+            assertEquals(value.length, rio.get(section, key, getBuffer));
+            assertEquals(value.length, getBuffer.position());
+            getBuffer.flip();
+            byte[] read = new byte[getBuffer.remaining()];
+            getBuffer.get(read);
+            assertTrue(Arrays.equals(value, read));
+
+            assertTrue(rio.put("section", "other", value, 100000, true));
+            getBuffer.clear();
+            assertEquals(value.length, rio.get(section, "other".getBytes(StandardCharsets.UTF_8), getBuffer));
+
+            assertTrue(rio.erase(section, key));
+            assertFalse(rio.has("section", "key"));
+            getBuffer.clear();
+            assertEquals(-1, rio.get(section, key, getBuffer));
+
+            try {
+                rio.get(section, key, ByteBuffer.allocate(1));
+                fail("Expected IllegalArgumentException for a heap buffer.");
+            } catch (IllegalArgumentException ignored) {
+                // No operations.
+            }
+        } finally {
+            delete(tmp);
+        }
+    }
+
     private enum Type {
         HAS,
         GET,
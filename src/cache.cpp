@@ -19,12 +19,22 @@ void Cache::renewTimestamp(const std::string& key)
 
 void Cache::removeOutdated()
 {
+    // Pinned keys are skipped at most once each, so a cache of only pinned keys is still evicted.
+    size_t skipped = 0;
     while (size > MAX_CACHE_SIZE)
     {
         logger << "Size: " << size << ", entries: " << keysByTimestamp.size()
             << " " << timestampsByKey.size() << " " << values.size() << endl; 
             
         auto timestampAndKey = keysByTimestamp.begin();
+        if (skipped < pinned.size() && pinned.count(timestampAndKey->second) > 0)
+        {
+            timestamp++;
+            renewTimestamp(string(timestampAndKey->second));
+            skipped++;
+            continue;
+        }
+
         size -= timestampAndKey->second.length();
         auto keyAndValue = values.find(timestampAndKey->second);
         size -= keyAndValue->second.length();
@@ -35,6 +45,7 @@ void Cache::removeOutdated()
         keysByTimestamp.erase(timestampAndKey);
         timestampsByKey.erase(keyAndValue->first);
         values.erase(keyAndValue);
+        evictions++;
     }
 
     logger << "Size: " << size << ", entries: " << keysByTimestamp.size()
@@ -51,9 +62,13 @@ bool Cache::has(const std::string& key)
 
     auto keyAndValue = values.find(key);
     if (keyAndValue == values.end())
+    {
+        misses++;
         return false;
+    }
     else
     {
+        hits++;
         renewTimestamp(key);
         return true;
     }
@@ -69,9 +84,13 @@ bool Cache::get(const std::string& key, std::string& value)
 
     auto keyAndValue = values.find(key);
     if (keyAndValue == values.end())
+    {
+        misses++;
         return false;
+    }
     else
     {
+        hits++;
         value = keyAndValue->second;
         renewTimestamp(key);
         return true;
@@ -119,3 +138,45 @@ void Cache::erase(const std::string& key)
         values.erase(keyAndValue);
     }
 }
+
+void Cache::erasePrefix(const std::string& prefix)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto keyAndTimestamp = timestampsByKey.lower_bound(prefix);
+    while (keyAndTimestamp != timestampsByKey.end()
+            && keyAndTimestamp->first.compare(0, prefix.length(), prefix) == 0)
+    {
+        auto keyAndValue = values.find(keyAndTimestamp->first);
+        size -= keyAndValue->first.length();
+        size -= keyAndValue->second.length();
+
+        keysByTimestamp.erase(keyAndTimestamp->second);
+        values.erase(keyAndValue);
+        keyAndTimestamp = timestampsByKey.erase(keyAndTimestamp);
+    }
+}
+
+void Cache::setPinned(const std::vector<std::string>& keys)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    pinned = std::unordered_set<std::string>(keys.begin(), keys.end());
+}
+
+bool Cache::isPinned(const std::string& key)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return pinned.count(key) > 0;
+}
+
+void Cache::collectStats(std::map<std::string, long long>& stats)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    stats["cache_hits"] = hits;
+    stats["cache_misses"] = misses;
+    stats["cache_evictions"] = evictions;
+    stats["cache_bytes"] = (long long) size;
+    stats["cache_entries"] = (long long) values.size();
+    stats["cache_pinned"] = (long long) pinned.size();
+}
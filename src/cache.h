@@ -1,6 +1,8 @@
 #include <string>
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <mutex>
 #include <iostream>
 
@@ -17,6 +19,12 @@ private:
     std::map<size_t, std::string> keysByTimestamp;
     std::map<std::string, size_t> timestampsByKey;
     std::unordered_map<std::string, std::string> values;
+    std::unordered_set<std::string> pinned;
+
+    // Counted under the lock anyway.
+    long long hits = 0;
+    long long misses = 0;
+    long long evictions = 0;
 
     void renewTimestamp(const std::string& key);
     void removeOutdated();
@@ -26,6 +34,14 @@ public:
     bool get(const std::string& key, std::string& value);
     void put(const std::string& key, const std::string& value);
     void erase(const std::string& key);
+    void erasePrefix(const std::string& prefix);
+
+    // Pinned keys are not evicted while others can be (they are moved to the most recent end instead).
+    // They are not put into the cache by pinning, only kept once there.
+    void setPinned(const std::vector<std::string>& keys);
+    bool isPinned(const std::string& key);
+
+    void collectStats(std::map<std::string, long long>& stats);
 };
 
 }
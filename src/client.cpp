@@ -0,0 +1,107 @@
+#include "client.h"
+
+#include <stdexcept>
+#include <boost/lexical_cast.hpp>
+
+using namespace riorita;
+using namespace std;
+using boost::asio::ip::tcp;
+
+const int32 MAX_RESPONSE_SIZE = 1073741824;
+
+Client::Client(const string& host, int port): socket(io_service), nextId(1)
+{
+    tcp::resolver resolver(io_service);
+    boost::asio::connect(socket, resolver.resolve(tcp::resolver::query(host, boost::lexical_cast<string>(port))));
+    socket.set_option(tcp::no_delay(true));
+}
+
+RequestId Client::send(const Request& request)
+{
+    Request copy(request);
+    copy.id = nextId++;
+
+    Bytes bytes = newRequest(copy);
+    try
+    {
+        boost::asio::write(socket, boost::asio::buffer(bytes.data, size_t(bytes.size)));
+    }
+    catch (...)
+    {
+        delete[] bytes.data;
+        throw;
+    }
+    delete[] bytes.data;
+
+    Pending sent = {copy.id, copy.version, copy.type};
+    pending.push_back(sent);
+    return copy.id;
+}
+
+void Client::receive(Response& response)
+{
+    if (pending.empty())
+        throw logic_error("No requests to receive a response to");
+
+    int32 size;
+    boost::asio::read(socket, boost::asio::buffer(&size, sizeof(size)));
+    if (size <= int32(sizeof(size)) || size > MAX_RESPONSE_SIZE)
+        throw runtime_error("Invalid response size " + boost::lexical_cast<string>(size));
+
+    buffer.resize(size_t(size) - sizeof(size));
+    boost::asio::read(socket, boost::asio::buffer(buffer));
+
+    Pending expected = pending.front();
+    pending.pop_front();
+
+    Bytes bytes(int32(buffer.size()), &buffer[0]);
+    if (!parseResponse(expected.version, expected.type, bytes, response) || response.id != expected.id)
+        throw runtime_error("Invalid response to request " + boost::lexical_cast<string>(expected.id));
+    if (!response.success)
+        throw runtime_error("Request " + boost::lexical_cast<string>(expected.id) + " failed on the server");
+}
+
+Response Client::call(RequestType type, const string& key, const string* value, long long ttlMillis)
+{
+    Bytes keyBytes(int32(key.length()), (byte*) key.data());
+    Bytes valueBytes;
+    if (value != 0)
+        valueBytes = Bytes(int32(value->length()), (byte*) value->data());
+
+    if (!pending.empty())
+        throw logic_error("Blocking calls can't follow requests without responses");
+
+    send(Request(ttlMillis > 0 ? 2 : 1, type, 0, Bytes(), keyBytes, valueBytes, ttlMillis));
+
+    Response response;
+    receive(response);
+    return response;
+}
+
+bool Client::ping()
+{
+    return call(PING, "", 0, 0).verdict;
+}
+
+bool Client::has(const string& key)
+{
+    return call(HAS, key, 0, 0).verdict;
+}
+
+bool Client::get(const string& key, string& value)
+{
+    Response response = call(GET, key, 0, 0);
+    if (response.verdict)
+        value.assign(response.data.data, response.data.data + response.data.size);
+    return response.verdict;
+}
+
+void Client::put(const string& key, const string& value, long long ttlMillis)
+{
+    call(PUT, key, &value, ttlMillis);
+}
+
+void Client::erase(const string& key)
+{
+    call(DELETE, key, 0, 0);
+}
@@ -0,0 +1,59 @@
+#ifndef RIORITA_CLIENT_H_
+#define RIORITA_CLIENT_H_
+
+#include <string>
+#include <deque>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "protocol.h"
+
+namespace riorita {
+
+// Blocking client over one connection. Requests may be pipelined: send several of them,
+// then receive responses, they come in the order of requests. Errors of the connection
+// or the protocol are thrown as exceptions, the client can't be used after them.
+class Client
+{
+public:
+    Client(const std::string& host, int port);
+
+    // Sends the request with a new id (the id of the request is ignored) and returns the id.
+    RequestId send(const Request& request);
+
+    // Receives the response to the earliest request sent, its data is valid until the next call.
+    void receive(Response& response);
+
+    size_t getPendingCount() const
+    {
+        return pending.size();
+    }
+
+    // Blocking calls, there must be no pending requests.
+    bool ping();
+    bool has(const std::string& key);
+    bool get(const std::string& key, std::string& value);
+    void put(const std::string& key, const std::string& value, long long ttlMillis = 0);
+    void erase(const std::string& key);
+
+private:
+    struct Pending
+    {
+        RequestId id;
+        byte version;
+        RequestType type;
+    };
+
+    Response call(RequestType type, const std::string& key, const std::string* value, long long ttlMillis);
+
+    boost::asio::io_service io_service;
+    boost::asio::ip::tcp::socket socket;
+    RequestId nextId;
+    std::deque<Pending> pending;
+    std::vector<byte> buffer;
+};
+
+}
+
+#endif
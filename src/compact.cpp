@@ -1,34 +1,53 @@
 #include "compact.h"
+#include "logger.h"
 
 #include <cstdio>
 #include <cstring>
 #include <cassert>
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+#include <iostream>
 #include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
-// #include <windows.h>
 
 using namespace riorita;
 using namespace std;
 
-const string INDEX_FILE = "FileSystemCompactStorage.index";
-const string DATA_FILE_PATTERN = "FileSystemCompactStorage.%04d";
-const int BLOCK_SIZE = 1024 * 1024;
-const int DATA_FILE_SIZE = 1024 * 1024 * 1024;
-const int MAX_DATA_FILE_NAME_LENGTH = 64;
-const int SIZEOF_INT = int(sizeof(int));
+const string SERVER_INDEX_FILE = "FileSystemCompactStorage.index";
+const string SERVER_DATA_FILE_PATTERN = "FileSystemCompactStorage.%04d";
+const string ENGINE_INDEX_FILE = "riorita.index";
+const string ENGINE_DATA_FILE_PATTERN = "riorita.%04d";
 
-static int getGroupByName(const string& name, int groups)
+const size_t BLOCK_SIZE = 1024 * 1024;
+const size_t DATA_FILE_SIZE = 1024 * 1024 * 1024;
+const size_t MAX_DATA_FILE_NAME_LENGTH = 64;
+const size_t INT_SIZE = sizeof(int);
+const size_t POSITION_SIZE = sizeof(Position);
+// The server format keeps positions without the expiration.
+const size_t SERVER_POSITION_SIZE = 5 * INT_SIZE;
+// Index files of framed records start with the marker, no name of unframed records has negative length.
+const int FRAMED_INDEX_MARKER = -2;
+const size_t FRAME_HEADER_SIZE = 2 * INT_SIZE;
+// Values ending in these last bytes of the last data file of each group are checked on start.
+const long long RECOVERY_CHECK_SIZE = 16 * 1024 * 1024;
+
+// The empty section gives the same groups as names of the server format.
+static int getGroupBySectionAndName(const string& section, const string& name, int groups)
 {
     int result = 0;
+    for (size_t i = 0; i < section.length(); i++)
+        result = (result * 113 + int(int(section[i]) + 255)) % 1061599;
     for (size_t i = 0; i < name.length(); i++)
         result = (result * 1009 + int(int(name[i]) + 255)) % 1062599;
     return result % groups;
 }
 
-static int fingerprint(const char* c, int size)
+static int fingerprint(const char* c, size_t size)
 {
     int result = 0;
-    for (int i = 0; i < size; i++)
+    for (size_t i = 0; i < size; i++)
         result = result * 97 + int(int(c[i]) + 255);
     return result;
 }
@@ -42,103 +61,312 @@ static string concatPath(const string& dir, const string& child)
 #endif
 }
 
-FileSystemCompactStorage::FileSystemCompactStorage(const string& dir, int groups)
-        : groups(groups), dir(dir)
+// The greatest index of data files in the directory of a group, -1 if there are none.
+static int getLastDataFileIndex(const string& groupDir, const string& dataFilePattern)
+{
+    string prefix = dataFilePattern.substr(0, dataFilePattern.find('%'));
+    int result = -1;
+
+    boost::system::error_code error;
+    if (!boost::filesystem::is_directory(groupDir, error))
+        return result;
+
+    for (boost::filesystem::directory_iterator end, i(groupDir); i != end; ++i)
+    {
+        string fileName = i->path().filename().string();
+        if (fileName.length() <= prefix.length() || fileName.compare(0, prefix.length(), prefix) != 0
+                || fileName.find_first_not_of("0123456789", prefix.length()) != string::npos)
+            continue;
+        result = max(result, atoi(fileName.c_str() + prefix.length()));
+    }
+    return result;
+}
+
+FileSystemCompactStorage::FileSystemCompactStorage(const string& dir, int groups, CompactFormat format, bool readOnly,
+        const boost::shared_ptr<Logger>& logger)
+        : groups(groups), dir(dir), format(format), readOnly(readOnly), closed(false), clears(0), logger(logger)
 {
+    assert(POSITION_SIZE == 32);
+
+    indexFile = format == COMPACT_SERVER_FORMAT ? SERVER_INDEX_FILE : ENGINE_INDEX_FILE;
+    dataFilePattern = format == COMPACT_SERVER_FORMAT ? SERVER_DATA_FILE_PATTERN : ENGINE_DATA_FILE_PATTERN;
+
+    if (!readOnly)
+        boost::filesystem::create_directory(dir);
+
     indices = vector<int>(groups, -1);
-    offsets = vector<int>(groups, DATA_FILE_SIZE);
+    offsets = vector<int>(groups, int(DATA_FILE_SIZE));
     mutexes.resize(groups);
 
     readIndexFile();
 }
 
+void Position::erase()
+{
+    this->group = this->index = this->offset = this->length = 0;
+    this->fingerprint = 1;
+    this->expiration_timestamp = 0LL;
+}
+
 static bool isErased(const Position& position)
 {
     return position.group == 0 && position.index == 0 && position.offset == 0
         && position.length == 0 && position.fingerprint == 1;
 }
 
-bool FileSystemCompactStorage::has(const string& name)
+static bool isErasedOrOutdated(const Position& position, timestamp current_timestamp)
+{
+    return isErased(position) || position.expiration_timestamp <= current_timestamp;
+}
+
+// Reads the value at the position and checks its fingerprint.
+static void readData(FILE* f, const Position& position, string& data)
+{
+    if (0 != fseek(f, position.offset, SEEK_SET))
+        throw runtime_error("Riorita: unable to seek");
+
+    vector<char> bytes(position.length + INT_SIZE);
+    if (bytes.size() != fread(bytes.data(), 1, bytes.size(), f))
+        throw runtime_error("Riorita: broken fread");
+
+    int fp;
+    memcpy(&fp, bytes.data() + position.length, INT_SIZE);
+    if (position.fingerprint != fingerprint(bytes.data(), position.length) || position.fingerprint != fp)
+        throw runtime_error("Riorita: broken fingerprint");
+
+    data.assign(bytes.data(), position.length);
+}
+
+static bool writeData(FILE* f, const string& data, int fp)
+{
+    return fwrite(data.c_str(), 1, data.length(), f) == data.length()
+        && fwrite(&fp, 1, INT_SIZE, f) == INT_SIZE;
+}
+
+bool FileSystemCompactStorage::has(const string& section, const string& name, timestamp current_timestamp)
 {
     boost::unique_lock<boost::mutex> scoped_lock(mutex);
+    return hasUnlocked(section, name, current_timestamp);
+}
+
+bool FileSystemCompactStorage::hasUnlocked(const string& section, const string& name, timestamp current_timestamp)
+{
+    if (positionBySectionAndName.count(section))
+    {
+        auto& positionByName = positionBySectionAndName[section];
+        return positionByName.count(name) && !isErasedOrOutdated(positionByName[name], current_timestamp);
+    }
+    else
+        return false;
+}
+
+void FileSystemCompactStorage::erase(const string& section)
+{
+    boost::unique_lock<boost::mutex> scoped_lock(mutex);
+
+    if (positionBySectionAndName.count(section))
+    {
+        Position position = {0, 0, 0, 0, 1, 0LL};
+        string records;
+        for (auto& p: positionBySectionAndName[section])
+            appendIndexRecord(records, section, p.first, position);
+        appendIndexRecords(records);
 
-    return positionByName.count(name)
-        && !isErased(positionByName[name]);
+        for (auto& p: positionBySectionAndName[section])
+            p.second = position;
+    }
 }
 
-void FileSystemCompactStorage::erase(const string& name)
+bool FileSystemCompactStorage::erase(const string& section, const string& name, timestamp current_timestamp)
 {
     boost::unique_lock<boost::mutex> scoped_lock(mutex);
-    
-    if (has(name))
+
+    if (positionBySectionAndName.count(section))
     {
-        Position position = {0, 0, 0, 0, 1};
-        positionByName[name] = position;
-        appendNameAndPosition(name, position);
+        auto& positionByName = positionBySectionAndName[section];
+        if (positionByName.count(name))
+        {
+            Position& position = positionByName[name];
+            if (!isErasedOrOutdated(position, current_timestamp))
+            {
+                Position erased = position;
+                erased.erase();
+                string record;
+                appendIndexRecord(record, section, name, erased);
+                appendIndexRecords(record);
+                position = erased;
+                return true;
+            }
+        }
     }
+
+    return false;
+}
+
+void FileSystemCompactStorage::erasePrefix(const string& section, const string& prefix)
+{
+    boost::unique_lock<boost::mutex> scoped_lock(mutex);
+
+    if (!positionBySectionAndName.count(section))
+        return;
+
+    // Erased names are dropped from the index in memory after their tombstones are written in one go.
+    auto& positionByName = positionBySectionAndName[section];
+    Position position = {0, 0, 0, 0, 1, 0LL};
+    string records;
+    auto first = positionByName.lower_bound(prefix);
+    auto last = first;
+    for (; last != positionByName.end() && last->first.compare(0, prefix.length(), prefix) == 0; ++last)
+        if (!isErased(last->second))
+            appendIndexRecord(records, section, last->first, position);
+
+    if (!records.empty())
+        appendIndexRecords(records);
+    positionByName.erase(first, last);
 }
 
-bool FileSystemCompactStorage::get(const string& name, string& data)
+void FileSystemCompactStorage::scan(const string& section, const string& prefix, const string& startAfter,
+        size_t limit, timestamp current_timestamp, vector<string>& names)
+{
+    boost::unique_lock<boost::mutex> scoped_lock(mutex);
+
+    if (!positionBySectionAndName.count(section))
+        return;
+
+    auto& positionByName = positionBySectionAndName[section];
+    auto i = startAfter < prefix ? positionByName.lower_bound(prefix) : positionByName.upper_bound(startAfter);
+    for (; i != positionByName.end() && names.size() < limit
+            && i->first.compare(0, prefix.length(), prefix) == 0; ++i)
+        if (!isErasedOrOutdated(i->second, current_timestamp))
+            names.push_back(i->first);
+}
+
+bool FileSystemCompactStorage::get(const string& section, const string& name, timestamp current_timestamp, string& data)
 {
     data.clear();
-    Position position = {0, 0, 0, 0, 1};
-    bool result = false;
+    Position position = {0, 0, 0, 0, 1, 0LL};
+    long long positionClears;
 
     {
         boost::unique_lock<boost::mutex> scoped_lock(mutex);
-        if (positionByName.count(name))
-            position = positionByName[name];
+        positionClears = clears;
+        if (positionBySectionAndName.count(section))
+        {
+            auto& positionByName = positionBySectionAndName[section];
+            if (positionByName.count(name))
+                position = positionByName[name];
+        }
     }
 
-    if (isErased(position))
+    if (isErasedOrOutdated(position, current_timestamp))
         return false;
 
-    char groupName[MAX_DATA_FILE_NAME_LENGTH];
-    sprintf(groupName, "%d", position.group);
-    char fileName[MAX_DATA_FILE_NAME_LENGTH];
-    sprintf(fileName, DATA_FILE_PATTERN.c_str(), position.index);
-    char* bytes = 0;
-
     {
         boost::unique_lock<boost::mutex> scoped_lock(mutexes[position.group]);
-        FILE* f = fopen(concatPath(dir, concatPath(groupName, fileName)).c_str(), "rb");
-        if (0 != f)
+        if (clears != positionClears)
+            return false;
+
+        FILE* f = fopen(getDataFilePath(position.group, position.index).c_str(), "rb");
+        if (0 == f)
+            throw runtime_error("Riorita: unable to open data file");
+
+        try
+        {
+            readData(f, position, data);
+        }
+        catch (...)
         {
-            if (0 == fseek(f, position.offset, SEEK_SET))
-            {
-                bytes = new char[position.length + SIZEOF_INT];
-                result = (position.length + SIZEOF_INT == int(fread(bytes, 1, position.length + SIZEOF_INT, f)));
-                if (!result)
-                    printf("Broken fread\n");
-            }
-            else
-                printf("Can't seek\n");
             fclose(f);
+            throw;
         }
-        else
-            printf("f == 0\n");
+        fclose(f);
     }
 
-    if (result)
+    return true;
+}
+
+void FileSystemCompactStorage::getAll(const string& section, const vector<string>& names, timestamp current_timestamp,
+        vector<string>& data, vector<bool>& found)
+{
+    data.assign(names.size(), string());
+    found.assign(names.size(), false);
+    vector<pair<Position, size_t>> positions;
+    long long positionClears;
+
     {
-        int fp;
-        memcpy(&fp, bytes + position.length, SIZEOF_INT);
-        result = (position.fingerprint == fingerprint(bytes, position.length)
-                && position.fingerprint == fp);
-        if (!result)
-            printf("Broken fps: %d %d %d\n", position.fingerprint, fingerprint(bytes, position.length), fp);
+        boost::unique_lock<boost::mutex> scoped_lock(mutex);
+        positionClears = clears;
+        if (positionBySectionAndName.count(section))
+        {
+            auto& positionByName = positionBySectionAndName[section];
+            for (size_t i = 0; i < names.size(); i++)
+            {
+                auto position = positionByName.find(names[i]);
+                if (position != positionByName.end() && !isErasedOrOutdated(position->second, current_timestamp))
+                    positions.push_back(make_pair(position->second, i));
+            }
+        }
     }
 
-    if (result)
-        data.append(bytes, position.length);
+    // Data files are append-only, so positions stay valid after the index lock is released.
+    sort(positions.begin(), positions.end(), [](const pair<Position, size_t>& a, const pair<Position, size_t>& b)
+    {
+        return make_tuple(a.first.group, a.first.index, a.first.offset)
+            < make_tuple(b.first.group, b.first.index, b.first.offset);
+    });
+
+    size_t i = 0;
+    while (i < positions.size())
+    {
+        int group = positions[i].first.group;
+        boost::unique_lock<boost::mutex> scoped_lock(mutexes[group]);
 
-    if (0 != bytes)
-        delete[] bytes; 
+        // Positions taken before clear() point to removed files, their values are not found.
+        if (clears != positionClears)
+        {
+            while (i < positions.size() && positions[i].first.group == group)
+                i++;
+            continue;
+        }
 
-    if (!result)
-        printf("!result\n");
+        while (i < positions.size() && positions[i].first.group == group)
+        {
+            int index = positions[i].first.index;
+            FILE* f = fopen(getDataFilePath(group, index).c_str(), "rb");
+            if (0 == f)
+                throw runtime_error("Riorita: unable to open data file");
 
-    return result;
+            try
+            {
+                for (; i < positions.size() && positions[i].first.group == group
+                        && positions[i].first.index == index; i++)
+                {
+                    readData(f, positions[i].first, data[positions[i].second]);
+                    found[positions[i].second] = true;
+                }
+            }
+            catch (...)
+            {
+                fclose(f);
+                throw;
+            }
+            fclose(f);
+        }
+    }
+}
+
+string FileSystemCompactStorage::getDataFilePath(int group, int index)
+{
+    return getDataFilePath(dir, group, index);
+}
+
+string FileSystemCompactStorage::getDataFilePath(const string& dir, int group, int index)
+{
+    char groupName[MAX_DATA_FILE_NAME_LENGTH];
+    sprintf(groupName, "%d", group);
+    char fileName[MAX_DATA_FILE_NAME_LENGTH];
+    sprintf(fileName, dataFilePattern.c_str(), index);
+    return concatPath(dir, concatPath(groupName, fileName));
 }
 
 void FileSystemCompactStorage::prepareDataFile(int group, int index)
@@ -148,135 +376,650 @@ void FileSystemCompactStorage::prepareDataFile(int group, int index)
     boost::filesystem::path groupDir(concatPath(dir, groupName));
     boost::filesystem::create_directory(groupDir);
 
-    char fileName[MAX_DATA_FILE_NAME_LENGTH];
-    sprintf(fileName, DATA_FILE_PATTERN.c_str(), index);
-    
-    FILE* f = fopen(concatPath(dir, concatPath(groupName, fileName)).c_str(), "wb");
-    if (0 != f)
-        fclose(f);
+    FILE* f = fopen(getDataFilePath(group, index).c_str(), "wb");
+    if (0 == f || 0 != fclose(f))
+        throw runtime_error("Riorita: unable to create data file");
 }
 
+// A value written in part is left in the file, so the next value of the group goes to a new file.
 void FileSystemCompactStorage::put(int group, int index, const string& data, int fp)
 {
-    char groupName[MAX_DATA_FILE_NAME_LENGTH];
-    sprintf(groupName, "%d", group);
-    char fileName[MAX_DATA_FILE_NAME_LENGTH];
-    sprintf(fileName, DATA_FILE_PATTERN.c_str(), index);
-    
-    FILE* f = fopen(concatPath(dir, concatPath(groupName, fileName)).c_str(), "ab");
-    if (0 != f)
+    FILE* f = fopen(getDataFilePath(group, index).c_str(), "ab");
+    if (0 == f)
+        throw runtime_error("Riorita: unable to open file to put");
+
+    bool written = writeData(f, data, fp);
+    written = fclose(f) == 0 && written;
+    if (!written)
     {
-        fwrite(data.c_str(), 1, data.length(), f);
-        fwrite(&fp, 1, SIZEOF_INT, f);
-        fclose(f);
+        offsets[group] = int(DATA_FILE_SIZE);
+        throw runtime_error("Riorita: unable to write data file");
     }
 }
 
-void FileSystemCompactStorage::put(const string& name, const string& data)
+void FileSystemCompactStorage::log(const string& message)
 {
-    int group = getGroupByName(name, groups);
+    if (logger)
+        *logger << message << endl;
+    else
+        std::cerr << "Riorita: " << message << std::endl;
+}
+
+bool FileSystemCompactStorage::put(const string& section, const string& name, const string& data,
+        timestamp current_timestamp, timestamp lifetime, bool overwrite)
+{
+    if (closed || readOnly)
+        return false;
+
+    int group = getGroupBySectionAndName(section, name, groups);
 
     {
         boost::unique_lock<boost::mutex> scoped_lock(mutexes[group]);
-        
-        if (offsets[group] + int(data.length() + SIZEOF_INT) >= DATA_FILE_SIZE)
+
+        if (!overwrite && has(section, name, current_timestamp))
+            return false;
+
+        if (offsets[group] + data.length() + INT_SIZE >= DATA_FILE_SIZE)
         {
             indices[group]++;
             offsets[group] = 0;
             prepareDataFile(group, indices[group]);
         }
 
-        int fp = fingerprint(data.c_str(), int(data.length()));
-        Position position = {group, indices[group], offsets[group], int(data.length()), fp};
+        int fp = fingerprint(data.c_str(), data.length());
+        timestamp expiration = lifetime >= NO_EXPIRATION - current_timestamp ? NO_EXPIRATION : current_timestamp + lifetime;
+        Position position = {group, indices[group], offsets[group], int(data.length()), fp, expiration};
         put(group, indices[group], data, fp);
-        
+        offsets[group] += int(data.length() + INT_SIZE);
+
         {
             boost::unique_lock<boost::mutex> scoped_lock(mutex);
-            positionByName[name] = position;
-            appendNameAndPosition(name, position);
+            string record;
+            appendIndexRecord(record, section, name, position);
+            appendIndexRecords(record);
+            positionBySectionAndName[section][name] = position;
         }
-        
-        offsets[group] += int(data.length()) + SIZEOF_INT;
     }
+
+    return true;
 }
 
-void FileSystemCompactStorage::appendNameAndPosition(const string& name, const Position& position)
+void FileSystemCompactStorage::putAll(const string& section, const vector<string>& names, const vector<string>& data,
+        timestamp current_timestamp, timestamp lifetime, bool overwrite, vector<bool>& put)
 {
-    string indexFile = concatPath(dir, INDEX_FILE);
-    FILE* indexFilePtr = fopen(indexFile.c_str(), "a+b");
-    if (0 != indexFilePtr)
+    put.assign(names.size(), false);
+    if (closed || readOnly)
+        return;
+
+    vector<vector<size_t>> entriesByGroup(groups);
+    for (size_t i = 0; i < names.size(); i++)
+        entriesByGroup[getGroupBySectionAndName(section, names[i], groups)].push_back(i);
+
+    // Groups are locked in ascending order and single operations lock at most one, so there are no deadlocks.
+    // Holding them until the index is updated keeps the order of data and index records of a name.
+    vector<boost::unique_lock<boost::mutex>> groupLocks;
+    for (int group = 0; group < groups; group++)
+        if (!entriesByGroup[group].empty())
+            groupLocks.push_back(boost::unique_lock<boost::mutex>(mutexes[group]));
+
+    if (overwrite)
+        put.assign(names.size(), true);
+    else
+    {
+        boost::unique_lock<boost::mutex> scoped_lock(mutex);
+        map<string, bool> seen;
+        for (size_t i = 0; i < names.size(); i++)
+            if (!seen.count(names[i]))
+            {
+                seen[names[i]] = true;
+                put[i] = !hasUnlocked(section, names[i], current_timestamp);
+            }
+    }
+
+    timestamp expiration = lifetime >= NO_EXPIRATION - current_timestamp ? NO_EXPIRATION : current_timestamp + lifetime;
+    vector<Position> positions(names.size());
+    for (int group = 0; group < groups; group++)
+    {
+        FILE* f = 0;
+        for (size_t i: entriesByGroup[group])
+        {
+            if (!put[i])
+                continue;
+
+            bool full = offsets[group] + data[i].length() + INT_SIZE >= DATA_FILE_SIZE;
+            if (0 == f || full)
+            {
+                if (0 != f)
+                {
+                    bool written = fclose(f) == 0;
+                    f = 0;
+                    if (!written)
+                    {
+                        offsets[group] = int(DATA_FILE_SIZE);
+                        throw runtime_error("Riorita: unable to write data file");
+                    }
+                }
+                if (full)
+                {
+                    indices[group]++;
+                    offsets[group] = 0;
+                    prepareDataFile(group, indices[group]);
+                }
+                f = fopen(getDataFilePath(group, indices[group]).c_str(), "ab");
+                if (0 == f)
+                    throw runtime_error("Riorita: unable to open file to put");
+            }
+
+            int fp = fingerprint(data[i].c_str(), data[i].length());
+            Position position = {group, indices[group], offsets[group], int(data[i].length()), fp, expiration};
+            if (!writeData(f, data[i], fp))
+            {
+                fclose(f);
+                offsets[group] = int(DATA_FILE_SIZE);
+                throw runtime_error("Riorita: unable to write data file");
+            }
+            positions[i] = position;
+            offsets[group] += int(data[i].length() + INT_SIZE);
+        }
+        if (0 != f && 0 != fclose(f))
+        {
+            offsets[group] = int(DATA_FILE_SIZE);
+            throw runtime_error("Riorita: unable to write data file");
+        }
+    }
+
+    {
+        boost::unique_lock<boost::mutex> scoped_lock(mutex);
+        string records;
+        for (size_t i = 0; i < names.size(); i++)
+            if (put[i])
+                appendIndexRecord(records, section, names[i], positions[i]);
+        appendIndexRecords(records);
+
+        for (size_t i = 0; i < names.size(); i++)
+            if (put[i])
+                positionBySectionAndName[section][names[i]] = positions[i];
+    }
+}
+
+// A record is framed as <length:4><checksum:4><record>, the checksum is the fingerprint of the record.
+void FileSystemCompactStorage::appendIndexRecord(string& records, const string& section, const string& name,
+        const Position& position)
+{
+    size_t start = records.length();
+    records.append(FRAME_HEADER_SIZE, '\0');
+
+    int length;
+    if (format == COMPACT_ENGINE_FORMAT)
+    {
+        length = int(section.length());
+        records.append((const char*) &length, INT_SIZE);
+        records.append(section);
+    }
+    else
+        assert(section.empty());
+
+    length = int(name.length());
+    records.append((const char*) &length, INT_SIZE);
+    records.append(name);
+
+    records.append((const char*) &position, format == COMPACT_ENGINE_FORMAT ? POSITION_SIZE : SERVER_POSITION_SIZE);
+
+    length = int(records.length() - start - FRAME_HEADER_SIZE);
+    int checksum = fingerprint(records.data() + start + FRAME_HEADER_SIZE, size_t(length));
+    memcpy(&records[start], &length, INT_SIZE);
+    memcpy(&records[start + INT_SIZE], &checksum, INT_SIZE);
+}
+
+void FileSystemCompactStorage::appendIndexRecords(const string& records)
+{
+    if (readOnly)
+        throw runtime_error("Riorita: storage is read-only");
+    // The index is removed by close(), records after it would make an index without the marker.
+    if (closed)
+        return;
+
+    // A torn record would hide the records appended after it on start, so the index is cut back on errors.
+    string indexFilePath = concatPath(dir, indexFile);
+    boost::system::error_code error;
+    uintmax_t size = boost::filesystem::file_size(indexFilePath, error);
+    if (error)
+        size = 0;
+
+    FILE* indexFilePtr = fopen(indexFilePath.c_str(), "a+b");
+    if (0 == indexFilePtr)
+        throw runtime_error("Riorita: unable to open index file");
+
+    bool written = fwrite(records.c_str(), 1, records.length(), indexFilePtr) == records.length();
+    written = fclose(indexFilePtr) == 0 && written;
+    if (!written)
     {
-        int length = int(name.length());
-        int size = SIZEOF_INT + length + int(sizeof(Position));
-        char* data = new char[size];
-        memcpy(data, &length, SIZEOF_INT);
-        memcpy(data + SIZEOF_INT, name.c_str(), name.length());
-        memcpy(data + SIZEOF_INT + length, &position, sizeof(Position));
-        fwrite(data, 1, size, indexFilePtr);
-        delete[] data;
+        boost::filesystem::resize_file(indexFilePath, size, error);
+        throw runtime_error("Riorita: unable to write index file");
     }
-    fclose(indexFilePtr);
 }
 
+static bool readString(const char* record, size_t size, size_t& pos, string& s)
+{
+    int length;
+    if (size - pos < INT_SIZE)
+        return false;
+    memcpy(&length, record + pos, INT_SIZE);
+    pos += INT_SIZE;
+
+    if (length < 0 || size_t(length) > size - pos)
+        return false;
+    s.assign(record + pos, size_t(length));
+    pos += size_t(length);
+    return true;
+}
+
+// Parses an unframed record of at most size bytes, returns its length or 0 if it is broken.
+size_t FileSystemCompactStorage::parseIndexRecord(const char* record, size_t size,
+        string& section, string& name, Position& position)
+{
+    size_t pos = 0;
+    section.clear();
+    if (format == COMPACT_ENGINE_FORMAT && !readString(record, size, pos, section))
+        return 0;
+    if (!readString(record, size, pos, name))
+        return 0;
+
+    size_t positionSize = format == COMPACT_ENGINE_FORMAT ? POSITION_SIZE : SERVER_POSITION_SIZE;
+    if (size - pos < positionSize)
+        return 0;
+    position.expiration_timestamp = NO_EXPIRATION;
+    memcpy(&position, record + pos, positionSize);
+    pos += positionSize;
+
+    bool valid = position.group >= 0 && position.group < groups && position.index >= 0
+        && position.offset >= 0 && position.length >= 0
+        && (long long) position.offset + position.length + INT_SIZE <= 0x7FFFFFFFLL;
+    return valid || isErased(position) ? pos : 0;
+}
+
+// Reads records up to the first broken one: a record torn by a crash is the last one written.
+// Unframed index files of previous versions are read too, they are rewritten framed.
 void FileSystemCompactStorage::readIndexFile()
 {
     boost::unique_lock<boost::mutex> scoped_lock(mutex);
 
-    string indexFile = concatPath(dir, INDEX_FILE);
-    FILE* indexFilePtr = fopen(indexFile.c_str(), "rb");
-    
-    bool hasError = false;
-    bool hasEof = false;
+    string indexFilePath = concatPath(dir, indexFile);
+    FILE* indexFilePtr = fopen(indexFilePath.c_str(), "rb");
     string indexData;
-    
+
     if (0 != indexFilePtr)
     {
-        char block[BLOCK_SIZE];
-        
+        vector<char> block(BLOCK_SIZE);
+        bool hasError = false;
+
         while (true)
         {
-            int read = int(fread(block, 1, BLOCK_SIZE, indexFilePtr));
-            
+            size_t read = fread(block.data(), 1, BLOCK_SIZE, indexFilePtr);
+
             if (read > 0)
-                indexData.append(block, read);
-            
+                indexData.append(block.data(), read);
+
             if (read != BLOCK_SIZE)
             {
-                hasError = ferror(indexFilePtr);
-                hasEof = feof(indexFilePtr);
-                
+                hasError = ferror(indexFilePtr) != 0;
                 break;
             }
         }
-        
-        assert(sizeof(Position) == 20);
 
-        int pos = 0;
-        while (pos < int(indexData.length()) && !hasError && hasEof)
+        fclose(indexFilePtr);
+
+        // The index is rewritten below, a partially read one must not replace it.
+        if (hasError)
+            throw runtime_error("Riorita: unable to read index file");
+    }
+
+    int marker = 0;
+    if (indexData.length() >= INT_SIZE)
+        memcpy(&marker, indexData.c_str(), INT_SIZE);
+    bool framed = marker == FRAMED_INDEX_MARKER;
+
+    size_t pos = framed ? INT_SIZE : 0;
+    string section;
+    string name;
+    Position position;
+    while (pos < indexData.length())
+    {
+        const char* record = indexData.c_str() + pos;
+        size_t size = indexData.length() - pos;
+
+        if (framed)
+        {
+            int length;
+            int checksum;
+            if (size < FRAME_HEADER_SIZE)
+                break;
+            memcpy(&length, record, INT_SIZE);
+            memcpy(&checksum, record + INT_SIZE, INT_SIZE);
+            if (length <= 0 || size_t(length) > size - FRAME_HEADER_SIZE
+                    || checksum != fingerprint(record + FRAME_HEADER_SIZE, size_t(length))
+                    || size_t(length) != parseIndexRecord(record + FRAME_HEADER_SIZE, size_t(length), section, name, position))
+                break;
+            size = FRAME_HEADER_SIZE + size_t(length);
+        }
+        else
+        {
+            size = parseIndexRecord(record, size, section, name, position);
+            if (size == 0)
+                break;
+        }
+        pos += size;
+
+        positionBySectionAndName[section][name] = position;
+        if (!isErased(position))
+            indices[position.group] = max(indices[position.group], position.index);
+    }
+
+    bool recovered = pos < indexData.length();
+    if (recovered)
+        log(string(readOnly ? "Ignored" : "Dropped") + " broken tail of "
+                + boost::lexical_cast<string>(indexData.length() - pos) + " bytes of " + indexFilePath);
+
+    // A running server may be appending to the index and data files, they are left to it.
+    if (readOnly)
+        return;
+
+    recovered = recoverDataFiles() || recovered;
+
+    if (!framed || recovered)
+    {
+        string records;
+        for (auto i = positionBySectionAndName.begin(); i != positionBySectionAndName.end(); ++i)
+            for (auto j = i->second.begin(); j != i->second.end(); ++j)
+                if (!isErased(j->second))
+                    appendIndexRecord(records, i->first, j->first, j->second);
+        writeIndexFile(indexFilePath, records);
+    }
+}
+
+// On a crash index records may outlive values in the last data files, such values are dropped.
+// Data files are never cut or reused, as backups may hard-link them: the last file of a group is the one
+// with the greatest index on disk (its values may be all overwritten), and a file with bytes after
+// its last live value is sealed, so the next value goes to a new file.
+bool FileSystemCompactStorage::recoverDataFiles()
+{
+    for (int group = 0; group < groups; group++)
+    {
+        char groupName[MAX_DATA_FILE_NAME_LENGTH];
+        sprintf(groupName, "%d", group);
+        indices[group] = max(indices[group], getLastDataFileIndex(concatPath(dir, groupName), dataFilePattern));
+    }
+
+    vector<vector<Position*>> lastFilePositions(groups);
+    for (auto i = positionBySectionAndName.begin(); i != positionBySectionAndName.end(); ++i)
+        for (auto j = i->second.begin(); j != i->second.end(); ++j)
+            if (!isErased(j->second) && j->second.index == indices[j->second.group])
+                lastFilePositions[j->second.group].push_back(&j->second);
+
+    bool recovered = false;
+    for (int group = 0; group < groups; group++)
+    {
+        if (indices[group] < 0)
+            continue;
+
+        string path = getDataFilePath(group, indices[group]);
+        boost::system::error_code error;
+        long long size = (long long) boost::filesystem::file_size(path, error);
+        if (error)
+            size = 0;
+
+        FILE* f = size > 0 ? fopen(path.c_str(), "rb") : 0;
+        int dropped = 0;
+        offsets[group] = 0;
+        for (size_t i = 0; i < lastFilePositions[group].size(); i++)
         {
-            int nameLength;
-            memcpy(&nameLength, indexData.c_str() + pos, SIZEOF_INT);
-            pos += SIZEOF_INT;
-            string name(indexData.c_str() + pos, nameLength);
-            pos += nameLength;
-            Position position;
-            memcpy(&position, indexData.c_str() + pos, sizeof(Position));
-            assert(position.group >= 0);
-            assert(position.group < groups);
-            pos += sizeof(Position);
-
-            positionByName[name] = position;
-
-            if (position.index > indices[position.group])
+            Position& position = *lastFilePositions[group][i];
+            long long end = (long long) position.offset + position.length + INT_SIZE;
+            bool valid = end <= size;
+            if (valid && end + RECOVERY_CHECK_SIZE > size)
             {
-                indices[position.group] = position.index;
-                offsets[position.group] = position.offset + position.length + SIZEOF_INT;
+                try
+                {
+                    string data;
+                    if (0 == f)
+                        throw runtime_error("Riorita: unable to open data file");
+                    readData(f, position, data);
+                }
+                catch (runtime_error&)
+                {
+                    valid = false;
+                }
             }
 
-            if (position.index == indices[position.group])
-                offsets[position.group] = max(offsets[position.group], position.offset + position.length + SIZEOF_INT);
+            if (valid)
+                offsets[group] = max(offsets[group], int(end));
+            else
+            {
+                position.erase();
+                dropped++;
+            }
         }
+        if (0 != f)
+            fclose(f);
 
-        fclose(indexFilePtr);
+        if (size > offsets[group])
+            offsets[group] = int(DATA_FILE_SIZE);
+
+        if (dropped > 0)
+        {
+            log("Dropped " + boost::lexical_cast<string>(dropped) + " broken values of " + path);
+            recovered = true;
+        }
+    }
+
+    return recovered;
+}
+
+void FileSystemCompactStorage::writeIndexFile(const string& path, const string& records)
+{
+    string tempPath = path + ".tmp";
+    FILE* f = fopen(tempPath.c_str(), "wb");
+    bool written = 0 != f
+        && fwrite(&FRAMED_INDEX_MARKER, 1, INT_SIZE, f) == INT_SIZE
+        && fwrite(records.c_str(), 1, records.length(), f) == records.length();
+    if (0 != f)
+        written = fclose(f) == 0 && written;
+
+    boost::system::error_code error;
+    if (written)
+        boost::filesystem::rename(tempPath, path, error);
+    if (!written || error)
+    {
+        boost::filesystem::remove(tempPath, error);
+        throw runtime_error("Riorita: unable to write index file");
     }
-}   
+}
+
+boost::shared_ptr<CompactSnapshot> FileSystemCompactStorage::snapshot()
+{
+    boost::shared_ptr<CompactSnapshot> result(new CompactSnapshot(*this));
+
+    // With all groups locked (in ascending order, like putAll) data files are as long as offsets say.
+    vector<boost::unique_lock<boost::mutex>> groupLocks;
+    for (int group = 0; group < groups; group++)
+        groupLocks.push_back(boost::unique_lock<boost::mutex>(mutexes[group]));
+    boost::unique_lock<boost::mutex> scoped_lock(mutex);
+
+    result->indices = indices;
+    result->offsets = offsets;
+    for (auto i = positionBySectionAndName.begin(); i != positionBySectionAndName.end(); ++i)
+        for (auto j = i->second.begin(); j != i->second.end(); ++j)
+            if (!isErased(j->second))
+            {
+                CompactSnapshot::Entry entry = {i->first, j->first, j->second};
+                result->entries.push_back(entry);
+            }
+
+    return result;
+}
+
+void FileSystemCompactStorage::clear()
+{
+    if (readOnly)
+        throw runtime_error("Riorita: storage is read-only");
+
+    // With all groups locked no value is being read or written.
+    vector<boost::unique_lock<boost::mutex>> groupLocks;
+    for (int group = 0; group < groups; group++)
+        groupLocks.push_back(boost::unique_lock<boost::mutex>(mutexes[group]));
+    boost::unique_lock<boost::mutex> scoped_lock(mutex);
+
+    if (closed)
+        return;
+
+    // The empty index goes first: after a crash the rest of data files has no values.
+    string indexFilePath = concatPath(dir, indexFile);
+    writeIndexFile(indexFilePath, "");
+    positionBySectionAndName.clear();
+    offsets.assign(groups, int(DATA_FILE_SIZE));
+    clears++;
+
+    for (boost::filesystem::directory_iterator end, i(dir); i != end; ++i)
+        if (i->path().filename().string() != indexFile)
+            boost::filesystem::remove_all(i->path());
+}
+
+void FileSystemCompactStorage::close()
+{
+    boost::unique_lock<boost::mutex> scoped_lock(mutex);
+
+    if (readOnly)
+        throw runtime_error("Riorita: storage is read-only");
+    if (!this->closed)
+    {
+        this->closed = true;
+        for (boost::filesystem::directory_iterator end, i(dir); i != end; ++i)
+            boost::filesystem::remove_all(i->path());
+    }
+}
+
+const string FileSystemCompactStorage::getDir()
+{
+    return this->dir;
+}
+
+int FileSystemCompactStorage::getGroups()
+{
+    return this->groups;
+}
+
+CompactFormat FileSystemCompactStorage::getFormat()
+{
+    return this->format;
+}
+
+// ==============================================================================
+
+CompactSnapshot::CompactSnapshot(FileSystemCompactStorage& storage)
+        : storage(storage), nextEntry(0), file(0), fileGroup(-1), fileIndex(-1)
+{
+    // No operations.
+}
+
+CompactSnapshot::~CompactSnapshot()
+{
+    if (0 != file)
+        fclose(file);
+}
+
+size_t CompactSnapshot::size() const
+{
+    return entries.size();
+}
+
+bool CompactSnapshot::next(string& section, string& name, string& data)
+{
+    if (nextEntry == 0)
+        sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+        {
+            return make_tuple(a.position.group, a.position.index, a.position.offset)
+                < make_tuple(b.position.group, b.position.index, b.position.offset);
+        });
+
+    if (nextEntry >= entries.size())
+        return false;
+
+    const Entry& entry = entries[nextEntry++];
+    if (0 == file || fileGroup != entry.position.group || fileIndex != entry.position.index)
+    {
+        if (0 != file)
+            fclose(file);
+        fileGroup = entry.position.group;
+        fileIndex = entry.position.index;
+        file = fopen(storage.getDataFilePath(fileGroup, fileIndex).c_str(), "rb");
+        if (0 == file)
+            throw runtime_error("Riorita: unable to open data file");
+    }
+
+    section = entry.section;
+    name = entry.name;
+    readData(file, entry.position, data);
+    return true;
+}
+
+static void copyFilePrefix(const string& from, const string& to, size_t length)
+{
+    FILE* in = fopen(from.c_str(), "rb");
+    if (0 == in)
+        throw runtime_error("Riorita: unable to open data file");
+    FILE* out = fopen(to.c_str(), "wb");
+    if (0 == out)
+    {
+        fclose(in);
+        throw runtime_error("Riorita: unable to create backup file");
+    }
+
+    vector<char> block(BLOCK_SIZE);
+    bool copied = true;
+    while (length > 0 && copied)
+    {
+        size_t read = fread(block.data(), 1, min(length, BLOCK_SIZE), in);
+        copied = read > 0 && fwrite(block.data(), 1, read, out) == read;
+        length -= read;
+    }
+    copied = fclose(out) == 0 && copied;
+    fclose(in);
+
+    if (!copied)
+        throw runtime_error("Riorita: unable to copy data file");
+}
+
+void CompactSnapshot::save(const string& directory)
+{
+    boost::filesystem::create_directories(directory);
+
+    for (int group = 0; group < int(indices.size()); group++)
+    {
+        if (indices[group] < 0)
+            continue;
+
+        char groupName[MAX_DATA_FILE_NAME_LENGTH];
+        sprintf(groupName, "%d", group);
+        boost::filesystem::create_directories(concatPath(directory, groupName));
+
+        for (int index = 0; index <= indices[group]; index++)
+        {
+            string from = storage.getDataFilePath(group, index);
+            string to = storage.getDataFilePath(directory, group, index);
+            if (index < indices[group] || offsets[group] >= int(DATA_FILE_SIZE))
+            {
+                boost::system::error_code error;
+                boost::filesystem::create_hard_link(from, to, error);
+                if (error)
+                    boost::filesystem::copy_file(from, to);
+            }
+            else
+                copyFilePrefix(from, to, size_t(offsets[group]));
+        }
+    }
+
+    string records;
+    for (size_t i = 0; i < entries.size(); i++)
+        storage.appendIndexRecord(records, entries[i].section, entries[i].name, entries[i].position);
+    storage.writeIndexFile(concatPath(directory, storage.indexFile), records);
+}
@@ -3,47 +3,174 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include <cstdlib>
+#include <cstdio>
 
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace riorita {
 
+class Logger;
+
+typedef long long timestamp;
+
+// Never expires.
+const timestamp NO_EXPIRATION = 0x7FFFFFFFFFFFFFFFLL;
+
+// Groups of the storage of the server.
+const int COMPACT_SERVER_GROUPS = 8;
+
 struct Position
-{   
+{
     int group;
     int index;
     int offset;
     int length;
     int fingerprint;
+    timestamp expiration_timestamp;
+
+    void erase();
+};
+
+// Files of the storage, both are kept readable. The server format has no sections and expirations:
+// its index records are <name-length:4><name><position:20>, it is used with the empty section only.
+// The engine format of the JNI library has <section-length:4><section><name-length:4><name><position:32>.
+enum CompactFormat
+{
+    COMPACT_SERVER_FORMAT,
+    COMPACT_ENGINE_FORMAT
+};
+
+class FileSystemCompactStorage;
+
+// Point-in-time view of a storage: positions of live values and lengths of data files when it was taken.
+// Data files are only appended, so the view stays valid while the storage is written.
+class CompactSnapshot
+{
+public:
+    ~CompactSnapshot();
+
+    // Reads values one by one in the order of data files and checks them, returns false after the last one.
+    bool next(std::string& section, std::string& name, std::string& data);
+
+    // Number of values.
+    size_t size() const;
+
+    // Writes a data directory of the storage as of the snapshot into the directory: sealed data files
+    // are hard-linked (copied if it fails, e.g. on another file system), written parts of the open ones
+    // are copied, the index is written last and has live values only. The storage never cuts, rewrites
+    // or reuses a data file, so linked files stay intact.
+    void save(const std::string& directory);
+
+private:
+    friend class FileSystemCompactStorage;
+
+    struct Entry
+    {
+        std::string section;
+        std::string name;
+        Position position;
+    };
+
+    explicit CompactSnapshot(FileSystemCompactStorage& storage);
+    CompactSnapshot(const CompactSnapshot&);
+    CompactSnapshot& operator = (const CompactSnapshot&);
+
+    FileSystemCompactStorage& storage;
+    std::vector<Entry> entries;
+    // The last data file of each group and its length, -1 if the group has no files.
+    std::vector<int> indices;
+    std::vector<int> offsets;
+
+    size_t nextEntry;
+    FILE* file;
+    int fileGroup;
+    int fileIndex;
 };
 
+// Values are appended to data files of groups, their positions are kept in memory and appended to the index
+// file, which is read on start. Index records are framed with checksums: on start the index is cut before
+// a torn record and values the last data files lost are dropped. I/O errors and broken data throw runtime_error,
+// a failed write throws before the positions in memory are changed.
+// A read-only storage changes no files: it skips the recovery (broken values are found when they are read),
+// so it may be opened on the data directory of a running server or on a hard-linked backup. It rejects
+// puts and throws on erases and close().
+// Recoveries are written to the logger (stderr if it is null).
 class FileSystemCompactStorage
 {
 public:
-    FileSystemCompactStorage(const std::string& dir, int groups);
-    bool get(const std::string& name, std::string& data);
-    bool has(const std::string& name);
-    void put(const std::string& name, const std::string& data);
-    void erase(const std::string& name);
+    FileSystemCompactStorage(const std::string& dir, int groups, CompactFormat format, bool readOnly = false,
+        const boost::shared_ptr<Logger>& logger = boost::shared_ptr<Logger>());
+    bool get(const std::string& section, const std::string& name, timestamp current_timestamp, std::string& data);
+    bool has(const std::string& section, const std::string& name, timestamp current_timestamp);
+    bool put(const std::string& section, const std::string& name, const std::string& data,
+        timestamp current_timestamp, timestamp lifetime, bool overwrite);
+    bool erase(const std::string& section, const std::string& name, timestamp current_timestamp);
+    void erase(const std::string& section);
+    void erasePrefix(const std::string& section, const std::string& prefix);
+
+    // Lists at most limit names starting with the prefix and greater than startAfter in ascending order.
+    void scan(const std::string& section, const std::string& prefix, const std::string& startAfter, size_t limit,
+        timestamp current_timestamp, std::vector<std::string>& names);
+
+    // Batch versions: locks are taken once per group, values are read in file order, index records are
+    // appended in one write. found[i] and put[i] tell the result for names[i].
+    void getAll(const std::string& section, const std::vector<std::string>& names, timestamp current_timestamp,
+        std::vector<std::string>& data, std::vector<bool>& found);
+    void putAll(const std::string& section, const std::vector<std::string>& names, const std::vector<std::string>& data,
+        timestamp current_timestamp, timestamp lifetime, bool overwrite, std::vector<bool>& put);
+
+    // Takes a snapshot, writers wait only while positions are copied.
+    boost::shared_ptr<CompactSnapshot> snapshot();
+
+    // Removes all values and their files, the storage stays usable. A read racing with it finds no value.
+    void clear();
+
+    // Removes all files, the storage rejects puts after it.
+    void close();
+    const std::string getDir();
+    int getGroups();
+    CompactFormat getFormat();
 
 private:
+    friend class CompactSnapshot;
+
     void readIndexFile();
-    void appendNameAndPosition(const std::string& name, const Position& position);
+    size_t parseIndexRecord(const char* record, size_t size, std::string& section, std::string& name,
+        Position& position);
+    bool recoverDataFiles();
+    void writeIndexFile(const std::string& path, const std::string& records);
+    bool hasUnlocked(const std::string& section, const std::string& name, timestamp current_timestamp);
+    void appendIndexRecord(std::string& records, const std::string& section, const std::string& name,
+        const Position& position);
+    void appendIndexRecords(const std::string& records);
+    std::string getDataFilePath(int group, int index);
+    std::string getDataFilePath(const std::string& dir, int group, int index);
     void prepareDataFile(int group, int index);
     void put(int group, int index, const std::string& data, int fp);
+    void log(const std::string& message);
 
     int groups;
     std::string dir;
-    std::map<std::string, Position> positionByName;
+    CompactFormat format;
+    std::string indexFile;
+    std::string dataFilePattern;
+    std::map<std::string, std::map<std::string, Position>> positionBySectionAndName;
 
     std::vector<int> indices;
     std::vector<int> offsets;
     boost::ptr_vector<boost::mutex> mutexes;
-    
+
+    bool readOnly;
+    bool closed;
+    // Changed by clear() under all locks: positions taken before it point to removed files.
+    long long clears;
     boost::mutex mutex;
+    boost::shared_ptr<Logger> logger;
 };
 
 }
@@ -1,4 +1,9 @@
 call "C:\Program Files (x86)\Microsoft Visual Studio\2017\Enterprise\VC\Auxiliary\Build\vcvars64.bat" 
 set SNAPPY_HOME=C:\Lib\snappy-windows-1.1.1.8
 set BOOST_HOME=C:\Lib\boost_1_67_0
-cl.exe /F268435456 /O2 /MT /EHsc /I%SNAPPY_HOME%\include /I%BOOST_HOME% /Feriorita.exe riorita.cpp protocol.cpp compact.cpp storage.cpp cache.cpp /link /LIBPATH:%BOOST_HOME%\lib64-msvc-14.1 libboost_system-vc141-mt-s-x64-1_67.lib libboost_thread-vc141-mt-s-x64-1_67.lib libboost_filesystem-vc141-mt-s-x64-1_67.lib libboost_program_options-vc141-mt-s-x64-1_67.lib snappy.lib
+set BENCHMARK_HOME=C:\Lib\benchmark
+cl.exe /F268435456 /O2 /MT /EHsc /I%SNAPPY_HOME%\include /I%BOOST_HOME% /Feriorita.exe riorita.cpp protocol.cpp compact.cpp memory.cpp expiration.cpp namespaces.cpp uploads.cpp storage.cpp cache.cpp metrics.cpp trace.cpp hotkeys.cpp replication.cpp client.cpp invalidations.cpp /link /LIBPATH:%BOOST_HOME%\lib64-msvc-14.1 libboost_system-vc141-mt-s-x64-1_67.lib libboost_thread-vc141-mt-s-x64-1_67.lib libboost_filesystem-vc141-mt-s-x64-1_67.lib libboost_program_options-vc141-mt-s-x64-1_67.lib snappy.lib
+cl.exe /O2 /MT /EHsc /I%BOOST_HOME% /Feriorita_bench.exe riorita_bench.cpp client.cpp protocol.cpp /link /LIBPATH:%BOOST_HOME%\lib64-msvc-14.1 libboost_system-vc141-mt-s-x64-1_67.lib libboost_program_options-vc141-mt-s-x64-1_67.lib
+cl.exe /O2 /MT /EHsc /I%SNAPPY_HOME%\include /I%BOOST_HOME% /I%BENCHMARK_HOME%\include /Feriorita_microbench.exe riorita_microbench.cpp protocol.cpp compact.cpp memory.cpp storage.cpp cache.cpp /link /LIBPATH:%BOOST_HOME%\lib64-msvc-14.1 /LIBPATH:%BENCHMARK_HOME%\lib libboost_system-vc141-mt-s-x64-1_67.lib libboost_thread-vc141-mt-s-x64-1_67.lib libboost_filesystem-vc141-mt-s-x64-1_67.lib snappy.lib benchmark.lib shlwapi.lib
+cl.exe /O2 /MT /EHsc /I%BOOST_HOME% /Feriorita_replay.exe riorita_replay.cpp client.cpp protocol.cpp trace.cpp /link /LIBPATH:%BOOST_HOME%\lib64-msvc-14.1 libboost_system-vc141-mt-s-x64-1_67.lib libboost_thread-vc141-mt-s-x64-1_67.lib libboost_program_options-vc141-mt-s-x64-1_67.lib
+cl.exe /O2 /MT /EHsc /I%BOOST_HOME% /Feriorita_backup.exe riorita_backup.cpp client.cpp protocol.cpp compact.cpp /link /LIBPATH:%BOOST_HOME%\lib64-msvc-14.1 libboost_system-vc141-mt-s-x64-1_67.lib libboost_thread-vc141-mt-s-x64-1_67.lib libboost_filesystem-vc141-mt-s-x64-1_67.lib libboost_program_options-vc141-mt-s-x64-1_67.lib
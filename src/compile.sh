@@ -1,2 +1,5 @@
-g++ -std=c++14 -Wall -Wextra -Wconversion  -DHAS_ROCKSDB -DHAS_LEVELDB -O2 -g -o riorita riorita.cpp protocol.cpp compact.cpp storage.cpp cache.cpp -lboost_system -lboost_thread -lboost_filesystem -lboost_program_options -lpthread -lleveldb -lsnappy -I../../rocksdb/include -L../../rocksdb -lrocksdb
-
+g++ -std=c++14 -Wall -Wextra -Wconversion  -DHAS_ROCKSDB -DHAS_LEVELDB -O2 -g -o riorita riorita.cpp protocol.cpp compact.cpp memory.cpp expiration.cpp namespaces.cpp uploads.cpp storage.cpp cache.cpp metrics.cpp trace.cpp hotkeys.cpp replication.cpp client.cpp invalidations.cpp -lboost_system -lboost_thread -lboost_filesystem -lboost_program_options -lpthread -lleveldb -lsnappy -I../../rocksdb/include -L../../rocksdb -lrocksdb
+g++ -std=c++14 -Wall -Wextra -Wconversion -O2 -g -o riorita_bench riorita_bench.cpp client.cpp protocol.cpp -lboost_system -lboost_program_options -lpthread
+g++ -std=c++14 -Wall -Wextra -Wconversion -DHAS_ROCKSDB -DHAS_LEVELDB -O2 -g -o riorita_microbench riorita_microbench.cpp protocol.cpp compact.cpp memory.cpp storage.cpp cache.cpp -lbenchmark -lboost_system -lboost_thread -lboost_filesystem -lpthread -lleveldb -lsnappy -I../../rocksdb/include -L../../rocksdb -lrocksdb
+g++ -std=c++14 -Wall -Wextra -Wconversion -O2 -g -o riorita_replay riorita_replay.cpp client.cpp protocol.cpp trace.cpp -lboost_system -lboost_thread -lboost_program_options -lpthread
+g++ -std=c++14 -Wall -Wextra -Wconversion -O2 -g -o riorita_backup riorita_backup.cpp client.cpp protocol.cpp compact.cpp -lboost_system -lboost_thread -lboost_filesystem -lboost_program_options -lpthread
@@ -0,0 +1,316 @@
+#include "expiration.h"
+
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+
+using namespace riorita;
+using namespace std;
+
+const long long TICK_MILLIS = 100;
+const size_t MIN_LOG_RECORDS_TO_REWRITE = 1000000;
+const int MAX_KEY_LENGTH = 1024 * 1024 * 1024;
+
+TimingWheel::TimingWheel(long long currentTick)
+        : currentTick(currentTick), slots(WHEEL_LEVELS, vector<Slot>(WHEEL_SLOTS))
+{
+    // No operations.
+}
+
+void TimingWheel::add(const string& key, long long tick)
+{
+    // Due keys are fired by the next advance.
+    tick = max(tick, currentTick + 1);
+
+    long long delta = tick - currentTick;
+    int level = 0;
+    while (level + 1 < WHEEL_LEVELS && delta >= (1LL << (8 * (level + 1))))
+        level++;
+
+    slots[level][(tick >> (8 * level)) & (WHEEL_SLOTS - 1)].push_back(make_pair(key, tick));
+}
+
+void TimingWheel::cascade(int level)
+{
+    Slot slot;
+    slot.swap(slots[level][(currentTick >> (8 * level)) & (WHEEL_SLOTS - 1)]);
+
+    for (size_t i = 0; i < slot.size(); i++)
+    {
+        long long delta = slot[i].second - currentTick;
+        int target = 0;
+        while (target + 1 < WHEEL_LEVELS && delta >= (1LL << (8 * (target + 1))))
+            target++;
+
+        // Keys due right now go to the current slot of the lowest level which is fired next.
+        long long tick = max(slot[i].second, currentTick);
+        slots[target][(tick >> (8 * target)) & (WHEEL_SLOTS - 1)].push_back(make_pair(slot[i].first, tick));
+    }
+}
+
+void TimingWheel::advance(long long tick, vector<pair<string, long long> >& due)
+{
+    while (currentTick < tick)
+    {
+        currentTick++;
+
+        for (int level = 1; level < WHEEL_LEVELS; level++)
+        {
+            if ((currentTick & ((1LL << (8 * level)) - 1)) != 0)
+                break;
+            cascade(level);
+        }
+
+        Slot& slot = slots[0][currentTick & (WHEEL_SLOTS - 1)];
+        due.insert(due.end(), slot.begin(), slot.end());
+        slot.clear();
+    }
+}
+
+long long Expirations::currentTimeMillis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static long long toTick(long long millis)
+{
+    return (millis + TICK_MILLIS - 1) / TICK_MILLIS;
+}
+
+Expirations::Expirations(const string& fileName, const ExpireCallback& callback)
+        : fileName(fileName), callback(callback), size(0), wheel(toTick(currentTimeMillis())), log(0), logRecords(0)
+{
+    for (int i = 0; i < SHARD_COUNT; i++)
+        shards.push_back(new Shard());
+
+    load();
+    thread = boost::thread(boost::bind(&Expirations::run, this));
+}
+
+Expirations::~Expirations()
+{
+    thread.interrupt();
+    thread.join();
+
+    if (log != 0)
+        fclose(log);
+}
+
+Expirations::Shard& Expirations::getShard(const string& key)
+{
+    size_t hash = std::hash<string>()(key);
+    return shards[(hash ^ (hash >> 17)) % shards.size()];
+}
+
+void Expirations::set(const string& key, long long ttlMillis)
+{
+    if (ttlMillis <= 0)
+    {
+        remove(key);
+        return;
+    }
+
+    long long expiresAt = currentTimeMillis() + ttlMillis;
+
+    // The shard lock is held while appending, so records of a key are logged in the order of changes.
+    Shard& shard = getShard(key);
+    boost::unique_lock<boost::mutex> shardLock(shard.mutex);
+    auto inserted = shard.expirations.insert(make_pair(key, expiresAt));
+    if (inserted.second)
+        size++;
+    else
+        inserted.first->second = expiresAt;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    wheel.add(key, toTick(expiresAt));
+    append(key, expiresAt);
+}
+
+void Expirations::remove(const string& key)
+{
+    // Most keys have no TTL, they pay only for the atomic read.
+    if (size == 0)
+        return;
+
+    Shard& shard = getShard(key);
+    boost::unique_lock<boost::mutex> shardLock(shard.mutex);
+    if (shard.expirations.erase(key) != 0)
+    {
+        size--;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        append(key, 0);
+    }
+}
+
+void Expirations::removePrefix(const string& prefix)
+{
+    if (size == 0)
+        return;
+
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        Shard& shard = shards[s];
+        boost::unique_lock<boost::mutex> shardLock(shard.mutex);
+
+        vector<string> removed;
+        for (auto i = shard.expirations.begin(); i != shard.expirations.end(); )
+            if (i->first.compare(0, prefix.length(), prefix) == 0)
+            {
+                removed.push_back(i->first);
+                i = shard.expirations.erase(i);
+            }
+            else
+                ++i;
+
+        if (!removed.empty())
+        {
+            size -= removed.size();
+            boost::unique_lock<boost::mutex> lock(mutex);
+            for (size_t i = 0; i < removed.size(); i++)
+                append(removed[i], 0);
+        }
+    }
+}
+
+bool Expirations::isExpired(const string& key)
+{
+    long long expiresAt = get(key);
+    return expiresAt != 0 && expiresAt <= currentTimeMillis();
+}
+
+long long Expirations::get(const string& key)
+{
+    if (size == 0)
+        return 0;
+
+    Shard& shard = getShard(key);
+    boost::unique_lock<boost::mutex> lock(shard.mutex);
+    auto i = shard.expirations.find(key);
+    return i == shard.expirations.end() ? 0 : i->second;
+}
+
+void Expirations::flush()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (log != 0)
+        fflush(log);
+}
+
+// The log consists of records <key-length:4><key><expires-at:8>, zero expires-at removes the key.
+void Expirations::append(const string& key, long long expiresAt)
+{
+    if (log != 0)
+    {
+        int length = int(key.length());
+        fwrite(&length, 1, sizeof(length), log);
+        fwrite(key.data(), 1, key.length(), log);
+        fwrite(&expiresAt, 1, sizeof(expiresAt), log);
+        logRecords++;
+    }
+}
+
+void Expirations::load()
+{
+    FILE* f = fopen(fileName.c_str(), "rb");
+    if (f != 0)
+    {
+        string key;
+        while (true)
+        {
+            int length;
+            long long expiresAt;
+            if (fread(&length, 1, sizeof(length), f) != sizeof(length) || length < 0 || length > MAX_KEY_LENGTH)
+                break;
+            key.resize(size_t(length));
+            if (fread(&key[0], 1, key.length(), f) != key.length()
+                    || fread(&expiresAt, 1, sizeof(expiresAt), f) != sizeof(expiresAt))
+                break;
+
+            if (expiresAt == 0)
+                getShard(key).expirations.erase(key);
+            else
+                getShard(key).expirations[key] = expiresAt;
+        }
+        fclose(f);
+    }
+
+    size_t count = 0;
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        for (auto i = shards[s].expirations.begin(); i != shards[s].expirations.end(); ++i)
+            wheel.add(i->first, toTick(i->second));
+        count += shards[s].expirations.size();
+    }
+    size = count;
+
+    rewrite();
+}
+
+// Takes every lock: the rewritten log has to match all shards at once.
+void Expirations::rewrite()
+{
+    boost::ptr_vector<boost::unique_lock<boost::mutex> > shardLocks;
+    for (size_t s = 0; s < shards.size(); s++)
+        shardLocks.push_back(new boost::unique_lock<boost::mutex>(shards[s].mutex));
+    boost::unique_lock<boost::mutex> lock(mutex);
+
+    if (log != 0)
+        fclose(log);
+
+    boost::filesystem::path path(fileName);
+    if (path.has_parent_path())
+        boost::filesystem::create_directories(path.parent_path());
+
+    string tempFileName = fileName + ".tmp";
+    log = fopen(tempFileName.c_str(), "wb");
+    if (log != 0)
+    {
+        logRecords = 0;
+        for (size_t s = 0; s < shards.size(); s++)
+            for (auto i = shards[s].expirations.begin(); i != shards[s].expirations.end(); ++i)
+                append(i->first, i->second);
+        fclose(log);
+        boost::filesystem::rename(tempFileName, fileName);
+    }
+
+    log = fopen(fileName.c_str(), "ab");
+    if (log == 0)
+        fprintf(stderr, "Can't open %s, expirations will not survive restart\n", fileName.c_str());
+}
+
+void Expirations::run()
+{
+    try
+    {
+        while (true)
+        {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(TICK_MILLIS));
+
+            vector<pair<string, long long> > due;
+            bool compact;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                wheel.advance(toTick(currentTimeMillis()), due);
+
+                if (log != 0)
+                    fflush(log);
+
+                compact = logRecords > max(MIN_LOG_RECORDS_TO_REWRITE, 4 * size.load());
+            }
+
+            if (compact)
+                rewrite();
+
+            // Keys changed since are filtered by the callback via isExpired.
+            for (size_t i = 0; i < due.size(); i++)
+                callback(due[i].first);
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+        // Stopped by the destructor.
+    }
+}
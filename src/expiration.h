@@ -0,0 +1,102 @@
+#ifndef RIORITA_EXPIRATION_H_
+#define RIORITA_EXPIRATION_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <cstdio>
+
+#include <boost/function.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace riorita {
+
+// Hierarchical timing wheel: WHEEL_LEVELS levels of WHEEL_SLOTS slots, a slot of a level
+// spans all slots of the previous one. Adding is O(1), advancing by a tick touches one slot
+// and rarely cascades a slot of an upper level down.
+class TimingWheel
+{
+public:
+    static const int WHEEL_LEVELS = 4;
+    static const int WHEEL_SLOTS = 256;
+
+    explicit TimingWheel(long long currentTick);
+
+    void add(const std::string& key, long long tick);
+
+    // Advances to the tick and appends keys which are due to it.
+    void advance(long long tick, std::vector<std::pair<std::string, long long> >& due);
+
+private:
+    typedef std::vector<std::pair<std::string, long long> > Slot;
+
+    void cascade(int level);
+
+    long long currentTick;
+    std::vector<std::vector<Slot> > slots;
+};
+
+// Expiration timestamps (in milliseconds since epoch) of keys stored with TTL. They are kept
+// in memory, appended to a log file in the data directory and rewritten compactly on start
+// and when the log grows much larger than the live set.
+// Expired keys are hidden by isExpired immediately and removed by the callback
+// from a background thread within a wheel tick.
+// Timestamps are spread over shards, so reads of different keys don't contend; the wheel and
+// the log have own mutex which is always taken after the shard one.
+class Expirations
+{
+public:
+    typedef boost::function<void (const std::string& key)> ExpireCallback;
+
+    Expirations(const std::string& fileName, const ExpireCallback& callback);
+    ~Expirations();
+
+    // Zero ttlMillis means no expiration.
+    void set(const std::string& key, long long ttlMillis);
+    void remove(const std::string& key);
+    void removePrefix(const std::string& prefix);
+    bool isExpired(const std::string& key);
+
+    // Returns the expiration timestamp of the key or 0 if it doesn't expire.
+    long long get(const std::string& key);
+
+    // Writes buffered records of the log, it is also done every tick.
+    void flush();
+
+    static long long currentTimeMillis();
+
+private:
+    static const int SHARD_COUNT = 64;
+
+    struct Shard
+    {
+        boost::mutex mutex;
+        std::unordered_map<std::string, long long> expirations;
+    };
+
+    Shard& getShard(const std::string& key);
+    void load();
+    void rewrite();
+    void append(const std::string& key, long long expiresAt);
+    void run();
+
+    std::string fileName;
+    ExpireCallback callback;
+
+    boost::ptr_vector<Shard> shards;
+    std::atomic<size_t> size;
+
+    boost::mutex mutex;
+    TimingWheel wheel;
+    FILE* log;
+    size_t logRecords;
+
+    boost::thread thread;
+};
+
+}
+
+#endif
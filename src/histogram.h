@@ -0,0 +1,93 @@
+#ifndef RIORITA_HISTOGRAM_H_
+#define RIORITA_HISTOGRAM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace riorita {
+
+// Latency histogram with relative error below 1/64: values below 128 have own buckets,
+// others go to 64 buckets per power of two.
+class Histogram
+{
+public:
+    Histogram(): counts(BUCKET_COUNT), count(0), max(0)
+    {
+    }
+
+    void record(long long value)
+    {
+        value = std::max(value, 0LL);
+        counts[getBucket(value)]++;
+        count++;
+        max = std::max(max, value);
+    }
+
+    void add(const Histogram& other)
+    {
+        for (int i = 0; i < BUCKET_COUNT; i++)
+            counts[i] += other.counts[i];
+        count += other.count;
+        max = std::max(max, other.max);
+    }
+
+    long long getCount() const
+    {
+        return count;
+    }
+
+    long long getMax() const
+    {
+        return max;
+    }
+
+    // Returns the upper bound of the bucket of the percentile (but not above the maximum).
+    long long getPercentile(double percentile) const
+    {
+        long long rank = (long long) std::ceil(percentile / 100.0 * double(count));
+        long long seen = 0;
+        for (int i = 0; i < BUCKET_COUNT; i++)
+        {
+            seen += counts[i];
+            if (seen > 0 && seen >= rank)
+                return std::min(getUpperBound(i), max);
+        }
+        return max;
+    }
+
+private:
+    static const int SUB_BUCKET_BITS = 6;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKET_COUNT = 2 * SUB_BUCKETS + (62 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+    static int getBucket(long long value)
+    {
+        if (value < 2 * SUB_BUCKETS)
+            return int(value);
+
+        int highestBit = 63;
+        while ((value >> highestBit) == 0)
+            highestBit--;
+        int shift = highestBit - SUB_BUCKET_BITS;
+        return 2 * SUB_BUCKETS + (shift - 1) * SUB_BUCKETS + int(value >> shift) - SUB_BUCKETS;
+    }
+
+    static long long getUpperBound(int bucket)
+    {
+        if (bucket < 2 * SUB_BUCKETS)
+            return bucket;
+
+        int shift = (bucket - 2 * SUB_BUCKETS) / SUB_BUCKETS + 1;
+        long long top = (bucket - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+        return ((top + 1) << shift) - 1;
+    }
+
+    std::vector<long long> counts;
+    long long count;
+    long long max;
+};
+
+}
+
+#endif
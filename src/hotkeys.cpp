@@ -0,0 +1,171 @@
+#include "hotkeys.h"
+
+#include <algorithm>
+#include <functional>
+
+using namespace riorita;
+using namespace std;
+
+const size_t MAX_BUFFERED_ACCESSES = 1024;
+
+HotKeys::HotKeys(size_t capacity, int shardCount)
+        : threadBuffer(keepBuffer)
+{
+    shardCount = max(shardCount, 1);
+    shardCapacity = max(capacity / size_t(shardCount), size_t(1));
+    for (int i = 0; i < shardCount; i++)
+        shards.push_back(new Shard());
+}
+
+void HotKeys::keepBuffer(Buffer* /* buffer */)
+{
+    // No operations.
+}
+
+size_t HotKeys::getShardIndex(const string& key)
+{
+    size_t hash = std::hash<string>()(key);
+    return (hash ^ (hash >> 17)) % shards.size();
+}
+
+void HotKeys::add(const string& key)
+{
+    Buffer* buffer = threadBuffer.get();
+    if (buffer == 0)
+    {
+        buffer = new Buffer();
+        {
+            boost::unique_lock<boost::mutex> lock(buffersMutex);
+            buffers.push_back(buffer);
+        }
+        threadBuffer.reset(buffer);
+    }
+
+    boost::unique_lock<boost::mutex> lock(buffer->mutex);
+    buffer->counts[key]++;
+    buffer->size++;
+    if (buffer->size >= MAX_BUFFERED_ACCESSES)
+        flush(*buffer);
+}
+
+// Called under the lock of the buffer, keys of a shard are merged under one lock.
+void HotKeys::flush(Buffer& buffer)
+{
+    vector<pair<size_t, unordered_map<string, long long>::const_iterator> > keys;
+    keys.reserve(buffer.counts.size());
+    for (auto i = buffer.counts.cbegin(); i != buffer.counts.cend(); ++i)
+        keys.push_back(make_pair(getShardIndex(i->first), i));
+    sort(keys.begin(), keys.end(), [](const pair<size_t, unordered_map<string, long long>::const_iterator>& a,
+            const pair<size_t, unordered_map<string, long long>::const_iterator>& b) {
+        return a.first < b.first;
+    });
+
+    for (size_t i = 0; i < keys.size(); )
+    {
+        Shard& shard = shards[keys[i].first];
+        boost::unique_lock<boost::mutex> lock(shard.mutex);
+        size_t j = i;
+        for (; j < keys.size() && keys[j].first == keys[i].first; j++)
+            add(shard, keys[j].second->first, keys[j].second->second);
+        i = j;
+    }
+
+    buffer.counts.clear();
+    buffer.size = 0;
+}
+
+void HotKeys::flushAll()
+{
+    boost::unique_lock<boost::mutex> lock(buffersMutex);
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        boost::unique_lock<boost::mutex> bufferLock(buffers[i].mutex);
+        flush(buffers[i]);
+    }
+}
+
+// Weighted Space-Saving: a key taking over the smallest counter gets its count plus the accesses.
+void HotKeys::add(Shard& shard, const string& key, long long count)
+{
+    auto i = shard.counters.find(key);
+    if (i != shard.counters.end())
+    {
+        shard.byCount.erase(make_pair(i->second.count, key));
+        i->second.count += count;
+        shard.byCount.insert(make_pair(i->second.count, key));
+        return;
+    }
+
+    Counter counter = {count, 0};
+    if (shard.counters.size() >= shardCapacity)
+    {
+        auto smallest = shard.byCount.begin();
+        counter.count = smallest->first + count;
+        counter.error = smallest->first;
+        shard.counters.erase(smallest->second);
+        shard.byCount.erase(smallest);
+    }
+
+    shard.counters[key] = counter;
+    shard.byCount.insert(make_pair(counter.count, key));
+}
+
+void HotKeys::getTop(size_t limit, vector<Entry>& entries)
+{
+    flushAll();
+
+    vector<Entry> top;
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        boost::unique_lock<boost::mutex> lock(shards[i].mutex);
+        size_t taken = 0;
+        for (auto j = shards[i].byCount.rbegin(); j != shards[i].byCount.rend() && taken < limit; ++j, ++taken)
+        {
+            Entry entry = {j->second, j->first, shards[i].counters[j->second].error};
+            top.push_back(entry);
+        }
+    }
+
+    sort(top.begin(), top.end(), [](const Entry& a, const Entry& b) {
+        return a.count > b.count || (a.count == b.count && a.key < b.key);
+    });
+    if (top.size() > limit)
+        top.resize(limit);
+    entries.insert(entries.end(), top.begin(), top.end());
+}
+
+void HotKeys::decay()
+{
+    flushAll();
+
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        Shard& shard = shards[i];
+        boost::unique_lock<boost::mutex> lock(shard.mutex);
+
+        // Halving keeps the order, so the set is rebuilt in one pass; keys counted down to zero are dropped.
+        set<pair<long long, string> > byCount;
+        for (auto j = shard.byCount.begin(); j != shard.byCount.end(); ++j)
+        {
+            Counter& counter = shard.counters[j->second];
+            counter.count /= 2;
+            counter.error /= 2;
+            if (counter.count == 0)
+                shard.counters.erase(j->second);
+            else
+                byCount.insert(byCount.end(), make_pair(counter.count, j->second));
+        }
+        shard.byCount.swap(byCount);
+    }
+}
+
+void HotKeys::collectStats(map<string, long long>& stats)
+{
+    long long tracked = 0;
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        boost::unique_lock<boost::mutex> lock(shards[i].mutex);
+        tracked += (long long) shards[i].counters.size();
+    }
+    stats["hot_keys_tracked"] = tracked;
+}
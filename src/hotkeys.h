@@ -0,0 +1,88 @@
+#ifndef RIORITA_HOTKEYS_H_
+#define RIORITA_HOTKEYS_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+namespace riorita {
+
+// The most frequently accessed keys by the Space-Saving algorithm (Metwally et al.): a fixed number
+// of counters, a key without a counter takes over the smallest one and inherits its count as the error.
+// Any key accessed more than total/capacity times is guaranteed to be tracked.
+//
+// Keys are split into independently locked shards by hash, a key always goes to the same shard,
+// so the top of all keys is the top of the shard tops. Accesses are counted in a buffer of the thread
+// and merged into shards by batches, so io threads don't contend for the shard of a viral key.
+// Reading the top merges all buffers first.
+class HotKeys
+{
+public:
+    struct Entry
+    {
+        std::string key;
+        long long count;
+        // The count may exceed the real number of accesses by at most the error.
+        long long error;
+    };
+
+    HotKeys(size_t capacity, int shardCount);
+
+    void add(const std::string& key);
+
+    // Appends at most limit keys with the largest counts, in descending order of counts.
+    void getTop(size_t limit, std::vector<Entry>& entries);
+
+    // Halves all counts, so the top follows the recent traffic.
+    void decay();
+
+    void collectStats(std::map<std::string, long long>& stats);
+
+private:
+    struct Counter
+    {
+        long long count;
+        long long error;
+    };
+
+    struct Shard
+    {
+        boost::mutex mutex;
+        std::unordered_map<std::string, Counter> counters;
+        std::set<std::pair<long long, std::string> > byCount;
+    };
+
+    // Its mutex is taken by other threads only to merge it before reading the top.
+    struct Buffer
+    {
+        Buffer(): size(0) {}
+
+        boost::mutex mutex;
+        std::unordered_map<std::string, long long> counts;
+        size_t size;
+    };
+
+    static void keepBuffer(Buffer* buffer);
+    size_t getShardIndex(const std::string& key);
+    void add(Shard& shard, const std::string& key, long long count);
+    void flush(Buffer& buffer);
+    void flushAll();
+
+    size_t shardCapacity;
+    boost::ptr_vector<Shard> shards;
+
+    // Buffers are owned by the list, the pointer of a thread doesn't delete its buffer.
+    boost::mutex buffersMutex;
+    boost::ptr_vector<Buffer> buffers;
+    boost::thread_specific_ptr<Buffer> threadBuffer;
+};
+
+}
+
+#endif
@@ -0,0 +1,215 @@
+#include "invalidations.h"
+#include "namespaces.h"
+
+#include <chrono>
+
+using namespace riorita;
+using namespace std;
+
+const size_t FILTER_BITS = 64 * 1024;
+// About 5% false positives when full.
+const size_t FILTER_CAPACITY = 8 * 1024;
+const long long SUBSCRIPTION_IDLE_MILLIS = 60 * 1000;
+
+static long long currentTimeMillis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Invalidations::Invalidations(size_t capacity)
+        : capacity(capacity), firstSequence(1), epoch(0), random(std::random_device()()), checkedAt(0)
+{
+    // No operations.
+}
+
+long long Invalidations::getKeyHash(const string& space, const string& key)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < space.length(); i++)
+        hash = (hash ^ (unsigned char) space[i]) * 1099511628211ULL;
+    hash = (hash ^ '~') * 1099511628211ULL;
+    for (size_t i = 0; i < key.length(); i++)
+        hash = (hash ^ (unsigned char) key[i]) * 1099511628211ULL;
+    return (long long) hash;
+}
+
+void Invalidations::add(const string& storageKey)
+{
+    string space;
+    string key;
+    Namespaces::parseStorageKey(storageKey, space, key);
+    long long hash = getKeyHash(space, key);
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    hashes.push_back(hash);
+    if (hashes.size() > capacity)
+    {
+        hashes.pop_front();
+        firstSequence++;
+    }
+}
+
+void Invalidations::invalidateAll()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    epoch++;
+}
+
+// Two probes by halves of the hash.
+void Invalidations::addToFilter(Subscription& subscription, long long hash)
+{
+    unsigned long long h = (unsigned long long) hash;
+    size_t first = size_t(h % FILTER_BITS);
+    size_t second = size_t((h >> 32) % FILTER_BITS);
+    subscription.filter[first / 64] |= 1ULL << (first % 64);
+    subscription.filter[second / 64] |= 1ULL << (second % 64);
+}
+
+bool Invalidations::filterContains(const Subscription& subscription, long long hash)
+{
+    unsigned long long h = (unsigned long long) hash;
+    size_t first = size_t(h % FILTER_BITS);
+    size_t second = size_t((h >> 32) % FILTER_BITS);
+    return (subscription.filter[first / 64] & (1ULL << (first % 64))) != 0
+        && (subscription.filter[second / 64] & (1ULL << (second % 64))) != 0;
+}
+
+void Invalidations::removeIdleSubscriptions(long long now)
+{
+    if (now - checkedAt < SUBSCRIPTION_IDLE_MILLIS)
+        return;
+    checkedAt = now;
+
+    for (auto i = subscriptions.begin(); i != subscriptions.end();)
+        if (now - i->second.polledAt > SUBSCRIPTION_IDLE_MILLIS)
+            i = subscriptions.erase(i);
+        else
+            ++i;
+}
+
+void Invalidations::poll(long long& subscriptionId, long long& sequence, const vector<long long>& cached,
+        bool& reset, vector<long long>& invalidated)
+{
+    long long now = currentTimeMillis();
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    removeIdleSubscriptions(now);
+
+    long long lastSequence = firstSequence + (long long) hashes.size() - 1;
+    auto i = subscriptions.find(subscriptionId);
+    if (i == subscriptions.end())
+    {
+        do
+            subscriptionId = (long long) (random() >> 1);
+        while (subscriptionId == 0 || subscriptions.count(subscriptionId) != 0);
+        i = subscriptions.insert(make_pair(subscriptionId, Subscription())).first;
+        i->second.filter.assign(FILTER_BITS / 64, 0);
+        i->second.count = 0;
+        // Forces the reset: the client may have cached values before it subscribed.
+        i->second.epoch = epoch - 1;
+    }
+
+    Subscription& subscription = i->second;
+    subscription.polledAt = now;
+    // Keys cached again (say, after a modification) are counted once, up to false positives of the filter.
+    for (size_t j = 0; j < cached.size(); j++)
+        if (!filterContains(subscription, cached[j]))
+        {
+            addToFilter(subscription, cached[j]);
+            subscription.count++;
+        }
+
+    reset = subscription.epoch != epoch || subscription.count > FILTER_CAPACITY
+        || sequence + 1 < firstSequence || sequence > lastSequence;
+    if (reset)
+    {
+        subscription.filter.assign(FILTER_BITS / 64, 0);
+        subscription.count = 0;
+        subscription.epoch = epoch;
+    }
+    else
+        for (long long j = sequence + 1; j <= lastSequence; j++)
+        {
+            long long hash = hashes[size_t(j - firstSequence)];
+            if (filterContains(subscription, hash))
+                invalidated.push_back(hash);
+        }
+
+    sequence = lastSequence;
+}
+
+void Invalidations::collectStats(map<string, long long>& stats)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    stats["invalidation_sequence"] = firstSequence + (long long) hashes.size() - 1;
+    stats["invalidation_subscriptions"] = (long long) subscriptions.size();
+}
+
+// ==============================================================================
+
+InvalidatingStorage::InvalidatingStorage(Storage* storage, Invalidations& invalidations)
+        : storage(storage), invalidations(invalidations)
+{
+    // No operations.
+}
+
+bool InvalidatingStorage::has(const string& key)
+{
+    return storage->has(key);
+}
+
+bool InvalidatingStorage::get(const string& key, string& value)
+{
+    return storage->get(key, value);
+}
+
+void InvalidatingStorage::erase(const string& key)
+{
+    storage->erase(key);
+    invalidations.add(key);
+}
+
+void InvalidatingStorage::put(const string& key, const string& value)
+{
+    storage->put(key, value);
+    invalidations.add(key);
+}
+
+// Only keys of dropped namespace generations are erased by prefix, they are invalidated by the drop.
+void InvalidatingStorage::erasePrefix(const string& prefix)
+{
+    storage->erasePrefix(prefix);
+}
+
+bool InvalidatingStorage::scan(const string& prefix, const string& startAfter, size_t limit, vector<string>& keys)
+{
+    return storage->scan(prefix, startAfter, limit, keys);
+}
+
+bool InvalidatingStorage::supportsRanges()
+{
+    return storage->supportsRanges();
+}
+
+bool InvalidatingStorage::getRange(const string& key, long long offset, size_t length, string& value, long long& totalSize)
+{
+    return storage->getRange(key, offset, length, value, totalSize);
+}
+
+void InvalidatingStorage::putFile(const string& key, const string& fileName)
+{
+    storage->putFile(key, fileName);
+    invalidations.add(key);
+}
+
+void InvalidatingStorage::collectStats(map<string, long long>& stats)
+{
+    storage->collectStats(stats);
+    invalidations.collectStats(stats);
+}
+
+bool InvalidatingStorage::backup(const string& directory)
+{
+    return storage->backup(directory);
+}
@@ -0,0 +1,96 @@
+#ifndef RIORITA_INVALIDATIONS_H_
+#define RIORITA_INVALIDATIONS_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <random>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "storage.h"
+
+namespace riorita {
+
+// Hashes of recently modified keys, numbered by sequence, for near caches of clients. A client polls with
+// INVALIDATIONS: it registers hashes of keys it has cached since the previous poll and gets the modified
+// ones among all registered. Registered keys of a subscription are kept in a Bloom filter, so a false
+// positive only drops a valid entry of the near cache. The subscription is reset (the client clears
+// its near cache) if it is new or forgotten, the filter is full of distinct keys, the client is behind
+// the oldest kept hash or all keys are invalidated at once.
+class Invalidations
+{
+public:
+    explicit Invalidations(size_t capacity);
+
+    // The hash of the namespace and the key, the same as of the trace.
+    static long long getKeyHash(const std::string& space, const std::string& key);
+
+    void add(const std::string& storageKey);
+
+    // Invalidates all keys, used as keys of a dropped namespace can't be listed.
+    void invalidateAll();
+
+    // Zero subscription subscribes. Sets the subscription, the sequence to pass next time, whether
+    // the near cache should be cleared and appends hashes of modified cached keys otherwise.
+    void poll(long long& subscription, long long& sequence, const std::vector<long long>& cached,
+            bool& reset, std::vector<long long>& invalidated);
+
+    void collectStats(std::map<std::string, long long>& stats);
+
+private:
+    struct Subscription
+    {
+        std::vector<unsigned long long> filter;
+        // Distinct keys in the filter.
+        size_t count;
+        long long epoch;
+        long long polledAt;
+    };
+
+    static void addToFilter(Subscription& subscription, long long hash);
+    static bool filterContains(const Subscription& subscription, long long hash);
+    void removeIdleSubscriptions(long long now);
+
+    const size_t capacity;
+
+    boost::mutex mutex;
+    std::deque<long long> hashes;
+    // The sequence of the first hash.
+    long long firstSequence;
+    long long epoch;
+    std::map<long long, Subscription> subscriptions;
+    std::mt19937_64 random;
+    long long checkedAt;
+};
+
+// Adds keys of writes to the invalidations.
+class InvalidatingStorage: public Storage
+{
+public:
+    InvalidatingStorage(Storage* storage, Invalidations& invalidations);
+
+    bool has(const std::string& key);
+    bool get(const std::string& key, std::string& value);
+    void erase(const std::string& key);
+    void put(const std::string& key, const std::string& value);
+    void erasePrefix(const std::string& prefix);
+    bool scan(const std::string& prefix, const std::string& startAfter, size_t limit,
+            std::vector<std::string>& keys);
+    bool supportsRanges();
+    bool getRange(const std::string& key, long long offset, size_t length,
+            std::string& value, long long& totalSize);
+    void putFile(const std::string& key, const std::string& fileName);
+    void collectStats(std::map<std::string, long long>& stats);
+    bool backup(const std::string& directory);
+
+private:
+    boost::shared_ptr<Storage> storage;
+    Invalidations& invalidations;
+};
+
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef RIORITA_LOCKS_H_
+#define RIORITA_LOCKS_H_
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+namespace riorita {
+
+// Fixed set of mutexes, a key is guarded by the mutex chosen by its hash.
+class StripedLocks
+{
+public:
+    explicit StripedLocks(size_t count = 1024)
+    {
+        mutexes.resize(count);
+    }
+
+    boost::mutex& get(const std::string& key)
+    {
+        return mutexes[std::hash<std::string>()(key) % mutexes.size()];
+    }
+
+private:
+    boost::ptr_vector<boost::mutex> mutexes;
+};
+
+// Versions of keys used as CAS tokens. A key is mapped by its hash to a slot, every write of the key
+// sets the slot to the next value of the counter, so a token never matches a value written later
+// (even an equal one). Keys of a slot share the version: a write of one only fails CAS of the others.
+// The counter starts from the startup time shifted by 20 bits, so tokens of the previous run are
+// not reused after a restart. Zero is never a token.
+class KeyVersions
+{
+public:
+    explicit KeyVersions(size_t count = 1 << 20)
+        : versions(count)
+    {
+        start = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() << 20;
+        counter = start;
+    }
+
+    // The token has to be read before the value: if a write happens in between,
+    // the token is older than the value and CAS with it fails.
+    long long get(const std::string& key) const
+    {
+        long long version = versions[getIndex(key)];
+        return version != 0 ? version : start;
+    }
+
+    // Called under the lock of the key after it is written, returns the token of the new value.
+    long long next(const std::string& key)
+    {
+        long long version = ++counter;
+        versions[getIndex(key)] = version;
+        return version;
+    }
+
+private:
+    size_t getIndex(const std::string& key) const
+    {
+        return std::hash<std::string>()(key) % versions.size();
+    }
+
+    std::vector<std::atomic<long long> > versions;
+    std::atomic<long long> counter;
+    long long start;
+};
+
+}
+
+#endif
@@ -0,0 +1,704 @@
+#include "memory.h"
+#include "logger.h"
+
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <tuple>
+#include <boost/bind.hpp>
+#include <boost/crc.hpp>
+#include <boost/function.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/lexical_cast.hpp>
+
+#if defined(_WIN32) || defined(WIN32) || defined(_WIN64) || defined(WIN64)
+#   include <io.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+using namespace riorita;
+using namespace std;
+
+const size_t PAGE_SIZE = 1024 * 1024;
+const size_t MIN_CHUNK_SIZE = 64;
+const size_t CHUNK_ALIGNMENT = 8;
+const double CHUNK_GROWTH_FACTOR = 1.25;
+// Hash map and ordered index nodes.
+const size_t ENTRY_OVERHEAD = 112;
+const int MAX_EVICTION_BUCKETS = 1 << 20;
+
+const size_t SNAPSHOT_CHUNK_SIZE = 4 * 1024 * 1024;
+const size_t FILE_BUFFER_SIZE = 1024 * 1024;
+const size_t MAX_RECORD_PART_LENGTH = 1024 * 1024 * 1024;
+const size_t RECORD_HEADER_SIZE = 1 + 4 + 4;
+const int MAX_FILE_NAME_LENGTH = 64;
+
+enum RecordType
+{
+    RECORD_PUT = 1,
+    RECORD_ERASE = 2
+};
+
+// Snapshots and logs consist of records: <type:1><key-length:4><value-length:4><key><value><crc32:4>.
+static void appendRecord(string& buffer, RecordType type, const string& key, const char* value, size_t valueLength)
+{
+    size_t start = buffer.length();
+
+    unsigned int keyLength = (unsigned int) key.length();
+    unsigned int length = (unsigned int) valueLength;
+    buffer += char(type);
+    buffer.append(reinterpret_cast<const char*>(&keyLength), 4);
+    buffer.append(reinterpret_cast<const char*>(&length), 4);
+    buffer += key;
+    buffer.append(value, valueLength);
+
+    boost::crc_32_type crc;
+    crc.process_bytes(buffer.data() + start, buffer.length() - start);
+    unsigned int checksum = crc.checksum();
+    buffer.append(reinterpret_cast<const char*>(&checksum), 4);
+}
+
+static void appendLogRecord(FILE* log, RecordType type, const string& key, const char* value, size_t valueLength)
+{
+    if (log != 0)
+    {
+        string buffer;
+        appendRecord(buffer, type, key, value, valueLength);
+        fwrite(buffer.data(), 1, buffer.length(), log);
+    }
+}
+
+SlabArena::SlabArena()
+{
+    for (size_t chunkSize = MIN_CHUNK_SIZE; chunkSize < PAGE_SIZE; )
+    {
+        chunkSizes.push_back(chunkSize);
+        chunkSize = size_t(double(chunkSize) * CHUNK_GROWTH_FACTOR);
+        chunkSize = (chunkSize + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+    }
+    chunkSizes.push_back(PAGE_SIZE);
+
+    freeChunks.resize(chunkSizes.size());
+}
+
+SlabArena::~SlabArena()
+{
+    for (size_t i = 0; i < pages.size(); i++)
+        delete[] pages[i];
+}
+
+char* SlabArena::allocate(size_t size, int& sizeClass)
+{
+    size_t index = lower_bound(chunkSizes.begin(), chunkSizes.end(), size) - chunkSizes.begin();
+
+    if (index == chunkSizes.size())
+    {
+        sizeClass = -1;
+        return new char[size];
+    }
+
+    sizeClass = int(index);
+    vector<char*>& chunks = freeChunks[index];
+    if (chunks.empty())
+    {
+        char* page = new char[PAGE_SIZE];
+        pages.push_back(page);
+
+        size_t chunkSize = chunkSizes[index];
+        for (size_t offset = 0; offset + chunkSize <= PAGE_SIZE; offset += chunkSize)
+            chunks.push_back(page + offset);
+    }
+
+    char* chunk = chunks.back();
+    chunks.pop_back();
+    return chunk;
+}
+
+void SlabArena::deallocate(char* chunk, int sizeClass)
+{
+    if (sizeClass < 0)
+        delete[] chunk;
+    else
+        freeChunks[sizeClass].push_back(chunk);
+}
+
+size_t SlabArena::getChunkSize(size_t size, int sizeClass) const
+{
+    return sizeClass < 0 ? size : chunkSizes[sizeClass];
+}
+
+ShardedMemoryStore::ShardedMemoryStore(int shardCount, size_t capacity)
+        : shardCapacity(capacity / size_t(shardCount)), snapshotIntervalSeconds(0), appendLog(false), generation(0)
+{
+    shards.resize(shardCount);
+}
+
+ShardedMemoryStore::~ShardedMemoryStore()
+{
+    if (!directory.empty())
+    {
+        snapshotThread.interrupt();
+        snapshotThread.join();
+
+        // The final snapshot makes the next start fast.
+        snapshot();
+
+        for (size_t i = 0; i < shards.size(); i++)
+            if (shards[i].log != 0)
+                fclose(shards[i].log);
+    }
+}
+
+ShardedMemoryStore::Shard& ShardedMemoryStore::getShard(const string& key)
+{
+    size_t hash = std::hash<string>()(key);
+    return shards[(hash ^ (hash >> 17)) % shards.size()];
+}
+
+size_t ShardedMemoryStore::getEntrySize(const Shard& shard, const string& key, const MemoryEntry& entry) const
+{
+    return key.length() + ENTRY_OVERHEAD + shard.arena.getChunkSize(entry.length, entry.sizeClass);
+}
+
+void ShardedMemoryStore::release(Shard& shard, const string& key, MemoryEntry& entry)
+{
+    shard.size -= getEntrySize(shard, key, entry);
+    shard.arena.deallocate(entry.data, entry.sizeClass);
+    entry.data = 0;
+}
+
+void ShardedMemoryStore::remove(Shard& shard, unordered_map<string, MemoryEntry>::iterator i)
+{
+    release(shard, i->first, i->second);
+    shard.keys.erase(&i->first);
+    shard.entries.erase(i);
+}
+
+bool ShardedMemoryStore::has(const string& key)
+{
+    Shard& shard = getShard(key);
+    boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+
+    auto i = shard.entries.find(key);
+    if (i == shard.entries.end())
+        return false;
+
+    i->second.referenced.store(true, memory_order_relaxed);
+    return true;
+}
+
+bool ShardedMemoryStore::get(const string& key, string& value)
+{
+    Shard& shard = getShard(key);
+    boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+
+    auto i = shard.entries.find(key);
+    if (i == shard.entries.end())
+        return false;
+
+    i->second.referenced.store(true, memory_order_relaxed);
+    value.assign(i->second.data, i->second.length);
+    return true;
+}
+
+bool ShardedMemoryStore::getRange(const string& key, size_t offset, size_t length, string& value, size_t& totalSize)
+{
+    Shard& shard = getShard(key);
+    boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+
+    auto i = shard.entries.find(key);
+    if (i == shard.entries.end())
+        return false;
+
+    i->second.referenced.store(true, memory_order_relaxed);
+    totalSize = i->second.length;
+    offset = min(offset, totalSize);
+    value.assign(i->second.data + offset, min(length, totalSize - offset));
+    return true;
+}
+
+void ShardedMemoryStore::put(const string& key, const string& value)
+{
+    Shard& shard = getShard(key);
+    boost::unique_lock<boost::shared_mutex> lock(shard.mutex);
+
+    auto inserted = shard.entries.emplace(piecewise_construct, forward_as_tuple(key), forward_as_tuple());
+    MemoryEntry& entry = inserted.first->second;
+    if (inserted.second)
+        shard.keys.insert(&inserted.first->first);
+    else
+        release(shard, key, entry);
+
+    entry.data = shard.arena.allocate(value.length(), entry.sizeClass);
+    entry.length = value.length();
+    memcpy(entry.data, value.data(), value.length());
+    entry.referenced.store(true, memory_order_relaxed);
+    shard.size += getEntrySize(shard, key, entry);
+    appendLogRecord(shard.log, RECORD_PUT, key, value.data(), value.length());
+
+    if (shardCapacity > 0 && shard.size > shardCapacity)
+        evict(shard);
+}
+
+void ShardedMemoryStore::erase(const string& key)
+{
+    Shard& shard = getShard(key);
+    boost::unique_lock<boost::shared_mutex> lock(shard.mutex);
+
+    auto i = shard.entries.find(key);
+    if (i != shard.entries.end())
+    {
+        remove(shard, i);
+        appendLogRecord(shard.log, RECORD_ERASE, key, 0, 0);
+    }
+}
+
+void ShardedMemoryStore::erasePrefix(const string& prefix)
+{
+    // Keys are collected under the shared lock, so writers are blocked only while each key is erased.
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        vector<string> keys;
+        {
+            boost::shared_lock<boost::shared_mutex> lock(shards[s].mutex);
+            for (auto i = shards[s].keys.lower_bound(&prefix); i != shards[s].keys.end()
+                    && (*i)->compare(0, prefix.length(), prefix) == 0; ++i)
+                keys.push_back(**i);
+        }
+
+        for (size_t i = 0; i < keys.size(); i++)
+            erase(keys[i]);
+    }
+}
+
+void ShardedMemoryStore::scan(const string& prefix, const string& startAfter, size_t limit, vector<string>& keys)
+{
+    // Keys are hashed over shards, so each shard gives a run of a page and the caller merges them.
+    for (size_t s = 0; s < shards.size(); s++)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(shards[s].mutex);
+        auto i = startAfter < prefix ? shards[s].keys.lower_bound(&prefix) : shards[s].keys.upper_bound(&startAfter);
+        for (size_t count = 0; count <= limit && i != shards[s].keys.end()
+                && (*i)->compare(0, prefix.length(), prefix) == 0; ++i, ++count)
+            keys.push_back(**i);
+    }
+}
+
+void ShardedMemoryStore::evict(Shard& shard)
+{
+    // The hand walks over buckets: referenced entries get a second chance, others are evicted.
+    // Bucket indices survive rehashing, so the hand stays meaningful (if approximate).
+    vector<string> victims;
+    for (int step = 0; step < MAX_EVICTION_BUCKETS && shard.size > shardCapacity && !shard.entries.empty(); step++)
+    {
+        size_t bucket = shard.clockHand++ % shard.entries.bucket_count();
+
+        for (auto i = shard.entries.begin(bucket); i != shard.entries.end(bucket); ++i)
+            if (i->second.referenced.load(memory_order_relaxed))
+                i->second.referenced.store(false, memory_order_relaxed);
+            else
+                victims.push_back(i->first);
+
+        for (size_t i = 0; i < victims.size(); i++)
+        {
+            remove(shard, shard.entries.find(victims[i]));
+            appendLogRecord(shard.log, RECORD_ERASE, victims[i], 0, 0);
+        }
+        victims.clear();
+    }
+}
+
+string ShardedMemoryStore::getFileName(long long generation, int part, const char* extension) const
+{
+    char fileName[MAX_FILE_NAME_LENGTH];
+    if (part < 0)
+        sprintf(fileName, "memory.%lld.%s", generation, extension);
+    else
+        sprintf(fileName, "memory.%lld.%d.%s", generation, part, extension);
+    return (boost::filesystem::path(directory) / fileName).string();
+}
+
+// Parses "memory.<generation>[.<part>].<extension>".
+static bool parseFileName(const string& fileName, long long& generation, int& part, string& extension)
+{
+    vector<string> tokens;
+    size_t start = 0;
+    for (size_t dot = fileName.find('.'); ; dot = fileName.find('.', start))
+    {
+        tokens.push_back(fileName.substr(start, dot == string::npos ? string::npos : dot - start));
+        if (dot == string::npos)
+            break;
+        start = dot + 1;
+    }
+
+    if (tokens.size() < 3 || tokens.size() > 4 || tokens[0] != "memory")
+        return false;
+
+    char* end;
+    generation = strtoll(tokens[1].c_str(), &end, 10);
+    if (tokens[1].empty() || *end != 0)
+        return false;
+
+    part = -1;
+    if (tokens.size() == 4)
+    {
+        part = int(strtol(tokens[2].c_str(), &end, 10));
+        if (tokens[2].empty() || *end != 0)
+            return false;
+    }
+
+    extension = tokens.back();
+    return true;
+}
+
+static void runInParallel(const vector<boost::function<void ()> >& tasks)
+{
+    std::atomic<size_t> next(0);
+    boost::thread_group threads;
+    size_t threadCount = min(tasks.size(), size_t(max(1U, boost::thread::hardware_concurrency())));
+
+    for (size_t i = 0; i < threadCount; i++)
+        threads.create_thread([&tasks, &next]() {
+            for (size_t task = next++; task < tasks.size(); task = next++)
+                tasks[task]();
+        });
+
+    threads.join_all();
+}
+
+// Writes buffered data of the file to the disk.
+static bool syncFile(FILE* f)
+{
+    if (fflush(f) != 0 || ferror(f))
+        return false;
+#if defined(_WIN32) || defined(WIN32) || defined(_WIN64) || defined(WIN64)
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+// Makes renames in the directory durable, Windows has no such sync.
+static bool syncDirectory(const string& directory)
+{
+#if defined(_WIN32) || defined(WIN32) || defined(_WIN64) || defined(WIN64)
+    return !directory.empty();
+#else
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool result = fsync(fd) == 0;
+    close(fd);
+    return result;
+#endif
+}
+
+void ShardedMemoryStore::persist(const string& directory, int snapshotIntervalSeconds, bool appendLog,
+        const boost::shared_ptr<Logger>& logger)
+{
+    this->directory = directory;
+    this->logger = logger;
+    this->snapshotIntervalSeconds = snapshotIntervalSeconds;
+    this->appendLog = appendLog;
+
+    boost::filesystem::create_directories(directory);
+    load();
+    switchLogs(generation);
+
+    snapshotThread = boost::thread(boost::bind(&ShardedMemoryStore::runSnapshots, this));
+}
+
+void ShardedMemoryStore::load()
+{
+    long long snapshotGeneration = -1;
+    long long lastGeneration = -1;
+    map<long long, vector<string> > logsByGeneration;
+
+    for (boost::filesystem::directory_iterator end, i(directory); i != end; ++i)
+    {
+        long long fileGeneration;
+        int part;
+        string extension;
+
+        if (parseFileName(i->path().filename().string(), fileGeneration, part, extension))
+        {
+            if (extension == "tmp")
+                boost::filesystem::remove(i->path());
+            else
+            {
+                lastGeneration = max(lastGeneration, fileGeneration);
+                if (extension == "manifest")
+                    snapshotGeneration = max(snapshotGeneration, fileGeneration);
+                if (extension == "log")
+                    logsByGeneration[fileGeneration].push_back(i->path().string());
+            }
+        }
+    }
+
+    if (snapshotGeneration >= 0)
+    {
+        int parts = 0;
+        FILE* manifest = fopen(getFileName(snapshotGeneration, -1, "manifest").c_str(), "rb");
+        if (manifest != 0)
+        {
+            if (fscanf(manifest, "%d", &parts) != 1)
+                parts = 0;
+            fclose(manifest);
+        }
+
+        vector<boost::function<void ()> > tasks;
+        for (int part = 0; part < parts; part++)
+            tasks.push_back(boost::bind(&ShardedMemoryStore::loadFile, this,
+                getFileName(snapshotGeneration, part, "snapshot"), false));
+        runInParallel(tasks);
+    }
+
+    // A key is always logged into the same part within a generation, so parts replay independently.
+    for (auto i = logsByGeneration.begin(); i != logsByGeneration.end(); ++i)
+        if (i->first >= snapshotGeneration)
+        {
+            vector<boost::function<void ()> > tasks;
+            for (size_t j = 0; j < i->second.size(); j++)
+                tasks.push_back(boost::bind(&ShardedMemoryStore::loadFile, this, i->second[j], true));
+            runInParallel(tasks);
+        }
+
+    generation = lastGeneration + 1;
+}
+
+void ShardedMemoryStore::log(const string& message)
+{
+    if (logger)
+        *logger << message << endl;
+    else
+        std::cerr << message << std::endl;
+}
+
+void ShardedMemoryStore::loadFile(const string& fileName, bool log)
+{
+    FILE* f = fopen(fileName.c_str(), "rb");
+    if (f == 0)
+    {
+        this->log("Can't open " + fileName);
+        return;
+    }
+
+    string record;
+    string key;
+    string value;
+    while (true)
+    {
+        record.resize(RECORD_HEADER_SIZE);
+        size_t done = fread(&record[0], 1, RECORD_HEADER_SIZE, f);
+        if (done == 0 && feof(f))
+            break;
+
+        unsigned int keyLength = 0;
+        unsigned int valueLength = 0;
+        if (done == RECORD_HEADER_SIZE)
+        {
+            memcpy(&keyLength, record.data() + 1, 4);
+            memcpy(&valueLength, record.data() + 5, 4);
+        }
+
+        bool valid = done == RECORD_HEADER_SIZE
+            && (record[0] == RECORD_PUT || record[0] == RECORD_ERASE)
+            && keyLength <= MAX_RECORD_PART_LENGTH && valueLength <= MAX_RECORD_PART_LENGTH;
+
+        if (valid)
+        {
+            size_t length = size_t(keyLength) + valueLength + 4;
+            record.resize(RECORD_HEADER_SIZE + length);
+            valid = fread(&record[RECORD_HEADER_SIZE], 1, length, f) == length;
+        }
+
+        if (valid)
+        {
+            boost::crc_32_type crc;
+            crc.process_bytes(record.data(), record.length() - 4);
+            unsigned int checksum;
+            memcpy(&checksum, record.data() + record.length() - 4, 4);
+            valid = checksum == crc.checksum();
+        }
+
+        if (!valid)
+        {
+            // A torn tail of a log is expected after a crash, anything else is a corruption.
+            this->log(string(log ? "Incomplete" : "Broken") + " record in " + fileName + ", the rest of the file is ignored");
+            break;
+        }
+
+        key.assign(record.data() + RECORD_HEADER_SIZE, keyLength);
+        if (record[0] == RECORD_PUT)
+        {
+            value.assign(record.data() + RECORD_HEADER_SIZE + keyLength, valueLength);
+            put(key, value);
+        }
+        else
+            erase(key);
+    }
+
+    fclose(f);
+}
+
+void ShardedMemoryStore::switchLogs(long long generation)
+{
+    if (!appendLog)
+        return;
+
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        FILE* log = fopen(getFileName(generation, int(i), "log").c_str(), "ab");
+        if (log == 0)
+            this->log("Can't open log " + getFileName(generation, int(i), "log"));
+        else
+            setvbuf(log, 0, _IOFBF, FILE_BUFFER_SIZE);
+
+        boost::unique_lock<boost::shared_mutex> lock(shards[i].mutex);
+        swap(log, shards[i].log);
+        if (log != 0)
+            fclose(log);
+    }
+}
+
+void ShardedMemoryStore::flushLogs()
+{
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(shards[i].mutex);
+        if (shards[i].log != 0)
+            fflush(shards[i].log);
+    }
+}
+
+void ShardedMemoryStore::snapshot()
+{
+    long long snapshotGeneration = generation + 1;
+    switchLogs(snapshotGeneration);
+
+    bool success = true;
+    for (size_t i = 0; i < shards.size() && success; i++)
+    {
+        string fileName = getFileName(snapshotGeneration, int(i), "snapshot");
+        FILE* f = fopen((fileName + ".tmp").c_str(), "wb");
+        if (f != 0)
+        {
+            writeSnapshotPart(shards[i], f);
+            success = syncFile(f);
+            success = fclose(f) == 0 && success;
+            if (success)
+                boost::filesystem::rename(fileName + ".tmp", fileName);
+        }
+        else
+            success = false;
+    }
+
+    // The manifest is written last, so only complete snapshots are ever loaded. Parts, the manifest
+    // and their renames reach the disk before the previous generation is removed: after a power loss
+    // either the old generation or the complete new one is there.
+    string manifestFileName = getFileName(snapshotGeneration, -1, "manifest");
+    success = success && syncDirectory(directory);
+    FILE* manifest = success ? fopen((manifestFileName + ".tmp").c_str(), "wb") : 0;
+    if (manifest != 0)
+    {
+        fprintf(manifest, "%d\n", int(shards.size()));
+        success = syncFile(manifest);
+        success = fclose(manifest) == 0 && success;
+    }
+
+    if (manifest != 0 && success)
+    {
+        boost::filesystem::rename(manifestFileName + ".tmp", manifestFileName);
+        success = syncDirectory(directory);
+    }
+
+    if (manifest != 0 && success)
+        removeGenerationsBefore(snapshotGeneration);
+    else
+        log("Can't write snapshot " + boost::lexical_cast<string>(snapshotGeneration));
+
+    generation = snapshotGeneration;
+}
+
+void ShardedMemoryStore::writeSnapshotPart(Shard& shard, FILE* f)
+{
+    // The shard is copied by chunks of buckets, writers wait only for a chunk to be copied. Rehashing
+    // between chunks moves entries between buckets, then the shard is restarted: duplicates are harmless
+    // because every later change of a key is in the log of the snapshot generation.
+    string buffer;
+    size_t bucket = 0;
+    size_t bucketCount = 0;
+
+    while (true)
+    {
+        {
+            boost::shared_lock<boost::shared_mutex> lock(shard.mutex);
+
+            if (bucketCount != shard.entries.bucket_count())
+            {
+                bucketCount = shard.entries.bucket_count();
+                bucket = 0;
+            }
+
+            for (; bucket < bucketCount && buffer.length() < SNAPSHOT_CHUNK_SIZE; bucket++)
+                for (auto i = shard.entries.begin(bucket); i != shard.entries.end(bucket); ++i)
+                    appendRecord(buffer, RECORD_PUT, i->first, i->second.data, i->second.length);
+        }
+
+        fwrite(buffer.data(), 1, buffer.length(), f);
+        buffer.clear();
+
+        if (bucket >= bucketCount)
+            break;
+    }
+}
+
+void ShardedMemoryStore::removeGenerationsBefore(long long generation)
+{
+    vector<boost::filesystem::path> obsolete;
+
+    for (boost::filesystem::directory_iterator end, i(directory); i != end; ++i)
+    {
+        long long fileGeneration;
+        int part;
+        string extension;
+
+        if (parseFileName(i->path().filename().string(), fileGeneration, part, extension)
+                && fileGeneration < generation)
+            obsolete.push_back(i->path());
+    }
+
+    for (size_t i = 0; i < obsolete.size(); i++)
+        boost::filesystem::remove(obsolete[i]);
+}
+
+void ShardedMemoryStore::runSnapshots()
+{
+    boost::posix_time::ptime lastSnapshot = boost::posix_time::second_clock::universal_time();
+
+    try
+    {
+        while (true)
+        {
+            boost::this_thread::sleep(boost::posix_time::seconds(1));
+            flushLogs();
+
+            boost::posix_time::ptime now = boost::posix_time::second_clock::universal_time();
+            if (snapshotIntervalSeconds > 0 && now - lastSnapshot >= boost::posix_time::seconds(snapshotIntervalSeconds))
+            {
+                snapshot();
+                lastSnapshot = now;
+            }
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+        // Stopped by the destructor.
+    }
+}
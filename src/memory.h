@@ -0,0 +1,137 @@
+#ifndef RIORITA_MEMORY_H_
+#define RIORITA_MEMORY_H_
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <set>
+#include <unordered_map>
+#include <cstdlib>
+#include <cstdio>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace riorita {
+
+class Logger;
+
+// Size-classed slab allocator: values are carved from 1 MB pages, chunks of a class are reused
+// via free lists. Values larger than the largest class are allocated directly.
+class SlabArena
+{
+public:
+    SlabArena();
+    ~SlabArena();
+
+    char* allocate(size_t size, int& sizeClass);
+    void deallocate(char* chunk, int sizeClass);
+    size_t getChunkSize(size_t size, int sizeClass) const;
+
+private:
+    SlabArena(const SlabArena&);
+    SlabArena& operator = (const SlabArena&);
+
+    std::vector<size_t> chunkSizes;
+    std::vector<std::vector<char*> > freeChunks;
+    std::vector<char*> pages;
+};
+
+struct MemoryEntry
+{
+    MemoryEntry(): data(0), length(0), sizeClass(-1), referenced(true) {}
+
+    char* data;
+    size_t length;
+    int sizeClass;
+    mutable std::atomic<bool> referenced;
+};
+
+// Concurrent in-memory key-value store: keys are spread over shards, each shard has own hash map,
+// ordered index of keys (for scans), arena and reader-writer lock, so readers never block each other. If capacity is positive,
+// entries are evicted by CLOCK (second chance) when a shard exceeds its part of the capacity.
+//
+// Optionally the store is persistent: it is streamed shard by shard into checksummed snapshot files
+// by a background thread (no fork, writers are blocked only while a small chunk of a shard is copied),
+// and every mutation may be appended to a per-shard log. Snapshot and log files are numbered
+// by generations: snapshot G is taken after all logs were switched to generation G, so
+// the latest complete snapshot plus logs of generations G, G+1, ... reproduce the state.
+class ShardedMemoryStore
+{
+public:
+    ShardedMemoryStore(int shardCount, size_t capacity);
+    ~ShardedMemoryStore();
+
+    bool has(const std::string& key);
+    bool get(const std::string& key, std::string& value);
+    bool getRange(const std::string& key, size_t offset, size_t length, std::string& value, size_t& totalSize);
+    void put(const std::string& key, const std::string& value);
+    void erase(const std::string& key);
+    void erasePrefix(const std::string& prefix);
+
+    // Appends at most limit + 1 keys starting with the prefix and greater than startAfter of each shard,
+    // in no particular order: the first limit + 1 keys of the store are among them.
+    void scan(const std::string& prefix, const std::string& startAfter, size_t limit, std::vector<std::string>& keys);
+
+    // Loads the latest snapshot and logs from the directory (in parallel), then starts
+    // background snapshots every snapshotIntervalSeconds (if positive) and logging (if appendLog).
+    // Failures and ignored records are written to the logger (stderr if it is null).
+    void persist(const std::string& directory, int snapshotIntervalSeconds, bool appendLog,
+        const boost::shared_ptr<Logger>& logger);
+
+private:
+    // Orders keys of the hash map, which are never moved while they are in it.
+    struct KeyPointerLess
+    {
+        bool operator () (const std::string* a, const std::string* b) const
+        {
+            return *a < *b;
+        }
+    };
+
+    struct Shard
+    {
+        Shard(): size(0), clockHand(0), log(0) {}
+
+        boost::shared_mutex mutex;
+        std::unordered_map<std::string, MemoryEntry> entries;
+        std::set<const std::string*, KeyPointerLess> keys;
+        SlabArena arena;
+        size_t size;
+        size_t clockHand;
+        FILE* log;
+    };
+
+    Shard& getShard(const std::string& key);
+    size_t getEntrySize(const Shard& shard, const std::string& key, const MemoryEntry& entry) const;
+    void release(Shard& shard, const std::string& key, MemoryEntry& entry);
+    void remove(Shard& shard, std::unordered_map<std::string, MemoryEntry>::iterator i);
+    void evict(Shard& shard);
+
+    void log(const std::string& message);
+    void load();
+    void loadFile(const std::string& fileName, bool log);
+    void switchLogs(long long generation);
+    void flushLogs();
+    void snapshot();
+    void writeSnapshotPart(Shard& shard, FILE* f);
+    void removeGenerationsBefore(long long generation);
+    void runSnapshots();
+    std::string getFileName(long long generation, int part, const char* extension) const;
+
+    boost::ptr_vector<Shard> shards;
+    size_t shardCapacity;
+
+    std::string directory;
+    boost::shared_ptr<Logger> logger;
+    int snapshotIntervalSeconds;
+    bool appendLog;
+    long long generation;
+    boost::thread snapshotThread;
+};
+
+}
+
+#endif
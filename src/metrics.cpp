@@ -0,0 +1,267 @@
+#include "metrics.h"
+#include "protocol.h"
+
+#include <cctype>
+#include <cstring>
+#include <chrono>
+
+using namespace riorita;
+using namespace std;
+
+static const char* counterNames[] = {"connections_accepted", "connections_denied", "connections_closed",
+    "invalid_requests", "bytes_in", "bytes_out"};
+
+static const char* latencyNames[] = {"request", "storage_has", "storage_get", "storage_put", "storage_erase"};
+
+Metrics::Shard::Shard()
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        counters[i] = 0;
+    for (int i = 0; i < MAX_REQUEST_TYPE; i++)
+        requests[i] = 0;
+    for (int i = 0; i < LATENCY_COUNT; i++)
+    {
+        for (int j = 0; j < LATENCY_BUCKETS; j++)
+            latencyBuckets[i][j] = 0;
+        latencySums[i] = 0;
+    }
+}
+
+Metrics::Metrics(): shard(&Metrics::keepShard)
+{
+    // No operations.
+}
+
+long long Metrics::currentTimeMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Metrics::Shard& Metrics::getShard()
+{
+    Shard* result = shard.get();
+    if (result == 0)
+    {
+        result = new Shard();
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            shards.push_back(result);
+        }
+        shard.reset(result);
+    }
+    return *result;
+}
+
+void Metrics::add(Counter counter, long long delta)
+{
+    increment(getShard().counters[counter], delta);
+}
+
+void Metrics::addRequest(int requestType, long long micros)
+{
+    if (requestType >= 0 && requestType < MAX_REQUEST_TYPE)
+        increment(getShard().requests[requestType], 1);
+    addLatency(REQUEST_LATENCY, micros);
+}
+
+void Metrics::addLatency(Latency latency, long long micros)
+{
+    int bucket = 0;
+    while (bucket + 1 < LATENCY_BUCKETS && micros > (1LL << bucket))
+        bucket++;
+
+    Shard& current = getShard();
+    increment(current.latencyBuckets[latency][bucket], 1);
+    increment(current.latencySums[latency], micros);
+}
+
+void Metrics::sum(Totals& totals)
+{
+    memset(&totals, 0, sizeof(totals));
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    for (auto s = shards.begin(); s != shards.end(); ++s)
+    {
+        for (int i = 0; i < COUNTER_COUNT; i++)
+            totals.counters[i] += s->counters[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < MAX_REQUEST_TYPE; i++)
+            totals.requests[i] += s->requests[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < LATENCY_COUNT; i++)
+        {
+            for (int j = 0; j < LATENCY_BUCKETS; j++)
+                totals.latencyBuckets[i][j] += s->latencyBuckets[i][j].load(std::memory_order_relaxed);
+            totals.latencySums[i] += s->latencySums[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Returns the upper bound of the bucket holding the percentile, it is at most twice the exact value.
+long long Metrics::getPercentile(const long long* buckets, double fraction)
+{
+    long long count = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        count += buckets[i];
+
+    long long seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen > 0 && double(seen) >= fraction * double(count))
+            return 1LL << i;
+    }
+    return 0;
+}
+
+static string toLowerCase(const char* s)
+{
+    string result(s);
+    for (size_t i = 0; i < result.length(); i++)
+        result[i] = char(tolower((unsigned char) result[i]));
+    return result;
+}
+
+void Metrics::collect(map<string, long long>& stats)
+{
+    Totals totals;
+    sum(totals);
+
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        stats[counterNames[i]] = totals.counters[i];
+    stats["connections_active"] = totals.counters[CONNECTIONS_ACCEPTED] - totals.counters[CONNECTIONS_CLOSED];
+
+    // Only types known to the parser are ever counted.
+    for (int i = 1; i < MAX_REQUEST_TYPE; i++)
+        if (totals.requests[i] > 0)
+            stats["requests_" + toLowerCase(toChars(RequestType(i)))] = totals.requests[i];
+
+    for (int i = 0; i < LATENCY_COUNT; i++)
+    {
+        long long count = 0;
+        for (int j = 0; j < LATENCY_BUCKETS; j++)
+            count += totals.latencyBuckets[i][j];
+
+        string name = string(latencyNames[i]) + "_latency";
+        stats[name + "_count"] = count;
+        stats[name + "_sum_us"] = totals.latencySums[i];
+        stats[name + "_p50_us"] = getPercentile(totals.latencyBuckets[i], 0.5);
+        stats[name + "_p99_us"] = getPercentile(totals.latencyBuckets[i], 0.99);
+    }
+}
+
+void Metrics::writePrometheus(ostream& out, const map<string, long long>& gauges)
+{
+    Totals totals;
+    sum(totals);
+
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        out << "# TYPE riorita_" << counterNames[i] << "_total counter\n";
+        out << "riorita_" << counterNames[i] << "_total " << totals.counters[i] << "\n";
+    }
+
+    out << "# TYPE riorita_requests_total counter\n";
+    for (int i = 1; i < MAX_REQUEST_TYPE; i++)
+        if (totals.requests[i] > 0)
+            out << "riorita_requests_total{type=\"" << toChars(RequestType(i)) << "\"} " << totals.requests[i] << "\n";
+
+    for (int i = 0; i < LATENCY_COUNT; i++)
+    {
+        string name = string("riorita_") + latencyNames[i] + "_duration_seconds";
+        out << "# TYPE " << name << " histogram\n";
+
+        long long count = 0;
+        for (int j = 0; j < LATENCY_BUCKETS; j++)
+        {
+            count += totals.latencyBuckets[i][j];
+            if (j + 1 < LATENCY_BUCKETS)
+                out << name << "_bucket{le=\"" << double(1LL << j) / 1e6 << "\"} " << count << "\n";
+        }
+        out << name << "_bucket{le=\"+Inf\"} " << count << "\n";
+        out << name << "_sum " << double(totals.latencySums[i]) / 1e6 << "\n";
+        out << name << "_count " << count << "\n";
+    }
+
+    for (auto i = gauges.begin(); i != gauges.end(); ++i)
+    {
+        out << "# TYPE riorita_" << i->first << " gauge\n";
+        out << "riorita_" << i->first << " " << i->second << "\n";
+    }
+}
+
+// ==============================================================================
+
+MeteredStorage::MeteredStorage(Storage* storage, Metrics& metrics): storage(storage), metrics(metrics)
+{
+    // No operations.
+}
+
+bool MeteredStorage::has(const string& key)
+{
+    long long start = Metrics::currentTimeMicros();
+    bool result = storage->has(key);
+    metrics.addLatency(STORAGE_HAS_LATENCY, Metrics::currentTimeMicros() - start);
+    return result;
+}
+
+bool MeteredStorage::get(const string& key, string& value)
+{
+    long long start = Metrics::currentTimeMicros();
+    bool result = storage->get(key, value);
+    metrics.addLatency(STORAGE_GET_LATENCY, Metrics::currentTimeMicros() - start);
+    return result;
+}
+
+void MeteredStorage::erase(const string& key)
+{
+    long long start = Metrics::currentTimeMicros();
+    storage->erase(key);
+    metrics.addLatency(STORAGE_ERASE_LATENCY, Metrics::currentTimeMicros() - start);
+}
+
+void MeteredStorage::put(const string& key, const string& value)
+{
+    long long start = Metrics::currentTimeMicros();
+    storage->put(key, value);
+    metrics.addLatency(STORAGE_PUT_LATENCY, Metrics::currentTimeMicros() - start);
+}
+
+void MeteredStorage::erasePrefix(const string& prefix)
+{
+    storage->erasePrefix(prefix);
+}
+
+bool MeteredStorage::scan(const string& prefix, const string& startAfter, size_t limit, vector<string>& keys)
+{
+    return storage->scan(prefix, startAfter, limit, keys);
+}
+
+bool MeteredStorage::supportsRanges()
+{
+    return storage->supportsRanges();
+}
+
+bool MeteredStorage::getRange(const string& key, long long offset, size_t length, string& value, long long& totalSize)
+{
+    long long start = Metrics::currentTimeMicros();
+    bool result = storage->getRange(key, offset, length, value, totalSize);
+    metrics.addLatency(STORAGE_GET_LATENCY, Metrics::currentTimeMicros() - start);
+    return result;
+}
+
+void MeteredStorage::putFile(const string& key, const string& fileName)
+{
+    long long start = Metrics::currentTimeMicros();
+    storage->putFile(key, fileName);
+    metrics.addLatency(STORAGE_PUT_LATENCY, Metrics::currentTimeMicros() - start);
+}
+
+void MeteredStorage::collectStats(map<string, long long>& stats)
+{
+    storage->collectStats(stats);
+}
+
+bool MeteredStorage::backup(const string& directory)
+{
+    return storage->backup(directory);
+}
@@ -0,0 +1,133 @@
+#ifndef RIORITA_METRICS_H_
+#define RIORITA_METRICS_H_
+
+#include <string>
+#include <map>
+#include <atomic>
+#include <ostream>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+#include "storage.h"
+
+namespace riorita {
+
+// Closed connections are counted only for accepted ones (not denied).
+enum Counter
+{
+    CONNECTIONS_ACCEPTED,
+    CONNECTIONS_DENIED,
+    CONNECTIONS_CLOSED,
+    INVALID_REQUESTS,
+    BYTES_IN,
+    BYTES_OUT,
+    COUNTER_COUNT
+};
+
+enum Latency
+{
+    REQUEST_LATENCY,
+    STORAGE_HAS_LATENCY,
+    STORAGE_GET_LATENCY,
+    STORAGE_PUT_LATENCY,
+    STORAGE_ERASE_LATENCY,
+    LATENCY_COUNT
+};
+
+// Server counters. Each thread increments its own shard padded to cache lines, so the hot path
+// has no shared writes; shards are summed up only when the metrics are read.
+class Metrics
+{
+public:
+    // Request types are bytes of the protocol, there is room for new ones.
+    static const int MAX_REQUEST_TYPE = 32;
+    // Latency bucket i counts durations up to 2^i microseconds, the last one counts the rest.
+    static const int LATENCY_BUCKETS = 26;
+
+    Metrics();
+
+    void add(Counter counter, long long delta = 1);
+    void addRequest(int requestType, long long micros);
+    void addLatency(Latency latency, long long micros);
+
+    // Flat names to values: counters, requests by type, latency counts and percentiles.
+    void collect(std::map<std::string, long long>& stats);
+
+    // Writes the metrics in the Prometheus text format, the gauges are appended as riorita_<name>.
+    void writePrometheus(std::ostream& out, const std::map<std::string, long long>& gauges);
+
+    static long long currentTimeMicros();
+
+private:
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    struct Shard
+    {
+        Shard();
+
+        char leadingPadding[CACHE_LINE_SIZE];
+        std::atomic<long long> counters[COUNTER_COUNT];
+        std::atomic<long long> requests[MAX_REQUEST_TYPE];
+        std::atomic<long long> latencyBuckets[LATENCY_COUNT][LATENCY_BUCKETS];
+        std::atomic<long long> latencySums[LATENCY_COUNT];
+        char trailingPadding[CACHE_LINE_SIZE];
+    };
+
+    // A snapshot of all shards summed up.
+    struct Totals
+    {
+        long long counters[COUNTER_COUNT];
+        long long requests[MAX_REQUEST_TYPE];
+        long long latencyBuckets[LATENCY_COUNT][LATENCY_BUCKETS];
+        long long latencySums[LATENCY_COUNT];
+    };
+
+    // Only the owner thread writes to a shard, so a relaxed load and store is enough.
+    static void increment(std::atomic<long long>& value, long long delta)
+    {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    static void keepShard(Shard*) {}
+
+    Shard& getShard();
+    void sum(Totals& totals);
+    static long long getPercentile(const long long* buckets, double fraction);
+
+    boost::mutex mutex;
+    // Shards outlive their threads: counts of finished threads are still counted.
+    boost::ptr_vector<Shard> shards;
+    boost::thread_specific_ptr<Shard> shard;
+};
+
+// Decorator timing calls of the underlying storage.
+class MeteredStorage: public Storage
+{
+public:
+    MeteredStorage(Storage* storage, Metrics& metrics);
+
+    bool has(const std::string& key);
+    bool get(const std::string& key, std::string& value);
+    void erase(const std::string& key);
+    void put(const std::string& key, const std::string& value);
+    void erasePrefix(const std::string& prefix);
+    bool scan(const std::string& prefix, const std::string& startAfter, size_t limit,
+            std::vector<std::string>& keys);
+    bool supportsRanges();
+    bool getRange(const std::string& key, long long offset, size_t length,
+            std::string& value, long long& totalSize);
+    void putFile(const std::string& key, const std::string& fileName);
+    void collectStats(std::map<std::string, long long>& stats);
+    bool backup(const std::string& directory);
+
+private:
+    boost::shared_ptr<Storage> storage;
+    Metrics& metrics;
+};
+
+}
+
+#endif
@@ -0,0 +1,247 @@
+#include "namespaces.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+using namespace riorita;
+using namespace std;
+
+// Requests which resolved a key just before the drop have time to finish before it is reclaimed.
+const long long RECLAIM_DELAY_MILLIS = 1000;
+const int MAX_NAMESPACE_LENGTH = 1024 * 1024;
+
+static long long currentTimeMillis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Namespaces::Namespaces(const string& fileName, const ReclaimCallback& reclaim)
+        : fileName(fileName), reclaim(reclaim), log(0)
+{
+    load();
+    thread = boost::thread(boost::bind(&Namespaces::run, this));
+}
+
+Namespaces::~Namespaces()
+{
+    thread.interrupt();
+    thread.join();
+
+    if (log != 0)
+        fclose(log);
+}
+
+// Prefix is "~<length>.<namespace>.<generation>~", the length makes it unambiguous for any namespace.
+string Namespaces::getPrefix(const string& space, long long generation)
+{
+    return "~" + boost::lexical_cast<string>(space.length()) + "." + space
+        + "." + boost::lexical_cast<string>(generation) + "~";
+}
+
+string Namespaces::getStorageKey(const string& space, const string& key)
+{
+    if (space.empty())
+        return key;
+
+    long long generation = 0;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mutex);
+        auto i = generationsBySpace.find(space);
+        if (i != generationsBySpace.end())
+            generation = i->second.current;
+    }
+
+    return getPrefix(space, generation) + key;
+}
+
+bool Namespaces::isValidKey(const string& space, const string& key)
+{
+    return !space.empty() || key.empty() || key[0] != '~';
+}
+
+// Prefixes start with "~" and a digit.
+string Namespaces::getNamespacedKeysEnd()
+{
+    return "~:";
+}
+
+void Namespaces::parseStorageKey(const string& storageKey, string& space, string& key)
+{
+    space.clear();
+    key = storageKey;
+    if (storageKey.empty() || storageKey[0] != '~')
+        return;
+
+    size_t dot = storageKey.find('.');
+    if (dot == string::npos || dot == 1 || dot > 8)
+        return;
+    size_t length = 0;
+    for (size_t i = 1; i < dot; i++)
+    {
+        if (!isdigit((unsigned char) storageKey[i]))
+            return;
+        length = length * 10 + size_t(storageKey[i] - '0');
+    }
+
+    size_t generationStart = dot + 1 + length + 1;
+    if (generationStart > storageKey.length() || storageKey[generationStart - 1] != '.')
+        return;
+    size_t end = storageKey.find('~', generationStart);
+    if (end == string::npos || end == generationStart)
+        return;
+    for (size_t i = generationStart; i < end; i++)
+        if (!isdigit((unsigned char) storageKey[i]))
+            return;
+
+    space = storageKey.substr(dot + 1, length);
+    key = storageKey.substr(end + 1);
+}
+
+long long Namespaces::drop(const string& space)
+{
+    boost::unique_lock<boost::shared_mutex> lock(mutex);
+
+    Generations& generations = generationsBySpace[space];
+    generations.current++;
+    generations.droppedAt = currentTimeMillis();
+    append(space, generations);
+
+    if (log != 0)
+        fflush(log);
+    return generations.current;
+}
+
+void Namespaces::setGeneration(const string& space, long long generation)
+{
+    boost::unique_lock<boost::shared_mutex> lock(mutex);
+
+    Generations& generations = generationsBySpace[space];
+    if (generations.current == generation)
+        return;
+    generations.current = generation;
+    generations.reclaimed = min(generations.reclaimed, generation);
+    generations.droppedAt = currentTimeMillis();
+    append(space, generations);
+
+    if (log != 0)
+        fflush(log);
+}
+
+void Namespaces::getGenerations(map<string, long long>& generations)
+{
+    boost::shared_lock<boost::shared_mutex> lock(mutex);
+    for (auto i = generationsBySpace.begin(); i != generationsBySpace.end(); ++i)
+        generations[i->first] = i->second.current;
+}
+
+// The log consists of records <namespace-length:4><namespace><current:8><reclaimed:8>.
+void Namespaces::append(const string& space, const Generations& generations)
+{
+    if (log != 0)
+    {
+        int length = int(space.length());
+        fwrite(&length, 1, sizeof(length), log);
+        fwrite(space.data(), 1, space.length(), log);
+        fwrite(&generations.current, 1, sizeof(generations.current), log);
+        fwrite(&generations.reclaimed, 1, sizeof(generations.reclaimed), log);
+    }
+}
+
+void Namespaces::load()
+{
+    FILE* f = fopen(fileName.c_str(), "rb");
+    if (f != 0)
+    {
+        string space;
+        while (true)
+        {
+            int length;
+            Generations generations;
+            if (fread(&length, 1, sizeof(length), f) != sizeof(length) || length < 0 || length > MAX_NAMESPACE_LENGTH)
+                break;
+            space.resize(size_t(length));
+            if (fread(&space[0], 1, space.length(), f) != space.length()
+                    || fread(&generations.current, 1, sizeof(generations.current), f) != sizeof(generations.current)
+                    || fread(&generations.reclaimed, 1, sizeof(generations.reclaimed), f) != sizeof(generations.reclaimed))
+                break;
+            generationsBySpace[space] = generations;
+        }
+        fclose(f);
+    }
+
+    boost::filesystem::path path(fileName);
+    if (path.has_parent_path())
+        boost::filesystem::create_directories(path.parent_path());
+
+    string tempFileName = fileName + ".tmp";
+    log = fopen(tempFileName.c_str(), "wb");
+    if (log != 0)
+    {
+        for (auto i = generationsBySpace.begin(); i != generationsBySpace.end(); ++i)
+            append(i->first, i->second);
+        fclose(log);
+        boost::filesystem::rename(tempFileName, fileName);
+    }
+
+    log = fopen(fileName.c_str(), "ab");
+    if (log == 0)
+        fprintf(stderr, "Can't open %s, dropped namespaces will not survive restart\n", fileName.c_str());
+}
+
+// Reclaims dropped generations of one namespace, returns false if there is nothing to reclaim.
+bool Namespaces::reclaimNext()
+{
+    string space;
+    long long from = 0;
+    long long to = 0;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mutex);
+        long long now = currentTimeMillis();
+        for (auto i = generationsBySpace.begin(); i != generationsBySpace.end(); ++i)
+            if (i->second.reclaimed < i->second.current && i->second.droppedAt + RECLAIM_DELAY_MILLIS <= now)
+            {
+                space = i->first;
+                from = i->second.reclaimed;
+                to = i->second.current;
+                break;
+            }
+    }
+
+    if (from == to)
+        return false;
+
+    for (long long generation = from; generation < to; generation++)
+        reclaim(getPrefix(space, generation));
+
+    boost::unique_lock<boost::shared_mutex> lock(mutex);
+    Generations& generations = generationsBySpace[space];
+    generations.reclaimed = max(generations.reclaimed, to);
+    append(space, generations);
+    if (log != 0)
+        fflush(log);
+
+    return true;
+}
+
+void Namespaces::run()
+{
+    try
+    {
+        while (true)
+        {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(RECLAIM_DELAY_MILLIS));
+
+            while (reclaimNext())
+                boost::this_thread::interruption_point();
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+        // Stopped by the destructor.
+    }
+}
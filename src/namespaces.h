@@ -0,0 +1,77 @@
+#ifndef RIORITA_NAMESPACES_H_
+#define RIORITA_NAMESPACES_H_
+
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <cstdio>
+
+#include <boost/function.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace riorita {
+
+// Namespaces with O(1) drop. A key of a namespace is stored with the prefix of the namespace
+// and its current generation, dropping the namespace just increments the generation, so all its keys
+// become unreachable at once. Keys of dropped generations are reclaimed by the callback in background.
+// Keys of the empty namespace are stored as is, so data written before namespaces stays readable,
+// and can't start with '~' which marks keys of other namespaces.
+//
+// Generations are appended to a log file in the data directory and rewritten compactly on start.
+class Namespaces
+{
+public:
+    typedef boost::function<void (const std::string& prefix)> ReclaimCallback;
+
+    Namespaces(const std::string& fileName, const ReclaimCallback& reclaim);
+    ~Namespaces();
+
+    std::string getStorageKey(const std::string& space, const std::string& key);
+
+    // Returns false for keys of the empty namespace which may clash with keys of other namespaces.
+    static bool isValidKey(const std::string& space, const std::string& key);
+    // Storage keys of all other namespaces are between "~" and it, the empty namespace skips them by it.
+    static std::string getNamespacedKeysEnd();
+
+    // Splits a storage key back into the namespace and the key, keys of the empty namespace are returned as is.
+    static void parseStorageKey(const std::string& storageKey, std::string& space, std::string& key);
+    // Returns the new generation of the namespace.
+    long long drop(const std::string& space);
+
+    // Replicas follow generations of the primary: a namespace switches to the generation,
+    // keys of previous ones are reclaimed.
+    void setGeneration(const std::string& space, long long generation);
+    void getGenerations(std::map<std::string, long long>& generations);
+
+private:
+    struct Generations
+    {
+        Generations(): current(0), reclaimed(0), droppedAt(0) {}
+
+        // Generations before reclaimed have no keys in the storage.
+        long long current;
+        long long reclaimed;
+        long long droppedAt;
+    };
+
+    static std::string getPrefix(const std::string& space, long long generation);
+
+    void load();
+    void append(const std::string& space, const Generations& generations);
+    void run();
+    bool reclaimNext();
+
+    std::string fileName;
+    ReclaimCallback reclaim;
+
+    boost::shared_mutex mutex;
+    std::unordered_map<std::string, Generations> generationsBySpace;
+    FILE* log;
+
+    boost::thread thread;
+};
+
+}
+
+#endif
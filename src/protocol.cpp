@@ -9,7 +9,12 @@ using namespace std;
 
 namespace riorita {
 
-const char* requestTypeNames[] = {"?", "PING", "HAS", "GET", "PUT", "DELETE"};
+const char* requestTypeNames[] = {"?", "PING", "HAS", "GET", "PUT", "DELETE", "DROP_NAMESPACE",
+    "PUT_IF_ABSENT", "COMPARE_AND_SET", "COMPARE_AND_DELETE", "APPEND", "RANGE_GET", "PUT_CHUNK", "SCAN", "STATS", "HOT_KEYS", "REPLICATE",
+    "INVALIDATIONS", "BACKUP"};
+
+// The first protocol version supporting each request type.
+const byte minVersions[] = {0, 1, 1, 1, 1, 1, 3, 4, 4, 4, 4, 5, 5, 6, 7, 8, 9, 10, 11};
 
 const int SIZEOF_BYTE = int(sizeof(byte));
 const int SIZEOF_INT32 = int(sizeof(int32));
@@ -22,6 +27,35 @@ const char* toChars(RequestType requestType) {
     return requestTypeNames[toByte(requestType)];    
 }
 
+bool hasValue(RequestType requestType) {
+    return requestType == PUT || requestType == PUT_IF_ABSENT
+        || requestType == COMPARE_AND_SET || requestType == APPEND || requestType == PUT_CHUNK;
+}
+
+static bool returnsData(RequestType requestType) {
+    return requestType == GET || requestType == RANGE_GET || requestType == SCAN || requestType == STATS
+        || requestType == HOT_KEYS || requestType == REPLICATE || requestType == INVALIDATIONS;
+}
+
+static bool hasCas(RequestType requestType) {
+    return requestType == COMPARE_AND_SET || requestType == COMPARE_AND_DELETE;
+}
+
+static bool respondsNumber(byte version, RequestType type, bool verdict) {
+    return version >= 4 && verdict && (type == GET || type == RANGE_GET
+        || (hasValue(type) && type != PUT_CHUNK));
+}
+
+static bool readInt64(const Bytes& bytes, int32& pos, int32& parsedByteCount, int64& value) {
+    if (pos + int32(sizeof(int64)) > bytes.size)
+        return false;
+
+    memcpy(&value, bytes.data + pos, sizeof(int64));
+    pos += sizeof(int64);
+    parsedByteCount += sizeof(int64);
+    return true;
+}
+
 Bytes::Bytes(int32 size, byte* data): size(size), data(data) {
     // No operations.
 }
@@ -60,13 +94,14 @@ Request* parseRequest(Bytes& bytes, int32 pos, int32& parsedByteCount)
         parsedByteCount++;
         //cout << "MAGIC_BYTE found" << endl;
     
-        if (bytes.data[pos++] != PROTOCOL_VERSION)
+        byte version = bytes.data[pos++];
+        if (version < MIN_PROTOCOL_VERSION || version > PROTOCOL_VERSION)
             return null;
         parsedByteCount++;
         //cout << "PROTOCOL_VERSION found" << endl;
 
         byte typeByte = bytes.data[pos++];
-        if (typeByte < PING || typeByte > DELETE)
+        if (typeByte < PING || typeByte > BACKUP || version < minVersions[typeByte])
             return null;
         parsedByteCount++;
         //cout << "type=" << typeByte << endl;
@@ -78,6 +113,30 @@ Request* parseRequest(Bytes& bytes, int32 pos, int32& parsedByteCount)
         parsedByteCount += sizeof(RequestId);
         //cout << "id=" << id << endl;
 
+        Bytes space;
+        if (version >= 3)
+        {
+            if (pos + lengthSize > bytes.size)
+                return null;
+
+            int32 spaceLength;
+            memcpy(&spaceLength, bytes.data + pos, lengthSize);
+            pos += lengthSize;
+            if (spaceLength < 0)
+                return null;
+            parsedByteCount += lengthSize;
+
+            if (spaceLength > bytes.size - pos - lengthSize)
+                return null;
+
+            space = Bytes(spaceLength, bytes.data + pos);
+            pos += spaceLength;
+            parsedByteCount += spaceLength;
+        }
+
+        if (pos + lengthSize > bytes.size)
+            return null;
+
         int32 keyLength;
         memcpy(&keyLength, bytes.data + pos, lengthSize);
         pos += lengthSize;
@@ -93,7 +152,8 @@ Request* parseRequest(Bytes& bytes, int32 pos, int32& parsedByteCount)
         parsedByteCount += keyLength;
 
         Bytes value;
-        if (type == PUT)
+        int64 ttl = 0;
+        if (hasValue(type))
         {
             //cout << "put " << pos << " " << bytes.size << endl;
 
@@ -121,9 +181,152 @@ Request* parseRequest(Bytes& bytes, int32 pos, int32& parsedByteCount)
             value = Bytes(valueLength, bytes.data + pos);
             pos += valueLength;
             parsedByteCount += valueLength;
+
+            if (version >= 2)
+            {
+                if (pos + int32(sizeof(int64)) > bytes.size)
+                    return null;
+
+                memcpy(&ttl, bytes.data + pos, sizeof(int64));
+                pos += sizeof(int64);
+
+                if (ttl < 0)
+                    return null;
+
+                parsedByteCount += sizeof(int64);
+            }
+        }
+
+        int64 cas = 0;
+        if (hasCas(type) && !readInt64(bytes, pos, parsedByteCount, cas))
+            return null;
+
+        Request* request = new Request(version, type, id, space, key, value, ttl, cas);
+
+        if (type == RANGE_GET)
+        {
+            int32 length;
+            if (!readInt64(bytes, pos, parsedByteCount, request->offset) || pos + lengthSize > bytes.size)
+            {
+                delete request;
+                return null;
+            }
+            memcpy(&length, bytes.data + pos, lengthSize);
+            pos += lengthSize;
+            parsedByteCount += lengthSize;
+            request->length = length;
+        }
+
+        if (type == PUT_CHUNK && (!readInt64(bytes, pos, parsedByteCount, request->offset)
+                || !readInt64(bytes, pos, parsedByteCount, request->totalSize)))
+        {
+            delete request;
+            return null;
+        }
+
+        if (type == SCAN)
+        {
+            int32 cursorLength;
+            if (pos + lengthSize > bytes.size)
+            {
+                delete request;
+                return null;
+            }
+            memcpy(&cursorLength, bytes.data + pos, lengthSize);
+            pos += lengthSize;
+            parsedByteCount += lengthSize;
+
+            if (cursorLength < 0 || cursorLength > bytes.size - pos - lengthSize - SIZEOF_BYTE)
+            {
+                delete request;
+                return null;
+            }
+            request->cursor = Bytes(cursorLength, bytes.data + pos);
+            pos += cursorLength;
+            parsedByteCount += cursorLength;
+
+            memcpy(&request->limit, bytes.data + pos, lengthSize);
+            pos += lengthSize;
+            parsedByteCount += lengthSize;
+            request->flags = bytes.data[pos++];
+            parsedByteCount++;
+        }
+
+        if (type == HOT_KEYS)
+        {
+            if (pos + lengthSize > bytes.size)
+            {
+                delete request;
+                return null;
+            }
+            memcpy(&request->limit, bytes.data + pos, lengthSize);
+            pos += lengthSize;
+            parsedByteCount += lengthSize;
+        }
+
+        if (type == REPLICATE)
+        {
+            int32 cursorLength;
+            if (pos + SIZEOF_BYTE > bytes.size)
+            {
+                delete request;
+                return null;
+            }
+            request->flags = bytes.data[pos++];
+            parsedByteCount++;
+
+            if (!readInt64(bytes, pos, parsedByteCount, request->logId)
+                    || !readInt64(bytes, pos, parsedByteCount, request->sequence)
+                    || pos + lengthSize > bytes.size)
+            {
+                delete request;
+                return null;
+            }
+            memcpy(&cursorLength, bytes.data + pos, lengthSize);
+            pos += lengthSize;
+            parsedByteCount += lengthSize;
+
+            if (cursorLength < 0 || cursorLength > bytes.size - pos)
+            {
+                delete request;
+                return null;
+            }
+            request->cursor = Bytes(cursorLength, bytes.data + pos);
+            pos += cursorLength;
+            parsedByteCount += cursorLength;
+        }
+
+        if (type == INVALIDATIONS)
+        {
+            int32 hashesLength;
+            if (!readInt64(bytes, pos, parsedByteCount, request->subscription)
+                    || !readInt64(bytes, pos, parsedByteCount, request->sequence)
+                    || pos + lengthSize > bytes.size)
+            {
+                delete request;
+                return null;
+            }
+            memcpy(&hashesLength, bytes.data + pos, lengthSize);
+            pos += lengthSize;
+            parsedByteCount += lengthSize;
+
+            if (hashesLength < 0 || hashesLength % int32(sizeof(int64)) != 0 || hashesLength > bytes.size - pos)
+            {
+                delete request;
+                return null;
+            }
+            request->hashes = Bytes(hashesLength, bytes.data + pos);
+            pos += hashesLength;
+            parsedByteCount += hashesLength;
         }
 
-        return new Request(type, id, key, value);
+        if (request->offset < 0 || request->length < 0 || request->totalSize < 0 || request->limit < 0)
+        {
+            delete request;
+            return null;
+        }
+
+        return request;
     }
     else
         return null;
@@ -158,14 +361,14 @@ inline int32 copyRequestHeader(const Request& request, bool success, byte* data)
     int32 pos = 0;
 
     pos += copyByte(MAGIC_BYTE, data + pos);
-    pos += copyByte(PROTOCOL_VERSION, data + pos);
+    pos += copyByte(request.version, data + pos);
     pos += copyInt64(request.id, data + pos);
     pos += copyByte(success ? 1 : 0, data + pos);
 
     return pos;
 }
 
-Bytes newResponse(const Request& request, bool success, bool verdict, int32 dataSize, const byte* data)
+Bytes newResponse(const Request& request, bool success, bool verdict, int32 dataSize, const byte* data, int64 number)
 {
     int32 headerSize = SIZEOF_INT32 // total size
         + SIZEOF_BYTE // magic byte
@@ -175,9 +378,12 @@ Bytes newResponse(const Request& request, bool success, bool verdict, int32 data
     ;
 
     int32 byteCount = headerSize + (success
-        ? 1 + (request.type == GET && verdict
+        ? 1 + (returnsData(request.type) && verdict
             ? SIZEOF_INT32 + dataSize
             : 0
+        ) + (respondsNumber(request.version, request.type, verdict)
+            ? int32(sizeof(int64))
+            : 0
         )
         : 0
     );
@@ -190,15 +396,155 @@ Bytes newResponse(const Request& request, bool success, bool verdict, int32 data
     if (success)
     {
         pos += copyByte(verdict ? 1 : 0, result + pos);
-        if (request.type == GET && verdict)
+        if (returnsData(request.type) && verdict)
         {
             pos += copyInt32(dataSize, result + pos);
             pos += copyBytes(dataSize, data, result + pos);
         }
+        if (respondsNumber(request.version, request.type, verdict))
+            pos += copyInt64(number, result + pos);
+    }
+
+    assert(byteCount == pos);
+    return Bytes(byteCount, result);
+}
+
+Bytes newRequest(const Request& request)
+{
+    int32 byteCount = SIZEOF_INT32 // total size
+        + SIZEOF_BYTE // magic byte
+        + SIZEOF_BYTE // protocol
+        + SIZEOF_BYTE // type
+        + int32(sizeof(RequestId)) // request id
+        + (request.version >= 3 ? SIZEOF_INT32 + request.space.size : 0)
+        + SIZEOF_INT32 + request.key.size
+        + (hasValue(request.type) ? SIZEOF_INT32 + request.value.size + (request.version >= 2 ? int32(sizeof(int64)) : 0) : 0)
+        + (hasCas(request.type) ? int32(sizeof(int64)) : 0)
+        + (request.type == RANGE_GET ? int32(sizeof(int64)) + SIZEOF_INT32 : 0)
+        + (request.type == PUT_CHUNK ? 2 * int32(sizeof(int64)) : 0)
+        + (request.type == SCAN ? SIZEOF_INT32 + request.cursor.size + SIZEOF_INT32 + SIZEOF_BYTE : 0)
+        + (request.type == HOT_KEYS ? SIZEOF_INT32 : 0)
+        + (request.type == REPLICATE ? SIZEOF_BYTE + 2 * int32(sizeof(int64)) + SIZEOF_INT32 + request.cursor.size : 0)
+        + (request.type == INVALIDATIONS ? 2 * int32(sizeof(int64)) + SIZEOF_INT32 + request.hashes.size : 0)
+    ;
+
+    byte* result = new byte[byteCount];
+
+    int32 pos = copyInt32(byteCount, result);
+    pos += copyByte(MAGIC_BYTE, result + pos);
+    pos += copyByte(request.version, result + pos);
+    pos += copyByte(toByte(request.type), result + pos);
+    pos += copyInt64(int64(request.id), result + pos);
+    if (request.version >= 3)
+    {
+        pos += copyInt32(request.space.size, result + pos);
+        pos += copyBytes(request.space.size, request.space.data, result + pos);
+    }
+    pos += copyInt32(request.key.size, result + pos);
+    pos += copyBytes(request.key.size, request.key.data, result + pos);
+
+    if (hasValue(request.type))
+    {
+        pos += copyInt32(request.value.size, result + pos);
+        pos += copyBytes(request.value.size, request.value.data, result + pos);
+        if (request.version >= 2)
+            pos += copyInt64(request.ttl, result + pos);
+    }
+
+    if (hasCas(request.type))
+        pos += copyInt64(request.cas, result + pos);
+
+    if (request.type == RANGE_GET)
+    {
+        pos += copyInt64(request.offset, result + pos);
+        pos += copyInt32(int32(request.length), result + pos);
+    }
+
+    if (request.type == PUT_CHUNK)
+    {
+        pos += copyInt64(request.offset, result + pos);
+        pos += copyInt64(request.totalSize, result + pos);
+    }
+
+    if (request.type == SCAN)
+    {
+        pos += copyInt32(request.cursor.size, result + pos);
+        pos += copyBytes(request.cursor.size, request.cursor.data, result + pos);
+        pos += copyInt32(request.limit, result + pos);
+        pos += copyByte(request.flags, result + pos);
+    }
+
+    if (request.type == HOT_KEYS)
+        pos += copyInt32(request.limit, result + pos);
+
+    if (request.type == REPLICATE)
+    {
+        pos += copyByte(request.flags, result + pos);
+        pos += copyInt64(request.logId, result + pos);
+        pos += copyInt64(request.sequence, result + pos);
+        pos += copyInt32(request.cursor.size, result + pos);
+        pos += copyBytes(request.cursor.size, request.cursor.data, result + pos);
+    }
+
+    if (request.type == INVALIDATIONS)
+    {
+        pos += copyInt64(request.subscription, result + pos);
+        pos += copyInt64(request.sequence, result + pos);
+        pos += copyInt32(request.hashes.size, result + pos);
+        pos += copyBytes(request.hashes.size, request.hashes.data, result + pos);
     }
 
     assert(byteCount == pos);
     return Bytes(byteCount, result);
 }
 
+bool parseResponse(byte version, RequestType type, const Bytes& bytes, Response& response)
+{
+    int32 headerSize = SIZEOF_BYTE // magic byte
+        + SIZEOF_BYTE // protocol
+        + sizeof(RequestId) // request id
+        + SIZEOF_BYTE // success
+    ;
+
+    if (bytes.size < headerSize || bytes.data[0] != MAGIC_BYTE || bytes.data[1] != version)
+        return false;
+
+    memcpy(&response.id, bytes.data + 2, sizeof(RequestId));
+    response.success = bytes.data[headerSize - 1] == 1;
+    response.verdict = false;
+    response.data = Bytes();
+    response.number = 0;
+
+    int32 pos = headerSize;
+    if (response.success)
+    {
+        if (pos + SIZEOF_BYTE > bytes.size)
+            return false;
+        response.verdict = bytes.data[pos++] == 1;
+
+        if (returnsData(type) && response.verdict)
+        {
+            int32 dataSize;
+            if (pos + SIZEOF_INT32 > bytes.size)
+                return false;
+            memcpy(&dataSize, bytes.data + pos, SIZEOF_INT32);
+            pos += SIZEOF_INT32;
+            if (dataSize < 0 || dataSize > bytes.size - pos)
+                return false;
+            response.data = Bytes(dataSize, bytes.data + pos);
+            pos += dataSize;
+        }
+
+        if (respondsNumber(version, type, response.verdict))
+        {
+            if (pos + int32(sizeof(int64)) > bytes.size)
+                return false;
+            memcpy(&response.number, bytes.data + pos, sizeof(int64));
+            pos += sizeof(int64);
+        }
+    }
+
+    return pos == bytes.size;
+}
+
 }
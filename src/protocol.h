@@ -11,7 +11,18 @@ typedef int int32;
 typedef long long int64;
 
 const byte MAGIC_BYTE = 113;
-const byte PROTOCOL_VERSION = 1;
+// Version 2 adds TTL to PUT, version 3 adds namespaces, version 4 adds CAS tokens and conditional writes,
+// version 5 adds range reads and chunked writes, version 6 adds scans, version 7 adds stats,
+// version 8 adds hot keys, version 9 adds replication, version 10 adds invalidations of near caches,
+// version 11 adds backups and TTLs in scans.
+// Responses repeat the version of the request.
+const byte MIN_PROTOCOL_VERSION = 1;
+const byte PROTOCOL_VERSION = 11;
+
+// Flags of SCAN: return sizes, values and (since version 11) remaining TTLs of keys.
+const byte SCAN_SIZES = 1;
+const byte SCAN_VALUES = 2;
+const byte SCAN_TTLS = 4;
 
 #define null (0)
 
@@ -21,11 +32,25 @@ enum RequestType {
     HAS = 2,
     GET = 3,
     PUT = 4,
-    DELETE = 5
+    DELETE = 5,
+    DROP_NAMESPACE = 6,
+    PUT_IF_ABSENT = 7,
+    COMPARE_AND_SET = 8,
+    COMPARE_AND_DELETE = 9,
+    APPEND = 10,
+    RANGE_GET = 11,
+    PUT_CHUNK = 12,
+    SCAN = 13,
+    STATS = 14,
+    HOT_KEYS = 15,
+    REPLICATE = 16,
+    INVALIDATIONS = 17,
+    BACKUP = 18
 };
 
 byte toByte(RequestType requestType);
 const char* toChars(RequestType requestType);
+bool hasValue(RequestType requestType);
 
 struct Bytes {
     int32 size;
@@ -35,20 +60,65 @@ struct Bytes {
 };
 
 struct Request {
-    Request(RequestType type, RequestId id, Bytes key, Bytes value):
-            type(type), id(id), key(key), value(value) {
+    Request(byte version, RequestType type, RequestId id, Bytes space, Bytes key, Bytes value, int64 ttl = 0, int64 cas = 0):
+            version(version), type(type), id(id), space(space), key(key), value(value), ttl(ttl), cas(cas),
+            offset(0), length(0), totalSize(0), limit(0), flags(0), logId(0), sequence(0), subscription(0) {
         // No operations.
     }
 
+    byte version;
     RequestType type;
     RequestId id;
+    // Namespace, empty for versions before 3.
+    Bytes space;
     Bytes key;
     Bytes value;
+
+    // Time to live of PUT value in milliseconds, 0 means forever.
+    int64 ttl;
+
+    // Expected CAS token of COMPARE_AND_SET and COMPARE_AND_DELETE.
+    int64 cas;
+
+    // Range of RANGE_GET, position of the chunk and size of the whole value of PUT_CHUNK.
+    int64 offset;
+    int64 length;
+    int64 totalSize;
+
+    // SCAN returns keys after the cursor, the key is the prefix. HOT_KEYS uses only the limit.
+    Bytes cursor;
+    int32 limit;
+    byte flags;
+
+    // REPLICATE asks for records of the log after the sequence or (by flags) for a snapshot page after the cursor.
+    int64 logId;
+    int64 sequence;
+
+    // INVALIDATIONS registers hashes of keys cached by the subscription and asks for the modified ones
+    // after the sequence.
+    int64 subscription;
+    Bytes hashes;
+};
+
+struct Response {
+    RequestId id;
+    bool success;
+    bool verdict;
+    // Points into the parsed bytes.
+    Bytes data;
+    int64 number;
 };
 
 Request* parseRequest(Bytes& bytes, int32 pos, int32& parsedByteCount);
 
-Bytes newResponse(const Request& request, bool success, bool verdict, int32 dataSize, const byte* data);
+// Client side: the request with the total size, and the response to a request of the version and type
+// (without the total size). Returns false if the bytes are not a valid response.
+Bytes newRequest(const Request& request);
+bool parseResponse(byte version, RequestType type, const Bytes& bytes, Response& response);
+
+// The number is the CAS token for GET and writes (sent only in version 4+ responses with verdict=1)
+// or the total size of the value for RANGE_GET.
+Bytes newResponse(const Request& request, bool success, bool verdict, int32 dataSize, const byte* data, int64 number = 0);
 
 }
 
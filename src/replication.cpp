@@ -0,0 +1,493 @@
+#include "replication.h"
+#include "client.h"
+#include "snappy.h"
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+
+using namespace riorita;
+using namespace std;
+
+const long long REPLICA_POLL_INTERVAL_MILLIS = 50;
+const long long REPLICA_RECONNECT_INTERVAL_MILLIS = 1000;
+
+template<typename T>
+static void appendBinary(string& data, const T& value)
+{
+    data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+static bool readBinary(const string& data, size_t& pos, T& value)
+{
+    if (data.length() - pos < sizeof(value))
+        return false;
+    memcpy(&value, data.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+}
+
+static bool readString(const string& data, size_t& pos, string& s)
+{
+    int32 length;
+    if (!readBinary(data, pos, length) || length < 0 || size_t(length) > data.length() - pos)
+        return false;
+    s.assign(data, pos, size_t(length));
+    pos += size_t(length);
+    return true;
+}
+
+void riorita::appendRecord(string& records, ReplicationOperation operation, const string& key,
+        const string& value, long long number)
+{
+    records += char(operation);
+    appendBinary(records, int32(key.length()));
+    records += key;
+    if (operation == REPLICATE_PUT)
+    {
+        appendBinary(records, int32(value.length()));
+        records += value;
+    }
+    if (operation == REPLICATE_EXPIRE || operation == REPLICATE_GENERATION)
+        appendBinary(records, number);
+}
+
+bool riorita::parseRecords(const string& records, vector<ReplicationRecord>& parsed)
+{
+    size_t pos = 0;
+    while (pos < records.length())
+    {
+        ReplicationRecord record;
+        record.operation = ReplicationOperation((unsigned char) records[pos++]);
+        record.number = 0;
+        if (record.operation < REPLICATE_PUT || record.operation > REPLICATE_GENERATION
+                || !readString(records, pos, record.key))
+            return false;
+        if (record.operation == REPLICATE_PUT && !readString(records, pos, record.value))
+            return false;
+        if ((record.operation == REPLICATE_EXPIRE || record.operation == REPLICATE_GENERATION)
+                && !readBinary(records, pos, record.number))
+            return false;
+        parsed.push_back(record);
+    }
+    return true;
+}
+
+// ==============================================================================
+
+static long long newLogId()
+{
+    long long id = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    return id == 0 ? 1 : id;
+}
+
+ReplicationLog::ReplicationLog(size_t capacity, const string& fileName)
+        : id(0), capacity(capacity), fileName(fileName), firstSequence(1), size(0)
+{
+    if (!load())
+    {
+        id = newLogId();
+        records.clear();
+        firstSequence = 1;
+        size = 0;
+    }
+
+    // The file describes the log only until the next write.
+    boost::system::error_code error;
+    boost::filesystem::remove(fileName, error);
+}
+
+// The file is <log-id:8><first-sequence:8> and records <record-length:4><record>.
+bool ReplicationLog::load()
+{
+    FILE* f = fopen(fileName.c_str(), "rb");
+    if (f == 0)
+        return false;
+
+    string data;
+    char buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        data.append(buffer, count);
+    fclose(f);
+
+    size_t pos = 0;
+    if (!readBinary(data, pos, id) || id == 0 || !readBinary(data, pos, firstSequence) || firstSequence <= 0)
+        return false;
+
+    while (pos < data.length())
+    {
+        string record;
+        vector<ReplicationRecord> parsed;
+        if (!readString(data, pos, record) || !parseRecords(record, parsed) || parsed.size() != 1)
+            return false;
+
+        size += record.length();
+        records.push_back(string());
+        records.back().swap(record);
+    }
+
+    trim();
+    return true;
+}
+
+void ReplicationLog::save()
+{
+    string tempFileName = fileName + ".tmp";
+    FILE* f = fopen(tempFileName.c_str(), "wb");
+    if (f == 0)
+        return;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    bool written = fwrite(&id, sizeof(id), 1, f) == 1 && fwrite(&firstSequence, sizeof(firstSequence), 1, f) == 1;
+    for (size_t i = 0; written && i < records.size(); i++)
+    {
+        int32 length = int32(records[i].length());
+        written = fwrite(&length, sizeof(length), 1, f) == 1
+            && fwrite(records[i].data(), 1, records[i].length(), f) == records[i].length();
+    }
+    written = fclose(f) == 0 && written;
+
+    boost::system::error_code error;
+    if (written)
+        boost::filesystem::rename(tempFileName, fileName, error);
+    else
+        boost::filesystem::remove(tempFileName, error);
+}
+
+// The last record is kept even if it is larger than the capacity.
+void ReplicationLog::trim()
+{
+    while (size > capacity && records.size() > 1)
+    {
+        size -= records.front().length();
+        records.pop_front();
+        firstSequence++;
+    }
+}
+
+void ReplicationLog::append(ReplicationOperation operation, const string& key, const string& value, long long number)
+{
+    string record;
+    appendRecord(record, operation, key, value, number);
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    size += record.length();
+    records.push_back(string());
+    records.back().swap(record);
+    trim();
+}
+
+long long ReplicationLog::getLastSequence()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return firstSequence + (long long) records.size() - 1;
+}
+
+bool ReplicationLog::read(long long after, size_t maxSize, string& result, long long& last, bool& more)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+
+    long long end = firstSequence + (long long) records.size();
+    if (after + 1 < firstSequence || after + 1 > end)
+        return false;
+
+    // At least one record is returned, so a large one doesn't stop the replica.
+    long long sequence = after + 1;
+    size_t start = result.length();
+    for (; sequence < end && (sequence == after + 1 || result.length() - start < maxSize); sequence++)
+        result += records[size_t(sequence - firstSequence)];
+
+    last = sequence - 1;
+    more = sequence < end;
+    return true;
+}
+
+void ReplicationLog::collectStats(map<string, long long>& stats)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    stats["replication_sequence"] = firstSequence + (long long) records.size() - 1;
+    stats["replication_log_records"] = (long long) records.size();
+    stats["replication_log_bytes"] = (long long) size;
+}
+
+// ==============================================================================
+
+ReplicatedStorage::ReplicatedStorage(Storage* storage, ReplicationLog& log): storage(storage), log(log)
+{
+    // No operations.
+}
+
+bool ReplicatedStorage::has(const string& key)
+{
+    return storage->has(key);
+}
+
+bool ReplicatedStorage::get(const string& key, string& value)
+{
+    return storage->get(key, value);
+}
+
+void ReplicatedStorage::erase(const string& key)
+{
+    storage->erase(key);
+    log.append(REPLICATE_ERASE, key, "", 0);
+}
+
+void ReplicatedStorage::put(const string& key, const string& value)
+{
+    storage->put(key, value);
+    log.append(REPLICATE_PUT, key, value, 0);
+}
+
+// Only keys of dropped namespace generations are erased by prefix, replicas reclaim them on their own.
+void ReplicatedStorage::erasePrefix(const string& prefix)
+{
+    storage->erasePrefix(prefix);
+}
+
+bool ReplicatedStorage::scan(const string& prefix, const string& startAfter, size_t limit, vector<string>& keys)
+{
+    return storage->scan(prefix, startAfter, limit, keys);
+}
+
+bool ReplicatedStorage::supportsRanges()
+{
+    return storage->supportsRanges();
+}
+
+bool ReplicatedStorage::getRange(const string& key, long long offset, size_t length, string& value, long long& totalSize)
+{
+    return storage->getRange(key, offset, length, value, totalSize);
+}
+
+// The value is read back, the file may be gone after the put.
+void ReplicatedStorage::putFile(const string& key, const string& fileName)
+{
+    storage->putFile(key, fileName);
+
+    string value;
+    if (storage->get(key, value))
+        log.append(REPLICATE_PUT, key, value, 0);
+}
+
+void ReplicatedStorage::collectStats(map<string, long long>& stats)
+{
+    storage->collectStats(stats);
+    log.collectStats(stats);
+}
+
+bool ReplicatedStorage::backup(const string& directory)
+{
+    return storage->backup(directory);
+}
+
+// ==============================================================================
+
+Replica::Replica(const string& host, int port, const string& fileName, const ApplyCallback& apply, const WipeCallback& wipe)
+        : host(host), port(port), fileName(fileName), apply(apply), wipe(wipe),
+        logId(0), sequence(0), primarySequence(0), snapshots(0), applied(0)
+{
+    load();
+    thread = boost::thread(boost::bind(&Replica::run, this));
+}
+
+Replica::~Replica()
+{
+    thread.interrupt();
+    thread.join();
+}
+
+// The file is <log-id:8><sequence:8>, zero log id means there is no consistent copy.
+void Replica::load()
+{
+    FILE* f = fopen(fileName.c_str(), "rb");
+    if (f != 0)
+    {
+        long long position[2];
+        if (fread(position, sizeof(position), 1, f) == 1)
+        {
+            logId = position[0];
+            sequence = position[1];
+        }
+        fclose(f);
+    }
+}
+
+void Replica::save()
+{
+    long long position[2] = {logId, sequence};
+
+    string tempFileName = fileName + ".tmp";
+    FILE* f = fopen(tempFileName.c_str(), "wb");
+    if (f == 0)
+        return;
+    bool written = fwrite(position, sizeof(position), 1, f) == 1;
+    written = fclose(f) == 0 && written;
+
+    boost::system::error_code error;
+    if (written)
+        boost::filesystem::rename(tempFileName, fileName, error);
+}
+
+struct ReplicateResponse
+{
+    unsigned char status;
+    long long logId;
+    long long sequence;
+    long long lastSequence;
+    bool more;
+    string cursor;
+    vector<ReplicationRecord> records;
+};
+
+static void replicate(Client& client, unsigned char flags, long long logId, long long sequence, const string& cursor,
+        ReplicateResponse& result)
+{
+    Request request(PROTOCOL_VERSION, REPLICATE, 0, Bytes(), Bytes(), Bytes());
+    request.flags = flags;
+    request.logId = logId;
+    request.sequence = sequence;
+    request.cursor = Bytes(int32(cursor.length()), (byte*) cursor.data());
+    client.send(request);
+
+    Response response;
+    client.receive(response);
+    if (!response.verdict)
+        throw runtime_error("The server is not a primary");
+
+    string data(response.data.data, response.data.data + response.data.size);
+    size_t pos = 0;
+    unsigned char more;
+    string compressed;
+    string records;
+    if (!readBinary(data, pos, result.status) || !readBinary(data, pos, result.logId)
+            || !readBinary(data, pos, result.sequence) || !readBinary(data, pos, result.lastSequence)
+            || !readBinary(data, pos, more) || !readString(data, pos, result.cursor)
+            || !readString(data, pos, compressed) || pos != data.length()
+            || !snappy::Uncompress(compressed.data(), compressed.length(), &records)
+            || !parseRecords(records, result.records))
+        throw runtime_error("Invalid replication response");
+    result.more = more != 0;
+}
+
+void Replica::follow()
+{
+    Client client(host, port);
+
+    while (true)
+    {
+        boost::this_thread::interruption_point();
+
+        long long currentLogId;
+        long long currentSequence;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            currentLogId = logId;
+            currentSequence = sequence;
+        }
+
+        if (currentLogId == 0)
+        {
+            wipe();
+
+            string cursor;
+            long long snapshotLogId = 0;
+            long long snapshotSequence = 0;
+            do
+            {
+                ReplicateResponse response;
+                replicate(client, REPLICATE_SNAPSHOT, 0, 0, cursor, response);
+                if (cursor.empty())
+                {
+                    snapshotLogId = response.logId;
+                    snapshotSequence = response.sequence;
+                }
+
+                for (size_t i = 0; i < response.records.size(); i++)
+                    apply(response.records[i]);
+
+                boost::unique_lock<boost::mutex> lock(mutex);
+                applied += (long long) response.records.size();
+                primarySequence = response.lastSequence;
+                cursor = response.cursor;
+                if (!response.more)
+                {
+                    logId = snapshotLogId;
+                    sequence = snapshotSequence;
+                    snapshots++;
+                }
+                if (!response.more || cursor.empty())
+                    break;
+            }
+            while (true);
+
+            save();
+            continue;
+        }
+
+        ReplicateResponse response;
+        replicate(client, REPLICATE_LOG, currentLogId, currentSequence, "", response);
+        if (response.status == REPLICATE_SNAPSHOT_NEEDED)
+        {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                logId = 0;
+                sequence = 0;
+            }
+            save();
+            continue;
+        }
+
+        for (size_t i = 0; i < response.records.size(); i++)
+            apply(response.records[i]);
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            applied += (long long) response.records.size();
+            sequence = response.sequence;
+            primarySequence = response.lastSequence;
+        }
+
+        if (!response.records.empty())
+            save();
+        if (!response.more)
+            boost::this_thread::sleep(boost::posix_time::milliseconds(REPLICA_POLL_INTERVAL_MILLIS));
+    }
+}
+
+void Replica::run()
+{
+    try
+    {
+        while (true)
+        {
+            try
+            {
+                follow();
+            }
+            catch (std::exception& e)
+            {
+                fprintf(stderr, "Replication from %s:%d failed: %s\n", host.c_str(), port, e.what());
+            }
+            boost::this_thread::sleep(boost::posix_time::milliseconds(REPLICA_RECONNECT_INTERVAL_MILLIS));
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+        // Stopped by the destructor.
+    }
+}
+
+void Replica::collectStats(map<string, long long>& stats)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    stats["replica_sequence"] = sequence;
+    stats["replica_lag"] = logId == 0 ? primarySequence : max(primarySequence - sequence, 0LL);
+    stats["replica_snapshots"] = snapshots;
+    stats["replica_applied_records"] = applied;
+}
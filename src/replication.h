@@ -0,0 +1,158 @@
+#ifndef RIORITA_REPLICATION_H_
+#define RIORITA_REPLICATION_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "storage.h"
+
+namespace riorita {
+
+enum ReplicationOperation
+{
+    REPLICATE_PUT = 1,
+    REPLICATE_ERASE = 2,
+    // The number is TTL in milliseconds, 0 removes the expiration.
+    REPLICATE_EXPIRE = 3,
+    // The key is the namespace, the number is its generation.
+    REPLICATE_GENERATION = 4
+};
+
+// Flags of REPLICATE requests and statuses of responses.
+const unsigned char REPLICATE_LOG = 0;
+const unsigned char REPLICATE_SNAPSHOT = 1;
+const unsigned char REPLICATE_OK = 0;
+const unsigned char REPLICATE_SNAPSHOT_NEEDED = 1;
+
+struct ReplicationRecord
+{
+    ReplicationOperation operation;
+    std::string key;
+    std::string value;
+    long long number;
+};
+
+// Records are <operation:1><key-length:4><key> followed by <value-length:4><value> for PUT
+// or by <number:8> for EXPIRE and GENERATION. Batches of them are snappy-compressed.
+void appendRecord(std::string& records, ReplicationOperation operation, const std::string& key,
+        const std::string& value, long long number);
+bool parseRecords(const std::string& records, std::vector<ReplicationRecord>& parsed);
+
+// Mutations of the primary numbered by sequence. The recent ones are kept in memory up to
+// the capacity in bytes; a replica which is behind the oldest kept one takes a snapshot.
+// The log is saved to the file on shutdown and taken from it (the file is removed) on start,
+// so replicas of a restarted primary continue. After a crash the id is new: sequences of writes
+// a replica has seen may be reused, so replicas take a snapshot.
+class ReplicationLog
+{
+public:
+    ReplicationLog(size_t capacity, const std::string& fileName);
+
+    // Writes the log to the file, called when no more writes are done.
+    void save();
+
+    void append(ReplicationOperation operation, const std::string& key, const std::string& value, long long number);
+
+    long long getId() const
+    {
+        return id;
+    }
+
+    long long getLastSequence();
+
+    // Appends records after the sequence up to about maxSize bytes, sets the sequence of the last one
+    // and whether more follow. Returns false if the records after the sequence are not kept any more.
+    bool read(long long after, size_t maxSize, std::string& records, long long& last, bool& more);
+
+    void collectStats(std::map<std::string, long long>& stats);
+
+private:
+    bool load();
+    void trim();
+
+    long long id;
+    const size_t capacity;
+    const std::string fileName;
+
+    boost::mutex mutex;
+    // Encoded records, the first one has sequence firstSequence.
+    std::deque<std::string> records;
+    long long firstSequence;
+    size_t size;
+};
+
+// Appends writes to the log after they are done. Callers hold the lock of the key, so records
+// of a key are in the order of writes.
+class ReplicatedStorage: public Storage
+{
+public:
+    ReplicatedStorage(Storage* storage, ReplicationLog& log);
+
+    bool has(const std::string& key);
+    bool get(const std::string& key, std::string& value);
+    void erase(const std::string& key);
+    void put(const std::string& key, const std::string& value);
+    void erasePrefix(const std::string& prefix);
+    bool scan(const std::string& prefix, const std::string& startAfter, size_t limit,
+            std::vector<std::string>& keys);
+    bool supportsRanges();
+    bool getRange(const std::string& key, long long offset, size_t length,
+            std::string& value, long long& totalSize);
+    void putFile(const std::string& key, const std::string& fileName);
+    void collectStats(std::map<std::string, long long>& stats);
+    bool backup(const std::string& directory);
+
+private:
+    boost::shared_ptr<Storage> storage;
+    ReplicationLog& log;
+};
+
+// Follows a primary: polls it for records by REPLICATE requests and applies them by the callback.
+// Without a known position (first start, a restarted primary, a replica too far behind) it wipes
+// local data and copies a snapshot page by page, then follows the log from the sequence at the start
+// of the snapshot: records between are applied twice, which is harmless as they set final states.
+// The position is saved to a file, so a restarted replica continues from it.
+class Replica
+{
+public:
+    typedef boost::function<void (const ReplicationRecord& record)> ApplyCallback;
+    typedef boost::function<void ()> WipeCallback;
+
+    Replica(const std::string& host, int port, const std::string& fileName,
+            const ApplyCallback& apply, const WipeCallback& wipe);
+    ~Replica();
+
+    void collectStats(std::map<std::string, long long>& stats);
+
+private:
+    void load();
+    void save();
+    void run();
+    void follow();
+
+    std::string host;
+    int port;
+    std::string fileName;
+    ApplyCallback apply;
+    WipeCallback wipe;
+
+    boost::mutex mutex;
+    long long logId;
+    long long sequence;
+    long long primarySequence;
+    long long snapshots;
+    long long applied;
+
+    boost::thread thread;
+};
+
+}
+
+#endif
@@ -2,9 +2,20 @@
 #include "storage.h"
 #include "logger.h"
 #include "cache.h"
+#include "locks.h"
+#include "expiration.h"
+#include "namespaces.h"
+#include "uploads.h"
+#include "metrics.h"
+#include "trace.h"
+#include "hotkeys.h"
+#include "replication.h"
+#include "invalidations.h"
+#include "snappy.h"
 
 #include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <deque>
 #include <iostream>
@@ -12,6 +23,7 @@
 #include <ctime>
 #include <map>
 #include <set>
+#include <sstream>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/bind.hpp>
@@ -29,14 +41,38 @@ using namespace std;
 
 const riorita::int32 MIN_VALID_REQUEST_SIZE = 15;
 const riorita::int32 MAX_VALID_REQUEST_SIZE = 1073741824;
+const size_t MAX_SCAN_LIMIT = 10000;
+const size_t MAX_SCAN_RESPONSE_SIZE = 16 * 1024 * 1024;
+const size_t MAX_HTTP_REQUEST_SIZE = 64 * 1024;
+const size_t MAX_HOT_KEYS_LIMIT = 1000;
+const size_t MAX_REPLICATION_BATCH_SIZE = 4 * 1024 * 1024;
+const size_t REPLICATION_SNAPSHOT_PAGE_KEYS = 1000;
 
 class Session;
 typedef boost::shared_ptr<Session> SessionPtr;
 set<SessionPtr> sessions;
 
+riorita::Metrics metrics;
 riorita::Cache cache;
 boost::shared_ptr<riorita::Logger> lout;
 boost::shared_ptr<riorita::Storage> storage;
+riorita::StripedLocks keyLocks;
+riorita::KeyVersions keyVersions;
+boost::shared_ptr<riorita::Expirations> expirations;
+boost::shared_ptr<riorita::Namespaces> namespaces;
+boost::shared_ptr<riorita::Uploads> uploads;
+boost::shared_ptr<riorita::TraceRecorder> tracer;
+boost::shared_ptr<riorita::HotKeys> hotKeys;
+size_t pinnedHotKeyCount = 0;
+// GET returns a value as a whole, so its size is bounded below the 32-bit size of a response.
+// RANGE_GET and PUT_CHUNK move at most maxChunkSize bytes, so a request never makes the server hold more.
+size_t maxValueSize = 0;
+size_t maxChunkSize = 0;
+boost::shared_ptr<riorita::ReplicationLog> replicationLog;
+boost::shared_ptr<riorita::Replica> replica;
+boost::shared_ptr<riorita::Invalidations> invalidations;
+string backupDirectory;
+string dataDirectory;
 
 static long long currentTimeMillis()
 {
@@ -90,20 +126,467 @@ static bool string_address_matches(const std::string& ip, std::string network)
     return (ip_addr & network_mask) == network_addr;
 }
 
+static vector<string> splitBySemicolon(const string& s)
+{
+    vector<string> result;
+    string item;
+    for (size_t i = 0; i < s.length(); i++)
+        if (s[i] != ';')
+            item += s[i];
+        else if (!item.empty())
+        {
+            result.push_back(item);
+            item = "";
+        }
+    if (!item.empty())
+        result.push_back(item);
+    return result;
+}
+
+// Called under the lock of the key after the value is written.
+static void setExpiration(const string& key, long long ttl)
+{
+    // Most values never expire, records of them would only double the replication log.
+    bool replicated = replicationLog && (ttl > 0 || expirations->get(key) != 0);
+    expirations->set(key, ttl);
+    if (replicated)
+        replicationLog->append(riorita::REPLICATE_EXPIRE, key, "", ttl);
+}
+
+// Reads the current value of a key for a conditional write, the key lock is held by the caller.
+static bool getCurrentValue(const string& key, string& value)
+{
+    if (expirations->isExpired(key))
+        return false;
+    return cache.get(key, value) || storage->get(key, value);
+}
+
+// Executes PUT_IF_ABSENT, COMPARE_AND_SET, COMPARE_AND_DELETE or APPEND under the key lock,
+// returns the verdict and the token of the new value.
+static bool processConditionalWrite(const riorita::Request& request, const string& key, riorita::int64& cas)
+{
+    string value(request.value.data, request.value.data + request.value.size);
+    boost::unique_lock<boost::mutex> lock(keyLocks.get(key));
+
+    string current;
+    bool exists = getCurrentValue(key, current);
+
+    if (request.type == riorita::PUT_IF_ABSENT && exists)
+        return false;
+
+    if ((request.type == riorita::COMPARE_AND_SET || request.type == riorita::COMPARE_AND_DELETE)
+            && (!exists || keyVersions.get(key) != request.cas))
+        return false;
+
+    if (request.type == riorita::COMPARE_AND_DELETE)
+    {
+        cache.erase(key);
+        storage->erase(key);
+        expirations->remove(key);
+        keyVersions.next(key);
+        return true;
+    }
+
+    if (request.type == riorita::APPEND && current.length() + value.length() > maxValueSize)
+        return false;
+
+    // Append keeps the expiration of an existing value unless a new TTL is given.
+    if (request.type == riorita::APPEND)
+        value = current + value;
+
+    cache.put(key, value);
+    storage->put(key, value);
+    if (request.type != riorita::APPEND || request.ttl > 0 || !exists)
+        setExpiration(key, request.ttl);
+
+    cas = keyVersions.next(key);
+    return true;
+}
+
+template<typename T>
+static void appendBinary(string& data, const T& value)
+{
+    data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Lists a page of keys of the namespace starting with the prefix (the key of the request) after the cursor.
+// The data is <more:1><cursor-length:4><cursor><count:4> and entries
+// <key-length:4><key>[<size:8>][<value-length:4><value>][<ttl-millis:8>].
+// The cursor is the last key looked at: expired keys are skipped, and a page of the empty namespace ends
+// at keys of other namespaces with the cursor after them, so a page may be shorter than the limit
+// or even empty while more keys follow.
+static bool processScan(const riorita::Request& request, const string& space, string& data)
+{
+    string spacePrefix = namespaces->getStorageKey(space, "");
+    string prefix = spacePrefix + string(request.key.data, request.key.data + request.key.size);
+    string cursor(request.cursor.data, request.cursor.data + request.cursor.size);
+    size_t limit = request.limit == 0 ? MAX_SCAN_LIMIT : min(size_t(request.limit), MAX_SCAN_LIMIT);
+
+    vector<string> keys;
+    bool more = storage->scan(prefix, cursor.empty() ? "" : spacePrefix + cursor, limit, keys);
+    bool ttls = request.version >= 11 && (request.flags & riorita::SCAN_TTLS) != 0;
+    long long now = riorita::Expirations::currentTimeMillis();
+
+    string entries;
+    riorita::int32 count = 0;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (!riorita::Namespaces::isValidKey(space, keys[i]))
+        {
+            cursor = riorita::Namespaces::getNamespacedKeysEnd();
+            more = true;
+            break;
+        }
+
+        if (expirations->isExpired(keys[i]))
+        {
+            cursor = keys[i].substr(spacePrefix.length());
+            continue;
+        }
+
+        string value;
+        if ((request.flags & (riorita::SCAN_SIZES | riorita::SCAN_VALUES)) != 0
+                && !cache.get(keys[i], value) && !storage->get(keys[i], value))
+            continue;
+
+        string entry;
+        string key = keys[i].substr(spacePrefix.length());
+        appendBinary(entry, riorita::int32(key.length()));
+        entry += key;
+        if ((request.flags & riorita::SCAN_SIZES) != 0)
+            appendBinary(entry, riorita::int64(value.length()));
+        if ((request.flags & riorita::SCAN_VALUES) != 0)
+        {
+            appendBinary(entry, riorita::int32(value.length()));
+            entry += value;
+        }
+        // Zero means no expiration, a key about to expire has at least a millisecond.
+        if (ttls)
+        {
+            long long expiresAt = expirations->get(keys[i]);
+            appendBinary(entry, riorita::int64(expiresAt == 0 ? 0 : max(expiresAt - now, 1LL)));
+        }
+
+        // The rest of the page is left for the next request, but at least one entry is returned.
+        if (count > 0 && entries.length() + entry.length() > MAX_SCAN_RESPONSE_SIZE)
+        {
+            more = true;
+            break;
+        }
+
+        entries += entry;
+        count++;
+        cursor = key;
+    }
+
+    data.clear();
+    appendBinary(data, riorita::byte(more ? 1 : 0));
+    appendBinary(data, riorita::int32(cursor.length()));
+    data += cursor;
+    appendBinary(data, count);
+    data += entries;
+    return true;
+}
+
+// Counters of the cache, the storage, the trace, hot keys and the replica: /metrics exports them as gauges.
+static void collectGauges(map<string, long long>& stats)
+{
+    cache.collectStats(stats);
+    storage->collectStats(stats);
+    if (tracer)
+        tracer->collectStats(stats);
+    if (hotKeys)
+        hotKeys->collectStats(stats);
+    if (replica)
+        replica->collectStats(stats);
+}
+
+// Counters of the server and of its components.
+static void collectStats(map<string, long long>& stats)
+{
+    metrics.collect(stats);
+    collectGauges(stats);
+}
+
+// The data is <count:4> and entries <name-length:4><name><value:8>.
+static bool processStats(string& data)
+{
+    map<string, long long> stats;
+    collectStats(stats);
+
+    data.clear();
+    appendBinary(data, riorita::int32(stats.size()));
+    for (auto i = stats.begin(); i != stats.end(); ++i)
+    {
+        appendBinary(data, riorita::int32(i->first.length()));
+        data += i->first;
+        appendBinary(data, riorita::int64(i->second));
+    }
+    return true;
+}
+
+// The data is <count:4> and entries <namespace-length:4><namespace><key-length:4><key><count:8><error:8>
+// by descending counts. Fails if hot keys are not tracked.
+static bool processHotKeys(const riorita::Request& request, string& data)
+{
+    if (!hotKeys)
+        return false;
+
+    size_t limit = request.limit == 0 ? MAX_HOT_KEYS_LIMIT : min(size_t(request.limit), MAX_HOT_KEYS_LIMIT);
+    vector<riorita::HotKeys::Entry> entries;
+    hotKeys->getTop(limit, entries);
+
+    data.clear();
+    appendBinary(data, riorita::int32(entries.size()));
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        string space;
+        string key;
+        riorita::Namespaces::parseStorageKey(entries[i].key, space, key);
+        appendBinary(data, riorita::int32(space.length()));
+        data += space;
+        appendBinary(data, riorita::int32(key.length()));
+        data += key;
+        appendBinary(data, riorita::int64(entries[i].count));
+        appendBinary(data, riorita::int64(entries[i].error));
+    }
+    return true;
+}
+
+// A snapshot page lists keys after the cursor with values and TTLs, the first page starts with
+// generations of namespaces.
+static void readSnapshotPage(const string& startAfter, string& records, bool& more, string& cursor)
+{
+    if (startAfter.empty())
+    {
+        map<string, long long> generations;
+        namespaces->getGenerations(generations);
+        for (auto i = generations.begin(); i != generations.end(); ++i)
+            riorita::appendRecord(records, riorita::REPLICATE_GENERATION, i->first, "", i->second);
+    }
+
+    vector<string> keys;
+    more = storage->scan("", startAfter, REPLICATION_SNAPSHOT_PAGE_KEYS, keys);
+    cursor = startAfter;
+
+    string value;
+    long long now = riorita::Expirations::currentTimeMillis();
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (records.length() >= MAX_REPLICATION_BATCH_SIZE)
+        {
+            more = true;
+            break;
+        }
+        cursor = keys[i];
+
+        long long expiresAt = expirations->get(keys[i]);
+        if ((expiresAt != 0 && expiresAt <= now) || !storage->get(keys[i], value))
+            continue;
+        riorita::appendRecord(records, riorita::REPLICATE_PUT, keys[i], value, 0);
+        if (expiresAt != 0)
+            riorita::appendRecord(records, riorita::REPLICATE_EXPIRE, keys[i], "", expiresAt - now);
+    }
+}
+
+// The data is <status:1><log-id:8><sequence:8><last-sequence:8><more:1><cursor-length:4><cursor>
+// <records-length:4><snappy-compressed records>. For the log the sequence is of the last returned record,
+// for a snapshot it is taken before reading the page and the replica follows the log from it.
+// Fails if the server keeps no replication log.
+static bool processReplicate(const riorita::Request& request, string& data)
+{
+    if (!replicationLog)
+        return false;
+
+    unsigned char status = riorita::REPLICATE_OK;
+    long long sequence = request.sequence;
+    long long lastSequence = replicationLog->getLastSequence();
+    bool more = false;
+    string cursor;
+    string records;
+
+    if (request.flags == riorita::REPLICATE_SNAPSHOT)
+    {
+        sequence = lastSequence;
+        readSnapshotPage(string(request.cursor.data, request.cursor.data + request.cursor.size), records, more, cursor);
+    }
+    else if (request.logId != replicationLog->getId()
+            || !replicationLog->read(request.sequence, MAX_REPLICATION_BATCH_SIZE, records, sequence, more))
+        status = riorita::REPLICATE_SNAPSHOT_NEEDED;
+
+    string compressed;
+    snappy::Compress(records.data(), records.length(), &compressed);
+
+    data.clear();
+    appendBinary(data, status);
+    appendBinary(data, riorita::int64(replicationLog->getId()));
+    appendBinary(data, riorita::int64(sequence));
+    appendBinary(data, riorita::int64(lastSequence));
+    appendBinary(data, riorita::byte(more ? 1 : 0));
+    appendBinary(data, riorita::int32(cursor.length()));
+    data += cursor;
+    appendBinary(data, riorita::int32(compressed.length()));
+    data += compressed;
+    return true;
+}
+
+// Registers hashes of keys cached by the near cache of the client and returns the modified ones.
+// The data is <subscription:8><sequence:8><reset:1><count:4> and hashes <hash:8>.
+// Fails if the server doesn't track invalidations.
+static bool processInvalidations(const riorita::Request& request, string& data)
+{
+    if (!invalidations)
+        return false;
+
+    vector<long long> cached(size_t(request.hashes.size) / sizeof(riorita::int64));
+    if (!cached.empty())
+        memcpy(&cached[0], request.hashes.data, size_t(request.hashes.size));
+
+    long long subscription = request.subscription;
+    long long sequence = request.sequence;
+    bool reset;
+    vector<long long> invalidated;
+    invalidations->poll(subscription, sequence, cached, reset, invalidated);
+
+    data.clear();
+    appendBinary(data, riorita::int64(subscription));
+    appendBinary(data, riorita::int64(sequence));
+    appendBinary(data, riorita::byte(reset ? 1 : 0));
+    appendBinary(data, riorita::int32(invalidated.size()));
+    for (size_t i = 0; i < invalidated.size(); i++)
+        appendBinary(data, riorita::int64(invalidated[i]));
+    return true;
+}
+
+// Writes a backup of the data into the new subdirectory of --backup-dir named by the key, the server keeps
+// serving meanwhile. Fails if backups are disabled, the name is taken or the backend can't do it.
+static bool processBackup(const riorita::Request& request)
+{
+    string name(request.key.data, request.key.data + request.key.size);
+    if (backupDirectory.empty() || name.empty() || name == "." || name == ".."
+            || name.find('/') != string::npos || name.find('\\') != string::npos)
+        return false;
+
+    boost::filesystem::path directory = boost::filesystem::path(backupDirectory) / name;
+    boost::system::error_code error;
+    boost::filesystem::create_directories(backupDirectory, error);
+    // Creating the directory claims the name, concurrent backups with the same name fail.
+    if (error || !boost::filesystem::create_directory(directory, error) || error)
+        return false;
+
+    bool result = storage->backup(directory.string());
+    expirations->flush();
+
+    // Both files are appended by records, a record torn by the copy is dropped on load.
+    const char* files[] = {"riorita.namespaces", "riorita.expirations"};
+    for (size_t i = 0; result && i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        boost::filesystem::path file = boost::filesystem::path(dataDirectory) / files[i];
+        if (boost::filesystem::exists(file, error))
+        {
+            boost::filesystem::copy_file(file, directory / files[i], error);
+            result = !error;
+        }
+    }
+
+    if (!result)
+        boost::filesystem::remove_all(directory, error);
+
+    *lout << "Backup into " << directory.string() << (result ? " is written" : " failed") << endl;
+    return result;
+}
+
+static bool isWrite(riorita::RequestType type)
+{
+    return type == riorita::PUT || type == riorita::DELETE || type == riorita::DROP_NAMESPACE
+        || type == riorita::PUT_IF_ABSENT || type == riorita::COMPARE_AND_SET || type == riorita::COMPARE_AND_DELETE
+        || type == riorita::APPEND || type == riorita::PUT_CHUNK;
+}
+
+static bool exceedsSizeLimits(const riorita::Request& request)
+{
+    if (riorita::hasValue(request.type)
+            && size_t(request.value.size) > (request.type == riorita::PUT_CHUNK ? maxChunkSize : maxValueSize))
+        return true;
+
+    return (request.type == riorita::PUT_CHUNK && request.totalSize > (long long) maxValueSize)
+        || (request.type == riorita::RANGE_GET && (request.length < 0 || size_t(request.length) > maxChunkSize));
+}
+
+static bool hasKey(riorita::RequestType type)
+{
+    return type == riorita::HAS || type == riorita::GET || type == riorita::PUT || type == riorita::DELETE
+        || type == riorita::PUT_IF_ABSENT || type == riorita::COMPARE_AND_SET || type == riorita::COMPARE_AND_DELETE
+        || type == riorita::APPEND || type == riorita::RANGE_GET || type == riorita::PUT_CHUNK || type == riorita::SCAN;
+}
+
 riorita::Bytes processRequest(const string& remoteAddr, const riorita::Request& request)
 {
     long long startTimeMillis = currentTimeMillis();
+    long long startTimeMicros = riorita::Metrics::currentTimeMicros();
 
     bool success = true;
     bool verdict = false;
+    bool cacheHit = false;
     string data;
+    riorita::int64 number = 0;
 
     if (request.type == riorita::PING)
         verdict = true;
 
-    string key(request.key.data, request.key.data + request.key.size);
+    // Replicas change only by the records of the primary.
+    if (replica && isWrite(request.type))
+    {
+        *lout
+             << "Rejected " << riorita::toChars(request.type) << " on replica"
+             << " [" << remoteAddr << ", id=" << request.id << "]"
+             << endl;
+        return newResponse(request, false, false, 0, null);
+    }
+
+    // Backends which read values only as a whole would hold a large value in memory for every range.
+    if ((request.type == riorita::RANGE_GET || request.type == riorita::PUT_CHUNK) && !storage->supportsRanges())
+    {
+        *lout
+             << "Rejected " << riorita::toChars(request.type) << ": the backend doesn't support ranges"
+             << " [" << remoteAddr << ", id=" << request.id << "]"
+             << endl;
+        return newResponse(request, false, false, 0, null);
+    }
 
-    if (request.type == riorita::HAS)
+    if (exceedsSizeLimits(request))
+    {
+        *lout
+             << "Rejected " << riorita::toChars(request.type) << ": the value or the range exceeds"
+             << " --max-value-size or --max-chunk-size"
+             << " [" << remoteAddr << ", id=" << request.id << "]"
+             << endl;
+        return newResponse(request, false, false, 0, null);
+    }
+
+    string space(request.space.data, request.space.data + request.space.size);
+    string requestKey(request.key.data, request.key.data + request.key.size);
+
+    // Keys of the empty namespace starting with '~' would reach keys of other namespaces.
+    if (hasKey(request.type) && !riorita::Namespaces::isValidKey(space, requestKey))
+    {
+        *lout
+             << "Rejected " << riorita::toChars(request.type) << ": keys of the empty namespace can't start with '~'"
+             << " [" << remoteAddr << ", id=" << request.id << "]"
+             << endl;
+        return newResponse(request, false, false, 0, null);
+    }
+
+    string key = namespaces->getStorageKey(space, requestKey);
+
+    // Expired keys are hidden until the expiration thread removes them.
+    bool read = request.type == riorita::HAS || request.type == riorita::GET || request.type == riorita::RANGE_GET;
+    bool expired = read && expirations->isExpired(key);
+
+    if (read && hotKeys)
+        hotKeys->add(key);
+
+    if (request.type == riorita::HAS && !expired)
     {
         if (cache.has(key))
         {
@@ -114,13 +597,15 @@ riorita::Bytes processRequest(const string& remoteAddr, const riorita::Request&
                 << " [" << remoteAddr << ", id=" << request.id << "]"
                 << endl;
             verdict = true;
+            cacheHit = true;
         }
         else
             verdict = storage->has(key);
     }
 
-    if (request.type == riorita::GET)
+    if (request.type == riorita::GET && !expired)
     {
+        riorita::int64 cas = request.version >= 4 ? keyVersions.get(key) : 0;
         if (cache.get(key, data))
         {
            *lout
@@ -130,28 +615,124 @@ riorita::Bytes processRequest(const string& remoteAddr, const riorita::Request&
                 << " [" << remoteAddr << ", id=" << request.id << "]"
                 << endl;
             verdict = true;
+            cacheHit = true;
+        }
+        else if (pinnedHotKeyCount > 0 && cache.isPinned(key))
+        {
+            // Read under the lock of the key, so a concurrent PUT can't be overwritten in the cache by the old value.
+            boost::unique_lock<boost::mutex> lock(keyLocks.get(key));
+            verdict = storage->get(key, data);
+            if (verdict)
+                cache.put(key, data);
         }
         else
             verdict = storage->get(key, data);
+
+        // A value stored before --max-value-size was lowered is read by RANGE_GET only.
+        if (verdict && data.length() > maxValueSize)
+        {
+            *lout
+                 << "Rejected " << riorita::toChars(request.type) << ": the value of " << data.length()
+                 << " bytes exceeds --max-value-size"
+                 << " [" << remoteAddr << ", id=" << request.id << "]"
+                 << endl;
+            success = false;
+            verdict = false;
+            data.clear();
+        }
+
+        if (verdict && request.version >= 4)
+            number = cas;
     }
 
 #undef DELETE
     if (request.type == riorita::DELETE)
     {
+        boost::unique_lock<boost::mutex> lock(keyLocks.get(key));
         cache.erase(key);
         storage->erase(key);
+        expirations->remove(key);
+        keyVersions.next(key);
         verdict = true;
     }
 
     if (request.type == riorita::PUT)
     {
         string value(request.value.data, request.value.data + request.value.size);
+        boost::unique_lock<boost::mutex> lock(keyLocks.get(key));
         cache.put(key, value);
         storage->put(key, value);
+        setExpiration(key, request.ttl);
+        verdict = true;
+
+        riorita::int64 cas = keyVersions.next(key);
+        if (request.version >= 4)
+            number = cas;
+    }
+
+    if (request.type == riorita::PUT_IF_ABSENT || request.type == riorita::COMPARE_AND_SET
+            || request.type == riorita::COMPARE_AND_DELETE || request.type == riorita::APPEND)
+        verdict = processConditionalWrite(request, key, number);
+
+    // Ranges are read from the storage directly: the cache would copy the whole value.
+    if (request.type == riorita::RANGE_GET && !expired)
+        verdict = storage->getRange(key, request.offset, size_t(request.length), data, number);
+
+    // Chunks are staged aside, the complete value is put at once.
+    if (request.type == riorita::PUT_CHUNK)
+    {
+        boost::unique_lock<boost::mutex> lock(keyLocks.get(key));
+        string completedFileName;
+        verdict = uploads->append(key, request.offset, request.totalSize,
+                reinterpret_cast<const char*>(request.value.data), size_t(request.value.size), completedFileName);
+
+        if (verdict && !completedFileName.empty())
+        {
+            cache.erase(key);
+            storage->putFile(key, completedFileName);
+            setExpiration(key, request.ttl);
+            keyVersions.next(key);
+
+            boost::system::error_code error;
+            boost::filesystem::remove(completedFileName, error);
+        }
+    }
+
+    if (request.type == riorita::SCAN)
+        verdict = processScan(request, space, data);
+
+    if (request.type == riorita::STATS)
+        verdict = processStats(data);
+
+    if (request.type == riorita::HOT_KEYS)
+        verdict = processHotKeys(request, data);
+
+    if (request.type == riorita::REPLICATE)
+        verdict = processReplicate(request, data);
+
+    if (request.type == riorita::INVALIDATIONS)
+        verdict = processInvalidations(request, data);
+
+    if (request.type == riorita::BACKUP)
+        verdict = processBackup(request);
+
+    // The default namespace can't be dropped: it would take a scan of all keys.
+    if (request.type == riorita::DROP_NAMESPACE && !space.empty())
+    {
+        long long generation = namespaces->drop(space);
+        if (replicationLog)
+            replicationLog->append(riorita::REPLICATE_GENERATION, space, "", generation);
+        if (invalidations)
+            invalidations->invalidateAll();
         verdict = true;
     }
 
     int size = max(int(data.length()), int(request.value.size));
+    long long latencyMicros = riorita::Metrics::currentTimeMicros() - startTimeMicros;
+    metrics.addRequest(request.type, latencyMicros);
+    if (tracer)
+        tracer->record(request.type, verdict, cacheHit, request.space, request.key, request.value.size,
+                riorita::int32(data.length()), startTimeMicros, latencyMicros);
 
     *lout
          << "Processed " << riorita::toChars(request.type)
@@ -162,7 +743,7 @@ riorita::Bytes processRequest(const string& remoteAddr, const riorita::Request&
 
     return newResponse(request, success, verdict,
             static_cast<riorita::int32>(data.length()),
-            reinterpret_cast<const riorita::byte*>(data.c_str()));
+            reinterpret_cast<const riorita::byte*>(data.c_str()), number);
 }
 
 class Session: public boost::enable_shared_from_this<Session>
@@ -171,6 +752,8 @@ public:
     virtual ~Session()
     {
         *lout << "Connection closed " << remoteAddr << endl;
+        if (accepted)
+            metrics.add(riorita::CONNECTIONS_CLOSED);
 
         response.reset();
         requestBytes.reset();
@@ -180,7 +763,7 @@ public:
     }
 
     Session(boost::asio::io_service& io_service)
-        : _strand(io_service), _socket(io_service), request(null)
+        : _strand(io_service), _socket(io_service), request(null), accepted(false)
     {
     }
 
@@ -211,12 +794,17 @@ public:
         if (allowed)
         {
             *lout << "New connection " << remoteAddr << endl;
+            metrics.add(riorita::CONNECTIONS_ACCEPTED);
+            accepted = true;
             sessions.insert(shared_from_this());
             boost::system::error_code error;
             handleStart(error);    
         }
         else
+        {
             *lout << "Denied " << remoteAddr << endl;
+            metrics.add(riorita::CONNECTIONS_DENIED);
+        }
     }
 
     void handleStart(const boost::system::error_code& error)
@@ -267,7 +855,9 @@ public:
                 << " bytes_transferred=" << bytes_transferred
                 << endl;
             ;
-            
+
+            if (!error)
+                metrics.add(riorita::INVALID_REQUESTS);
             onError();
         }
     }
@@ -280,15 +870,17 @@ public:
 
             long long startTimeMillis = currentTimeMillis();
             request = parseRequest(requestBytes, 0, parsedByteCount);
-            *lout
-                 << "Parsed " << riorita::toChars(request->type)
-                 << " in " << (currentTimeMillis() - startTimeMillis) << " ms"
-                 << ", size=" << requestBytes.size
-                 << " [" << remoteAddr << ", id=" << request->id << "]"
-                 << endl;
 
             if (request != null && parsedByteCount == requestBytes.size)
             {
+                *lout
+                     << "Parsed " << riorita::toChars(request->type)
+                     << " in " << (currentTimeMillis() - startTimeMillis) << " ms"
+                     << ", size=" << requestBytes.size
+                     << " [" << remoteAddr << ", id=" << request->id << "]"
+                     << endl;
+
+                metrics.add(riorita::BYTES_IN, requestBytes.size + riorita::int32(sizeof(riorita::int32)));
                 response = processRequest(remoteAddr, *request);
 
                 *lout
@@ -308,7 +900,8 @@ public:
             else
             {
                 *lout << "Can't parse request: " << remoteAddr << endl;
-                
+                metrics.add(riorita::INVALID_REQUESTS);
+
                 onError();
             }
 
@@ -334,6 +927,7 @@ public:
 
         if (!error && bytes_transferred == responseSize)
         {
+            metrics.add(riorita::BYTES_OUT, (long long) responseSize);
             handleStart(error);
         }
         else
@@ -352,6 +946,7 @@ private:
     riorita::Bytes response;
 
     string remoteAddr;
+    bool accepted;
 };
 
 //----------------------------------------------------------------------
@@ -366,18 +961,7 @@ public:
         : io_service_(io_service),
         acceptor_(io_service)
     {
-        allowed_remote_addrs_.clear();
-        string remote_addr;
-        for (size_t i = 0; i < allowedRemoteAddrs.length(); i++)
-            if (allowedRemoteAddrs[i] != ';')
-                remote_addr += allowedRemoteAddrs[i];
-            else if (!remote_addr.empty())
-            {
-                allowed_remote_addrs_.push_back(remote_addr);
-                remote_addr = "";
-            }
-        if (!remote_addr.empty())
-            allowed_remote_addrs_.push_back(remote_addr);
+        allowed_remote_addrs_ = splitBySemicolon(allowedRemoteAddrs);
 
         *lout << "Allowed size: " << allowed_remote_addrs_.size() << endl;
         for (size_t i = 0; i < allowed_remote_addrs_.size(); i++)
@@ -419,19 +1003,262 @@ typedef std::list<RioritaServerPtr> RioritaServerList;
 
 //----------------------------------------------------------------------
 
-void init(const string& logFile, const string& dataDir, riorita::StorageType storageType)
+// Answers GET /metrics in the Prometheus text format, one request per connection.
+class MetricsSession: public boost::enable_shared_from_this<MetricsSession>
+{
+public:
+    MetricsSession(boost::asio::io_service& io_service)
+        : _socket(io_service), request(MAX_HTTP_REQUEST_SIZE)
+    {
+    }
+
+    tcp::socket& socket()
+    {
+        return _socket;
+    }
+
+    void start(const vector<string>& allowed_remote_addrs)
+    {
+        boost::system::error_code error;
+        string remoteAddr = boost::lexical_cast<std::string>(_socket.remote_endpoint(error));
+
+        bool allowed = false;
+        for (size_t i = 0; i < allowed_remote_addrs.size(); i++)
+            if (!error && string_address_matches(remoteAddr, allowed_remote_addrs[i]))
+                allowed = true;
+
+        if (allowed)
+            boost::asio::async_read_until(_socket, request, "\r\n\r\n",
+                boost::bind(&MetricsSession::handleRequest, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void handleRequest(const boost::system::error_code& error)
+    {
+        if (error)
+            return;
+
+        istream requestStream(&request);
+        string method;
+        string path;
+        requestStream >> method >> path;
+
+        string status = "404 Not Found";
+        string body = "Not found\n";
+        if (method == "GET" && (path == "/metrics" || path.compare(0, 9, "/metrics?") == 0))
+        {
+            map<string, long long> gauges;
+            collectGauges(gauges);
+
+            std::ostringstream out;
+            metrics.writePrometheus(out, gauges);
+            status = "200 OK";
+            body = out.str();
+        }
+
+        std::ostringstream out;
+        out << "HTTP/1.0 " << status << "\r\n"
+            << "Content-Type: text/plain; version=0.0.4\r\n"
+            << "Content-Length: " << body.length() << "\r\n"
+            << "Connection: close\r\n\r\n"
+            << body;
+        response = out.str();
+
+        boost::asio::async_write(_socket, boost::asio::buffer(response),
+            boost::bind(&MetricsSession::handleEnd, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void handleEnd(const boost::system::error_code& /* error */)
+    {
+        boost::system::error_code ignored;
+        _socket.shutdown(tcp::socket::shutdown_both, ignored);
+    }
+
+private:
+    tcp::socket _socket;
+    boost::asio::streambuf request;
+    string response;
+};
+
+typedef boost::shared_ptr<MetricsSession> MetricsSessionPtr;
+
+class MetricsServer
+{
+public:
+    MetricsServer(boost::asio::io_service& io_service,
+        const tcp::endpoint& endpoint, const string& allowedRemoteAddrs)
+        : io_service_(io_service),
+        acceptor_(io_service)
+    {
+        allowed_remote_addrs_ = splitBySemicolon(allowedRemoteAddrs);
+
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen();
+
+        startAccept();
+    }
+
+    void startAccept()
+    {
+        MetricsSessionPtr session(new MetricsSession(io_service_));
+        acceptor_.async_accept(session->socket(),
+            boost::bind(&MetricsServer::handleAccept, this, session,
+            boost::asio::placeholders::error));
+    }
+
+    void handleAccept(MetricsSessionPtr session, const boost::system::error_code& error)
+    {
+        if (!error)
+            session->start(allowed_remote_addrs_);
+
+        startAccept();
+    }
+
+private:
+    boost::asio::io_service& io_service_;
+    tcp::acceptor acceptor_;
+    vector<string> allowed_remote_addrs_;
+};
+
+//----------------------------------------------------------------------
+
+// Removes the key if it is still expired: it could be written again after the wheel was scheduled.
+void expire(const string& key)
+{
+    boost::unique_lock<boost::mutex> lock(keyLocks.get(key));
+    if (expirations->isExpired(key))
+    {
+        cache.erase(key);
+        storage->erase(key);
+        expirations->remove(key);
+        keyVersions.next(key);
+        *lout << "Expired key of length " << key.length() << endl;
+    }
+}
+
+// Removes keys of a dropped namespace generation, called in background.
+void reclaim(const string& prefix)
+{
+    *lout << "Reclaiming keys with prefix " << prefix << endl;
+    cache.erasePrefix(prefix);
+    storage->erasePrefix(prefix);
+    expirations->removePrefix(prefix);
+    *lout << "Reclaimed keys with prefix " << prefix << endl;
+}
+
+// Applies a record of the primary like a request would, so it is logged again for replicas of this replica.
+void applyReplicated(const riorita::ReplicationRecord& record)
+{
+    if (record.operation == riorita::REPLICATE_GENERATION)
+    {
+        namespaces->setGeneration(record.key, record.number);
+        if (replicationLog)
+            replicationLog->append(riorita::REPLICATE_GENERATION, record.key, "", record.number);
+        return;
+    }
+
+    boost::unique_lock<boost::mutex> lock(keyLocks.get(record.key));
+    if (record.operation == riorita::REPLICATE_PUT)
+    {
+        cache.put(record.key, record.value);
+        storage->put(record.key, record.value);
+        keyVersions.next(record.key);
+    }
+    if (record.operation == riorita::REPLICATE_ERASE)
+    {
+        cache.erase(record.key);
+        storage->erase(record.key);
+        expirations->remove(record.key);
+        keyVersions.next(record.key);
+    }
+    if (record.operation == riorita::REPLICATE_EXPIRE)
+        setExpiration(record.key, record.number);
+}
+
+// Removes all data before a snapshot of the primary is copied.
+void wipeReplicated()
+{
+    cache.erasePrefix("");
+    storage->erasePrefix("");
+    expirations->removePrefix("");
+    if (invalidations)
+        invalidations->invalidateAll();
+    *lout << "Wiped data to copy a snapshot of the primary" << endl;
+}
+
+void init(const string& logFile, riorita::StorageType storageType, const riorita::StorageOptions& opts,
+        const string& traceFile, bool traceKeys, size_t traceBuffer, size_t replicationLogSize, const string& replicaOf,
+        size_t invalidationLogSize)
 {
     lout = boost::shared_ptr<riorita::Logger>(new riorita::Logger(logFile));
+    dataDirectory = opts.directory;
 
-    riorita::StorageOptions opts;
-    opts.directory = dataDir;
+    riorita::StorageOptions storageOptions(opts);
+    storageOptions.logger = lout;
 
-    storage = boost::shared_ptr<riorita::Storage>(riorita::newStorage(storageType, opts));
-    if (null == storage)
+    riorita::Storage* backend = null;
+    try
+    {
+        backend = riorita::newStorage(storageType, storageOptions);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+    if (null == backend)
     {
         std::cerr << "Can't initialize storage" << std::endl;
         exit(1);
     }
+    riorita::Storage* decorated = new riorita::MeteredStorage(backend, metrics);
+    if (replicationLogSize > 0)
+    {
+        replicationLog = boost::shared_ptr<riorita::ReplicationLog>(new riorita::ReplicationLog(replicationLogSize,
+                (boost::filesystem::path(opts.directory) / "riorita.replication").string()));
+        decorated = new riorita::ReplicatedStorage(decorated, *replicationLog);
+    }
+    if (invalidationLogSize > 0)
+    {
+        invalidations = boost::shared_ptr<riorita::Invalidations>(new riorita::Invalidations(invalidationLogSize));
+        decorated = new riorita::InvalidatingStorage(decorated, *invalidations);
+    }
+    storage = boost::shared_ptr<riorita::Storage>(decorated);
+
+    expirations = boost::shared_ptr<riorita::Expirations>(new riorita::Expirations(
+            (boost::filesystem::path(opts.directory) / "riorita.expirations").string(), expire));
+    namespaces = boost::shared_ptr<riorita::Namespaces>(new riorita::Namespaces(
+            (boost::filesystem::path(opts.directory) / "riorita.namespaces").string(), reclaim));
+    uploads = boost::shared_ptr<riorita::Uploads>(new riorita::Uploads(
+            (boost::filesystem::path(opts.directory) / "uploads").string()));
+
+    if (!traceFile.empty())
+    {
+        try
+        {
+            tracer = boost::shared_ptr<riorita::TraceRecorder>(new riorita::TraceRecorder(traceFile, traceKeys, traceBuffer));
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            exit(1);
+        }
+    }
+
+    if (!replicaOf.empty())
+    {
+        size_t colon = replicaOf.rfind(':');
+        int primaryPort = colon == string::npos ? 0 : atoi(replicaOf.c_str() + colon + 1);
+        if (primaryPort <= 0)
+        {
+            std::cerr << "Expected --replica-of as host:port, but " << replicaOf << " found" << std::endl;
+            exit(1);
+        }
+
+        *lout << "Replica of " << replicaOf << endl;
+        replica = boost::shared_ptr<riorita::Replica>(new riorita::Replica(replicaOf.substr(0, colon), primaryPort,
+                (boost::filesystem::path(opts.directory) / "riorita.replica").string(), applyReplicated, wipeReplicated));
+    }
 }
 
 #ifdef HAS_ROCKSDB
@@ -444,25 +1271,118 @@ void init(const string& logFile, const string& dataDir, riorita::StorageType sto
 
 boost::asio::io_service io_service(4);
 
+const int STATS_LOG_INTERVAL_SECONDS = 60;
+const int HOT_KEYS_DECAY_INTERVAL_SECONDS = 30;
+
+void logStats(boost::asio::deadline_timer& timer, const boost::system::error_code& error)
+{
+    if (error)
+        return;
+
+    map<string, long long> stats;
+    collectStats(stats);
+
+    std::ostringstream line;
+    line << "Stats:";
+    for (map<string, long long>::const_iterator i = stats.begin(); i != stats.end(); ++i)
+        line << " " << i->first << "=" << i->second;
+    *lout << line.str() << endl;
+
+    timer.expires_at(timer.expires_at() + boost::posix_time::seconds(STATS_LOG_INTERVAL_SECONDS));
+    timer.async_wait(boost::bind(logStats, boost::ref(timer), boost::asio::placeholders::error));
+}
+
+// Pins the current top keys in the cache, then halves the counts so the next top is mostly of the recent traffic.
+void decayHotKeys(boost::asio::deadline_timer& timer, const boost::system::error_code& error)
+{
+    if (error)
+        return;
+
+    if (pinnedHotKeyCount > 0)
+    {
+        vector<riorita::HotKeys::Entry> entries;
+        hotKeys->getTop(pinnedHotKeyCount, entries);
+
+        vector<string> keys;
+        for (size_t i = 0; i < entries.size(); i++)
+            keys.push_back(entries[i].key);
+        cache.setPinned(keys);
+    }
+    hotKeys->decay();
+
+    timer.expires_at(timer.expires_at() + boost::posix_time::seconds(HOT_KEYS_DECAY_INTERVAL_SECONDS));
+    timer.async_wait(boost::bind(decayHotKeys, boost::ref(timer), boost::asio::placeholders::error));
+}
+
 int main(int argc, char* argv[])
 {
     int port;
+    int metricsPort;
     string allowedRemoteAddrs;
     
     {
         po::options_description description("=== riorita ===\nOptions");
 
         string logFile;
-        string dataDir;
         string backend;
+        riorita::StorageOptions opts;
+        size_t memoryCapacityMb;
+        size_t filesLargeValueKb;
+        size_t tieredHotCapacityMb;
+        size_t rocksDbBlockCacheMb;
+        size_t rocksDbWriteBufferMb;
+        size_t rocksDbMinBlobKb;
+        size_t rocksDbRateLimitMb;
+        string rocksDbColumnFamilies;
+        string traceFile;
+        bool traceKeys = false;
+        size_t traceBuffer;
+        size_t hotKeyCapacity;
+        size_t replicationLogMb;
+        string replicaOf;
+        size_t invalidationLogSize;
+        size_t maxValueSizeMb;
+        size_t maxChunkSizeMb;
 
         description.add_options()
             ("help", "Help message")
             ("log", po::value<string>(&logFile)->default_value("riorita.log"), "Log file")
-            ("data", po::value<string>(&dataDir)->default_value("data"), "Data directory")
-            ("backend", po::value<string>(&backend)->default_value(DEFAULT_BACKEND), "Backend: rocksdb, leveldb, files, compact or memory")
+            ("data", po::value<string>(&opts.directory)->default_value("data"), "Data directory")
+            ("backend", po::value<string>(&backend)->default_value(DEFAULT_BACKEND), "Backend: rocksdb, leveldb, files, compact, memory or tiered")
             ("port", po::value<int>(&port)->default_value(8024), "Port")
+            ("metrics-port", po::value<int>(&metricsPort)->default_value(0), "Port of HTTP /metrics in the Prometheus format, 0 means disabled")
+            ("trace", po::value<string>(&traceFile)->default_value(""), "Trace file of processed requests for riorita_replay, empty means disabled")
+            ("trace-keys", po::bool_switch(&traceKeys), "Trace: record keys, otherwise only their hashes")
+            ("trace-buffer", po::value<size_t>(&traceBuffer)->default_value(65536), "Trace: records buffered in memory, requests above it are not traced")
+            ("hot-keys", po::value<size_t>(&hotKeyCapacity)->default_value(1024), "Number of counters tracking the most read keys, 0 means disabled")
+            ("hot-keys-pin", po::value<size_t>(&pinnedHotKeyCount)->default_value(0), "Number of the most read keys kept in the cache regardless of LRU, 0 means disabled")
+            ("replication-log", po::value<size_t>(&replicationLogMb)->default_value(0), "Size in MB of recent changes kept for replicas, 0 means the server is not a primary")
+            ("replica-of", po::value<string>(&replicaOf)->default_value(""), "Follows the primary at host:port and rejects writes, empty means the server is not a replica")
+            ("invalidation-log", po::value<size_t>(&invalidationLogSize)->default_value(0), "Number of recently modified keys kept for near caches of clients, 0 means disabled")
+            ("backup-dir", po::value<string>(&backupDirectory)->default_value(""), "Directory of backups written by BACKUP (the compact backend only), empty means disabled")
+            ("max-value-size", po::value<size_t>(&maxValueSizeMb)->default_value(1024), "Size in MB of the largest value, at most 2047: GET returns a value as a whole")
+            ("max-chunk-size", po::value<size_t>(&maxChunkSizeMb)->default_value(64), "Size in MB of the largest range of RANGE_GET and chunk of PUT_CHUNK")
             ("allowed", po::value<string>(&allowedRemoteAddrs)->default_value("0.0.0.0;127.0.0.1"), "Allows remote addresses: example '212.193.32.0/19;0.0.0.0;127.0.0.1'")
+            ("memory-capacity", po::value<size_t>(&memoryCapacityMb)->default_value(0), "Memory: capacity in MB, least recently used entries are evicted above it, 0 means unlimited")
+            ("memory-shards", po::value<int>(&opts.memoryShards)->default_value(64), "Memory: number of independently locked shards")
+            ("memory-persistent", po::bool_switch(&opts.memoryPersistent), "Memory: keep data in snapshots in the data directory, load them on start")
+            ("memory-snapshot-interval", po::value<int>(&opts.memorySnapshotInterval)->default_value(600), "Memory: seconds between background snapshots, 0 means only on shutdown")
+            ("memory-log", po::bool_switch(&opts.memoryLog), "Memory: append every change to a log to survive crashes between snapshots")
+            ("files-io", po::value<string>(&opts.filesIo)->default_value("buffered"), "Files: I/O mode for large values: buffered, fadvise or direct")
+            ("files-large-value", po::value<size_t>(&filesLargeValueKb)->default_value(1024), "Files: values starting from this size in KB are large")
+            ("tiered-hot-backend", po::value<string>(&opts.tieredHotType)->default_value("compact"), "Tiered: backend of the hot tier")
+            ("tiered-hot-data", po::value<string>(&opts.tieredHotDirectory)->default_value("data/hot"), "Tiered: data directory of the hot tier")
+            ("tiered-cold-backend", po::value<string>(&opts.tieredColdType)->default_value(DEFAULT_BACKEND), "Tiered: backend of the cold tier")
+            ("tiered-cold-data", po::value<string>(&opts.tieredColdDirectory)->default_value("data/cold"), "Tiered: data directory of the cold tier")
+            ("tiered-hot-capacity", po::value<size_t>(&tieredHotCapacityMb)->default_value(64 * 1024), "Tiered: size of values in MB kept in the hot tier")
+            ("tiered-hot-max-age", po::value<int>(&opts.tieredHotMaxAge)->default_value(0), "Tiered: seconds without access after which a value is demoted, 0 means never")
+            ("rocksdb-block-cache", po::value<size_t>(&rocksDbBlockCacheMb)->default_value(1024), "RocksDB: shared block cache size in MB")
+            ("rocksdb-hyper-clock-cache", po::bool_switch(&opts.rocksDbHyperClockCache), "RocksDB: use HyperClockCache instead of LRU block cache")
+            ("rocksdb-write-buffer", po::value<size_t>(&rocksDbWriteBufferMb)->default_value(64), "RocksDB: write buffer size in MB")
+            ("rocksdb-min-blob-size", po::value<size_t>(&rocksDbMinBlobKb)->default_value(64), "RocksDB: values starting from this size in KB go to blob files")
+            ("rocksdb-compaction", po::value<string>(&opts.rocksDbCompactionStyle)->default_value("level"), "RocksDB: compaction style: level, universal or fifo")
+            ("rocksdb-rate-limit", po::value<size_t>(&rocksDbRateLimitMb)->default_value(0), "RocksDB: flush and compaction rate limit in MB/s, 0 means unlimited")
+            ("rocksdb-column-families", po::value<string>(&rocksDbColumnFamilies)->default_value(""), "RocksDB: key prefixes stored in own column families: example 'contest:;user:'")
         ;
 
         po::variables_map varmap;
@@ -476,13 +1396,31 @@ int main(int argc, char* argv[])
         }
 
         riorita::StorageType type = riorita::getType(backend);
-        if (type == riorita::ILLEGAL_STORAGE_TYPE)
+        if (type == riorita::ILLEGAL_STORAGE_TYPE || opts.memoryShards <= 0
+                || maxValueSizeMb == 0 || maxValueSizeMb >= 2048 || maxChunkSizeMb == 0)
         {
             std::cout << description << std::endl;
             return 1;
         }
 
-        init(logFile, dataDir, type);
+        maxValueSize = maxValueSizeMb * 1024 * 1024;
+        maxChunkSize = maxChunkSizeMb * 1024 * 1024;
+        opts.memoryCapacity = memoryCapacityMb * 1024 * 1024;
+        opts.filesLargeValueSize = filesLargeValueKb * 1024;
+        opts.tieredHotCapacity = tieredHotCapacityMb * 1024 * 1024;
+        opts.rocksDbBlockCacheSize = rocksDbBlockCacheMb * 1024 * 1024;
+        opts.rocksDbWriteBufferSize = rocksDbWriteBufferMb * 1024 * 1024;
+        opts.rocksDbMinBlobSize = rocksDbMinBlobKb * 1024;
+        opts.rocksDbRateLimit = rocksDbRateLimitMb * 1024 * 1024;
+        opts.rocksDbColumnFamilyPrefixes = splitBySemicolon(rocksDbColumnFamilies);
+
+        init(logFile, type, opts, traceFile, traceKeys, traceBuffer, replicationLogMb * 1024 * 1024, replicaOf,
+                invalidationLogSize);
+
+        if (hotKeyCapacity > 0)
+            hotKeys = boost::shared_ptr<riorita::HotKeys>(new riorita::HotKeys(hotKeyCapacity, 16));
+        else
+            pinnedHotKeyCount = 0;
     }
 
     *lout << "Starting riorita server" << endl;
@@ -497,6 +1435,14 @@ int main(int argc, char* argv[])
             servers.push_back(server);
         }
 
+        boost::shared_ptr<MetricsServer> metricsServer;
+        if (metricsPort > 0)
+        {
+            *lout << "Listen metrics port " << metricsPort << endl;
+            tcp::endpoint endpoint(tcp::v4(), short(metricsPort));
+            metricsServer.reset(new MetricsServer(io_service, endpoint, allowedRemoteAddrs));
+        }
+
         boost::asio::signal_set signals_(io_service);
         signals_.add(SIGINT);
         signals_.add(SIGTERM);
@@ -505,6 +1451,13 @@ int main(int argc, char* argv[])
 #endif // defined(SIGQUIT)
         signals_.async_wait(boost::bind(&boost::asio::io_service::stop, &io_service));
 
+        boost::asio::deadline_timer statsTimer(io_service, boost::posix_time::seconds(STATS_LOG_INTERVAL_SECONDS));
+        statsTimer.async_wait(boost::bind(logStats, boost::ref(statsTimer), boost::asio::placeholders::error));
+
+        boost::asio::deadline_timer hotKeysTimer(io_service, boost::posix_time::seconds(HOT_KEYS_DECAY_INTERVAL_SECONDS));
+        if (hotKeys)
+            hotKeysTimer.async_wait(boost::bind(decayHotKeys, boost::ref(hotKeysTimer), boost::asio::placeholders::error));
+
 
         *lout << "Started riorita server" << endl;
     
@@ -520,6 +1473,13 @@ int main(int argc, char* argv[])
         
         for (std::size_t i = 0; i < threads.size(); ++i)
           threads[i]->join();
+
+        // Open connections are closed while the log and metrics still exist.
+        sessions.clear();
+
+        // Requests are not served any more, replicas continue from the saved log after a restart.
+        if (replicationLog)
+            replicationLog->save();
     }
     catch (std::exception& e)
     {
@@ -0,0 +1,140 @@
+#include "client.h"
+#include "compact.h"
+
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+using namespace std;
+
+struct BackupOptions
+{
+    string host;
+    int port;
+    string name;
+    string verify;
+    string restore;
+    string data;
+};
+
+// Asks the server to write the backup into the subdirectory of its --backup-dir.
+static bool backup(const BackupOptions& options)
+{
+    riorita::Client client(options.host, options.port);
+    riorita::Bytes keyBytes(riorita::int32(options.name.length()), (riorita::byte*) options.name.data());
+    client.send(riorita::Request(riorita::PROTOCOL_VERSION, riorita::BACKUP, 0,
+            riorita::Bytes(), keyBytes, riorita::Bytes()));
+
+    riorita::Response response;
+    client.receive(response);
+    return response.verdict;
+}
+
+// Reads every value of the compact storage in the directory and checks its fingerprint. The storage is opened
+// read-only, so a backup (its files may be hard-linked) or the data directory of a running server is not changed.
+static void verify(const string& directory)
+{
+    if (!boost::filesystem::is_directory(directory))
+        throw runtime_error("Directory " + directory + " doesn't exist");
+
+    riorita::FileSystemCompactStorage storage(directory, riorita::COMPACT_SERVER_GROUPS, riorita::COMPACT_SERVER_FORMAT, true);
+    boost::shared_ptr<riorita::CompactSnapshot> snapshot = storage.snapshot();
+
+    string section;
+    string name;
+    string data;
+    long long count = 0;
+    long long bytes = 0;
+    while (snapshot->next(section, name, data))
+    {
+        count++;
+        bytes += (long long) data.length();
+    }
+
+    printf("Verified %lld values of %lld bytes (compressed) in %s\n", count, bytes, directory.c_str());
+}
+
+static void copyDirectory(const boost::filesystem::path& from, const boost::filesystem::path& to)
+{
+    boost::filesystem::create_directories(to);
+    for (boost::filesystem::directory_iterator end, i(from); i != end; ++i)
+    {
+        boost::filesystem::path target = to / i->path().filename();
+        if (boost::filesystem::is_directory(i->path()))
+            copyDirectory(i->path(), target);
+        else
+            boost::filesystem::copy_file(i->path(), target);
+    }
+}
+
+// Copies the backup into the data directory of a stopped server, which must be absent or empty.
+static void restore(const string& backupDirectory, const string& dataDirectory)
+{
+    verify(backupDirectory);
+
+    if (boost::filesystem::exists(dataDirectory) && !boost::filesystem::is_empty(dataDirectory))
+        throw runtime_error("Data directory " + dataDirectory + " is not empty");
+
+    copyDirectory(backupDirectory, dataDirectory);
+    verify(dataDirectory);
+}
+
+int main(int argc, char* argv[])
+{
+    BackupOptions options;
+
+    po::options_description description("=== riorita_backup ===\nOptions");
+    description.add_options()
+        ("help", "Help message")
+        ("host", po::value<string>(&options.host)->default_value("127.0.0.1"), "Server host")
+        ("port", po::value<int>(&options.port)->default_value(8024), "Server port")
+        ("name", po::value<string>(&options.name), "Backs up the server into the new subdirectory of its --backup-dir")
+        ("verify", po::value<string>(&options.verify), "Checks every value of the backup (or data) directory of the compact backend")
+        ("restore", po::value<string>(&options.restore), "Copies the backup directory into --data of a stopped server")
+        ("data", po::value<string>(&options.data), "Data directory to restore into, it must be absent or empty")
+    ;
+
+    po::variables_map varmap;
+    po::store(po::parse_command_line(argc, argv, description), varmap);
+    po::notify(varmap);
+
+    int actions = int(!options.name.empty()) + int(!options.verify.empty()) + int(!options.restore.empty());
+    if (varmap.count("help") || actions != 1 || options.restore.empty() != options.data.empty())
+    {
+        std::cout << description << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        if (!options.name.empty())
+        {
+            if (!backup(options))
+            {
+                std::cerr << "Server has not written backup " << options.name
+                          << ": check its --backup-dir, backend and log, the name may be taken" << std::endl;
+                return 1;
+            }
+            printf("Backup %s is written\n", options.name.c_str());
+        }
+
+        if (!options.verify.empty())
+            verify(options.verify);
+
+        if (!options.restore.empty())
+            restore(options.restore, options.data);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
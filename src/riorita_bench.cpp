@@ -0,0 +1,363 @@
+#include "client.h"
+#include "histogram.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+using namespace std;
+
+typedef std::chrono::steady_clock Clock;
+
+static long long nowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct BenchOptions
+{
+    string host;
+    int port;
+    int connections;
+    int pipeline;
+    double duration;
+    double warmup;
+    double rate;
+    long long keyCount;
+    string keyPrefix;
+    string keyDistribution;
+    double zipfTheta;
+    double hotKeyFraction;
+    double hotOperationFraction;
+    size_t valueSize;
+    size_t valueSizeMax;
+    string valueDistribution;
+    double readRatio;
+    bool preload;
+    unsigned seed;
+};
+
+// Zipfian ranks by Gray et al. "Quickly generating billion-record synthetic databases" (as in YCSB).
+// Ranks are scrambled by a hash, so hot keys are spread over the key space. It is shared by workers.
+class KeyChooser
+{
+public:
+    KeyChooser(const BenchOptions& options): options(options), zetan(0), alpha(0), eta(0)
+    {
+        if (options.keyDistribution == "zipfian")
+        {
+            double theta = options.zipfTheta;
+            for (long long i = 1; i <= options.keyCount; i++)
+                zetan += 1.0 / pow(double(i), theta);
+            double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+            alpha = 1.0 / (1.0 - theta);
+            eta = (1.0 - pow(2.0 / double(options.keyCount), 1.0 - theta)) / (1.0 - zeta2 / zetan);
+        }
+    }
+
+    long long next(std::mt19937_64& random) const
+    {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        long long n = options.keyCount;
+        double u = uniform(random);
+
+        if (options.keyDistribution == "zipfian")
+        {
+            double uz = u * zetan;
+            long long rank;
+            if (uz < 1.0)
+                rank = 0;
+            else if (uz < 1.0 + pow(0.5, options.zipfTheta))
+                rank = 1;
+            else
+                rank = std::min(n - 1, (long long) (double(n) * pow(eta * u - eta + 1.0, alpha)));
+            return (long long) (fnv(rank) % (unsigned long long) n);
+        }
+
+        if (options.keyDistribution == "hotspot")
+        {
+            long long hotKeys = std::max(1LL, (long long) (double(n) * options.hotKeyFraction));
+            double v = uniform(random);
+            if (u < options.hotOperationFraction || hotKeys == n)
+                return std::min(hotKeys - 1, (long long) (v * double(hotKeys)));
+            return std::min(n - 1, hotKeys + (long long) (v * double(n - hotKeys)));
+        }
+
+        return std::min(n - 1, (long long) (u * double(n)));
+    }
+
+private:
+    static unsigned long long fnv(long long value)
+    {
+        unsigned long long hash = 14695981039346656037ULL;
+        for (int i = 0; i < 8; i++)
+            hash = (hash ^ ((unsigned long long) value >> (8 * i) & 255)) * 1099511628211ULL;
+        return hash;
+    }
+
+    const BenchOptions& options;
+    double zetan;
+    double alpha;
+    double eta;
+};
+
+static size_t nextValueSize(const BenchOptions& options, std::mt19937_64& random)
+{
+    if (options.valueDistribution == "uniform" && options.valueSizeMax > options.valueSize)
+        return std::uniform_int_distribution<size_t>(options.valueSize, options.valueSizeMax)(random);
+
+    // Mean is the value size, the tail is cut at the maximum.
+    if (options.valueDistribution == "exponential")
+    {
+        double size = std::exponential_distribution<double>(1.0 / double(std::max<size_t>(options.valueSize, 1)))(random);
+        return std::min(size_t(size), std::max(options.valueSize, options.valueSizeMax));
+    }
+
+    return options.valueSize;
+}
+
+struct WorkerResult
+{
+    WorkerResult(): reads(0), writes(0), misses(0), errors(0)
+    {
+    }
+
+    // Latencies from the intended start (corrected for coordinated omission) and from the actual send.
+    riorita::Histogram latency;
+    riorita::Histogram serviceTime;
+    long long reads;
+    long long writes;
+    long long misses;
+    long long errors;
+    string error;
+};
+
+struct InFlight
+{
+    long long intendedStart;
+    long long actualStart;
+    bool read;
+};
+
+static string getKey(const BenchOptions& options, long long index)
+{
+    return options.keyPrefix + to_string(index);
+}
+
+// Drives one connection: keeps up to pipeline requests in flight, in the open-loop mode
+// sends them on schedule whatever the latency is.
+static void runWorker(const BenchOptions& options, const KeyChooser& keys, int index, const string& values,
+        long long startNanos, WorkerResult& result)
+{
+    std::mt19937_64 random(options.seed * 1000003ULL + unsigned(index));
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    long long warmupEnd = startNanos + (long long) (options.warmup * 1e9);
+    long long end = warmupEnd + (long long) (options.duration * 1e9);
+    long long interval = options.rate > 0 ? (long long) (1e9 * options.connections / options.rate) : 0;
+    // Connections are shifted in the schedule, so they don't send at once.
+    long long next = startNanos + interval * index / options.connections;
+
+    try
+    {
+        riorita::Client client(options.host, options.port);
+        deque<InFlight> inFlight;
+
+        while (true)
+        {
+            long long now = nowNanos();
+            if (now >= end && inFlight.empty())
+                break;
+
+            while (int(inFlight.size()) < options.pipeline && (interval == 0 ? now < end : next < end && next <= now))
+            {
+                InFlight request = {interval == 0 ? now : next, now, uniform(random) < options.readRatio};
+                next += interval;
+
+                string key = getKey(options, keys.next(random));
+                riorita::Bytes keyBytes(riorita::int32(key.length()), (riorita::byte*) key.data());
+                riorita::Bytes valueBytes;
+                if (!request.read)
+                    valueBytes = riorita::Bytes(riorita::int32(nextValueSize(options, random)), (riorita::byte*) values.data());
+
+                client.send(riorita::Request(1, request.read ? riorita::GET : riorita::PUT, 0,
+                        riorita::Bytes(), keyBytes, valueBytes));
+                inFlight.push_back(request);
+            }
+
+            if (inFlight.empty())
+            {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(std::min(next, end) - nowNanos()));
+                continue;
+            }
+
+            riorita::Response response;
+            client.receive(response);
+            long long done = nowNanos();
+
+            InFlight request = inFlight.front();
+            inFlight.pop_front();
+            if (request.intendedStart < warmupEnd)
+                continue;
+
+            result.latency.record(done - request.intendedStart);
+            result.serviceTime.record(done - request.actualStart);
+            if (request.read)
+            {
+                result.reads++;
+                if (!response.verdict)
+                    result.misses++;
+            }
+            else
+                result.writes++;
+        }
+    }
+    catch (std::exception& e)
+    {
+        result.errors++;
+        result.error = e.what();
+    }
+}
+
+// Puts every key once, each connection takes every connections-th key.
+static void runPreload(const BenchOptions& options, int index, const string& values, WorkerResult& result)
+{
+    std::mt19937_64 random(options.seed * 1000003ULL + unsigned(index));
+    try
+    {
+        riorita::Client client(options.host, options.port);
+        for (long long i = index; i < options.keyCount || client.getPendingCount() > 0; )
+        {
+            if (i < options.keyCount && int(client.getPendingCount()) < options.pipeline)
+            {
+                string key = getKey(options, i);
+                riorita::Bytes keyBytes(riorita::int32(key.length()), (riorita::byte*) key.data());
+                riorita::Bytes valueBytes(riorita::int32(nextValueSize(options, random)), (riorita::byte*) values.data());
+                client.send(riorita::Request(1, riorita::PUT, 0, riorita::Bytes(), keyBytes, valueBytes));
+                i += options.connections;
+            }
+            else
+            {
+                riorita::Response response;
+                client.receive(response);
+            }
+        }
+    }
+    catch (std::exception& e)
+    {
+        result.errors++;
+        result.error = e.what();
+    }
+}
+
+static void printLatencies(const char* title, const riorita::Histogram& histogram)
+{
+    const double percentiles[] = {50, 90, 99, 99.9, 99.99};
+    printf("%-14s", title);
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+        printf(" p%-6g %9.1f", percentiles[i], double(histogram.getPercentile(percentiles[i])) / 1e3);
+    printf(" max %9.1f (us)\n", double(histogram.getMax()) / 1e3);
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+
+    po::options_description description("=== riorita_bench ===\nOptions");
+    description.add_options()
+        ("help", "Help message")
+        ("host", po::value<string>(&options.host)->default_value("127.0.0.1"), "Server host")
+        ("port", po::value<int>(&options.port)->default_value(8024), "Server port")
+        ("connections", po::value<int>(&options.connections)->default_value(16), "Number of connections, each one has a thread")
+        ("pipeline", po::value<int>(&options.pipeline)->default_value(1), "Requests in flight per connection")
+        ("duration", po::value<double>(&options.duration)->default_value(30), "Seconds of measurement")
+        ("warmup", po::value<double>(&options.warmup)->default_value(5), "Seconds before measurement")
+        ("rate", po::value<double>(&options.rate)->default_value(0), "Requests per second of all connections (open loop), 0 means as fast as possible (closed loop)")
+        ("keys", po::value<long long>(&options.keyCount)->default_value(100000), "Number of distinct keys")
+        ("key-prefix", po::value<string>(&options.keyPrefix)->default_value("bench:"), "Prefix of keys")
+        ("key-distribution", po::value<string>(&options.keyDistribution)->default_value("uniform"), "Key distribution: uniform, zipfian or hotspot")
+        ("zipf-theta", po::value<double>(&options.zipfTheta)->default_value(0.99), "Zipfian: skew, between 0 and 1 exclusive")
+        ("hot-keys", po::value<double>(&options.hotKeyFraction)->default_value(0.2), "Hotspot: fraction of keys which are hot")
+        ("hot-operations", po::value<double>(&options.hotOperationFraction)->default_value(0.8), "Hotspot: fraction of requests to hot keys")
+        ("value-size", po::value<size_t>(&options.valueSize)->default_value(1024), "Value size in bytes (minimum for uniform, mean for exponential)")
+        ("value-size-max", po::value<size_t>(&options.valueSizeMax)->default_value(0), "Maximum value size in bytes for uniform and exponential")
+        ("value-distribution", po::value<string>(&options.valueDistribution)->default_value("fixed"), "Value size distribution: fixed, uniform or exponential")
+        ("read-ratio", po::value<double>(&options.readRatio)->default_value(0.9), "Fraction of GET requests, others are PUT")
+        ("preload", po::bool_switch(&options.preload), "Put all keys before the benchmark")
+        ("seed", po::value<unsigned>(&options.seed)->default_value(1), "Random seed")
+    ;
+
+    po::variables_map varmap;
+    po::store(po::parse_command_line(argc, argv, description), varmap);
+    po::notify(varmap);
+
+    if (varmap.count("help") || options.connections <= 0 || options.pipeline <= 0 || options.keyCount <= 0
+            || (options.keyDistribution != "uniform" && options.keyDistribution != "zipfian" && options.keyDistribution != "hotspot")
+            || (options.keyDistribution == "zipfian" && (options.zipfTheta <= 0 || options.zipfTheta >= 1))
+            || (options.valueDistribution != "fixed" && options.valueDistribution != "uniform" && options.valueDistribution != "exponential"))
+    {
+        std::cout << description << std::endl;
+        return 1;
+    }
+
+    string values(std::max(options.valueSize, options.valueSizeMax), 'v');
+    std::mt19937_64 random(options.seed);
+    for (size_t i = 0; i < values.length(); i++)
+        values[i] = char('a' + random() % 26);
+
+    vector<WorkerResult> results(options.connections);
+    vector<std::thread> threads;
+
+    if (options.preload)
+    {
+        long long start = nowNanos();
+        for (int i = 0; i < options.connections; i++)
+            threads.push_back(std::thread(runPreload, std::cref(options), i, std::cref(values), std::ref(results[i])));
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+        threads.clear();
+        printf("Preloaded %lld keys in %.1f s\n", options.keyCount, double(nowNanos() - start) / 1e9);
+    }
+
+    KeyChooser keys(options);
+    long long start = nowNanos();
+    for (int i = 0; i < options.connections; i++)
+        threads.push_back(std::thread(runWorker, std::cref(options), std::cref(keys), i, std::cref(values), start, std::ref(results[i])));
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    WorkerResult total;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        total.latency.add(results[i].latency);
+        total.serviceTime.add(results[i].serviceTime);
+        total.reads += results[i].reads;
+        total.writes += results[i].writes;
+        total.misses += results[i].misses;
+        total.errors += results[i].errors;
+        if (!results[i].error.empty())
+            fprintf(stderr, "Connection %d failed: %s\n", int(i), results[i].error.c_str());
+    }
+
+    long long operations = total.reads + total.writes;
+    printf("Connections %d, pipeline %d, %s, %s keys, read ratio %g\n", options.connections, options.pipeline,
+            options.rate > 0 ? ("open loop at " + to_string((long long) options.rate) + " requests/s").c_str() : "closed loop",
+            options.keyDistribution.c_str(), options.readRatio);
+    printf("Requests %lld (GET %lld, misses %lld, PUT %lld), errors %lld\n",
+            operations, total.reads, total.misses, total.writes, total.errors);
+    printf("Throughput %.1f requests/s\n", double(operations) / options.duration);
+    printLatencies("Latency", total.latency);
+    printLatencies("Service time", total.serviceTime);
+
+    return total.errors > 0 ? 2 : 0;
+}
@@ -0,0 +1,288 @@
+// Microbenchmarks of the server components. Run with --benchmark_format=json (or csv)
+// for machine-readable output, --benchmark_filter=<regex> selects benchmarks.
+
+#include "protocol.h"
+#include "cache.h"
+#include "compact.h"
+#include "storage.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+
+using namespace std;
+
+// A temporary directory removed with the object.
+class TempDirectory
+{
+public:
+    TempDirectory(): path(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("riorita-%%%%-%%%%-%%%%"))
+    {
+        boost::filesystem::create_directories(path);
+    }
+
+    ~TempDirectory()
+    {
+        boost::system::error_code error;
+        boost::filesystem::remove_all(path, error);
+    }
+
+    string getPath() const
+    {
+        return path.string();
+    }
+
+private:
+    boost::filesystem::path path;
+};
+
+static vector<string> newKeys(size_t count)
+{
+    vector<string> keys(count);
+    for (size_t i = 0; i < count; i++)
+        keys[i] = "key:" + to_string(i * 2654435761ULL % 1000000007ULL);
+    return keys;
+}
+
+static string newValue(size_t size)
+{
+    string value(size, ' ');
+    for (size_t i = 0; i < size; i++)
+        value[i] = char('a' + (i * 7 + i / 13) % 26);
+    return value;
+}
+
+// ==============================================================================
+
+static riorita::Bytes newRequestBytes(riorita::RequestType type, const string& key, const string& value)
+{
+    riorita::Request request(riorita::PROTOCOL_VERSION, type, 1, riorita::Bytes(),
+            riorita::Bytes(riorita::int32(key.length()), (riorita::byte*) key.data()),
+            riorita::Bytes(riorita::int32(value.length()), (riorita::byte*) value.data()));
+    riorita::Bytes bytes = riorita::newRequest(request);
+
+    // The server parses the request without the total size.
+    riorita::Bytes withoutSize(bytes.size - riorita::int32(sizeof(riorita::int32)), new riorita::byte[bytes.size]);
+    memcpy(withoutSize.data, bytes.data + sizeof(riorita::int32), size_t(withoutSize.size));
+    delete[] bytes.data;
+    return withoutSize;
+}
+
+static void BM_ParseRequest(benchmark::State& state)
+{
+    riorita::RequestType type = state.range(0) == 0 ? riorita::GET : riorita::PUT;
+    riorita::Bytes bytes = newRequestBytes(type, "contest:1234:standings", newValue(size_t(state.range(0))));
+
+    for (auto _ : state)
+    {
+        riorita::int32 parsedByteCount;
+        riorita::Request* request = riorita::parseRequest(bytes, 0, parsedByteCount);
+        benchmark::DoNotOptimize(request);
+        delete request;
+    }
+
+    state.SetItemsProcessed(int64_t(state.iterations()));
+    delete[] bytes.data;
+}
+BENCHMARK(BM_ParseRequest)->Arg(0)->Arg(100)->Arg(10 << 10)->Arg(1 << 20);
+
+static void BM_NewResponse(benchmark::State& state)
+{
+    string key = "contest:1234:standings";
+    string value = newValue(size_t(state.range(0)));
+    riorita::Request request(riorita::PROTOCOL_VERSION, riorita::GET, 1, riorita::Bytes(),
+            riorita::Bytes(riorita::int32(key.length()), (riorita::byte*) key.data()), riorita::Bytes());
+
+    for (auto _ : state)
+    {
+        riorita::Bytes response = riorita::newResponse(request, true, true,
+                riorita::int32(value.length()), (const riorita::byte*) value.data(), 1);
+        benchmark::DoNotOptimize(response.data);
+        delete[] response.data;
+    }
+
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(value.length()));
+}
+BENCHMARK(BM_NewResponse)->Arg(0)->Arg(100)->Arg(10 << 10)->Arg(1 << 20);
+
+// ==============================================================================
+
+static const size_t CACHE_KEY_COUNT = 100000;
+
+static riorita::Cache* cache;
+static vector<string> cacheKeys;
+
+static void BM_CacheGet(benchmark::State& state)
+{
+    string value = newValue(size_t(state.range(0)));
+    if (state.thread_index() == 0)
+    {
+        cache = new riorita::Cache();
+        cacheKeys = newKeys(CACHE_KEY_COUNT);
+        for (size_t i = 0; i < cacheKeys.size(); i++)
+            cache->put(cacheKeys[i], value);
+    }
+
+    string result;
+    size_t i = size_t(state.thread_index());
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(cache->get(cacheKeys[i % CACHE_KEY_COUNT], result));
+        i += 7919;
+    }
+
+    if (state.thread_index() == 0)
+    {
+        delete cache;
+        cache = 0;
+    }
+}
+BENCHMARK(BM_CacheGet)->Arg(100)->Arg(10 << 10)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_CachePut(benchmark::State& state)
+{
+    string value = newValue(size_t(state.range(0)));
+    if (state.thread_index() == 0)
+    {
+        cache = new riorita::Cache();
+        cacheKeys = newKeys(CACHE_KEY_COUNT);
+    }
+
+    size_t i = size_t(state.thread_index());
+    for (auto _ : state)
+    {
+        cache->put(cacheKeys[i % CACHE_KEY_COUNT], value);
+        i += 7919;
+    }
+
+    if (state.thread_index() == 0)
+    {
+        delete cache;
+        cache = 0;
+    }
+}
+BENCHMARK(BM_CachePut)->Arg(100)->Arg(10 << 10)->ThreadRange(1, 8)->UseRealTime();
+
+// ==============================================================================
+
+// Arguments are the key count and the value size.
+static void BM_CompactPut(benchmark::State& state)
+{
+    vector<string> keys = newKeys(size_t(state.range(0)));
+    string value = newValue(size_t(state.range(1)));
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        {
+            TempDirectory directory;
+            riorita::FileSystemCompactStorage compact(directory.getPath(), 8, riorita::COMPACT_SERVER_FORMAT);
+            state.ResumeTiming();
+
+            for (size_t i = 0; i < keys.size(); i++)
+                compact.put("", keys[i], value, 0, riorita::NO_EXPIRATION, true);
+
+            state.PauseTiming();
+        }
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(keys.size()));
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(keys.size() * value.length()));
+}
+BENCHMARK(BM_CompactPut)->ArgsProduct({{1000, 10000}, {100, 10 << 10}})->ArgNames({"keys", "value"})->Unit(benchmark::kMillisecond);
+
+static void BM_CompactGet(benchmark::State& state)
+{
+    vector<string> keys = newKeys(size_t(state.range(0)));
+    string value = newValue(size_t(state.range(1)));
+
+    TempDirectory directory;
+    riorita::FileSystemCompactStorage compact(directory.getPath(), 8, riorita::COMPACT_SERVER_FORMAT);
+    for (size_t i = 0; i < keys.size(); i++)
+        compact.put("", keys[i], value, 0, riorita::NO_EXPIRATION, true);
+
+    string result;
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(compact.get("", keys[i % keys.size()], 0, result));
+        i += 7919;
+    }
+
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(value.length()));
+}
+BENCHMARK(BM_CompactGet)->ArgsProduct({{1000, 100000}, {100, 10 << 10}})->ArgNames({"keys", "value"});
+
+// Opening the storage reads the whole index.
+static void BM_CompactRestart(benchmark::State& state)
+{
+    vector<string> keys = newKeys(size_t(state.range(0)));
+    string value = newValue(100);
+
+    TempDirectory directory;
+    {
+        riorita::FileSystemCompactStorage compact(directory.getPath(), 8, riorita::COMPACT_SERVER_FORMAT);
+        for (size_t i = 0; i < keys.size(); i++)
+            compact.put("", keys[i], value, 0, riorita::NO_EXPIRATION, true);
+    }
+
+    for (auto _ : state)
+    {
+        riorita::FileSystemCompactStorage compact(directory.getPath(), 8, riorita::COMPACT_SERVER_FORMAT);
+        benchmark::DoNotOptimize(&compact);
+    }
+
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(keys.size()));
+}
+BENCHMARK(BM_CompactRestart)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// ==============================================================================
+
+// The same workload for every backend: put the keys, then 90% gets and 10% puts over them.
+// The first argument is the storage type, the second one is the value size.
+static void BM_Storage(benchmark::State& state)
+{
+    riorita::StorageType type = riorita::StorageType(state.range(0));
+    vector<string> keys = newKeys(10000);
+    string value = newValue(size_t(state.range(1)));
+
+    TempDirectory directory;
+    riorita::StorageOptions options;
+    options.directory = directory.getPath();
+    options.tieredHotType = "memory";
+    options.tieredHotDirectory = directory.getPath() + "/hot";
+    options.tieredColdType = "compact";
+    options.tieredColdDirectory = directory.getPath() + "/cold";
+    boost::scoped_ptr<riorita::Storage> storage(riorita::newStorage(type, options));
+    if (!storage)
+    {
+        state.SkipWithError("The backend is not compiled in");
+        return;
+    }
+
+    for (size_t i = 0; i < keys.size(); i++)
+        storage->put(keys[i], value);
+
+    string result;
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        if (i % 10 == 0)
+            storage->put(keys[i % keys.size()], value);
+        else
+            benchmark::DoNotOptimize(storage->get(keys[i % keys.size()], result));
+        i += 7919;
+    }
+
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(value.length()));
+}
+BENCHMARK(BM_Storage)->ArgsProduct({
+        {riorita::MEMORY, riorita::FILES, riorita::LEVELDB, riorita::COMPACT, riorita::ROCKSDB, riorita::TIERED},
+        {100, 10 << 10}})->ArgNames({"backend", "value"});
+
+BENCHMARK_MAIN();
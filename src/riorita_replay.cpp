@@ -0,0 +1,362 @@
+#include "client.h"
+#include "histogram.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+using namespace std;
+
+typedef std::chrono::steady_clock Clock;
+
+static long long nowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct ReplayOptions
+{
+    string host;
+    int port;
+    string trace;
+    double speed;
+    int connections;
+};
+
+// Records of one connection, filled by the reader of the trace. It is bounded, so the trace
+// is streamed instead of being loaded into memory.
+class RecordQueue
+{
+public:
+    RecordQueue(): closed(false)
+    {
+    }
+
+    void push(const riorita::TraceRecord& record)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return records.size() < MAX_SIZE; });
+        records.push_back(record);
+        notEmpty.notify_one();
+    }
+
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_one();
+    }
+
+    // Returns false if the queue is closed and empty.
+    bool pop(riorita::TraceRecord& record)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !records.empty() || closed; });
+        if (records.empty())
+            return false;
+
+        std::swap(record, records.front());
+        records.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+private:
+    static const size_t MAX_SIZE = 10000;
+
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    deque<riorita::TraceRecord> records;
+    bool closed;
+};
+
+struct ReplayResult
+{
+    ReplayResult(): requests(0), skipped(0), reads(0), misses(0), errors(0)
+    {
+    }
+
+    riorita::Histogram latency;
+    riorita::Histogram serviceTime;
+    long long requests;
+    long long skipped;
+    long long reads;
+    long long misses;
+    long long errors;
+    string error;
+};
+
+// Without recorded keys a key is made of the hash and padded to the original size.
+static string getKey(const riorita::TraceRecord& record, bool hasKeys)
+{
+    if (hasKeys)
+        return record.key;
+
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "trace:%016llx", (unsigned long long) record.keyHash);
+    string key(buffer);
+    if (int(key.length()) < record.keySize)
+        key.resize(size_t(record.keySize), '.');
+    return key;
+}
+
+// Range reads and conditional writes are replayed as plain reads and writes: their parameters
+// are not traced. Scans and namespace drops are skipped.
+static bool getReplayType(riorita::byte type, riorita::RequestType& replayType)
+{
+    switch (type)
+    {
+        case riorita::PING:
+        case riorita::HAS:
+        case riorita::GET:
+        case riorita::PUT:
+        case riorita::DELETE:
+        case riorita::PUT_IF_ABSENT:
+        case riorita::APPEND:
+        case riorita::STATS:
+            replayType = riorita::RequestType(type);
+            return true;
+        case riorita::RANGE_GET:
+            replayType = riorita::GET;
+            return true;
+        case riorita::COMPARE_AND_SET:
+        case riorita::PUT_CHUNK:
+            replayType = riorita::PUT;
+            return true;
+        case riorita::COMPARE_AND_DELETE:
+            replayType = riorita::DELETE;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Sends each record at its time in the trace divided by the speed, one request at a time.
+// The latency is measured from that time, so it includes waiting behind slow requests.
+static void runWorker(const ReplayOptions& options, bool hasKeys, RecordQueue& queue, long long startNanos,
+        ReplayResult& result)
+{
+    string values;
+    try
+    {
+        riorita::Client client(options.host, options.port);
+
+        riorita::TraceRecord record;
+        while (queue.pop(record))
+        {
+            riorita::RequestType type;
+            if (!getReplayType(record.type, type))
+            {
+                result.skipped++;
+                continue;
+            }
+
+            long long intendedStart = options.speed > 0
+                    ? startNanos + (long long) (double(record.timeMicros) * 1e3 / options.speed) : nowNanos();
+            long long now = nowNanos();
+            if (intendedStart > now)
+                std::this_thread::sleep_for(std::chrono::nanoseconds(intendedStart - now));
+            long long actualStart = nowNanos();
+
+            string key = getKey(record, hasKeys);
+            riorita::Bytes spaceBytes(riorita::int32(record.space.length()), (riorita::byte*) record.space.data());
+            riorita::Bytes keyBytes(riorita::int32(key.length()), (riorita::byte*) key.data());
+            riorita::Bytes valueBytes;
+            if (riorita::hasValue(type))
+            {
+                if (values.length() < size_t(record.valueSize))
+                    values.resize(size_t(record.valueSize), 'v');
+                valueBytes = riorita::Bytes(record.valueSize, (riorita::byte*) values.data());
+            }
+
+            client.send(riorita::Request(riorita::PROTOCOL_VERSION, type, 0, spaceBytes, keyBytes, valueBytes));
+            riorita::Response response;
+            client.receive(response);
+            long long done = nowNanos();
+
+            result.latency.record(done - std::min(intendedStart, actualStart));
+            result.serviceTime.record(done - actualStart);
+            result.requests++;
+            if (type == riorita::GET || type == riorita::HAS)
+            {
+                result.reads++;
+                if (!response.verdict)
+                    result.misses++;
+            }
+        }
+    }
+    catch (std::exception& e)
+    {
+        result.errors++;
+        result.error = e.what();
+
+        // The reader must not wait for this connection.
+        riorita::TraceRecord record;
+        while (queue.pop(record))
+            result.skipped++;
+    }
+}
+
+// The server counters which show how the replay went, e.g. cache hits.
+static map<string, long long> getStats(const ReplayOptions& options)
+{
+    map<string, long long> stats;
+    riorita::Client client(options.host, options.port);
+    client.send(riorita::Request(riorita::PROTOCOL_VERSION, riorita::STATS, 0,
+            riorita::Bytes(), riorita::Bytes(), riorita::Bytes()));
+
+    riorita::Response response;
+    client.receive(response);
+
+    const riorita::byte* p = response.data.data;
+    const riorita::byte* end = p + response.data.size;
+    riorita::int32 count = 0;
+    if (end - p >= riorita::int32(sizeof(count)))
+    {
+        memcpy(&count, p, sizeof(count));
+        p += sizeof(count);
+    }
+    for (riorita::int32 i = 0; i < count && end - p >= riorita::int32(sizeof(riorita::int32)); i++)
+    {
+        riorita::int32 length;
+        memcpy(&length, p, sizeof(length));
+        p += sizeof(length);
+        if (length < 0 || end - p < length + riorita::int32(sizeof(long long)))
+            break;
+        string name(p, p + length);
+        p += length;
+        long long value;
+        memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        stats[name] = value;
+    }
+    return stats;
+}
+
+static void printLatencies(const char* title, const riorita::Histogram& histogram)
+{
+    const double percentiles[] = {50, 90, 99, 99.9, 99.99};
+    printf("%-14s", title);
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+        printf(" p%-6g %9.1f", percentiles[i], double(histogram.getPercentile(percentiles[i])) / 1e3);
+    printf(" max %9.1f (us)\n", double(histogram.getMax()) / 1e3);
+}
+
+int main(int argc, char* argv[])
+{
+    ReplayOptions options;
+
+    po::options_description description("=== riorita_replay ===\nOptions");
+    description.add_options()
+        ("help", "Help message")
+        ("host", po::value<string>(&options.host)->default_value("127.0.0.1"), "Server host")
+        ("port", po::value<int>(&options.port)->default_value(8024), "Server port")
+        ("trace", po::value<string>(&options.trace), "Trace file written by riorita --trace")
+        ("speed", po::value<double>(&options.speed)->default_value(1), "Speed relative to the trace: 2 replays twice as fast, 0 means as fast as possible")
+        ("connections", po::value<int>(&options.connections)->default_value(16), "Number of connections, each one has a thread; a key always goes to the same one")
+    ;
+
+    po::variables_map varmap;
+    po::store(po::parse_command_line(argc, argv, description), varmap);
+    po::notify(varmap);
+
+    if (varmap.count("help") || options.trace.empty() || options.connections <= 0 || options.speed < 0)
+    {
+        std::cout << description << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        riorita::TraceReader reader(options.trace);
+        map<string, long long> statsBefore = getStats(options);
+
+        vector<RecordQueue> queues(options.connections);
+        vector<ReplayResult> results(options.connections);
+        vector<std::thread> threads;
+
+        riorita::Histogram tracedLatency;
+        long long traced = 0;
+        long long tracedReads = 0;
+        long long tracedCacheHits = 0;
+        long long tracedMisses = 0;
+
+        long long start = nowNanos();
+        for (int i = 0; i < options.connections; i++)
+            threads.push_back(std::thread(runWorker, std::cref(options), reader.hasKeys(), std::ref(queues[i]),
+                    start, std::ref(results[i])));
+
+        riorita::TraceRecord record;
+        while (reader.next(record))
+        {
+            traced++;
+            tracedLatency.record(record.latencyMicros * 1000LL);
+            if (record.type == riorita::GET || record.type == riorita::HAS)
+            {
+                tracedReads++;
+                if ((record.flags & riorita::TRACE_CACHE_HIT) != 0)
+                    tracedCacheHits++;
+                if ((record.flags & riorita::TRACE_VERDICT) == 0)
+                    tracedMisses++;
+            }
+
+            queues[size_t(record.keyHash) % queues.size()].push(record);
+        }
+        for (size_t i = 0; i < queues.size(); i++)
+            queues[i].close();
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+        double seconds = double(nowNanos() - start) / 1e9;
+
+        ReplayResult total;
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            total.latency.add(results[i].latency);
+            total.serviceTime.add(results[i].serviceTime);
+            total.requests += results[i].requests;
+            total.skipped += results[i].skipped;
+            total.reads += results[i].reads;
+            total.misses += results[i].misses;
+            total.errors += results[i].errors;
+            if (!results[i].error.empty())
+                fprintf(stderr, "Connection %d failed: %s\n", int(i), results[i].error.c_str());
+        }
+
+        map<string, long long> statsAfter = getStats(options);
+        long long cacheHits = statsAfter["cache_hits"] - statsBefore["cache_hits"];
+        long long cacheMisses = statsAfter["cache_misses"] - statsBefore["cache_misses"];
+
+        printf("Trace %s: %lld requests (reads %lld, misses %lld, cache hits %.1f%%)\n", options.trace.c_str(),
+                traced, tracedReads, tracedMisses, tracedReads > 0 ? 100.0 * double(tracedCacheHits) / double(tracedReads) : 0.0);
+        printLatencies("Traced", tracedLatency);
+        printf("Replayed %lld requests in %.1f s at speed %g (reads %lld, misses %lld, cache hits %.1f%%), skipped %lld, errors %lld\n",
+                total.requests, seconds, options.speed, total.reads, total.misses,
+                cacheHits + cacheMisses > 0 ? 100.0 * double(cacheHits) / double(cacheHits + cacheMisses) : 0.0,
+                total.skipped, total.errors);
+        printf("Throughput %.1f requests/s\n", double(total.requests) / seconds);
+        printLatencies("Latency", total.latency);
+        printLatencies("Service time", total.serviceTime);
+
+        return total.errors > 0 ? 2 : 0;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
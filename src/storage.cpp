@@ -4,19 +4,54 @@
 #include <map>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <unordered_set>
+#include <unordered_map>
+#include <list>
+#include <set>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
 #include "snappy.h"
 #include "compact.h"
+#include "memory.h"
+#include "logger.h"
 
 #include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#if defined(_WIN32) || defined(WIN32) || defined(_WIN64) || defined(WIN64)
+#   include <io.h>
+#   include <fcntl.h>
+#   include <sys/stat.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/stat.h>
+#endif
 
 #ifdef HAS_LEVELDB
 #   include "leveldb/db.h"
 #   include "leveldb/cache.h"
 #   include "leveldb/filter_policy.h"
+#   include "leveldb/write_batch.h"
 #endif
 
 #ifdef HAS_ROCKSDB
-#include <rocksdb/db.h>
+#   include <rocksdb/db.h>
+#   include <rocksdb/cache.h>
+#   include <rocksdb/filter_policy.h>
+#   include <rocksdb/rate_limiter.h>
+#   include <rocksdb/table.h>
+#   include <rocksdb/version.h>
 #endif
 
 using namespace riorita;
@@ -24,6 +59,59 @@ using namespace std;
 
 namespace riorita {
 
+StorageOptions::StorageOptions()
+    : memoryCapacity(0),
+    memoryShards(64),
+    memoryPersistent(false),
+    memorySnapshotInterval(0),
+    memoryLog(false),
+    filesIo("buffered"),
+    filesLargeValueSize(size_t(1024) * 1024),
+    tieredHotCapacity(size_t(64) * 1024 * 1024 * 1024),
+    tieredHotMaxAge(0),
+    rocksDbBlockCacheSize(size_t(1024) * 1024 * 1024),
+    rocksDbHyperClockCache(false),
+    rocksDbWriteBufferSize(size_t(64) * 1024 * 1024),
+    rocksDbMinBlobSize(size_t(64) * 1024),
+    rocksDbCompactionStyle("level"),
+    rocksDbRateLimit(0)
+{
+    // No operations.
+}
+
+bool Storage::getRange(const string& /* key */, long long /* offset */, size_t /* length */,
+        string& /* value */, long long& /* totalSize */)
+{
+    return false;
+}
+
+bool Storage::finishScan(vector<string>& keys, size_t limit)
+{
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+    bool more = keys.size() > limit;
+    if (more)
+        keys.resize(limit);
+    return more;
+}
+
+void Storage::putFile(const string& key, const string& fileName)
+{
+    FILE* f = fopen(fileName.c_str(), "rb");
+    if (f == 0)
+        return;
+
+    string value;
+    char buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        value.append(buffer, count);
+    fclose(f);
+
+    put(key, value);
+}
+
 StorageType getType(const string& typeName)
 {
     if (typeName == "memory" || typeName == "MEMORY")
@@ -39,132 +127,645 @@ StorageType getType(const string& typeName)
         return COMPACT;
 
     if (typeName == "rocksdb" || typeName == "ROCKSDB")
-        return LEVELDB;
+        return ROCKSDB;
+
+    if (typeName == "tiered" || typeName == "TIERED")
+        return TIERED;
 
     return ILLEGAL_STORAGE_TYPE;
 }
 
+// Backends report failures to the configured logger, stderr is used without one.
+static void log(const StorageOptions& options, const string& message)
+{
+    if (options.logger)
+        *options.logger << message << endl;
+    else
+        std::cerr << message << std::endl;
+}
+
 struct MemoryStorage: public Storage
 {
     MemoryStorage(const StorageOptions& options)
+        : store(options.memoryShards, options.memoryCapacity)
     {
-        // No operations.
+        if (options.memoryPersistent)
+            store.persist(options.directory, options.memorySnapshotInterval, options.memoryLog, options.logger);
     }
 
     bool has(const string& key)
     {
-        return data.count(key) != 0;
+        return store.has(key);
     }
 
     bool get(const string& key, string& value)
     {
-        if (data.count(key) != 0)
-        {
-            value = data[key];
-            return true;
-        }
-        else
+        return store.get(key, value);
+    }
+
+    bool supportsRanges()
+    {
+        return true;
+    }
+
+    bool getRange(const string& key, long long offset, size_t length, string& value, long long& totalSize)
+    {
+        size_t size;
+        if (!store.getRange(key, size_t(offset), length, value, size))
             return false;
+        totalSize = (long long) size;
+        return true;
     }
 
     void erase(const string& key)
     {
-        data.erase(key);
+        store.erase(key);
     }
 
     void put(const string& key, const string& value)
     {
-        data[key] = value;
+        store.put(key, value);
+    }
+
+    void erasePrefix(const string& prefix)
+    {
+        store.erasePrefix(prefix);
+    }
+
+    bool scan(const string& prefix, const string& startAfter, size_t limit, vector<string>& keys)
+    {
+        store.scan(prefix, startAfter, limit, keys);
+        return finishScan(keys, limit);
     }
 
 private:
-    map<string, string> data;
+    ShardedMemoryStore store;
 };
 
 // ==============================================================================
 
+#if defined(_WIN32) || defined(WIN32) || defined(_WIN64) || defined(WIN64)
+
+static int openForRead(const string& fileName, bool)
+{
+    return _open(fileName.c_str(), _O_RDONLY | _O_BINARY);
+}
+
+static int openForWrite(const string& fileName, bool)
+{
+    return _open(fileName.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+}
+
+static long long getFileSize(int fd)
+{
+    struct _stat64 st;
+    return _fstat64(fd, &st) == 0 ? (long long) st.st_size : -1;
+}
+
+#   define readFile(fd, buffer, size) _read(fd, buffer, (unsigned int) (size))
+#   define seekFile _lseeki64
+#   define writeFile(fd, buffer, size) _write(fd, buffer, (unsigned int) (size))
+#   define closeFile _close
+#   define truncateFile _chsize_s
+
+#else
+
+static int openForRead(const string& fileName, bool direct)
+{
+#ifdef O_DIRECT
+    return open(fileName.c_str(), O_RDONLY | (direct ? O_DIRECT : 0));
+#else
+    return open(fileName.c_str(), O_RDONLY);
+#endif
+}
+
+static int openForWrite(const string& fileName, bool direct)
+{
+#ifdef O_DIRECT
+    return open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0), 0644);
+#else
+    return open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+}
+
+static long long getFileSize(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 ? (long long) st.st_size : -1;
+}
+
+#   define readFile ::read
+#   define seekFile ::lseek
+#   define writeFile ::write
+#   define closeFile ::close
+#   define truncateFile ::ftruncate
+
+#endif
+
+static bool readExactly(int fd, char* buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        long long count = (long long) readFile(fd, buffer + done, size - done);
+        if (count <= 0)
+            break;
+        done += size_t(count);
+    }
+    return done == size;
+}
+
+static bool writeExactly(int fd, const char* buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        long long count = (long long) writeFile(fd, buffer + done, size - done);
+        if (count <= 0)
+            break;
+        done += size_t(count);
+    }
+    return done == size;
+}
+
+// O_DIRECT needs buffers, offsets and sizes aligned to the logical block size.
+const size_t DIRECT_IO_ALIGNMENT = 4096;
+
+static char* allocateAligned(size_t size)
+{
+    size = (size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+#if defined(_WIN32) || defined(WIN32) || defined(_WIN64) || defined(WIN64)
+    return static_cast<char*>(_aligned_malloc(size, DIRECT_IO_ALIGNMENT));
+#else
+    void* result = 0;
+    return posix_memalign(&result, DIRECT_IO_ALIGNMENT, size) == 0 ? static_cast<char*>(result) : 0;
+#endif
+}
+
+static void freeAligned(char* buffer)
+{
+#if defined(_WIN32) || defined(WIN32) || defined(_WIN64) || defined(WIN64)
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+// Tells the kernel not to keep large values in the page cache, they would only evict hot small ones.
+static void dropFromPageCache(int fd, bool written)
+{
+#if defined(__linux__)
+    if (written)
+        sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#elif defined(POSIX_FADV_DONTNEED)
+    if (!written)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+    (void) fd;
+    (void) written;
+#endif
+}
+
+// Values are stored one per file: small ones snappy-compressed (.bin), large ones as is (.raw),
+// so a range of a large value is read without reading the whole file.
 struct FilesStorage: public Storage
 {
-    FilesStorage(const StorageOptions& options): options(options)
+    FilesStorage(const StorageOptions& options): options(options), tempFileCounter(0), indexed(false)
     {
-        // No operations.
+        migrateLegacyFiles();
     }
 
     bool has(const string& key)
     {
-        return boost::filesystem::exists(getFileName(key));
+        boost::system::error_code error;
+        return boost::filesystem::exists(getFileName(key, COMPRESSED_EXTENSION), error)
+            || boost::filesystem::exists(getFileName(key, RAW_EXTENSION), error);
     }
 
     bool get(const string& key, string& value)
     {
-        string fileName = getFileName(key);
-        FILE* f = fopen(fileName.c_str(), "rb");
-        if (!f)
-            return false;
-        
-        int size = int(boost::filesystem::file_size(fileName));
+        string bytes;
+        if (readContent(getFileName(key, COMPRESSED_EXTENSION), bytes))
+            return snappy::Uncompress(bytes.data(), bytes.size(), &value);
+
+        return readContent(getFileName(key, RAW_EXTENSION), value);
+    }
 
-        char* bytes = new char[size + 1];
-        int done = int(fread(bytes, 1, size, f));
-        if (done != size)
+    bool supportsRanges()
+    {
+        return true;
+    }
+
+    // Compressed values are small, they are read as a whole.
+    bool getRange(const string& key, long long offset, size_t length, string& value, long long& totalSize)
+    {
+        int fd = openForRead(getFileName(key, RAW_EXTENSION), false);
+        if (fd < 0)
         {
-            delete[] bytes;
-            return false;
+            string whole;
+            if (!get(key, whole))
+                return false;
+
+            totalSize = (long long) whole.length();
+            value = whole.substr(size_t(min(offset, totalSize)), length);
+            return true;
         }
 
-        bytes[done] = 0;
-        snappy::Uncompress(bytes, done, &value);
-        delete[] bytes;
-        fclose(f);
+        totalSize = getFileSize(fd);
+        bool result = totalSize >= 0;
+        if (result)
+        {
+            offset = min(offset, totalSize);
+            value.resize(size_t(min((long long) length, totalSize - offset)));
+            result = seekFile(fd, offset, SEEK_SET) == offset
+                && readExactly(fd, &value[0], value.size());
+            if (options.filesIo != "buffered")
+                dropFromPageCache(fd, false);
+        }
 
-        return true;
+        closeFile(fd);
+        return result;
     }
 
     void erase(const string& key)
     {
-        boost::filesystem::remove(getFileName(key));
+        boost::system::error_code error;
+        boost::filesystem::remove(getFileName(key, COMPRESSED_EXTENSION), error);
+        boost::filesystem::remove(getFileName(key, RAW_EXTENSION), error);
+        updateIndex(key, false);
     }
 
     void put(const string& key, const string& value)
     {
-        string fileName = getFileName(key);
+        bool raw = value.length() >= options.filesLargeValueSize;
+        string fileName = getFileName(key, raw ? RAW_EXTENSION : COMPRESSED_EXTENSION);
 
         size_t lastSlash = fileName.find_last_of('/');
         if (lastSlash != string::npos)
+            createDirectories(fileName.substr(0, lastSlash));
+
+        // The value may be stored in the other form before.
+        string otherFileName = getFileName(key, raw ? COMPRESSED_EXTENSION : RAW_EXTENSION);
+        bool written;
+        if (raw)
+            written = writeContent(fileName, value, otherFileName);
+        else
         {
-            string dirs = fileName.substr(0, lastSlash);
-            boost::filesystem::create_directories(dirs);
+            string compressed;
+            snappy::Compress(value.data(), value.size(), &compressed);
+            written = writeContent(fileName, compressed, otherFileName);
         }
 
-        string compressed;
-        snappy::Compress(value.data(), value.size(), &compressed);
+        if (written)
+            updateIndex(key, true);
+    }
 
-        FILE* f = fopen(fileName.c_str(), "wb");
-        fwrite(compressed.c_str(), 1, compressed.length(), f);
-        fclose(f);
+    // A large file is moved in place, so it is never read into memory.
+    void putFile(const string& key, const string& fileName)
+    {
+        boost::system::error_code error;
+        boost::uintmax_t size = boost::filesystem::file_size(fileName, error);
+        if (error || size < options.filesLargeValueSize)
+        {
+            Storage::putFile(key, fileName);
+            return;
+        }
+
+        string rawFileName = getFileName(key, RAW_EXTENSION);
+        size_t lastSlash = rawFileName.find_last_of('/');
+        if (lastSlash != string::npos)
+            createDirectories(rawFileName.substr(0, lastSlash));
+
+        // The compressed form is preferred by get, it goes first: a crash in between loses the value
+        // instead of leaving the old one.
+        boost::filesystem::remove(getFileName(key, COMPRESSED_EXTENSION), error);
+        boost::filesystem::rename(fileName, rawFileName, error);
+        if (error)
+            Storage::putFile(key, fileName);
+        else
+            updateIndex(key, true);
+    }
+
+    void erasePrefix(const string& prefix)
+    {
+        vector<string> fileNames;
+        findFiles(prefix, fileNames);
+
+        boost::system::error_code error;
+        for (size_t j = 0; j < fileNames.size(); j++)
+        {
+            boost::filesystem::remove(fileNames[j], error);
+            updateIndex(getKey(fileNames[j]), false);
+        }
+    }
+
+    // Pages are read from the index, only the first scan walks the files.
+    bool scan(const string& prefix, const string& startAfter, size_t limit, vector<string>& keys)
+    {
+        boost::unique_lock<boost::mutex> lock(indexMutex);
+        if (!indexed)
+        {
+            vector<string> fileNames;
+            findFiles("", fileNames);
+            for (size_t j = 0; j < fileNames.size(); j++)
+                index.insert(getKey(fileNames[j]));
+            indexed = true;
+        }
+
+        auto i = startAfter < prefix ? index.lower_bound(prefix) : index.upper_bound(startAfter);
+        for (size_t count = 0; count <= limit && i != index.end()
+                && i->compare(0, prefix.length(), prefix) == 0; ++i, ++count)
+            keys.push_back(*i);
+
+        return finishScan(keys, limit);
     }
 
 private:
+    static const size_t HASHED_PATH_LENGTH = 6;
+    static const size_t EXTENSION_LENGTH = 4;
+    static const char* const COMPRESSED_EXTENSION;
+    static const char* const RAW_EXTENSION;
+    static const char* const LAYOUT_MARKER;
+
     StorageOptions options;
+    std::atomic<unsigned long long> tempFileCounter;
+
+    boost::mutex directoriesMutex;
+    unordered_set<string> directories;
+
+    // Ordered keys, they are kept in memory only after the first scan.
+    boost::mutex indexMutex;
+    bool indexed;
+    set<string> index;
+
+    // Files are changed before the index: the first scan may add a key already,
+    // but it never misses one which is written concurrently.
+    void updateIndex(const string& key, bool present)
+    {
+        boost::unique_lock<boost::mutex> lock(indexMutex);
+        if (!indexed)
+            return;
+
+        if (present)
+            index.insert(key);
+        else
+            index.erase(key);
+    }
+
+    string getKey(const string& fileName)
+    {
+        size_t rootLength = options.directory.length() + 1 + HASHED_PATH_LENGTH;
+        return fileName.substr(rootLength, fileName.length() - rootLength - EXTENSION_LENGTH);
+    }
+
+    // Keys are spread over hashed directories, so all of them are walked.
+    void findFiles(const string& prefix, vector<string>& fileNames)
+    {
+        boost::system::error_code error;
+        boost::filesystem::recursive_directory_iterator i(options.directory, error), end;
+        size_t rootLength = options.directory.length() + 1 + HASHED_PATH_LENGTH;
+
+        for (; !error && i != end; i.increment(error))
+        {
+            string fileName = i->path().generic_string();
+            if (fileName.length() >= rootLength + EXTENSION_LENGTH
+                    && (fileName.compare(fileName.length() - EXTENSION_LENGTH, EXTENSION_LENGTH, COMPRESSED_EXTENSION) == 0
+                        || fileName.compare(fileName.length() - EXTENSION_LENGTH, EXTENSION_LENGTH, RAW_EXTENSION) == 0)
+                    && fileName.compare(rootLength, prefix.length(), prefix) == 0)
+                fileNames.push_back(fileName);
+        }
+    }
+
+    bool readContent(const string& fileName, string& content)
+    {
+        int fd = openForRead(fileName, false);
+        if (fd < 0)
+            return false;
+
+        long long size = getFileSize(fd);
+        bool large = size >= (long long) options.filesLargeValueSize;
+        int directFd = large && options.filesIo == "direct" ? openForRead(fileName, true) : -1;
+        bool result = false;
+
+        if (size < 0)
+            result = false;
+        else if (directFd >= 0)
+        {
+            char* bytes = allocateAligned(size_t(size));
+            if (bytes != 0)
+            {
+                size_t aligned = (size_t(size) + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+                size_t done = 0;
+                while (done < aligned)
+                {
+                    long long count = (long long) readFile(directFd, bytes + done, aligned - done);
+                    if (count <= 0)
+                        break;
+                    done += size_t(count);
+                }
+                result = done == size_t(size);
+                if (result)
+                    content.assign(bytes, size_t(size));
+                freeAligned(bytes);
+            }
+        }
+        else
+        {
+            content.resize(size_t(size));
+            result = readExactly(fd, &content[0], content.size());
+            if (large && options.filesIo == "fadvise")
+                dropFromPageCache(fd, false);
+        }
+
+        if (directFd >= 0)
+            closeFile(directFd);
+        closeFile(fd);
+        return result;
+    }
+
+    // Readers never see a partially written file: the content is written aside and renamed. The other
+    // form of the value is removed just before the rename, so a crash never leaves the old value visible.
+    bool writeContent(const string& fileName, const string& content, const string& otherFileName)
+    {
+        string tempFileName = fileName + ".tmp" + boost::lexical_cast<string>(tempFileCounter++);
+        bool large = content.length() >= options.filesLargeValueSize;
+        bool direct = large && options.filesIo == "direct";
+        bool result = false;
+
+        // Not every file system supports O_DIRECT, then buffered I/O is used.
+        int fd = direct ? openForWrite(tempFileName, true) : -1;
+        if (fd < 0)
+        {
+            direct = false;
+            fd = openForWrite(tempFileName, false);
+        }
+
+        if (fd >= 0)
+        {
+            if (direct)
+            {
+                size_t aligned = (content.length() + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+                char* bytes = allocateAligned(aligned);
+                if (bytes != 0)
+                {
+                    memcpy(bytes, content.data(), content.length());
+                    memset(bytes + content.length(), 0, aligned - content.length());
+                    result = writeExactly(fd, bytes, aligned)
+                        && truncateFile(fd, (long) content.length()) == 0;
+                    freeAligned(bytes);
+                }
+            }
+            else
+            {
+                result = writeExactly(fd, content.data(), content.length());
+                if (large && options.filesIo == "fadvise")
+                    dropFromPageCache(fd, true);
+            }
+            closeFile(fd);
+        }
 
-    string getFileName(const string& key)
+        boost::system::error_code error;
+        if (result)
+        {
+            boost::filesystem::remove(otherFileName, error);
+            boost::filesystem::rename(tempFileName, fileName, error);
+        }
+        if (!result || error)
+        {
+            boost::filesystem::remove(tempFileName, error);
+            return false;
+        }
+        return true;
+    }
+
+    void createDirectories(const string& directory)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(directoriesMutex);
+            if (directories.count(directory))
+                return;
+        }
+
+        boost::system::error_code error;
+        boost::filesystem::create_directories(directory, error);
+        if (!error)
+        {
+            boost::unique_lock<boost::mutex> lock(directoriesMutex);
+            directories.insert(directory);
+        }
+    }
+
+    // Values of older versions are stored by the key prefix: "ab/cd/ef/abcdefgh.bin".
+    string getLegacyFileName(const string& key)
     {
         string path;
-        for (size_t i = 2; i <= 6; i+=2)
+        for (size_t i = 2; i <= 6; i += 2)
             if (key.size() >= i)
                 path += key.substr(i - 2, 2) + '/';
-        return options.directory + '/' + path + key + ".bin";
+        return options.directory + '/' + path + key + COMPRESSED_EXTENSION;
+    }
+
+    // Moves values of the legacy layout to the hashed one once, the marker file
+    // keeps later starts from walking the directory.
+    void migrateLegacyFiles()
+    {
+        string markerFileName = options.directory + '/' + LAYOUT_MARKER;
+        boost::system::error_code error;
+        if (boost::filesystem::exists(markerFileName, error))
+            return;
+
+        vector<string> fileNames;
+        boost::filesystem::recursive_directory_iterator i(options.directory, error), end;
+        for (; !error && i != end; i.increment(error))
+        {
+            string fileName = i->path().generic_string();
+            string key = i->path().filename().generic_string();
+            if (key.length() > EXTENSION_LENGTH
+                    && key.compare(key.length() - EXTENSION_LENGTH, EXTENSION_LENGTH, COMPRESSED_EXTENSION) == 0)
+            {
+                key.resize(key.length() - EXTENSION_LENGTH);
+                if (fileName == getLegacyFileName(key) && fileName != getFileName(key, COMPRESSED_EXTENSION))
+                    fileNames.push_back(fileName);
+            }
+        }
+        if (error && error != boost::system::errc::no_such_file_or_directory)
+        {
+            log(options, "Can't walk " + options.directory + " to migrate legacy files: " + error.message());
+            return;
+        }
+
+        size_t moved = 0;
+        for (size_t j = 0; j < fileNames.size(); j++)
+        {
+            string fileName = fileNames[j];
+            string key = fileName.substr(fileName.find_last_of('/') + 1);
+            key.resize(key.length() - EXTENSION_LENGTH);
+
+            // A value written by a newer version without the migration is newer than the legacy one.
+            string newFileName = getFileName(key, COMPRESSED_EXTENSION);
+            if (boost::filesystem::exists(newFileName, error) || boost::filesystem::exists(getFileName(key, RAW_EXTENSION), error))
+                boost::filesystem::remove(fileName, error);
+            else
+            {
+                createDirectories(newFileName.substr(0, newFileName.find_last_of('/')));
+                boost::filesystem::rename(fileName, newFileName, error);
+                if (error)
+                {
+                    log(options, "Can't move legacy file " + fileName + ": " + error.message());
+                    return;
+                }
+                moved++;
+            }
+
+            // Emptied legacy directories are removed, the hashed ones are not empty.
+            for (size_t lastSlash = fileName.find_last_of('/');
+                    lastSlash != string::npos && lastSlash > options.directory.length();
+                    lastSlash = fileName.find_last_of('/'))
+            {
+                fileName.resize(lastSlash);
+                if (!boost::filesystem::is_empty(fileName, error) || error
+                        || !boost::filesystem::remove(fileName, error))
+                    break;
+            }
+        }
+
+        if (!fileNames.empty())
+            log(options, "Moved " + boost::lexical_cast<string>(moved) + " legacy files to hashed directories in " + options.directory);
+
+        boost::filesystem::create_directories(options.directory, error);
+        FILE* marker = fopen(markerFileName.c_str(), "wb");
+        if (marker != 0)
+            fclose(marker);
+    }
+
+    // Two levels of 256 directories by a hash of the key give even fan-out for any keys.
+    string getFileName(const string& key, const char* extension)
+    {
+        unsigned long long hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < key.length(); i++)
+            hash = (hash ^ (unsigned char) key[i]) * 1099511628211ULL;
+
+        // The low bits depend on every byte, the high ones hardly change with the last bytes.
+        char path[8];
+        sprintf(path, "%02x/%02x/", unsigned(hash & 255), unsigned((hash >> 8) & 255));
+        return options.directory + '/' + path + key + extension;
     }
 };
 
+const char* const FilesStorage::COMPRESSED_EXTENSION = ".bin";
+const char* const FilesStorage::RAW_EXTENSION = ".raw";
+const char* const FilesStorage::LAYOUT_MARKER = "hashed.layout";
+
 // ==============================================================================
 
 struct CompactStorage: public Storage
 {
-    CompactStorage(const StorageOptions& options)
+    CompactStorage(const StorageOptions& options): options(options)
     {
         boost::filesystem::create_directories(options.directory);
-        compact = new FileSystemCompactStorage(options.directory, 8);
+        compact = new FileSystemCompactStorage(options.directory, COMPACT_SERVER_GROUPS, COMPACT_SERVER_FORMAT,
+                false, options.logger);
     }
 
     ~CompactStorage()
@@ -172,15 +773,26 @@ struct CompactStorage: public Storage
         delete compact;
     }
 
+    // The server format has the empty section only and values without expiration,
+    // which is handled by Expirations.
     bool has(const string& key)
     {
-        return compact->has(key);
+        return compact->has("", key, 0);
     }
 
     bool get(const string& key, string& value)
     {
         string raw;
-        bool result = compact->get(key, raw);
+        bool result;
+        try
+        {
+            result = compact->get("", key, 0, raw);
+        }
+        catch (std::exception& e)
+        {
+            log(options, e.what());
+            return false;
+        }
         if (result)
             snappy::Uncompress(raw.data(), raw.size(), &value);
         return result;
@@ -188,17 +800,64 @@ struct CompactStorage: public Storage
 
     void erase(const string& key)
     {
-        compact->erase(key);
+        try
+        {
+            compact->erase("", key, 0);
+        }
+        catch (std::exception& e)
+        {
+            log(options, e.what());
+        }
     }
 
     void put(const string& key, const string& value)
     {
         string raw;
         snappy::Compress(value.data(), value.size(), &raw);
-        compact->put(key, raw);
+        try
+        {
+            compact->put("", key, raw, 0, NO_EXPIRATION, true);
+        }
+        catch (std::exception& e)
+        {
+            log(options, e.what());
+        }
+    }
+
+    void erasePrefix(const string& prefix)
+    {
+        try
+        {
+            compact->erasePrefix("", prefix);
+        }
+        catch (std::exception& e)
+        {
+            log(options, e.what());
+        }
+    }
+
+    bool scan(const string& prefix, const string& startAfter, size_t limit, vector<string>& keys)
+    {
+        compact->scan("", prefix, startAfter, limit + 1, 0, keys);
+        return finishScan(keys, limit);
+    }
+
+    bool backup(const string& directory)
+    {
+        try
+        {
+            compact->snapshot()->save(directory);
+            return true;
+        }
+        catch (std::exception& e)
+        {
+            log(options, e.what());
+            return false;
+        }
     }
 
 private:
+    StorageOptions options;
     FileSystemCompactStorage* compact;
 };
 
@@ -216,7 +875,8 @@ struct LevelDbStorage: public Storage
         this->options.block_size = 65536;
         this->options.filter_policy = leveldb::NewBloomFilterPolicy(10);
         leveldb::Status status = leveldb::DB::Open(this->options, options.directory, &db);
-        assert(status.ok());
+        if (!status.ok())
+            throw runtime_error("Can't open leveldb in " + options.directory + ": " + status.ToString());
     }
 
     bool has(const string& key)
@@ -242,6 +902,36 @@ struct LevelDbStorage: public Storage
         db->Put(leveldb::WriteOptions(), key, value);
     }
 
+    // Keys are ordered, so only the range of the prefix is iterated; deletes go in batches.
+    void erasePrefix(const string& prefix)
+    {
+        boost::scoped_ptr<leveldb::Iterator> i(db->NewIterator(leveldb::ReadOptions()));
+        leveldb::WriteBatch batch;
+        int batchSize = 0;
+        for (i->Seek(prefix); i->Valid() && i->key().starts_with(prefix); i->Next())
+        {
+            batch.Delete(i->key());
+            if (++batchSize == ERASE_BATCH_SIZE)
+            {
+                db->Write(leveldb::WriteOptions(), &batch);
+                batch.Clear();
+                batchSize = 0;
+            }
+        }
+        db->Write(leveldb::WriteOptions(), &batch);
+    }
+
+    bool scan(const string& prefix, const string& startAfter, size_t limit, vector<string>& keys)
+    {
+        boost::scoped_ptr<leveldb::Iterator> i(db->NewIterator(leveldb::ReadOptions()));
+        i->Seek(max(prefix, startAfter));
+        if (i->Valid() && i->key() == startAfter)
+            i->Next();
+        for (; i->Valid() && i->key().starts_with(prefix) && keys.size() <= limit; i->Next())
+            keys.push_back(i->key().ToString());
+        return finishScan(keys, limit);
+    }
+
     ~LevelDbStorage()
     {
         delete db;
@@ -251,6 +941,8 @@ struct LevelDbStorage: public Storage
     }
 
 private:
+    static const int ERASE_BATCH_SIZE = 1000;
+
     leveldb::DB* db;
     leveldb::Options options;
 };
@@ -258,53 +950,598 @@ private:
 #endif
 
 #ifdef HAS_ROCKSDB
-struct RocksDBStorage: public Storage {
 
-   RocksDBStorage(const StorageOptions& options)
+#if ROCKSDB_MAJOR > 7 || (ROCKSDB_MAJOR == 7 && ROCKSDB_MINOR >= 7)
+#   define HAS_ROCKSDB_HYPER_CLOCK_CACHE
+#endif
+
+struct RocksDBStorage: public Storage
+{
+    RocksDBStorage(const StorageOptions& options)
+        : prefixes(options.rocksDbColumnFamilyPrefixes)
     {
-        this->options.create_if_missing = true;
-        this->options.create_missing_column_families = true;
-	this->options.allow_mmap_reads = true;
-	this->options.allow_mmap_writes = true;
-        this->options.write_buffer_size = 64 * 1024 * 1024;
-        const auto status = rocksdb::DB::Open(this->options, options.directory, &db);
-        assert(status.ok());
+        // One block cache shared by all column families.
+        std::shared_ptr<rocksdb::Cache> cache;
+#ifdef HAS_ROCKSDB_HYPER_CLOCK_CACHE
+        if (options.rocksDbHyperClockCache)
+            cache = rocksdb::HyperClockCacheOptions(options.rocksDbBlockCacheSize, BLOCK_SIZE).MakeSharedCache();
+#endif
+        if (!cache)
+            cache = rocksdb::NewLRUCache(options.rocksDbBlockCacheSize);
+
+        rocksdb::BlockBasedTableOptions table;
+        table.block_cache = cache;
+        table.block_size = BLOCK_SIZE;
+        table.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, false));
+        table.partition_filters = true;
+        table.index_type = rocksdb::BlockBasedTableOptions::kTwoLevelIndexSearch;
+        table.metadata_block_size = 4096;
+        table.cache_index_and_filter_blocks = true;
+        table.cache_index_and_filter_blocks_with_high_priority = true;
+        table.pin_top_level_index_and_filter = true;
+        table.pin_l0_filter_and_index_blocks_in_cache = true;
+
+        rocksdb::ColumnFamilyOptions family;
+        family.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table));
+        family.write_buffer_size = options.rocksDbWriteBufferSize;
+        family.compression = rocksdb::kSnappyCompression;
+
+        // Values up to tens of megabytes go to blob files, LSM keeps only references.
+        family.enable_blob_files = true;
+        family.min_blob_size = options.rocksDbMinBlobSize;
+        family.blob_file_size = 256 * 1024 * 1024;
+        family.blob_compression_type = rocksdb::kSnappyCompression;
+        family.enable_blob_garbage_collection = true;
+
+        if (options.rocksDbCompactionStyle == "universal")
+            family.compaction_style = rocksdb::kCompactionStyleUniversal;
+        else if (options.rocksDbCompactionStyle == "fifo")
+            family.compaction_style = rocksdb::kCompactionStyleFIFO;
+        else
+        {
+            family.compaction_style = rocksdb::kCompactionStyleLevel;
+            family.level_compaction_dynamic_level_bytes = true;
+        }
+
+        rocksdb::DBOptions dbOptions;
+        dbOptions.create_if_missing = true;
+        dbOptions.create_missing_column_families = true;
+        dbOptions.max_background_jobs = std::max(2, int(boost::thread::hardware_concurrency()));
+        dbOptions.bytes_per_sync = 1024 * 1024;
+        if (options.rocksDbRateLimit > 0)
+            dbOptions.rate_limiter.reset(rocksdb::NewGenericRateLimiter(int64_t(options.rocksDbRateLimit)));
+
+        // All existing column families have to be opened, not only configured ones.
+        vector<string> names;
+        rocksdb::DB::ListColumnFamilies(dbOptions, options.directory, &names);
+        names.push_back(rocksdb::kDefaultColumnFamilyName);
+        names.insert(names.end(), prefixes.begin(), prefixes.end());
+        sort(names.begin(), names.end());
+        names.erase(unique(names.begin(), names.end()), names.end());
+
+        vector<rocksdb::ColumnFamilyDescriptor> descriptors;
+        for (size_t i = 0; i < names.size(); i++)
+            descriptors.push_back(rocksdb::ColumnFamilyDescriptor(names[i], family));
+
+        vector<rocksdb::ColumnFamilyHandle*> handles;
+        const auto status = rocksdb::DB::Open(dbOptions, options.directory, descriptors, &handles, &db);
+        if (!status.ok())
+            throw runtime_error("Can't open rocksdb in " + options.directory + ": " + status.ToString());
+
+        for (size_t i = 0; i < handles.size(); i++)
+            handlesByName[names[i]] = handles[i];
     }
 
     bool has(const string& key)
     {
+        rocksdb::ColumnFamilyHandle* family = getColumnFamily(key);
         std::string value;
-        const auto s = db->Get(rocksdb::ReadOptions(), key, &value);
+        if (!db->KeyMayExist(rocksdb::ReadOptions(), family, key, &value))
+            return false;
+        rocksdb::PinnableSlice pinned;
+        const auto s = db->Get(rocksdb::ReadOptions(), family, key, &pinned);
         return s.ok();
     }
 
     bool get(const string& key, string& value)
     {
-        const auto s = db->Get(rocksdb::ReadOptions(), key, &value);
+        const auto s = db->Get(rocksdb::ReadOptions(), getColumnFamily(key), key, &value);
         return s.ok();
     }
 
     void erase(const string& key)
     {
-        db->Delete(rocksdb::WriteOptions(), key);
+        db->Delete(rocksdb::WriteOptions(), getColumnFamily(key), key);
     }
 
     void put(const string& key, const string& value)
     {
-        db->Put(rocksdb::WriteOptions(), key, value);
+        db->Put(rocksdb::WriteOptions(), getColumnFamily(key), key, value);
+    }
+
+    // A range tombstone is O(1), the data is reclaimed by compactions.
+    void erasePrefix(const string& prefix)
+    {
+        // Keys starting with the prefix are below the prefix with the last non-0xff byte incremented.
+        string limit = prefix;
+        while (!limit.empty() && (unsigned char) limit.back() == 255)
+            limit.pop_back();
+        if (!limit.empty())
+            limit.back()++;
+
+        for (auto i = handlesByName.begin(); i != handlesByName.end(); ++i)
+            if (!limit.empty())
+                db->DeleteRange(rocksdb::WriteOptions(), i->second, prefix, limit);
+            else
+            {
+                boost::scoped_ptr<rocksdb::Iterator> j(db->NewIterator(rocksdb::ReadOptions(), i->second));
+                for (j->Seek(prefix); j->Valid(); j->Next())
+                    db->Delete(rocksdb::WriteOptions(), i->second, j->key());
+            }
+    }
+
+    // Keys of the prefix may be in several column families, each of them gives a sorted page.
+    bool scan(const string& prefix, const string& startAfter, size_t limit, vector<string>& keys)
+    {
+        for (auto i = handlesByName.begin(); i != handlesByName.end(); ++i)
+        {
+            boost::scoped_ptr<rocksdb::Iterator> j(db->NewIterator(rocksdb::ReadOptions(), i->second));
+            j->Seek(max(prefix, startAfter));
+            if (j->Valid() && j->key() == startAfter)
+                j->Next();
+            for (size_t count = 0; j->Valid() && j->key().starts_with(prefix) && count <= limit; j->Next(), count++)
+                keys.push_back(j->key().ToString());
+        }
+        return finishScan(keys, limit);
     }
 
-   ~RocksDBStorage()
+    ~RocksDBStorage()
     {
+        for (auto i = handlesByName.begin(); i != handlesByName.end(); ++i)
+            db->DestroyColumnFamilyHandle(i->second);
         delete db;
     }
 
 private:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
     rocksdb::DB* db;
-    rocksdb::Options options;
+    vector<string> prefixes;
+    map<string, rocksdb::ColumnFamilyHandle*> handlesByName;
+
+    // Keys are routed to the column family of the longest matching prefix.
+    rocksdb::ColumnFamilyHandle* getColumnFamily(const string& key)
+    {
+        const string* best = 0;
+        for (size_t i = 0; i < prefixes.size(); i++)
+            if (key.compare(0, prefixes[i].length(), prefixes[i]) == 0
+                    && (best == 0 || prefixes[i].length() > best->length()))
+                best = &prefixes[i];
+
+        // Read concurrently: the map is filled by the constructor only, so no operator[] here.
+        return handlesByName.find(best == 0 ? rocksdb::kDefaultColumnFamilyName : *best)->second;
+    }
 };
+
 #endif
 
+// ==============================================================================
+
+// Hot backend (e.g. compact on NVMe) over a cold one (e.g. RocksDB on HDD). New values go to
+// the hot tier, values read from the cold tier are promoted to the hot one, and a background
+// thread demotes least recently used values back to the cold tier. Values promoted and not
+// changed since have a copy in the cold tier, so their demotion is just erasing.
+struct TieredStorage: public Storage
+{
+    TieredStorage(const StorageOptions& options)
+        : options(options), hotCapacity(options.tieredHotCapacity), hotMaxAge(options.tieredHotMaxAge), hotSize(0),
+        hotHits(0), coldHits(0), misses(0), promotions(0), demotions(0), demotedBytes(0)
+    {
+        StorageOptions hotOptions(options);
+        hotOptions.directory = options.tieredHotDirectory;
+        hot.reset(newStorage(getType(options.tieredHotType), hotOptions));
+
+        StorageOptions coldOptions(options);
+        coldOptions.directory = options.tieredColdDirectory;
+        cold.reset(newStorage(getType(options.tieredColdType), coldOptions));
+
+        if (!hot || !cold)
+            throw runtime_error("Can't initialize tiers of tiered storage");
+        locks.resize(LOCK_COUNT);
+        demotionThread = boost::thread(boost::bind(&TieredStorage::runDemotions, this));
+    }
+
+    ~TieredStorage()
+    {
+        demotionThread.interrupt();
+        demotionThread.join();
+    }
+
+    bool has(const string& key)
+    {
+        if (hot->has(key))
+        {
+            hotHits++;
+            return true;
+        }
+
+        if (cold->has(key))
+        {
+            coldHits++;
+            return true;
+        }
+
+        misses++;
+        return false;
+    }
+
+    bool get(const string& key, string& value)
+    {
+        if (hot->get(key, value))
+        {
+            hotHits++;
+            touch(key, value.length(), false, true);
+            return true;
+        }
+
+        if (cold->has(key))
+        {
+            // Both tiers are read again under the lock: a put or an erase after the checks above
+            // must not be undone by the promotion.
+            boost::unique_lock<boost::mutex> lock(getLock(key));
+            if (hot->get(key, value))
+            {
+                hotHits++;
+                touch(key, value.length(), false, true);
+                return true;
+            }
+
+            if (cold->get(key, value))
+            {
+                coldHits++;
+                hot->put(key, value);
+                touch(key, value.length(), false, false);
+                promotions++;
+                return true;
+            }
+        }
+
+        misses++;
+        return false;
+    }
+
+    bool supportsRanges()
+    {
+        return hot->supportsRanges() && cold->supportsRanges();
+    }
+
+    // Ranges are read from a tier as is: large values are not worth promoting for a part of them.
+    bool getRange(const string& key, long long offset, size_t length, string& value, long long& totalSize)
+    {
+        if (hot->getRange(key, offset, length, value, totalSize))
+        {
+            hotHits++;
+            return true;
+        }
+
+        if (cold->getRange(key, offset, length, value, totalSize))
+        {
+            coldHits++;
+            return true;
+        }
+
+        misses++;
+        return false;
+    }
+
+    void erase(const string& key)
+    {
+        boost::unique_lock<boost::mutex> lock(getLock(key));
+        hot->erase(key);
+        cold->erase(key);
+        forget(key);
+    }
+
+    void put(const string& key, const string& value)
+    {
+        boost::unique_lock<boost::mutex> lock(getLock(key));
+        hot->put(key, value);
+        touch(key, value.length(), true, true);
+    }
+
+    // The file goes to the hot tier as is, so it is not read into memory if the tier can take it.
+    void putFile(const string& key, const string& fileName)
+    {
+        boost::system::error_code error;
+        boost::uintmax_t size = boost::filesystem::file_size(fileName, error);
+
+        boost::unique_lock<boost::mutex> lock(getLock(key));
+        hot->putFile(key, fileName);
+        touch(key, error ? 0 : size_t(size), true, true);
+    }
+
+    void erasePrefix(const string& prefix)
+    {
+        hot->erasePrefix(prefix);
+        cold->erasePrefix(prefix);
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (auto i = entries.begin(); i != entries.end(); )
+            if (i->first.compare(0, prefix.length(), prefix) == 0)
+            {
+                hotSize -= i->second.size;
+                recency.erase(i->second.position);
+                i = entries.erase(i);
+            }
+            else
+                ++i;
+    }
+
+    // A key being demoted may be in both tiers.
+    bool scan(const string& prefix, const string& startAfter, size_t limit, vector<string>& keys)
+    {
+        bool hotMore = hot->scan(prefix, startAfter, limit, keys);
+        vector<string> coldKeys;
+        bool coldMore = cold->scan(prefix, startAfter, limit, coldKeys);
+        keys.insert(keys.end(), coldKeys.begin(), coldKeys.end());
+
+        // A tier with more keys has them after the merged page, which ends no later than its own one.
+        bool more = finishScan(keys, limit);
+        return more || hotMore || coldMore;
+    }
+
+    void collectStats(map<string, long long>& stats)
+    {
+        stats["tiered_hot_hits"] = hotHits;
+        stats["tiered_cold_hits"] = coldHits;
+        stats["tiered_misses"] = misses;
+        stats["tiered_promotions"] = promotions;
+        stats["tiered_demotions"] = demotions;
+        stats["tiered_demoted_bytes"] = demotedBytes;
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            stats["tiered_hot_bytes"] = (long long) hotSize;
+            stats["tiered_hot_entries"] = (long long) entries.size();
+        }
+
+        hot->collectStats(stats);
+        cold->collectStats(stats);
+    }
+
+private:
+    static const size_t LOCK_COUNT = 1024;
+    static const size_t INDEX_PAGE_SIZE = 1024;
+
+    struct HotEntry
+    {
+        list<string>::iterator position;
+        size_t size;
+        time_t lastAccess;
+        // The hot tier has changes the cold one hasn't.
+        bool dirty;
+    };
+
+    StorageOptions options;
+    boost::scoped_ptr<Storage> hot;
+    boost::scoped_ptr<Storage> cold;
+
+    // Puts, erases, promotions and demotions of a key are serialized by its lock.
+    boost::ptr_vector<boost::mutex> locks;
+
+    // Hot entries in the most recently used first order.
+    boost::mutex mutex;
+    list<string> recency;
+    unordered_map<string, HotEntry> entries;
+    size_t hotCapacity;
+    int hotMaxAge;
+    size_t hotSize;
+
+    std::atomic<long long> hotHits;
+    std::atomic<long long> coldHits;
+    std::atomic<long long> misses;
+    std::atomic<long long> promotions;
+    std::atomic<long long> demotions;
+    std::atomic<long long> demotedBytes;
+
+    boost::thread demotionThread;
+
+    boost::mutex& getLock(const string& key)
+    {
+        return locks[std::hash<string>()(key) % LOCK_COUNT];
+    }
+
+    // Entries written before a restart are unknown until indexed or accessed, then they are assumed dirty.
+    void touch(const string& key, size_t size, bool dirty, bool dirtyIfUnknown)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+
+        auto i = entries.find(key);
+        if (i == entries.end())
+        {
+            recency.push_front(key);
+            HotEntry entry = {recency.begin(), size, time(0), dirty || dirtyIfUnknown};
+            entries.insert(make_pair(key, entry));
+        }
+        else
+        {
+            recency.splice(recency.begin(), recency, i->second.position);
+            hotSize -= i->second.size;
+            i->second.size = size;
+            i->second.lastAccess = time(0);
+            i->second.dirty = i->second.dirty || dirty;
+        }
+
+        hotSize += size;
+    }
+
+    // Adds an unknown entry as the least recently used one.
+    void remember(const string& key, size_t size)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (entries.count(key))
+            return;
+
+        recency.push_back(key);
+        HotEntry entry = {--recency.end(), size, time(0), true};
+        entries.insert(make_pair(key, entry));
+        hotSize += size;
+    }
+
+    // Makes the entry the most recently used one, so it doesn't hold back other demotions.
+    void postpone(const string& key)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+
+        auto i = entries.find(key);
+        if (i != entries.end())
+        {
+            recency.splice(recency.begin(), recency, i->second.position);
+            i->second.lastAccess = time(0);
+        }
+    }
+
+    void forget(const string& key)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+
+        auto i = entries.find(key);
+        if (i != entries.end())
+        {
+            hotSize -= i->second.size;
+            recency.erase(i->second.position);
+            entries.erase(i);
+        }
+    }
+
+    // Returns the least recently used key if it has to be demoted.
+    bool nextDemotion(string& key)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+
+        if (recency.empty())
+            return false;
+
+        const HotEntry& entry = entries[recency.back()];
+        if (hotSize > hotCapacity || (hotMaxAge > 0 && entry.lastAccess + hotMaxAge < time(0)))
+        {
+            key = recency.back();
+            return true;
+        }
+
+        return false;
+    }
+
+    // Backends don't report failed writes, so the value is read back before the hot copy is erased.
+    bool putCold(const string& key, const string& value)
+    {
+        try
+        {
+            cold->put(key, value);
+            string stored;
+            return cold->get(key, stored) && stored == value;
+        }
+        catch (std::exception&)
+        {
+            return false;
+        }
+    }
+
+    // Returns false if the value stays in the hot tier because the cold one didn't take it.
+    bool demote(const string& key)
+    {
+        boost::unique_lock<boost::mutex> lock(getLock(key));
+
+        bool dirty;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            auto i = entries.find(key);
+            if (i == entries.end())
+                return true;
+            dirty = i->second.dirty;
+        }
+
+        string value;
+        if (hot->get(key, value))
+        {
+            if (dirty && !putCold(key, value))
+            {
+                log(options, "Can't demote " + key + " to the cold tier, it stays in the hot one");
+                postpone(key);
+                return false;
+            }
+            hot->erase(key);
+            demotions++;
+            demotedBytes += (long long) value.length();
+        }
+
+        forget(key);
+        return true;
+    }
+
+    // Stops at a failed demotion, it is retried a second later.
+    void demoteExcess()
+    {
+        string key;
+        while (nextDemotion(key) && demote(key))
+            boost::this_thread::interruption_point();
+    }
+
+    // Values left in the hot tier by the previous run are indexed page by page as the least recently
+    // used ones, and the excess is demoted as it is found.
+    void indexHotTier()
+    {
+        string startAfter;
+        bool more = true;
+        while (more)
+        {
+            vector<string> keys;
+            more = hot->scan("", startAfter, INDEX_PAGE_SIZE, keys);
+            if (keys.empty())
+                break;
+
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                boost::unique_lock<boost::mutex> lock(getLock(keys[i]));
+                string value;
+                long long size = 0;
+                bool found = hot->supportsRanges() ? hot->getRange(keys[i], 0, 0, value, size)
+                    : hot->get(keys[i], value);
+                if (found)
+                    remember(keys[i], hot->supportsRanges() ? size_t(size) : value.length());
+            }
+
+            startAfter = keys.back();
+            demoteExcess();
+        }
+    }
+
+    void runDemotions()
+    {
+        try
+        {
+            try
+            {
+                indexHotTier();
+            }
+            catch (std::exception& e)
+            {
+                log(options, string("Can't index the hot tier: ") + e.what());
+            }
+
+            while (true)
+            {
+                boost::this_thread::sleep(boost::posix_time::seconds(1));
+                demoteExcess();
+            }
+        }
+        catch (boost::thread_interrupted&)
+        {
+            // Stopped by the destructor.
+        }
+    }
+};
+
 Storage* newStorage(StorageType type, const StorageOptions& options)
 {
 
@@ -323,6 +1560,10 @@ Storage* newStorage(StorageType type, const StorageOptions& options)
       case ROCKSDB:
         return new RocksDBStorage(options);
 #endif
+      case TIERED:
+        return new TieredStorage(options);
+      default:
+        break;
     }
 
     return 0;
@@ -2,20 +2,102 @@
 #define RIORITA_STORAGE_H_
 
 #include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+
+#include <boost/shared_ptr.hpp>
 
 namespace riorita {
 
+class Logger;
+
 struct StorageOptions
 {
-    std::string directory;    
+    StorageOptions();
+
+    std::string directory;
+
+    // Log of the server, backends report failures and recoveries into it (stderr if it is not set).
+    boost::shared_ptr<Logger> logger;
+
+    // Memory backend: capacity in bytes (0 means unlimited) and number of shards.
+    size_t memoryCapacity;
+    int memoryShards;
+
+    // Memory backend persistence: snapshots into the directory (on shutdown and every
+    // memorySnapshotInterval seconds if positive) and optional append-only log of changes.
+    bool memoryPersistent;
+    int memorySnapshotInterval;
+    bool memoryLog;
+
+    // Files backend: "buffered", "fadvise" (keep large values out of the page cache)
+    // or "direct" (O_DIRECT for large values); values starting from filesLargeValueSize are large.
+    std::string filesIo;
+    size_t filesLargeValueSize;
+
+    // Tiered backend: hot and cold backend types with own directories. Least recently used
+    // entries are demoted from the hot tier above tieredHotCapacity bytes of values or
+    // when they were not accessed for tieredHotMaxAge seconds (if positive).
+    std::string tieredHotType;
+    std::string tieredHotDirectory;
+    std::string tieredColdType;
+    std::string tieredColdDirectory;
+    size_t tieredHotCapacity;
+    int tieredHotMaxAge;
+
+    // RocksDB tuning, all sizes are in bytes.
+    size_t rocksDbBlockCacheSize;
+    bool rocksDbHyperClockCache;
+    size_t rocksDbWriteBufferSize;
+    size_t rocksDbMinBlobSize;
+    std::string rocksDbCompactionStyle;
+    size_t rocksDbRateLimit;
+    std::vector<std::string> rocksDbColumnFamilyPrefixes;
 };
 
 struct Storage
 {
+    virtual ~Storage() {}
+
     virtual bool has(const std::string& key) = 0;
     virtual bool get(const std::string& key, std::string& value) = 0;
     virtual void erase(const std::string& key) = 0;
     virtual void put(const std::string& key, const std::string& value) = 0;
+
+    // Erases all keys starting with the prefix. It may be slow, it is called in background
+    // to reclaim dropped namespaces.
+    virtual void erasePrefix(const std::string& prefix) = 0;
+
+    // Lists at most limit keys starting with the prefix and greater than startAfter in ascending order.
+    // Returns true if there are more such keys.
+    virtual bool scan(const std::string& prefix, const std::string& startAfter, size_t limit,
+            std::vector<std::string>& keys) = 0;
+
+    // Returns true if the backend reads a part of a value without reading the whole one and takes
+    // large files without reading them into memory: the server rejects RANGE_GET and PUT_CHUNK otherwise.
+    virtual bool supportsRanges() { return false; }
+
+    // Reads at most length bytes of the value from the offset and the size of the whole value.
+    // Called only if supportsRanges, by default there is no value.
+    virtual bool getRange(const std::string& key, long long offset, size_t length,
+            std::string& value, long long& totalSize);
+
+    // Puts the content of the file (it may be moved by the call). By default it is read into memory,
+    // it is used for small files and by backends which keep values in memory anyway.
+    virtual void putFile(const std::string& key, const std::string& fileName);
+
+    // Appends backend specific counters, like per-tier hits.
+    virtual void collectStats(std::map<std::string, long long>& /* stats */) {}
+
+    // Writes a consistent copy of the data into the new directory while the storage is being used.
+    // Returns false if the backend can't do it.
+    virtual bool backup(const std::string& /* directory */) { return false; }
+
+protected:
+    // Makes the result of scan from the candidates, which may be unordered and have duplicates
+    // (but all of them start with the prefix and are greater than startAfter).
+    static bool finishScan(std::vector<std::string>& keys, size_t limit);
 };
 
 enum StorageType
@@ -25,7 +107,8 @@ enum StorageType
     FILES,
     LEVELDB,
     COMPACT,
-    ROCKSDB
+    ROCKSDB,
+    TIERED
 };
 
 Storage* newStorage(StorageType type, const StorageOptions& options);
@@ -0,0 +1,226 @@
+#include "trace.h"
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <boost/bind.hpp>
+
+using namespace riorita;
+using namespace std;
+
+static const char TRACE_HEADER[] = "RTRACE";
+const byte TRACE_FORMAT_VERSION = 1;
+const long long TRACE_FLUSH_INTERVAL_MILLIS = 100;
+const int32 MAX_TRACE_KEY_SIZE = 1024 * 1024 * 1024;
+
+static long long currentTimeMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TraceRecorder::TraceRecorder(const string& fileName, bool recordKeys, size_t capacity)
+        : recordKeys(recordKeys), file(fopen(fileName.c_str(), "wb")), startMicros(currentTimeMicros()),
+        ring(max(capacity, size_t(1))), head(0), size(0), recorded(0), dropped(0)
+{
+    if (file == 0)
+        throw runtime_error("Can't open trace file " + fileName);
+
+    byte header[2] = {TRACE_FORMAT_VERSION, byte(recordKeys ? 1 : 0)};
+    fwrite(TRACE_HEADER, 1, strlen(TRACE_HEADER), file);
+    fwrite(header, 1, sizeof(header), file);
+    fflush(file);
+
+    thread = boost::thread(boost::bind(&TraceRecorder::run, this));
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    thread.interrupt();
+    thread.join();
+
+    // Records after the last flush of the thread.
+    vector<TraceRecord> records;
+    size_t count;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (count = 0; count < size; count++)
+            records.push_back(ring[(head + count) % ring.size()]);
+        size = 0;
+    }
+    write(records, count);
+    fclose(file);
+}
+
+// FNV-1a of the namespace, a separator and the key.
+int64 TraceRecorder::getKeyHash(const Bytes& space, const Bytes& key)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int32 i = 0; i < space.size; i++)
+        hash = (hash ^ space.data[i]) * 1099511628211ULL;
+    hash = (hash ^ '~') * 1099511628211ULL;
+    for (int32 i = 0; i < key.size; i++)
+        hash = (hash ^ key.data[i]) * 1099511628211ULL;
+    return int64(hash);
+}
+
+void TraceRecorder::record(RequestType type, bool verdict, bool cacheHit, const Bytes& space, const Bytes& key,
+        int32 valueSize, int32 responseSize, long long requestStartMicros, long long latencyMicros)
+{
+    int64 keyHash = getKeyHash(space, key);
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (size == ring.size())
+    {
+        dropped++;
+        return;
+    }
+
+    // Slots are reused, so strings keep their capacity and rarely allocate.
+    TraceRecord& record = ring[(head + size) % ring.size()];
+    record.timeMicros = requestStartMicros - startMicros;
+    record.type = toByte(type);
+    record.flags = byte((verdict ? TRACE_VERDICT : 0) | (cacheHit ? TRACE_CACHE_HIT : 0));
+    record.keyHash = keyHash;
+    record.keySize = key.size;
+    record.valueSize = valueSize;
+    record.responseSize = responseSize;
+    record.latencyMicros = int32(min(latencyMicros, 2147483647LL));
+    if (recordKeys)
+    {
+        record.space.assign(space.data, space.data + space.size);
+        record.key.assign(key.data, key.data + key.size);
+    }
+
+    size++;
+    recorded++;
+}
+
+void TraceRecorder::collectStats(map<string, long long>& stats)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    stats["trace_records"] = recorded;
+    stats["trace_dropped"] = dropped;
+}
+
+template<typename T>
+static void writeBinary(FILE* file, const T& value)
+{
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+void TraceRecorder::write(const vector<TraceRecord>& records, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const TraceRecord& record = records[i];
+        writeBinary(file, record.timeMicros);
+        writeBinary(file, record.type);
+        writeBinary(file, record.flags);
+        writeBinary(file, record.keyHash);
+        writeBinary(file, record.keySize);
+        writeBinary(file, record.valueSize);
+        writeBinary(file, record.responseSize);
+        writeBinary(file, record.latencyMicros);
+
+        if (recordKeys)
+        {
+            writeBinary(file, int32(record.space.length()));
+            fwrite(record.space.data(), 1, record.space.length(), file);
+            fwrite(record.key.data(), 1, record.key.length(), file);
+        }
+    }
+    fflush(file);
+}
+
+void TraceRecorder::run()
+{
+    // Records are swapped out of the ring, so the lock is held only to swap them.
+    vector<TraceRecord> records;
+    try
+    {
+        while (true)
+        {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(TRACE_FLUSH_INTERVAL_MILLIS));
+
+            size_t count;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (records.size() < size)
+                    records.resize(size);
+                for (count = 0; count < size; count++)
+                    std::swap(records[count], ring[(head + count) % ring.size()]);
+                head = (head + size) % ring.size();
+                size = 0;
+            }
+
+            write(records, count);
+        }
+    }
+    catch (boost::thread_interrupted&)
+    {
+        // Stopped by the destructor.
+    }
+}
+
+// ==============================================================================
+
+TraceReader::TraceReader(const string& fileName): file(fopen(fileName.c_str(), "rb")), recordKeys(false)
+{
+    if (file == 0)
+        throw runtime_error("Can't open trace file " + fileName);
+
+    char header[sizeof(TRACE_HEADER) - 1];
+    byte format[2];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, TRACE_HEADER, sizeof(header)) != 0
+            || fread(format, 1, sizeof(format), file) != sizeof(format) || format[0] != TRACE_FORMAT_VERSION)
+    {
+        fclose(file);
+        throw runtime_error("Not a trace file " + fileName);
+    }
+
+    recordKeys = format[1] != 0;
+}
+
+TraceReader::~TraceReader()
+{
+    fclose(file);
+}
+
+template<typename T>
+static bool readBinary(FILE* file, T& value)
+{
+    return fread(&value, sizeof(value), 1, file) == 1;
+}
+
+static bool readString(FILE* file, int32 size, string& s)
+{
+    if (size < 0 || size > MAX_TRACE_KEY_SIZE)
+        return false;
+    s.resize(size_t(size));
+    return size == 0 || fread(&s[0], 1, size_t(size), file) == size_t(size);
+}
+
+bool TraceReader::next(TraceRecord& record)
+{
+    if (!readBinary(file, record.timeMicros))
+        return false;
+
+    // A record cut by a crash of the server ends the trace.
+    if (!readBinary(file, record.type) || !readBinary(file, record.flags) || !readBinary(file, record.keyHash)
+            || !readBinary(file, record.keySize) || !readBinary(file, record.valueSize)
+            || !readBinary(file, record.responseSize) || !readBinary(file, record.latencyMicros))
+        return false;
+
+    record.space.clear();
+    record.key.clear();
+    if (recordKeys)
+    {
+        int32 spaceSize;
+        if (!readBinary(file, spaceSize) || !readString(file, spaceSize, record.space)
+                || !readString(file, record.keySize, record.key))
+            return false;
+    }
+
+    return true;
+}
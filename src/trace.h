@@ -0,0 +1,97 @@
+#ifndef RIORITA_TRACE_H_
+#define RIORITA_TRACE_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "protocol.h"
+
+namespace riorita {
+
+// Flags of a trace record.
+const byte TRACE_VERDICT = 1;
+const byte TRACE_CACHE_HIT = 2;
+
+// A processed request. Without recorded keys only the hash of the namespace and the key is known.
+struct TraceRecord
+{
+    // Since the start of the trace.
+    int64 timeMicros;
+    byte type;
+    byte flags;
+    int64 keyHash;
+    int32 keySize;
+    int32 valueSize;
+    int32 responseSize;
+    int32 latencyMicros;
+    std::string space;
+    std::string key;
+};
+
+// Writes processed requests to a binary trace file. Requests are put into a ring buffer of fixed
+// capacity and written by a background thread, so the request path never waits for the disk;
+// records arriving to the full buffer are dropped and counted.
+//
+// File: the header "RTRACE", <version:1><keys:1>, then records
+// <time:8><type:1><flags:1><key-hash:8><key-size:4><value-size:4><response-size:4><latency:4>
+// followed by <space-len:4><space><key> if keys are recorded.
+class TraceRecorder
+{
+public:
+    TraceRecorder(const std::string& fileName, bool recordKeys, size_t capacity);
+    ~TraceRecorder();
+
+    // The start is on the clock of Metrics::currentTimeMicros.
+    void record(RequestType type, bool verdict, bool cacheHit, const Bytes& space, const Bytes& key,
+            int32 valueSize, int32 responseSize, long long startMicros, long long latencyMicros);
+
+    void collectStats(std::map<std::string, long long>& stats);
+
+    static int64 getKeyHash(const Bytes& space, const Bytes& key);
+
+private:
+    void run();
+    void write(const std::vector<TraceRecord>& records, size_t count);
+
+    bool recordKeys;
+    FILE* file;
+    long long startMicros;
+
+    boost::mutex mutex;
+    std::vector<TraceRecord> ring;
+    size_t head;
+    size_t size;
+    long long recorded;
+    long long dropped;
+
+    boost::thread thread;
+};
+
+// Reads trace files written by TraceRecorder.
+class TraceReader
+{
+public:
+    explicit TraceReader(const std::string& fileName);
+    ~TraceReader();
+
+    bool hasKeys() const
+    {
+        return recordKeys;
+    }
+
+    // Returns false at the end of the trace.
+    bool next(TraceRecord& record);
+
+private:
+    FILE* file;
+    bool recordKeys;
+};
+
+}
+
+#endif
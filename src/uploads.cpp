@@ -0,0 +1,102 @@
+#include "uploads.h"
+
+#include <cstdio>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+using namespace riorita;
+using namespace std;
+
+const int ABANDONED_UPLOAD_SECONDS = 3600;
+
+Uploads::Uploads(const string& directory): directory(directory), fileCounter(0)
+{
+    // Uploads don't survive restarts.
+    boost::system::error_code error;
+    boost::filesystem::remove_all(directory, error);
+    boost::filesystem::create_directories(directory, error);
+}
+
+Uploads::~Uploads()
+{
+    boost::system::error_code error;
+    for (auto i = uploads.begin(); i != uploads.end(); ++i)
+        boost::filesystem::remove(i->second.fileName, error);
+}
+
+bool Uploads::append(const string& key, long long offset, long long totalSize,
+        const char* data, size_t size, string& completedFileName)
+{
+    string fileName;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        removeAbandoned();
+
+        auto i = uploads.find(key);
+        if (offset == 0)
+        {
+            if (i == uploads.end())
+            {
+                Upload upload;
+                upload.fileName = directory + "/upload." + boost::lexical_cast<string>(fileCounter++);
+                i = uploads.insert(make_pair(key, upload)).first;
+            }
+            i->second.size = 0;
+            i->second.totalSize = totalSize;
+        }
+        else if (i == uploads.end() || i->second.size != offset || i->second.totalSize != totalSize)
+            return false;
+
+        if (offset + (long long) size > totalSize)
+        {
+            boost::system::error_code error;
+            boost::filesystem::remove(i->second.fileName, error);
+            uploads.erase(i);
+            return false;
+        }
+
+        i->second.updatedAt = time(0);
+        fileName = i->second.fileName;
+    }
+
+    FILE* f = fopen(fileName.c_str(), offset == 0 ? "wb" : "ab");
+    bool written = f != 0 && fwrite(data, 1, size, f) == size;
+    if (f != 0)
+        written = fclose(f) == 0 && written;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    auto i = uploads.find(key);
+    if (i == uploads.end())
+        return false;
+
+    if (!written)
+    {
+        boost::system::error_code error;
+        boost::filesystem::remove(fileName, error);
+        uploads.erase(i);
+        return false;
+    }
+
+    i->second.size += (long long) size;
+    if (i->second.size == i->second.totalSize)
+    {
+        completedFileName = fileName;
+        uploads.erase(i);
+    }
+
+    return true;
+}
+
+void Uploads::removeAbandoned()
+{
+    time_t now = time(0);
+    for (auto i = uploads.begin(); i != uploads.end(); )
+        if (i->second.updatedAt + ABANDONED_UPLOAD_SECONDS < now)
+        {
+            boost::system::error_code error;
+            boost::filesystem::remove(i->second.fileName, error);
+            i = uploads.erase(i);
+        }
+        else
+            ++i;
+}
@@ -0,0 +1,46 @@
+#ifndef RIORITA_UPLOADS_H_
+#define RIORITA_UPLOADS_H_
+
+#include <string>
+#include <unordered_map>
+#include <ctime>
+
+#include <boost/thread/mutex.hpp>
+
+namespace riorita {
+
+// Values uploaded by chunks are staged in files of the directory until the last chunk arrives,
+// so the server holds only one chunk in memory. Uploads not continued for an hour are abandoned.
+// Chunks of a key must not be appended concurrently.
+class Uploads
+{
+public:
+    explicit Uploads(const std::string& directory);
+    ~Uploads();
+
+    // Appends the chunk of the value of totalSize bytes. The offset must be the number of bytes
+    // received so far, zero offset restarts the upload. Returns false for a chunk out of order.
+    // If the value is complete, completedFileName is set, the caller has to remove the file.
+    bool append(const std::string& key, long long offset, long long totalSize,
+            const char* data, size_t size, std::string& completedFileName);
+
+private:
+    struct Upload
+    {
+        std::string fileName;
+        long long size;
+        long long totalSize;
+        time_t updatedAt;
+    };
+
+    void removeAbandoned();
+
+    std::string directory;
+    boost::mutex mutex;
+    std::unordered_map<std::string, Upload> uploads;
+    unsigned long long fileCounter;
+};
+
+}
+
+#endif